@@ -25,9 +25,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <fnmatch.h>
 #include <regex.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -101,6 +104,14 @@ enum {
 	RECORD_EXISTS
 };
 
+#define BUILD_MAX_WORKERS 16
+
+/* jobs the directory walker may run ahead of the store writer */
+#define BUILD_MAX_QUEUED 512
+
+/* upper bound on tracks written to the store per idle callback */
+#define BUILD_BATCH_TRACKS 256
+
 enum {
 	DATA_SRC_CDDB = 0,
 	DATA_SRC_META,
@@ -121,6 +132,10 @@ typedef struct _build_track_t {
 	float rva;
 	int rva_found;
 
+	long long mtime;
+	unsigned long long inode;
+	unsigned long long size;
+
 	struct _build_track_t * next;
 
 } build_track_t;
@@ -164,6 +179,29 @@ typedef struct {
 
 } build_disc_t;
 
+typedef struct _build_job_t {
+
+	char * path;          /* record directory (strict) or file (loose) */
+	char * artist_d_name; /* strict only */
+	char * d_name;
+
+	int new_context;      /* forget the current artist before writing */
+	int done;
+	build_disc_t * disc;  /* NULL if there is nothing to write */
+
+	struct _build_job_t * next;
+
+} build_job_t;
+
+typedef struct {
+
+	GtkTreeIter iter;
+	long long mtime;
+	unsigned long long inode;
+	unsigned long long size;
+
+} build_index_track_t;
+
 
 typedef struct {
 
@@ -240,10 +278,30 @@ typedef struct {
 	AQUALUNG_THREAD_DECLARE(thread_id);
 	AQUALUNG_MUTEX_DECLARE(mutex);
 
+	AQUALUNG_THREAD_DECLARE(worker_ids[BUILD_MAX_WORKERS]);
+	AQUALUNG_THREAD_DECLARE(writer_id);
+	AQUALUNG_MUTEX_DECLARE(queue_mutex);
+	AQUALUNG_COND_DECLARE(job_added);
+	AQUALUNG_COND_DECLARE(job_done);
+	AQUALUNG_COND_DECLARE(job_space);
+	AQUALUNG_MUTEX_DECLARE(wait_mutex);
+	AQUALUNG_COND_DECLARE(thread_wait);
+	AQUALUNG_MUTEX_DECLARE(index_mutex);
+	AQUALUNG_MUTEX_DECLARE(cddb_mutex);
+
 	int type;
 
 	int cancelled;
-	int write_data_locked;
+
+	int n_workers;
+	build_job_t * job_head;  /* oldest job not yet written */
+	build_job_t * job_tail;
+	build_job_t * next_job;  /* next job for the workers */
+	int n_jobs;
+	int walk_done;
+	int pending_new_context;
+	build_job_t * batch;     /* jobs handed to write_batch_to_store */
+	int batch_done;          /* set by write_batch_to_store, under wait_mutex */
 
 	data_src_t * data_src_artist;
 	data_src_t * data_src_record;
@@ -268,6 +326,11 @@ typedef struct {
 	int artist_iter_is_set;
 	map_t * artist_name_map;
 
+	GHashTable * track_index; /* filename -> build_index_track_t */
+	GHashTable * disc_index;  /* tracklist key -> record iter */
+	gulong index_handler;
+	volatile int index_stale;
+
 	char root[MAXLEN];
 	int artist_dir_depth;
 	int reset_existing_data;
@@ -307,6 +370,7 @@ typedef struct {
 
 
 void file_transform(char * buf, file_transform_t * model);
+void store_index_free(build_store_t * data);
 
 
 data_src_t *
@@ -865,8 +929,21 @@ build_store_new(GtkTreeIter * store_iter, char * file) {
 		return NULL;
 	}
 
+	AQUALUNG_COND_INIT(data->job_added);
+	AQUALUNG_COND_INIT(data->job_done);
+	AQUALUNG_COND_INIT(data->job_space);
+	AQUALUNG_COND_INIT(data->thread_wait);
+
 #ifndef HAVE_LIBPTHREAD
         data->mutex = g_mutex_new();
+	data->queue_mutex = g_mutex_new();
+	data->wait_mutex = g_mutex_new();
+	data->index_mutex = g_mutex_new();
+	data->cddb_mutex = g_mutex_new();
+	data->job_added = g_cond_new();
+	data->job_done = g_cond_new();
+	data->job_space = g_cond_new();
+	data->thread_wait = g_cond_new();
 #endif /* !HAVE_LIBPTHREAD */
 
         data->store_iter = *store_iter;
@@ -944,6 +1021,9 @@ build_store_save(build_store_t * data) {
 	xmlNodePtr root;
 	xmlNodePtr node;
 
+	/* a pending save would overwrite the file */
+	store_file_save_flush();
+
 	doc = xmlParseFile(data->file);
         root = xmlDocGetRootElement(doc);
 
@@ -1053,42 +1133,25 @@ build_store_load(build_store_t * data, int test_only) {
 	return found;
 }
 
-xmlNodePtr
-build_store_get_xml_node(char * file) {
-
-	xmlDocPtr doc;
-	xmlNodePtr node;
-
-	doc = xmlParseFile(file);
-
-	if (doc == NULL) {
-		return NULL;
-	}
-
-        node = xmlDocGetRootElement(doc);
-
-	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-
-		if (!xmlStrcmp(node->name, (const xmlChar *)"builder")) {
-			xmlNodePtr res = xmlCopyNode(node, 1);
-			xmlFreeDoc(doc);
-			return res;
-		}
-	}
-
-	xmlFreeDoc(doc);
-	return NULL;
-}
-
 void
 build_store_free(build_store_t * data) {
 
 #ifndef HAVE_LIBPTHREAD
 	g_mutex_free(data->mutex);
+	g_mutex_free(data->queue_mutex);
+	g_mutex_free(data->wait_mutex);
+	g_mutex_free(data->index_mutex);
+	g_mutex_free(data->cddb_mutex);
+	g_cond_free(data->job_added);
+	g_cond_free(data->job_done);
+	g_cond_free(data->job_space);
+	g_cond_free(data->thread_wait);
 #endif /* !HAVE_LIBPTHREAD */
 
 	free(data->file);
 
+	store_index_free(data);
+
 	g_strfreev(data->capitalize_artist->pre_stringv);
 	data->capitalize_artist->pre_stringv = NULL;
 
@@ -1179,108 +1242,371 @@ collate(const char * str1, const char * str2) {
 }
 
 
-int
-store_contains_disc(GtkTreeIter * store_iter,
-		    GtkTreeIter * __artist_iter,
-		    GtkTreeIter * __record_iter, build_disc_t * disc) {
+/* GtkTreeStore iters stay valid as long as their row exists,
+ * and user_data identifies the row.
+ */
+static int
+store_iter_equal(GtkTreeIter * a, GtkTreeIter * b) {
 
+	return a->user_data == b->user_data;
+}
 
-	int i, j, k;
-	int n_tracks;
+
+static char *
+tracklist_key_disc(build_disc_t * disc) {
+
+	GString * key = g_string_new(NULL);
+	build_track_t * ptrack;
+
+	for (ptrack = disc->tracks; ptrack; ptrack = ptrack->next) {
+		g_string_append(key, ptrack->filename);
+		g_string_append_c(key, '\n');
+	}
+
+	return g_string_free(key, FALSE);
+}
+
+
+static char *
+tracklist_key_record(GtkTreeIter * record_iter) {
+
+	GString * key = g_string_new(NULL);
+	GtkTreeIter track_iter;
+	gboolean valid;
+
+	valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(music_store),
+					     &track_iter, record_iter);
+	while (valid) {
+
+		track_data_t * data;
+
+		gtk_tree_model_get(GTK_TREE_MODEL(music_store), &track_iter,
+				   MS_COL_DATA, &data, -1);
+
+		g_string_append(key, data->file);
+		g_string_append_c(key, '\n');
+
+		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(music_store), &track_iter);
+	}
+
+	return g_string_free(key, FALSE);
+}
+
+
+static void
+index_insert_track(GHashTable * track_index, GtkTreeIter * track_iter, track_data_t * track_data) {
+
+	/* as with the tree walk, the first occurrence wins */
+	if (g_hash_table_lookup(track_index, track_data->file) == NULL) {
+
+		build_index_track_t * entry = g_new(build_index_track_t, 1);
+
+		entry->iter = *track_iter;
+		entry->mtime = track_data->mtime;
+		entry->inode = track_data->inode;
+		entry->size = track_data->size;
+
+		g_hash_table_insert(track_index, g_strdup(track_data->file), entry);
+	}
+}
+
+
+static void
+index_insert_record(GHashTable * disc_index, GtkTreeIter * record_iter) {
+
+	char * key = tracklist_key_record(record_iter);
+
+	if (g_hash_table_lookup(disc_index, key) == NULL) {
+		g_hash_table_insert(disc_index, key, gtk_tree_iter_copy(record_iter));
+	} else {
+		g_free(key);
+	}
+}
+
+
+static void
+store_index_add_track(build_store_t * data, GtkTreeIter * track_iter, track_data_t * track_data) {
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	index_insert_track(data->track_index, track_iter, track_data);
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+}
+
+
+/* Record the file state a track in the store was just read in with. */
+static void
+store_update_track_stat(build_store_t * data, GtkTreeIter * track_iter,
+			track_data_t * track_data, build_track_t * ptrack) {
+
+	build_index_track_t * entry;
+
+	track_data->mtime = ptrack->mtime;
+	track_data->inode = ptrack->inode;
+	track_data->size = ptrack->size;
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+
+	entry = g_hash_table_lookup(data->track_index, track_data->file);
+	if (entry != NULL && store_iter_equal(&entry->iter, track_iter)) {
+		entry->mtime = ptrack->mtime;
+		entry->inode = ptrack->inode;
+		entry->size = ptrack->size;
+	}
+
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+}
+
+
+static void
+store_index_add_record(build_store_t * data, GtkTreeIter * record_iter) {
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	index_insert_record(data->disc_index, record_iter);
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+}
+
+
+static void
+store_index_remove_record(build_store_t * data, GtkTreeIter * record_iter) {
+
+	char * key = tracklist_key_record(record_iter);
+	GtkTreeIter * iter;
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+
+	iter = g_hash_table_lookup(data->disc_index, key);
+	if (iter != NULL && store_iter_equal(iter, record_iter)) {
+		g_hash_table_remove(data->disc_index, key);
+	}
+
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+
+	g_free(key);
+}
+
+
+/* Rows removed behind our back (e.g. by the user while the build
+ * is running) would leave dangling iters in the index, so have it
+ * rebuilt on next use.
+ */
+static void
+store_index_row_deleted(GtkTreeModel * model, GtkTreePath * path, gpointer user_data) {
+
+	build_store_t * data = (build_store_t *)user_data;
+	GtkTreePath * store_path = gtk_tree_model_get_path(model, &data->store_iter);
+
+	if (gtk_tree_path_is_descendant(path, store_path)) {
+		data->index_stale = 1;
+	}
+
+	gtk_tree_path_free(store_path);
+}
+
+
+/* Must be called with the GDK lock held or from the GTK thread.
+ * The new index is built aside and swapped in at once, so the workers
+ * never see a partially filled one.
+ */
+void
+store_index_build(build_store_t * data) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(music_store);
 	GtkTreeIter artist_iter;
 	GtkTreeIter record_iter;
 	GtkTreeIter track_iter;
+	gboolean valid_artist;
+	gboolean valid_record;
+	gboolean valid_track;
+	GHashTable * track_index;
+	GHashTable * disc_index;
+	GHashTable * old_track_index;
+	GHashTable * old_disc_index;
 
-	build_track_t * ptrack = disc->tracks;
 
-	for (n_tracks = 0; ptrack; ++n_tracks, ptrack = ptrack->next) ;
+	if (data->index_handler == 0) {
+		data->index_handler = g_signal_connect(G_OBJECT(music_store), "row-deleted",
+						       G_CALLBACK(store_index_row_deleted), data);
+	}
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-					     &artist_iter, store_iter, i++)) {
-		j = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-						     &record_iter, &artist_iter, j++)) {
-			int match = 1;
+	track_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	disc_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					   (GDestroyNotify)gtk_tree_iter_free);
 
-			if (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(music_store),
-							   &record_iter) != n_tracks) {
-				continue;
-			}
+	valid_artist = gtk_tree_model_iter_children(model, &artist_iter, &data->store_iter);
+	while (valid_artist) {
 
-			k = 0;
-			ptrack = disc->tracks;
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-							     &track_iter, &record_iter, k++)) {
+		valid_record = gtk_tree_model_iter_children(model, &record_iter, &artist_iter);
+		while (valid_record) {
 
-				track_data_t * data;
+			valid_track = gtk_tree_model_iter_children(model, &track_iter, &record_iter);
+			while (valid_track) {
 
-				gtk_tree_model_get(GTK_TREE_MODEL(music_store), &track_iter,
-						   MS_COL_DATA, &data, -1);
+				track_data_t * track_data;
 
-				if (strcmp(data->file, ptrack->filename)) {
-					match = 0;
-					break;
-				}
+				gtk_tree_model_get(model, &track_iter, MS_COL_DATA, &track_data, -1);
+				index_insert_track(track_index, &track_iter, track_data);
 
-				ptrack = ptrack->next;
+				valid_track = gtk_tree_model_iter_next(model, &track_iter);
 			}
 
-			if (match) {
-				if (__artist_iter) {
-					*__artist_iter = artist_iter;
-				}
-				if (__record_iter) {
-					*__record_iter = record_iter;
-				}
-				return 1;
-			}
+			index_insert_record(disc_index, &record_iter);
+
+			valid_record = gtk_tree_model_iter_next(model, &record_iter);
 		}
+
+		valid_artist = gtk_tree_model_iter_next(model, &artist_iter);
 	}
 
-	return 0;
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	old_track_index = data->track_index;
+	old_disc_index = data->disc_index;
+	data->track_index = track_index;
+	data->disc_index = disc_index;
+	data->index_stale = 0;
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+
+	if (old_track_index != NULL) {
+		g_hash_table_destroy(old_track_index);
+	}
+	if (old_disc_index != NULL) {
+		g_hash_table_destroy(old_disc_index);
+	}
+}
+
+
+void
+store_index_free(build_store_t * data) {
+
+	if (data->index_handler != 0) {
+		g_signal_handler_disconnect(G_OBJECT(music_store), data->index_handler);
+		data->index_handler = 0;
+	}
+
+	if (data->track_index != NULL) {
+		g_hash_table_destroy(data->track_index);
+		data->track_index = NULL;
+	}
+
+	if (data->disc_index != NULL) {
+		g_hash_table_destroy(data->disc_index);
+		data->disc_index = NULL;
+	}
 }
 
 
 int
-store_contains_track(GtkTreeIter * store_iter,
+store_contains_disc(build_store_t * data,
+		    GtkTreeIter * __artist_iter,
+		    GtkTreeIter * __record_iter, build_disc_t * disc) {
+
+	GtkTreeIter * iter;
+	GtkTreeIter record_iter;
+	char * key;
+
+
+	if (data->disc_index == NULL || data->index_stale) {
+		store_index_build(data);
+	}
+
+	key = tracklist_key_disc(disc);
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	if ((iter = g_hash_table_lookup(data->disc_index, key)) != NULL) {
+		record_iter = *iter;
+	}
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+
+	g_free(key);
+
+	if (iter == NULL) {
+		return 0;
+	}
+
+	if (__artist_iter) {
+		gtk_tree_model_iter_parent(GTK_TREE_MODEL(music_store), __artist_iter, &record_iter);
+	}
+	if (__record_iter) {
+		*__record_iter = record_iter;
+	}
+
+	return 1;
+}
+
+
+int
+store_contains_track(build_store_t * data,
 		     GtkTreeIter * __track_iter, char * filename) {
 
+	build_index_track_t * entry;
 
-	int i, j, k;
-	GtkTreeIter artist_iter;
-	GtkTreeIter record_iter;
-	GtkTreeIter track_iter;
 
+	if (data->track_index == NULL || data->index_stale) {
+		store_index_build(data);
+	}
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	if ((entry = g_hash_table_lookup(data->track_index, filename)) != NULL &&
+	    __track_iter != NULL) {
+		*__track_iter = entry->iter;
+	}
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-					     &artist_iter, store_iter, i++)) {
-		j = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-						     &record_iter, &artist_iter, j++)) {
-			k = 0;
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-							     &track_iter, &record_iter, k++)) {
+	return entry != NULL;
+}
 
-				track_data_t * data;
 
-				gtk_tree_model_get(GTK_TREE_MODEL(music_store), &track_iter,
-						   MS_COL_DATA, &data, -1);
+/* Lookups for the build workers: these never touch the tree, so a
+ * stale index is used as is and the store writer sorts things out.
+ */
+int
+store_has_disc(build_store_t * data, build_disc_t * disc) {
 
-				if (!strcmp(data->file, filename)) {
+	char * key = tracklist_key_disc(disc);
+	int ret;
 
-					if (__track_iter) {
-						*__track_iter = track_iter;
-					}
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+	ret = g_hash_table_lookup(data->disc_index, key) != NULL;
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
 
-					return 1;
-				}
-			}
-		}
+	g_free(key);
+
+	return ret;
+}
+
+
+/* Whether the tracks are in the store and their files are still the
+ * same as when they were read in, judging by mtime, size and inode.
+ */
+int
+store_has_unchanged_tracks(build_store_t * data, build_track_t * tracks) {
+
+	build_track_t * ptrack;
+	int ret = 1;
+
+	AQUALUNG_MUTEX_LOCK(data->index_mutex);
+
+	for (ptrack = tracks; ptrack && ret; ptrack = ptrack->next) {
+
+		build_index_track_t * entry = g_hash_table_lookup(data->track_index, ptrack->filename);
+
+		ret = entry != NULL &&
+			entry->mtime == ptrack->mtime &&
+			entry->inode == ptrack->inode &&
+			entry->size == ptrack->size;
 	}
 
-	return 0;
+	AQUALUNG_MUTEX_UNLOCK(data->index_mutex);
+
+	return ret;
+}
+
+
+static void
+build_track_set_stat(build_track_t * ptrack, struct stat * st) {
+
+	ptrack->mtime = st->st_mtime;
+	ptrack->inode = st->st_ino;
+	ptrack->size = st->st_size;
 }
 
 
@@ -1384,7 +1710,7 @@ store_get_iter_for_artist_and_record(GtkTreeIter * store_iter,
 
 
 int
-store_get_iter_for_tracklist(GtkTreeIter * store_iter,
+store_get_iter_for_tracklist(build_store_t * data,
 			     GtkTreeIter * artist_iter,
 			     GtkTreeIter * record_iter,
 			     build_disc_t * disc, map_t ** artist_name_map) {
@@ -1392,7 +1718,7 @@ store_get_iter_for_tracklist(GtkTreeIter * store_iter,
 
 	/* check if record already exists */
 
-	if (store_contains_disc(store_iter, artist_iter, record_iter, disc)) {
+	if (store_contains_disc(data, artist_iter, record_iter, disc)) {
 
 		if (disc->artist.unknown) {
 			gtk_tree_store_set(music_store, artist_iter,
@@ -1409,7 +1735,7 @@ store_get_iter_for_tracklist(GtkTreeIter * store_iter,
 
 	i = 0;
 	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-					     artist_iter, store_iter, i++)) {
+					     artist_iter, &data->store_iter, i++)) {
 
 		char * artist_name;
 
@@ -1430,7 +1756,7 @@ store_get_iter_for_tracklist(GtkTreeIter * store_iter,
 
 
 	/* no such artist -- create both artist and record */
-	create_artist(store_iter, artist_iter, disc);
+	create_artist(&data->store_iter, artist_iter, disc);
 	create_record(artist_iter, record_iter, disc);
 
 	/* start contest for artist name */
@@ -1441,51 +1767,17 @@ store_get_iter_for_tracklist(GtkTreeIter * store_iter,
 
 
 int
-artist_get_iter_for_tracklist(GtkTreeIter * artist_iter,
+artist_get_iter_for_tracklist(build_store_t * data, GtkTreeIter * artist_iter,
 			      GtkTreeIter * record_iter, build_disc_t * disc) {
 
-	int i, j;
-	int n_tracks;
-	GtkTreeIter track_iter;
-
-	build_track_t * ptrack = disc->tracks;
+	GtkTreeIter iter;
 
 
 	/* check if record already exists */
 
-	for (n_tracks = 0; ptrack; ++n_tracks, ptrack = ptrack->next) ;
-
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-					     record_iter, artist_iter, i++)) {
-		int match = 1;
-
-		if (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(music_store),
-						   record_iter) != n_tracks) {
-			continue;
-		}
-
-		j = 0;
-		ptrack = disc->tracks;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
-						     &track_iter, record_iter, j++)) {
-
-			track_data_t * data;
-
-			gtk_tree_model_get(GTK_TREE_MODEL(music_store), &track_iter,
-					   MS_COL_DATA, &data, -1);
-
-			if (strcmp(data->file, ptrack->filename)) {
-				match = 0;
-				break;
-			}
-
-			ptrack = ptrack->next;
-		}
-
-		if (match) {
-			return RECORD_EXISTS;
-		}
+	if (store_contains_disc(data, &iter, record_iter, disc) &&
+	    store_iter_equal(&iter, artist_iter)) {
+		return RECORD_EXISTS;
 	}
 
 
@@ -2622,7 +2914,7 @@ process_meta(build_store_t * data, build_disc_t * disc) {
 			fprintf(stderr, "process_meta: file_decoder_new() failed\n");
 			return;
 		}
-		if (file_decoder_open(fdec, ptrack->filename) == 0) {
+		if (file_decoder_probe(fdec, ptrack->filename) == 0) {
 
 			if (metadata_get_artist(fdec->meta, &tmp) && !is_all_wspace(tmp)) {
 				map_put(&map_artist, tmp);
@@ -2681,7 +2973,7 @@ process_meta(build_store_t * data, build_disc_t * disc) {
 
 
 void
-add_new_track(GtkTreeIter * record_iter, build_track_t * ptrack, int i) {
+add_new_track(build_store_t * data, GtkTreeIter * record_iter, build_track_t * ptrack, int i) {
 
 	GtkTreeIter track_iter;
 	char sort_name[16];
@@ -2709,6 +3001,9 @@ add_new_track(GtkTreeIter * record_iter, build_track_t * ptrack, int i) {
 	track_data->comment = strdup(ptrack->comment);
 	track_data->duration = ptrack->duration;
 	track_data->volume = 1.0f;
+	track_data->mtime = ptrack->mtime;
+	track_data->inode = ptrack->inode;
+	track_data->size = ptrack->size;
 
 	if (ptrack->rva_found) {
 		track_data->rva = ptrack->rva;
@@ -2718,13 +3013,14 @@ add_new_track(GtkTreeIter * record_iter, build_track_t * ptrack, int i) {
 	if (options.enable_ms_tree_icons) {
 		gtk_tree_store_set(music_store, &track_iter, MS_COL_ICON, icon_track, -1);
 	}
+
+	store_index_add_track(data, &track_iter, track_data);
 }
 
 
-gboolean
-write_record_to_store(gpointer user_data) {
+void
+write_record_to_store(build_store_t * data) {
 
-	build_store_t * data = (build_store_t *)user_data;
 	build_track_t * ptrack;
 	int result = 0;
 	int i;
@@ -2733,9 +3029,9 @@ write_record_to_store(gpointer user_data) {
 
 
 	if (data->artist_iter_is_set) {
-		result = artist_get_iter_for_tracklist(&data->artist_iter, &record_iter, data->disc);
+		result = artist_get_iter_for_tracklist(data, &data->artist_iter, &record_iter, data->disc);
 	} else {
-		result = store_get_iter_for_tracklist(&data->store_iter,
+		result = store_get_iter_for_tracklist(data,
 						      &data->artist_iter,
 						      &record_iter,
 						      data->disc,
@@ -2756,8 +3052,9 @@ write_record_to_store(gpointer user_data) {
 
 	if (result == RECORD_NEW) {
 		for (i = 0, ptrack = data->disc->tracks; ptrack; i++, ptrack = ptrack->next) {
-			add_new_track(&record_iter, ptrack, i + 1);
+			add_new_track(data, &record_iter, ptrack, i + 1);
 		}
+		store_index_add_record(data, &record_iter);
 	}
 
 	if (result == RECORD_EXISTS) {
@@ -2791,26 +3088,24 @@ write_record_to_store(gpointer user_data) {
 				track_data->use_rva = 1;
 			}
 
+			store_update_track_stat(data, &iter, track_data, ptrack);
+
 			ptrack = ptrack->next;
 		}
 	}
-
-	music_store_mark_changed(&data->store_iter);
-
-	data->write_data_locked = 0;
-
-	return FALSE;
 }
 
 
-gboolean
-write_track_to_store(gpointer user_data) {
-
-	build_store_t * data = (build_store_t *)user_data;
+void
+write_track_to_store(build_store_t * data) {
 
 	GtkTreeIter record_iter;
 
 
+	/* the worker only had a peek at the index, look again */
+	data->disc->flag = store_contains_track(data, &data->disc->iter,
+						data->disc->tracks->filename);
+
 	if (data->disc->flag) { /* track is present, reset data */
 
 		track_data_t * track_data;
@@ -2831,6 +3126,8 @@ write_track_to_store(gpointer user_data) {
 			track_data->use_rva = 1;
 		}
 
+		store_update_track_stat(data, &data->disc->iter, track_data, data->disc->tracks);
+
 	} else {
 
 		GtkTreeIter artist_iter;
@@ -2840,14 +3137,11 @@ write_track_to_store(gpointer user_data) {
 						     &record_iter,
 						     data->disc);
 
-		add_new_track(&record_iter, data->disc->tracks, 0 /* append */);
+		/* the record's tracklist changes, and so does its index key */
+		store_index_remove_record(data, &record_iter);
+		add_new_track(data, &record_iter, data->disc->tracks, 0 /* append */);
+		store_index_add_record(data, &record_iter);
 	}
-
-	music_store_mark_changed(&data->store_iter);
-
-	data->write_data_locked = 0;
-
-	return FALSE;
 }
 
 
@@ -2920,6 +3214,7 @@ get_file_list(build_store_t * data, char * dir_record, build_disc_t * disc, int
 
 	build_track_t * last_track = NULL;
 	float duration = 0.0f;
+	struct stat st;
 
 	char * utf8;
 
@@ -2930,7 +3225,8 @@ get_file_list(build_store_t * data, char * dir_record, build_disc_t * disc, int
 		strncpy(basename, ent_track[i]->d_name, MAXLEN-1);
 		snprintf(filename, MAXLEN-1, "%s/%s", dir_record, ent_track[i]->d_name);
 
-		if (is_dir(filename) || !filter_excl_incl(data, basename)) {
+		if (g_stat(filename, &st) != 0 || S_ISDIR(st.st_mode) ||
+		    !filter_excl_incl(data, basename)) {
 			free(ent_track[i]);
 			continue;
 		}
@@ -2952,6 +3248,7 @@ get_file_list(build_store_t * data, char * dir_record, build_disc_t * disc, int
 				track->duration = duration;
 				track->rva = 1.0f;
 				track->rva_found = 0;
+				build_track_set_stat(track, &st);
 			}
 
 			if (last_track == NULL) {
@@ -3177,19 +3474,44 @@ cddb_init_query_data(build_disc_t * disc, int * ntracks, int ** frames, int * le
 
 
 void
+build_tracks_free(build_track_t * tracks) {
+
+	build_track_t * ptrack;
+
+	while (tracks) {
+		ptrack = tracks->next;
+		free(tracks);
+		tracks = ptrack;
+	}
+}
+
+
+void
+build_disc_free(build_disc_t * disc) {
+
+	build_tracks_free(disc->tracks);
+	free(disc);
+}
+
+
+/* Runs in a build worker. Returns the disc to be written to the store,
+ * or NULL if there is nothing to write.
+ */
+build_disc_t *
 process_record(build_store_t * data, char * dir_record, char * artist_d_name, char * record_d_name) {
 
 	build_disc_t * disc = NULL;
-	build_track_t * ptrack = NULL;
 
 	char * utf8;
 
 
 	if ((disc = (build_disc_t *)calloc(1, sizeof(build_disc_t))) == NULL) {
 		fprintf(stderr, "build_store.c: process_record(): calloc error\n");
-		return;
+		return NULL;
 	}
 
+	set_prog_file_entry(data, dir_record);
+
 	utf8 = g_filename_display_name(artist_d_name);
 	strncpy(disc->artist.d_name, utf8, MAXLEN-1);
 	g_free(utf8);
@@ -3208,9 +3530,15 @@ process_record(build_store_t * data, char * dir_record, char * artist_d_name, ch
 			goto finish;
 		}
 
-		if (store_contains_disc(&data->store_iter, NULL, NULL, disc)) {
+		/* the record is there and none of its files have changed
+		   since they were read in, so there is nothing to probe */
+		if (store_has_disc(data, disc) &&
+		    store_has_unchanged_tracks(data, disc->tracks)) {
 			goto finish;
 		}
+
+		build_tracks_free(disc->tracks);
+		disc->tracks = NULL;
 	}
 
 	get_file_list(data, dir_record, disc, 1/* try to open*/);
@@ -3220,7 +3548,8 @@ process_record(build_store_t * data, char * dir_record, char * artist_d_name, ch
 	}
 
 	if (!data->reset_existing_data) {
-		if (store_contains_disc(&data->store_iter, NULL, NULL, disc)) {
+		if (store_has_disc(data, disc) &&
+		    store_has_unchanged_tracks(data, disc->tracks)) {
 			goto finish;
 		}
 	}
@@ -3245,6 +3574,7 @@ process_record(build_store_t * data, char * dir_record, char * artist_d_name, ch
 		int year = 0;
 		char ** tracks;
 		int i;
+		build_track_t * ptrack;
 
 		artist[0] = '\0';
 		record[0] = '\0';
@@ -3252,22 +3582,25 @@ process_record(build_store_t * data, char * dir_record, char * artist_d_name, ch
 		set_prog_action_label(data, _("CDDB lookup"));
 
 		if (cddb_init_query_data(disc, &ntracks, &frames, &length) != 0) {
-			return;
+			goto finish;
 		}
 
 		if ((tracks = calloc(ntracks, sizeof(char *))) == NULL) {
 			fprintf(stderr, "process_record: calloc error\n");
-			return;
+			goto finish;
 		}
 
 		for (i = 0; i < ntracks; i++) {
 			if ((tracks[i] = calloc(1, MAXLEN * sizeof(char))) == NULL) {
 				fprintf(stderr, "process_record: calloc error\n");
-				return;
+				goto finish;
 			}
 		}
 
+		/* one query at a time, even with several build workers */
+		AQUALUNG_MUTEX_LOCK(data->cddb_mutex);
 		cddb_query_batch(ntracks, frames, length, artist, record, &year, tracks);
+		AQUALUNG_MUTEX_UNLOCK(data->cddb_mutex);
 
 		if (artist[0] != '\0') {
 			strncpy(disc->artist.name[DATA_SRC_CDDB], artist, MAXLEN-1);
@@ -3299,46 +3632,57 @@ process_record(build_store_t * data, char * dir_record, char * artist_d_name, ch
 		strncpy(disc->record.comment, disc->record.year, MAXLEN-1);
 	}
 
+	return disc;
 
-	/* wait for the gtk thread to update music_store */
+ finish:
 
-	data->write_data_locked = 1;
-	data->disc = disc;
+	build_disc_free(disc);
 
-	aqualung_idle_add(write_record_to_store, data);
+	return NULL;
+}
 
-	while (data->write_data_locked) {
-		g_usleep(10000);
-	}
 
- finish:
+/* Runs in a build worker, see process_record(). */
+build_disc_t *
+process_track(build_store_t * data, char * filename, char * d_name) {
 
-	/* free tracklist */
+        build_disc_t * disc;
+	build_track_t track;
+	struct stat st;
 
-	for (ptrack = disc->tracks; ptrack; disc->tracks = ptrack) {
-		ptrack = disc->tracks->next;
-		free(disc->tracks);
-	}
 
-	free(disc);
-}
+	set_prog_file_entry(data, filename);
 
+	if (g_stat(filename, &st) != 0 || !filter_excl_incl(data, filename)) {
+		return NULL;
+	}
 
-void
-process_track(build_store_t * data, char * filename, char * d_name, float duration) {
+	/* files that have not changed since they were read in
+	   are skipped without opening them */
+	track.filename[0] = '\0';
+	strncat(track.filename, filename, MAXLEN-1);
+	build_track_set_stat(&track, &st);
+	track.next = NULL;
 
-	GtkTreeIter iter_track;
-        build_disc_t * disc;
+	if (!data->reset_existing_data && store_has_unchanged_tracks(data, &track)) {
+		return NULL;
+	}
 
+	set_prog_action_label(data, _("Reading file"));
+
+	if ((track.duration = get_file_duration(filename)) <= 0.0f) {
+		return NULL;
+	}
 
 	if ((disc = (build_disc_t *)calloc(1, sizeof(build_disc_t))) == NULL) {
 		fprintf(stderr, "build_store.c: process_track(): calloc error\n");
-		return;
+		return NULL;
 	}
 
 	if ((disc->tracks = (build_track_t *)calloc(1, sizeof(build_track_t))) == NULL) {
 		fprintf(stderr, "build_store.c: process_track(): calloc error\n");
-		return;
+		free(disc);
+		return NULL;
 	} else {
 		char * utf8;
 
@@ -3353,17 +3697,10 @@ process_track(build_store_t * data, char * filename, char * d_name, float durati
 		g_free(utf8);
 
 		strncpy(disc->tracks->filename, filename, MAXLEN-1);
-		disc->tracks->duration = duration;
+		disc->tracks->duration = track.duration;
 		disc->tracks->rva = 1.0f;
 		disc->tracks->rva_found = 0;
-	}
-
-
-	disc->flag = store_contains_track(&data->store_iter, &iter_track, filename);
-	disc->iter = iter_track;
-
-	if (!data->reset_existing_data && disc->flag) {
-		goto finish;
+		build_track_set_stat(disc->tracks, &st);
 	}
 
 
@@ -3381,22 +3718,287 @@ process_track(build_store_t * data, char * filename, char * d_name, float durati
 		strncpy(disc->record.comment, disc->record.year, MAXLEN-1);
 	}
 
+	return disc;
+}
 
-	/* wait for the gtk thread to update music_store */
 
-	data->write_data_locked = 1;
-	data->disc = disc;
+/* The store build is a pipeline: the build thread walks the directory
+ * tree and queues a job per record (strict) or file (loose), a pool of
+ * workers probes the files and collects their metadata, and a writer
+ * thread hands finished jobs to the GTK thread in walk order, many of
+ * them per idle callback.
+ */
 
-	aqualung_idle_add(write_track_to_store, data);
+void
+build_queue_job(build_store_t * data, char * path, char * artist_d_name, char * d_name) {
+
+	build_job_t * job;
 
-	while (data->write_data_locked) {
-		g_usleep(10000);
+	if ((job = (build_job_t *)calloc(1, sizeof(build_job_t))) == NULL) {
+		fprintf(stderr, "build_store.c: build_queue_job(): calloc error\n");
+		return;
 	}
 
- finish:
+	job->path = g_strdup(path);
+	job->artist_d_name = g_strdup(artist_d_name);
+	job->d_name = g_strdup(d_name);
+	job->new_context = data->pending_new_context;
+	data->pending_new_context = 0;
 
-	free(disc->tracks);
-	free(disc);
+	AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+
+	while (data->n_jobs >= BUILD_MAX_QUEUED && !data->cancelled) {
+		AQUALUNG_COND_WAIT(data->job_space, data->queue_mutex);
+	}
+
+	if (data->job_tail != NULL) {
+		data->job_tail->next = job;
+	} else {
+		data->job_head = job;
+	}
+	data->job_tail = job;
+
+	if (data->next_job == NULL) {
+		data->next_job = job;
+	}
+
+	data->n_jobs++;
+
+	AQUALUNG_COND_SIGNAL(data->job_added);
+	AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+}
+
+
+void
+build_job_free(build_job_t * job) {
+
+	if (job->disc != NULL) {
+		build_disc_free(job->disc);
+	}
+
+	g_free(job->path);
+	g_free(job->artist_d_name);
+	g_free(job->d_name);
+	free(job);
+}
+
+
+void *
+build_worker(void * arg) {
+
+	build_store_t * data = (build_store_t *)arg;
+	build_job_t * job;
+
+	AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+
+	for (;;) {
+
+		while (data->next_job == NULL && !data->walk_done) {
+			AQUALUNG_COND_WAIT(data->job_added, data->queue_mutex);
+		}
+
+		if ((job = data->next_job) == NULL) {
+			break;
+		}
+		data->next_job = job->next;
+
+		AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+
+		if (!data->cancelled) {
+			if (data->type == BUILD_TYPE_STRICT) {
+				job->disc = process_record(data, job->path,
+							   job->artist_d_name, job->d_name);
+			} else {
+				job->disc = process_track(data, job->path, job->d_name);
+			}
+		}
+
+		AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+		job->done = 1;
+		AQUALUNG_COND_SIGNAL(data->job_done);
+	}
+
+	AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+
+	return NULL;
+}
+
+
+gboolean
+write_batch_to_store(gpointer user_data) {
+
+	build_store_t * data = (build_store_t *)user_data;
+	build_job_t * job;
+	int changed = 0;
+
+	AQUALUNG_MUTEX_LOCK(data->wait_mutex);
+
+	for (job = data->batch; job; job = job->next) {
+
+		if (job->new_context) {
+			data->artist_iter_is_set = 0;
+			if (data->artist_name_map != NULL) {
+				map_free(data->artist_name_map);
+				data->artist_name_map = NULL;
+			}
+		}
+
+		if (job->disc == NULL || data->cancelled) {
+			continue;
+		}
+
+		data->disc = job->disc;
+		if (data->type == BUILD_TYPE_STRICT) {
+			write_record_to_store(data);
+		} else {
+			write_track_to_store(data);
+		}
+		changed = 1;
+	}
+
+	data->disc = NULL;
+
+	if (changed) {
+		music_store_mark_changed(&data->store_iter);
+	}
+
+	data->batch_done = 1;
+	AQUALUNG_COND_SIGNAL(data->thread_wait);
+	AQUALUNG_MUTEX_UNLOCK(data->wait_mutex);
+
+	return FALSE;
+}
+
+
+void *
+build_writer(void * arg) {
+
+	build_store_t * data = (build_store_t *)arg;
+
+	AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+
+	for (;;) {
+
+		build_job_t * job;
+		build_job_t * last = NULL;
+		int n_jobs = 0;
+		int n_tracks = 0;
+
+		while ((data->job_head == NULL || !data->job_head->done) &&
+		       !(data->job_head == NULL && data->walk_done)) {
+			AQUALUNG_COND_WAIT(data->job_done, data->queue_mutex);
+		}
+
+		if (data->job_head == NULL) {
+			break;
+		}
+
+		/* take the run of finished jobs at the head of the queue */
+		for (job = data->job_head; job && job->done && n_tracks < BUILD_BATCH_TRACKS; job = job->next) {
+
+			build_track_t * ptrack;
+
+			if (job->disc != NULL) {
+				for (ptrack = job->disc->tracks; ptrack; ptrack = ptrack->next) {
+					++n_tracks;
+				}
+			}
+
+			last = job;
+			++n_jobs;
+		}
+
+		data->batch = data->job_head;
+		data->job_head = last->next;
+		if (data->job_head == NULL) {
+			data->job_tail = NULL;
+		}
+		last->next = NULL;
+
+		AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+
+		AQUALUNG_MUTEX_LOCK(data->wait_mutex);
+		data->batch_done = 0;
+		aqualung_idle_add(write_batch_to_store, data);
+		while (!data->batch_done) {
+			AQUALUNG_COND_WAIT(data->thread_wait, data->wait_mutex);
+		}
+		AQUALUNG_MUTEX_UNLOCK(data->wait_mutex);
+
+		while (data->batch != NULL) {
+			job = data->batch;
+			data->batch = job->next;
+			build_job_free(job);
+		}
+
+		AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+		data->n_jobs -= n_jobs;
+		AQUALUNG_COND_SIGNAL(data->job_space);
+	}
+
+	AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+
+	return NULL;
+}
+
+
+int
+build_n_workers(void) {
+
+	int n = options.ms_build_worker_threads;
+
+	if (n <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+	}
+	if (n > BUILD_MAX_WORKERS) {
+		n = BUILD_MAX_WORKERS;
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	return n;
+}
+
+
+void
+build_pipeline_start(build_store_t * data) {
+
+	int i;
+
+	data->n_workers = build_n_workers();
+
+	for (i = 0; i < data->n_workers; i++) {
+		AQUALUNG_THREAD_CREATE(data->worker_ids[i], NULL, build_worker, data);
+	}
+
+	AQUALUNG_THREAD_CREATE(data->writer_id, NULL, build_writer, data);
+}
+
+
+void
+build_pipeline_finish(build_store_t * data) {
+
+	int i;
+
+	AQUALUNG_MUTEX_LOCK(data->queue_mutex);
+	data->walk_done = 1;
+	AQUALUNG_COND_BROADCAST(data->job_added);
+	AQUALUNG_COND_SIGNAL(data->job_done);
+	AQUALUNG_MUTEX_UNLOCK(data->queue_mutex);
+
+	for (i = 0; i < data->n_workers; i++) {
+		AQUALUNG_THREAD_JOIN(data->worker_ids[i]);
+	}
+
+	AQUALUNG_THREAD_JOIN(data->writer_id);
+
+	if (data->artist_name_map != NULL) {
+		map_free(data->artist_name_map);
+		data->artist_name_map = NULL;
+	}
 }
 
 
@@ -3409,7 +4011,7 @@ scan_artist_record(build_store_t * data, char * dir_artist, char * name_artist,
 	char dir_record[MAXLEN];
 
 
-	data->artist_iter_is_set = 0;
+	data->pending_new_context = 1;
 
 	n = scandir(dir_artist, &ent_record, filter, alphasort);
 	for (i = 0; i < n; i++) {
@@ -3425,28 +4027,23 @@ scan_artist_record(build_store_t * data, char * dir_artist, char * name_artist,
 			continue;
 		}
 
-		set_prog_file_entry(data, dir_record);
-
 		if (depth == 0) {
 
-			data->artist_iter_is_set = 0;
+			data->pending_new_context = 1;
 
-			process_record(data,
-                                       dir_record,
-				       ent_record[i]->d_name,
-				       ent_record[i]->d_name);
+			build_queue_job(data,
+					dir_record,
+					ent_record[i]->d_name,
+					ent_record[i]->d_name);
 
-			if (data->artist_name_map != NULL) {
-				map_free(data->artist_name_map);
-				data->artist_name_map = NULL;
-			}
+			data->pending_new_context = 1;
 
 		} else if (depth == 1) {
 
-			process_record(data,
-                                       dir_record,
-			               name_artist,
-				       ent_record[i]->d_name);
+			build_queue_job(data,
+					dir_record,
+					name_artist,
+					ent_record[i]->d_name);
 		} else {
 			scan_artist_record(data, dir_record, ent_record[i]->d_name, depth - 1);
 		}
@@ -3464,10 +4061,7 @@ scan_artist_record(build_store_t * data, char * dir_artist, char * name_artist,
 		free(ent_record);
 	}
 
-	if (data->artist_name_map != NULL) {
-		map_free(data->artist_name_map);
-		data->artist_name_map = NULL;
-	}
+	data->pending_new_context = 1;
 }
 
 
@@ -3490,14 +4084,7 @@ scan_recursively(build_store_t * data, char * dir) {
 		if (is_dir(path)) {
 			scan_recursively(data, path);
 		} else {
-			float d;
-
-			set_prog_file_entry(data, path);
-			set_prog_action_label(data, _("Reading file"));
-
-			if (filter_excl_incl(data, path) && (d = get_file_duration(path)) > 0.0f) {
-				process_track(data, path, ent[i]->d_name, d);
-			}
+			build_queue_job(data, path, NULL, ent[i]->d_name);
 		}
 
 		free(ent[i]);
@@ -3596,7 +4183,15 @@ build_thread_strict(void * arg) {
 	AQUALUNG_THREAD_DETACH();
 
 	remove_dead_files(data);
+
+	/* the index walks music_store, which belongs to the GTK thread */
+	gdk_threads_enter();
+	store_index_build(data);
+	gdk_threads_leave();
+
+	build_pipeline_start(data);
 	scan_artist_record(data, data->root, NULL, (data->artist_dir_depth == 0) ? 0 : (data->artist_dir_depth + 1));
+	build_pipeline_finish(data);
 
 	aqualung_idle_add(finish_build, data);
 
@@ -3612,7 +4207,15 @@ build_thread_loose(void * arg) {
 	AQUALUNG_THREAD_DETACH();
 
 	remove_dead_files(data);
+
+	/* the index walks music_store, which belongs to the GTK thread */
+	gdk_threads_enter();
+	store_index_build(data);
+	gdk_threads_leave();
+
+	build_pipeline_start(data);
 	scan_recursively(data, data->root);
+	build_pipeline_finish(data);
 
 	aqualung_idle_add(finish_build, data);
 
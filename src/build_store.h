@@ -22,15 +22,12 @@
 #define AQUALUNG_BUILD_STORE_H
 
 #include <gtk/gtk.h>
-#include <libxml/tree.h>
 
 
 int build_is_busy(void);
 
 void build_store(GtkTreeIter * store_iter, char * file);
 
-xmlNodePtr build_store_get_xml_node(char * file);
-
 
 #endif /* AQUALUNG_BUILD_STORE_H */
 
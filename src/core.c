@@ -91,8 +91,11 @@
 #include "utils.h"
 #include "version.h"
 #include "rb.h"
+#include "resampler.h"
+#include "sample_conv.h"
 #include "options.h"
 #include "decoder/file_decoder.h"
+#include "httpc.h"
 #include "transceiver.h"
 #include "gui_main.h"
 #include "i18n.h"
@@ -151,9 +154,28 @@ int output = 0; /* oss/alsa/jack */
 
 int src_type_parsed = 0;
 
+/* Gapless playback: ask the GUI for the next track this many seconds
+   before the end of the current one, open it and pre-decode its first
+   PRELOAD_FRAMES frames while the current track is still playing. */
+#define PRELOAD_AHEAD_SECS 10
+#define PRELOAD_FRAMES     8192
+
+typedef struct {
+	file_decoder_t * fdec;
+	char filename[MAXLEN];
+	float voladj;
+	float * buf;           /* frames decoded ahead of time */
+	unsigned int n_frames; /* number of frames in buf */
+	unsigned int pos;      /* next frame in buf to hand out */
+} preroll_t;
+
 /* Synchronization between disk thread and output thread */
 AQUALUNG_MUTEX_DECLARE_INIT(disk_thread_lock)
 AQUALUNG_COND_DECLARE_INIT(disk_thread_wake)
+AQUALUNG_MUTEX_DECLARE_INIT(output_thread_lock)
+AQUALUNG_COND_DECLARE_INIT(output_thread_wake)
+/* set while the disk thread sleeps waiting for free space in rb */
+volatile int disk_thread_wants_space = 0;
 rb_t * rb; /* this is the audio stream carrier ringbuffer */
 rb_t * rb_disk2out;
 rb_t * rb_out2disk;
@@ -247,6 +269,84 @@ rollback(file_decoder_t * fdec, double src_ratio, guint32 playback_offset) {
 }
 
 
+/* The disk thread is woken up to refill rb once this many bytes are free. */
+size_t
+rb_refill_watermark(void) {
+
+	return rb->size / 8;
+}
+
+
+/* Called by the disk thread after it has written to rb or rb_disk2out. */
+void
+wake_output_thread(void) {
+
+	AQUALUNG_MUTEX_LOCK(output_thread_lock)
+	AQUALUNG_COND_SIGNAL(output_thread_wake)
+	AQUALUNG_MUTEX_UNLOCK(output_thread_lock)
+}
+
+
+/* Called by output threads when rb is empty: sleep until the disk thread
+   has written audio data or a command for us. */
+void
+wait_for_output_data(void) {
+
+	AQUALUNG_MUTEX_LOCK(output_thread_lock)
+	while (rb_read_space(rb) < 2*sample_size && rb_read_space(rb_disk2out) == 0) {
+		AQUALUNG_COND_WAIT(output_thread_wake, output_thread_lock)
+	}
+	AQUALUNG_MUTEX_UNLOCK(output_thread_lock)
+}
+
+
+/* Called on the output side after consuming audio from rb. This also runs
+   in the JACK process callback, so it must never block: if the lock is
+   busy, the disk thread is still awake and the wakeup is retried on the
+   next period anyway. */
+void
+wake_disk_thread_for_space(void) {
+
+	if (!disk_thread_wants_space || rb_write_space(rb) < rb_refill_watermark())
+		return;
+
+	if (AQUALUNG_MUTEX_TRYLOCK(disk_thread_lock)) {
+		AQUALUNG_COND_SIGNAL(disk_thread_wake)
+		AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
+	}
+}
+
+
+/* Called by the output side after answering CMD_FLUSH on rb_out2disk.
+   The JACK process callback must not block and passes blocking = 0; it
+   gets 0 back if the lock was busy and retries on its next period. */
+int
+wake_disk_thread_for_reply(int blocking) {
+
+	if (blocking) {
+		AQUALUNG_MUTEX_LOCK(output_thread_lock)
+	} else if (!(AQUALUNG_MUTEX_TRYLOCK(output_thread_lock))) {
+		return 0;
+	}
+	AQUALUNG_COND_BROADCAST(output_thread_wake)
+	AQUALUNG_MUTEX_UNLOCK(output_thread_lock)
+	return 1;
+}
+
+
+/* The GUI writes a command and its payload separately; wait until the
+   payload has arrived as well (the GUI wakes us after writing it). */
+void
+wait_for_gui_payload(size_t size) {
+
+	AQUALUNG_MUTEX_LOCK(disk_thread_lock)
+	while (rb_read_space(rb_gui2disk) < size) {
+		AQUALUNG_COND_WAIT(disk_thread_wake, disk_thread_lock)
+	}
+	AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
+}
+
+
 /* returns number of samples in rb and output driver buffer */
 guint32
 flush_output(double src_ratio) {
@@ -263,20 +363,111 @@ flush_output(double src_ratio) {
 	sample_offset = rb_read_space(rb) / (2 * sample_size) * src_ratio;
 
 	rb_write(rb_disk2out, &send_cmd, 1);
-	while (rb_read_space(rb_out2disk) < sizeof(guint32))
-		g_usleep(1000);
+	wake_output_thread();
+	AQUALUNG_MUTEX_LOCK(output_thread_lock)
+	while (rb_read_space(rb_out2disk) < sizeof(guint32)) {
+		AQUALUNG_COND_WAIT(output_thread_wake, output_thread_lock)
+	}
+	AQUALUNG_MUTEX_UNLOCK(output_thread_lock)
 	rb_read(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
 
 	return sample_offset + driver_offset * src_ratio;
 }
 
 
+/* Send a command and its payload to the GUI with a single rb_write(),
+   so the GUI never sees the command without its payload. */
+void
+send_to_gui(char cmd, void * payload, size_t size) {
+
+	char buf[1 + MAX(sizeof(fileinfo_t), sizeof(status_t))];
+
+	if (size > sizeof(buf) - 1 || rb_write_space(rb_disk2gui) < 1 + size) {
+		/* a lost status update is replaced by the next one */
+		if (cmd != CMD_STATUS) {
+			fprintf(stderr, "send_to_gui: dropping command %d\n", cmd);
+		}
+		return;
+	}
+
+	buf[0] = cmd;
+	if (size > 0) {
+		memcpy(buf + 1, payload, size);
+	}
+	rb_write(rb_disk2gui, buf, 1 + size);
+}
+
+
 void
 send_meta(metadata_t * meta, void * data) {
 
-	char send_cmd = CMD_METABLOCK;
-	rb_write(rb_disk2gui, &send_cmd, 1);
-	rb_write(rb_disk2gui, (char *)&meta, sizeof(metadata_t *));
+	send_to_gui(CMD_METABLOCK, &meta, sizeof(metadata_t *));
+}
+
+
+/* Read num frames, handing out the pre-decoded frames (if any) first. */
+unsigned int
+preroll_read(preroll_t * p, float * dest, unsigned int num) {
+
+	int channels = p->fdec->fileinfo.channels;
+	unsigned int n = 0;
+
+	if (p->pos < p->n_frames) {
+		n = p->n_frames - p->pos;
+		if (n > num)
+			n = num;
+		memcpy(dest, p->buf + p->pos * channels, n * channels * sizeof(float));
+		p->pos += n;
+		if (n == num)
+			return n;
+	}
+
+	return n + file_decoder_read(p->fdec, dest + n * channels, num - n);
+}
+
+
+/* Forget about pre-decoded frames, e.g. because the decoder has seeked. */
+void
+preroll_reset(preroll_t * p) {
+
+	p->n_frames = 0;
+	p->pos = 0;
+}
+
+
+void
+preroll_discard(preroll_t * p) {
+
+	if (p->fdec->file_open)
+		file_decoder_close(p->fdec);
+	p->filename[0] = '\0';
+	preroll_reset(p);
+}
+
+
+/* Open the next track and decode its first frames, so that switching
+   to it at the end of the current track is immediate. Streams and CDDA
+   tracks (which have their own flow-through) are not pre-opened. */
+void
+preroll_open(preroll_t * p, char * filename, float voladj, unsigned long out_SR) {
+
+	preroll_discard(p);
+
+	if (httpc_is_url(filename) || g_str_has_prefix(filename, "CDDA "))
+		return;
+
+	if (file_decoder_open(p->fdec, filename))
+		return;
+
+	if (p->fdec->is_stream || !sample_rates_ok(out_SR, p->fdec->fileinfo.sample_rate)) {
+		file_decoder_close(p->fdec);
+		return;
+	}
+
+	file_decoder_set_rva(p->fdec, voladj);
+	strncpy(p->filename, filename, MAXLEN-1);
+	p->voladj = voladj;
+	p->n_frames = file_decoder_read(p->fdec, p->buf, PRELOAD_FRAMES);
 }
 
 
@@ -291,8 +482,16 @@ disk_thread(void * arg) {
 	int n_src_prev = 0;
 	int end_of_file = 0;
 	double src_ratio = 1.0;
-	void * readbuf = malloc(MAX_RATIO * info->rb_size * 2 * sample_size);
-	void * framebuf = malloc(MAX_RATIO * info->rb_size * 2 * sample_size);
+	unsigned long ratio_SR = 0; /* input rate src_ratio was computed for */
+	/* framebuf holds at most a ringbuffer full of output frames; readbuf
+	   is grown to fit the input for that many frames at src_ratio */
+	unsigned int framebuf_frames = rb->size / (2 * sample_size);
+	unsigned int readbuf_frames = framebuf_frames;
+	void * readbuf = malloc(readbuf_frames * 2 * sample_size);
+	/* native decoder output, if it is not stereo */
+	float * decbuf = NULL;
+	unsigned int decbuf_len = 0;
+	void * framebuf = malloc(framebuf_frames * 2 * sample_size);
 	size_t n_space;
 	char send_cmd, recv_cmd;
 	char filename[RB_CONTROL_SIZE];
@@ -302,21 +501,20 @@ disk_thread(void * arg) {
 #endif /* HAVE_CDDA */
 	seek_t seek;
 	cue_t cue;
-	int i;
+	preroll_t cur; /* fdec and its pre-decoded frames */
+	preroll_t next; /* the next track, opened ahead of time */
+	int preload_requested = 0;
 
 
 #ifdef HAVE_SRC
-	int src_type_prev;
-	SRC_STATE * src_state;
-	SRC_DATA src_data;
-	int src_error;
-
-        if ((src_state = src_new(options.src_type, 2, &src_error)) == NULL) {
-		fprintf(stderr, "disk thread: error: src_new() failed: %s.\n",
-			src_strerror(src_error));
+	int src_type_prev = -1;
+	long n_gen;
+	resampler_t * resampler;
+
+	if ((resampler = resampler_new(2)) == NULL) {
+		fprintf(stderr, "disk thread: error: resampler_new() failed\n");
 		exit(1);
 	}
-	src_type_prev = options.src_type;
 #endif /* HAVE_SRC */
 
 	if ((fdec = file_decoder_new()) == NULL) {
@@ -325,12 +523,20 @@ disk_thread(void * arg) {
 	}
 	file_decoder_set_meta_cb(fdec, send_meta, NULL);
 
-	if ((!readbuf) || (!framebuf)) {
-		fprintf(stderr, "disk thread: malloc error\n");
+	memset(&cur, 0, sizeof(preroll_t));
+	memset(&next, 0, sizeof(preroll_t));
+	cur.fdec = fdec;
+	if ((next.fdec = file_decoder_new()) == NULL) {
+		fprintf(stderr, "disk thread: error: file_decoder_new() failed\n");
 		exit(1);
 	}
+	cur.buf = malloc(PRELOAD_FRAMES * FILE_DECODER_MAX_CHANNELS * sample_size);
+	next.buf = malloc(PRELOAD_FRAMES * FILE_DECODER_MAX_CHANNELS * sample_size);
 
-	AQUALUNG_MUTEX_LOCK(disk_thread_lock)
+	if ((!readbuf) || (!framebuf) || (!cur.buf) || (!next.buf)) {
+		fprintf(stderr, "disk thread: malloc error\n");
+		exit(1);
+	}
 
 	filename[0] = '\0';
 #ifdef HAVE_CDDA
@@ -345,9 +551,7 @@ disk_thread(void * arg) {
 			switch (recv_cmd) {
 			case CMD_CUE:
 				/* read the string */
-				while (rb_read_space(rb_gui2disk) < sizeof(cue_t))
-					;
-
+				wait_for_gui_payload(sizeof(cue_t));
 				rb_read(rb_gui2disk, (void *)&cue, sizeof(cue_t));
 				
 #ifdef HAVE_CDDA
@@ -360,6 +564,9 @@ disk_thread(void * arg) {
 					filename[0] = '\0';
 				}
 
+				preload_requested = 0;
+				preroll_reset(&cur);
+
 #ifdef HAVE_CDDA
 				if (!flowthrough || !same_disc_next_track(filename, filename_prev)) {
 					if (fdec->file_lib != 0)
@@ -387,19 +594,30 @@ disk_thread(void * arg) {
 
 						sample_offset = 0;
 
-						send_cmd = CMD_FILEINFO;
 						fileinfo_sent = fdec->fileinfo;
 						fileinfo_sent.format_str = strdup(fdec->fileinfo.format_str);
-						rb_write(rb_disk2gui, &send_cmd,
-								      sizeof(send_cmd));
-						rb_write(rb_disk2gui, (char *)&fileinfo_sent,
-							              sizeof(fileinfo_t));
+						send_to_gui(CMD_FILEINFO, &fileinfo_sent, sizeof(fileinfo_t));
 
 						info->is_streaming = 1;
 						end_of_file = 0;
 					} else {
 #endif /* HAVE_CDDA */
-					if (file_decoder_open(fdec, filename)) {
+					if ((next.filename[0] != '\0') &&
+					    (strcmp(next.filename, filename) == 0) &&
+					    (next.voladj == cue.voladj)) {
+						/* take over the pre-opened decoder */
+						preroll_t tmp = cur;
+						cur = next;
+						next = tmp;
+						next.filename[0] = '\0';
+						fdec = cur.fdec;
+						file_decoder_set_meta_cb(next.fdec, NULL, NULL);
+						file_decoder_set_meta_cb(fdec, send_meta, NULL);
+					} else if (next.filename[0] != '\0') {
+						preroll_discard(&next);
+					}
+
+					if (!fdec->file_open && file_decoder_open(fdec, filename)) {
 						fdec->samples_left = 0;
 						info->is_streaming = 0;
 						end_of_file = 1;
@@ -422,9 +640,8 @@ disk_thread(void * arg) {
 						fileinfo_t fileinfo_sent;
 
 						file_decoder_set_rva(fdec, cue.voladj);
-						info->in_SR_prev = info->in_SR;
 						info->in_SR = fdec->fileinfo.sample_rate;
-						info->is_mono = fdec->fileinfo.is_mono;
+						info->channels = fdec->fileinfo.channels;
 						fdec->sample_pos = 0;
 #ifdef HAVE_CDDA
 						if (fdec->file_lib == CDDA_LIB) {
@@ -439,13 +656,9 @@ disk_thread(void * arg) {
 
 						sample_offset = 0;
 
-						send_cmd = CMD_FILEINFO;
 						fileinfo_sent = fdec->fileinfo;
 						fileinfo_sent.format_str = strdup(fdec->fileinfo.format_str);
-						rb_write(rb_disk2gui, &send_cmd,
-								      sizeof(send_cmd));
-						rb_write(rb_disk2gui, (char *)&fileinfo_sent,
-								      sizeof(fileinfo_t));
+						send_to_gui(CMD_FILEINFO, &fileinfo_sent, sizeof(fileinfo_t));
 
 						info->is_streaming = 1;
 						end_of_file = 0;
@@ -456,6 +669,7 @@ disk_thread(void * arg) {
 #endif /* HAVE_CDDA */
 				} else { /* STOP */
 					info->is_streaming = 0;
+					preroll_discard(&next);
 
 					/* send a FLUSH command to output thread to stop immediately */
 					flush_output(src_ratio);
@@ -466,6 +680,7 @@ disk_thread(void * arg) {
 				info->is_streaming = 0;
 				if (fdec->file_lib != 0)
 					file_decoder_close(fdec);
+				preroll_discard(&next);
 				goto flush;
 				break;
 			case CMD_PAUSE:
@@ -474,6 +689,10 @@ disk_thread(void * arg) {
 				/* send a FLUSH command to output thread */
 				playback_offset = flush_output(src_ratio);
 				rollback(fdec, src_ratio, playback_offset);
+				preroll_reset(&cur);
+#ifdef HAVE_SRC
+				resampler_reset(resampler);
+#endif /* HAVE_SRC */
 				if (fdec->is_stream) {
 					file_decoder_pause(fdec);
 				}
@@ -484,18 +703,30 @@ disk_thread(void * arg) {
 					file_decoder_resume(fdec);
 				}
 				break;
+			case CMD_PRELOAD:
+				wait_for_gui_payload(sizeof(cue_t));
+				rb_read(rb_gui2disk, (void *)&cue, sizeof(cue_t));
+				if (cue.filename != NULL) {
+					preroll_open(&next, cue.filename, cue.voladj, info->out_SR);
+					free(cue.filename);
+				}
+				break;
 			case CMD_FINISH:
 				/* send FINISH to output thread, then goto exit */
 				send_cmd = CMD_FINISH;
 				rb_write(rb_disk2out, &send_cmd, 1);
+				wake_output_thread();
 				goto done;
 				break;
 			case CMD_SEEKTO:
-				while (rb_read_space(rb_gui2disk) < sizeof(seek_t))
-					;
+				wait_for_gui_payload(sizeof(seek_t));
 				rb_read(rb_gui2disk, (char *)&seek, sizeof(seek_t));
 				if (fdec->file_lib != 0) {
 					file_decoder_seek(fdec, seek.seek_to_pos);
+					preroll_reset(&cur);
+#ifdef HAVE_SRC
+					resampler_reset(resampler);
+#endif /* HAVE_SRC */
 					/* send a FLUSH command to output thread */
 					flush_output(src_ratio);
 
@@ -506,10 +737,7 @@ disk_thread(void * arg) {
 					/* send dummy STATUS to gui, to set pos slider to zero */
 					disk_thread_status.samples_left = 0;
 					disk_thread_status.sample_offset = 0;
-					send_cmd = CMD_STATUS;
-					rb_write(rb_disk2gui, &send_cmd, sizeof(send_cmd));
-					rb_write(rb_disk2gui, (char *)&disk_thread_status,
-							      sizeof(status_t));
+					send_to_gui(CMD_STATUS, &disk_thread_status, sizeof(status_t));
 				}
 				break;
 			default:
@@ -526,28 +754,62 @@ disk_thread(void * arg) {
 		n_read = 0;
 		n_space = rb_write_space(rb) / (2 * sample_size);
 		while (n_src < 0.95 * n_space) {
-			
-			src_ratio = (double)info->out_SR / (double)info->in_SR;
+
+			if ((ratio_SR != info->in_SR)
+#ifdef HAVE_SRC
+			    || (src_type_prev != options.src_type)
+#endif /* HAVE_SRC */
+			    ) {
+				unsigned int frames;
+
+				ratio_SR = info->in_SR;
+				src_ratio = (double)info->out_SR / (double)info->in_SR;
+#ifdef HAVE_SRC
+				src_type_prev = options.src_type;
+				if ((info->in_SR != info->out_SR) &&
+				    resampler_select(resampler, options.src_type,
+						     info->in_SR, info->out_SR)) {
+					goto done;
+				}
+#endif /* HAVE_SRC */
+				frames = ceil(framebuf_frames / src_ratio);
+				if (frames > readbuf_frames) {
+					void * buf = realloc(readbuf, frames * 2 * sample_size);
+					if (buf == NULL) {
+						fprintf(stderr, "disk thread: realloc error\n");
+						goto done;
+					}
+					readbuf = buf;
+					readbuf_frames = frames;
+				}
+			}
+
 			n_src_prev = n_src;
 			want_read = floor((n_space - n_src) / src_ratio);
 
 			if (want_read == 0)
 				break;
 
-			if (want_read > MAX_RATIO * info->rb_size)
-				want_read = MAX_RATIO * info->rb_size;
-			
-			n_read = file_decoder_read(fdec, readbuf, want_read);
-			if (n_read < want_read)
-				end_of_file = 1;
+			if (want_read > readbuf_frames)
+				want_read = readbuf_frames;
 			
-			if (info->is_mono) { /* convert to stereo interleaved */
-				for (i = 2*n_read - 1; i >= 0; i--) {
-					memcpy(readbuf + i * sample_size,
-					       readbuf + i/2 * sample_size,
-					       sample_size);
+			if (info->channels == 2) {
+				n_read = preroll_read(&cur, readbuf, want_read);
+			} else {
+				if (want_read * info->channels > decbuf_len) {
+					float * buf = realloc(decbuf, want_read * info->channels * sample_size);
+					if (buf == NULL) {
+						fprintf(stderr, "disk thread: realloc error\n");
+						goto done;
+					}
+					decbuf = buf;
+					decbuf_len = want_read * info->channels;
 				}
+				n_read = preroll_read(&cur, decbuf, want_read);
+				sample_conv_to_stereo(decbuf, readbuf, info->channels, n_read);
 			}
+			if (n_read < want_read)
+				end_of_file = 1;
 			
 			info->in_SR = fdec->fileinfo.sample_rate;
 			if (info->in_SR == info->out_SR) {
@@ -556,32 +818,13 @@ disk_thread(void * arg) {
 				n_src += n_read;
 
 			} else { /* do SRC */
-#ifdef HAVE_SRC				
-				if ((info->in_SR_prev != info->in_SR) ||
-				    (src_type_prev != options.src_type)) { /* reinit SRC */
-
-					src_state = src_delete(src_state);
-					if ((src_state = src_new(options.src_type, 2, &src_error)) == NULL) {
-						fprintf(stderr, "disk thread: error: src_new() failed: "
-						       "%s.\n", src_strerror(src_error));
-						goto done;
-					}
-					info->in_SR_prev = info->in_SR;
-					src_type_prev = options.src_type;
-				}
-				
-				src_data.input_frames = n_read;
-				src_data.data_in = readbuf;
-				src_data.src_ratio = src_ratio;
-				src_data.data_out = framebuf + n_src_prev * 2*sample_size;
-				src_data.output_frames = n_space - n_src_prev;
-				src_data.end_of_input = 0;
-				if ((src_error = src_process(src_state, &src_data))) {
-					fprintf(stderr, "disk thread: SRC error: %s\n",
-					       src_strerror(src_error));
+#ifdef HAVE_SRC
+				if ((n_gen = resampler_process(resampler, readbuf, n_read,
+							       framebuf + n_src_prev * 2*sample_size,
+							       n_space - n_src_prev)) < 0) {
 					goto done;
 				}
-				n_src += src_data.output_frames_gen;
+				n_src += n_gen;
 #endif /* HAVE_SRC */
 			}
 			
@@ -598,6 +841,7 @@ disk_thread(void * arg) {
 
 	flush:
 		rb_write(rb, framebuf, n_src * 2*sample_size);
+		wake_output_thread();
 
 		/* update & send STATUS */
 		fdec->sample_pos += n_read;
@@ -613,10 +857,16 @@ disk_thread(void * arg) {
 		}
 
 		if (!rb_read_space(rb_gui2disk)) {
-			send_cmd = CMD_STATUS;
+			send_to_gui(CMD_STATUS, &disk_thread_status, sizeof(status_t));
+		}
+
+		/* approaching the end of the track: ask for the next one */
+		if (!preload_requested && info->is_streaming && fdec->file_open &&
+		    !fdec->is_stream && (fdec->fileinfo.total_samples > 0) &&
+		    (fdec->samples_left < PRELOAD_AHEAD_SECS * info->in_SR)) {
+			send_cmd = CMD_PRELOADREQ;
 			rb_write(rb_disk2gui, &send_cmd, sizeof(send_cmd));
-			rb_write(rb_disk2gui, (char *)&disk_thread_status,
-					      sizeof(status_t));
+			preload_requested = 1;
 		}
 
 		/* cleanup buffer counters */
@@ -625,40 +875,76 @@ disk_thread(void * arg) {
 		end_of_file = 0;
 		
 	sleep:
-		{
-			/* suspend thread, wake up after 100 ms */
-#ifndef HAVE_LIBPTHREAD
-			GTimeVal time;
-			GTimeVal * timeout = &time;
-			g_get_current_time(timeout);
-			g_time_val_add(timeout, 100000);
-#else /* HAVE_LIBPTHREAD */
-			struct timeval now;
-			struct timezone tz;
-			struct timespec timeout;
-			gettimeofday(&now, &tz);
-			timeout.tv_nsec = now.tv_usec * 1000 + 100000000;
-			timeout.tv_sec = now.tv_sec;
-			while (timeout.tv_nsec > 1000000000) {
-				timeout.tv_nsec -= 1000000000;
-				timeout.tv_sec += 1;
-			}
-#endif /* HAVE_LIBPTHREAD */
-			AQUALUNG_COND_TIMEDWAIT(disk_thread_wake, disk_thread_lock, timeout)
-		}
+		/* Suspend thread until the GUI sends a command or, while
+		   playing, the output side has drained rb below the refill
+		   watermark. */
+		AQUALUNG_MUTEX_LOCK(disk_thread_lock)
+		disk_thread_wants_space = info->is_streaming && !end_of_file;
+		while (rb_read_space(rb_gui2disk) == 0 &&
+		       !(disk_thread_wants_space &&
+			 rb_write_space(rb) >= rb_refill_watermark())) {
+			AQUALUNG_COND_WAIT(disk_thread_wake, disk_thread_lock)
+		}
+		disk_thread_wants_space = 0;
+		AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
 	}
  done:
 	free(readbuf);
+	free(decbuf);
 	free(framebuf);
 #ifdef HAVE_SRC
-	src_state = src_delete(src_state);
+	resampler_delete(resampler);
 #endif /* HAVE_SRC */
 	file_decoder_delete(fdec);
-	AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
+	file_decoder_delete(next.fdec);
+	free(cur.buf);
+	free(next.buf);
 	return 0;
 }
 
 
+/* De-interleave n frames straight out of the ringbuffer memory into
+   l_buf/r_buf. The readable data may wrap around the end of the buffer,
+   so it is handled as (at most) two contiguous regions; a frame split
+   by the wrap is copied separately. */
+void
+read_output_frames(int n) {
+
+	rb_data_t vec[2];
+	size_t frame_size = 2*sample_size;
+	size_t bytes = n * frame_size;
+	int n1;
+
+	rb_get_read_vector(rb, vec);
+
+	if (vec[0].len > bytes) {
+		vec[0].len = bytes;
+	}
+	n1 = vec[0].len / frame_size;
+	sample_conv_deinterleave((float *)vec[0].buf, l_buf, r_buf, n1);
+
+	if (n1 < n) {
+		size_t split = vec[0].len - n1 * frame_size;
+		float frame[2];
+		int n2 = n - n1;
+
+		if (split > 0) {
+			memcpy(frame, vec[0].buf + n1 * frame_size, split);
+			memcpy((char *)frame + split, vec[1].buf, frame_size - split);
+			l_buf[n1] = frame[0];
+			r_buf[n1] = frame[1];
+			--n2;
+		}
+		sample_conv_deinterleave((float *)(vec[1].buf + (split ? frame_size - split : 0)),
+					 l_buf + n - n2, r_buf + n - n2, n2);
+	}
+
+	rb_read_advance(rb, bytes);
+
+	wake_disk_thread_for_space();
+}
+
+
 void
 read_and_process_output(int bufsize, int * n_avail, int flushing) {
 
@@ -666,10 +952,8 @@ read_and_process_output(int bufsize, int * n_avail, int flushing) {
 	if (*n_avail > bufsize)
 		*n_avail = bufsize;
 	
-	for (i = 0; i < *n_avail; i++) {
-		rb_read(rb, (char *)&(l_buf[i]), sample_size);
-		rb_read(rb, (char *)&(r_buf[i]), sample_size);
-	}
+	read_output_frames(*n_avail);
+
 	for (i = *n_avail; i < bufsize; i++) {
 		l_buf[i] = 0.0f;
 		r_buf[i] = 0.0f;
@@ -727,7 +1011,6 @@ read_and_process_output(int bufsize, int * n_avail, int flushing) {
 void *
 sndio_thread(void * arg) {
 
-	guint32 i;
         thread_info_t * info = (thread_info_t *)arg;
 	guint32 driver_offset = 0;
 	int bufsize = 1024;
@@ -771,6 +1054,7 @@ sndio_thread(void * arg) {
 					rb_read(rb, (char *)sndio_short_buf, n_avail);
 				}
 				rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+				wake_disk_thread_for_reply(1);
 				goto sndio_wake;
 				break;
 			case CMD_FINISH:
@@ -783,26 +1067,13 @@ sndio_thread(void * arg) {
 		}
 
 		if ((n_avail = rb_read_space(rb) / (2*sample_size)) == 0) {
-			g_usleep(100000);
+			wait_for_output_data();
 			goto sndio_wake;
 		}
 
 		read_and_process_output(bufsize, &n_avail, 0);
 
-		for (i = 0; i < bufsize; i++) {
-			if (l_buf[i] > 1.0)
-				l_buf[i] = 1.0;
-			else if (l_buf[i] < -1.0)
-				l_buf[i] = -1.0;
-
-			if (r_buf[i] > 1.0)
-				r_buf[i] = 1.0;
-			else if (r_buf[i] < -1.0)
-				r_buf[i] = -1.0;
-
-			sndio_short_buf[2*i] = floorf(32767.0 * l_buf[i]);
-			sndio_short_buf[2*i+1] = floorf(32767.0 * r_buf[i]);
-		}
+		sample_conv_to_s16(l_buf, r_buf, sndio_short_buf, bufsize, options.output_dither);
 
 		/* write data to audio device */
 		bytes_written = sio_write(sndio_hdl, sndio_short_buf, 2*n_avail * sizeof(short));
@@ -827,7 +1098,6 @@ sndio_thread(void * arg) {
 void *
 pulse_thread(void * arg) {
 	
-	guint32 i;
 	thread_info_t * info = (thread_info_t *)arg;
 	guint32 driver_offset = 0;
 	int bufsize = 1024;
@@ -868,6 +1138,7 @@ pulse_thread(void * arg) {
 					rb_read(rb, (char *)pa_short_buf, n_avail);
 				}
 				rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+				wake_disk_thread_for_reply(1);
 				goto pulse_wake;
 				break;
 			case CMD_FINISH:
@@ -880,26 +1151,13 @@ pulse_thread(void * arg) {
 		}
 
 		if ((n_avail = rb_read_space(rb) / (2*sample_size)) == 0) {
-			g_usleep(100000);
+			wait_for_output_data();
 			goto pulse_wake;
 		}
 
 		read_and_process_output(bufsize, &n_avail, 0);
 
-		for (i = 0; i < bufsize; i++) {
-			if (l_buf[i] > 1.0)
-				l_buf[i] = 1.0;
-			else if (l_buf[i] < -1.0)
-				l_buf[i] = -1.0;
-
-			if (r_buf[i] > 1.0)
-				r_buf[i] = 1.0;
-			else if (r_buf[i] < -1.0)
-				r_buf[i] = -1.0;
-
-			pa_short_buf[2*i] = floorf(32767.0 * l_buf[i]);
-			pa_short_buf[2*i+1] = floorf(32767.0 * r_buf[i]);
-		}
+		sample_conv_to_s16(l_buf, r_buf, pa_short_buf, bufsize, options.output_dither);
 
 		/* write data to audio device */
 		ret = pa_simple_write(pa, pa_short_buf, 2*n_avail * sizeof(short), &err);
@@ -918,7 +1176,6 @@ pulse_thread(void * arg) {
 void *
 oss_thread(void * arg) {
 
-	guint32 i;
         thread_info_t * info = (thread_info_t *)arg;
 	guint32 driver_offset = 0;
 	int bufsize = 1024;
@@ -960,6 +1217,7 @@ oss_thread(void * arg) {
 					rb_read(rb, (char *)oss_short_buf, n_avail);
 				}
 				rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+				wake_disk_thread_for_reply(1);
 				goto oss_wake;
 				break;
 			case CMD_FINISH:
@@ -972,26 +1230,13 @@ oss_thread(void * arg) {
 		}
 
 		if ((n_avail = rb_read_space(rb) / (2*sample_size)) == 0) {
-			g_usleep(100000);
+			wait_for_output_data();
 			goto oss_wake;
 		}
 
 		read_and_process_output(bufsize, &n_avail, 0);
 
-		for (i = 0; i < bufsize; i++) {
-			if (l_buf[i] > 1.0)
-				l_buf[i] = 1.0;
-			else if (l_buf[i] < -1.0)
-				l_buf[i] = -1.0;
-
-			if (r_buf[i] > 1.0)
-				r_buf[i] = 1.0;
-			else if (r_buf[i] < -1.0)
-				r_buf[i] = -1.0;
-
-			oss_short_buf[2*i] = floorf(32767.0 * l_buf[i]);
-			oss_short_buf[2*i+1] = floorf(32767.0 * r_buf[i]);
-		}
+		sample_conv_to_s16(l_buf, r_buf, oss_short_buf, bufsize, options.output_dither);
 
 		/* write data to audio device */
 		ioctl_status = write(fd_oss, oss_short_buf, 2*n_avail * sizeof(short));
@@ -1011,7 +1256,6 @@ oss_thread(void * arg) {
 void *
 alsa_thread(void * arg) {
 
-	guint32 i;
 	guint32 driver_offset = 0;
         thread_info_t * info = (thread_info_t *)arg;
 	snd_pcm_sframes_t n_written = 0;
@@ -1074,6 +1318,7 @@ alsa_thread(void * arg) {
 					}
 				}
 				rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+				wake_disk_thread_for_reply(1);
 				goto alsa_wake;
 				break;
 			case CMD_FINISH:
@@ -1086,45 +1331,19 @@ alsa_thread(void * arg) {
 		}
 
 		if ((n_avail = rb_read_space(rb) / (2*sample_size)) == 0) {
-			g_usleep(100000);
+			wait_for_output_data();
 			goto alsa_wake;
 		}
 
 		read_and_process_output(bufsize, &n_avail, 0);
 
 		if (is_output_32bit) {
-			for (i = 0; i < bufsize; i++) {
-				if (l_buf[i] > 1.0)
-					l_buf[i] = 1.0;
-				else if (l_buf[i] < -1.0)
-					l_buf[i] = -1.0;
-
-				if (r_buf[i] > 1.0)
-					r_buf[i] = 1.0;
-				else if (r_buf[i] < -1.0)
-					r_buf[i] = -1.0;
-				
-				alsa_int_buf[2*i] = floorf(2147483647.0 * l_buf[i]);
-				alsa_int_buf[2*i+1] = floorf(2147483647.0 * r_buf[i]);
-			}
+			sample_conv_to_s32(l_buf, r_buf, alsa_int_buf, bufsize);
 
 			alsa_buf = alsa_int_buf;
 			alsa_sample_size = sizeof(*alsa_int_buf)*2;
 		} else {
-			for (i = 0; i < bufsize; i++) {
-				if (l_buf[i] > 1.0)
-					l_buf[i] = 1.0;
-				else if (l_buf[i] < -1.0)
-					l_buf[i] = -1.0;
-				
-				if (r_buf[i] > 1.0)
-					r_buf[i] = 1.0;
-				else if (r_buf[i] < -1.0)
-					r_buf[i] = -1.0;
-
-				alsa_short_buf[2*i] = floorf(32767.0 * l_buf[i]);
-				alsa_short_buf[2*i+1] = floorf(32767.0 * r_buf[i]);
-			}
+			sample_conv_to_s16(l_buf, r_buf, alsa_short_buf, bufsize, options.output_dither);
 
 			alsa_buf = alsa_short_buf;
 			alsa_sample_size = sizeof(*alsa_short_buf)*2;
@@ -1189,12 +1408,17 @@ process(guint32 nframes, void * arg) {
 
 	static int flushing = 0;
 	static int flushcnt = 0;
+	static int reply_pending = 0;
 	char recv_cmd;
 
 	jack_nframes = nframes;
 #ifdef HAVE_LADSPA
 	ladspa_buflen = nframes;
 #endif /* HAVE_LADSPA */
+
+	if (reply_pending && wake_disk_thread_for_reply(0)) {
+		reply_pending = 0;
+	}
 	
 	while (rb_read_space(rb_disk2out)) {
 		rb_read(rb_disk2out, &recv_cmd, 1);
@@ -1204,6 +1428,7 @@ process(guint32 nframes, void * arg) {
 			flushcnt = rb_read_space(rb)/nframes/
 				(2*sample_size) * 1.1f;
 			rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+			reply_pending = !wake_disk_thread_for_reply(0);
 			break;
 		case CMD_FINISH:
 			return 0;
@@ -1697,7 +1922,6 @@ pulse_init(thread_info_t * info, int verbose, gboolean realtime, int priority) {
 void *
 win32_thread(void * arg) {
 
-	guint32 i;
 	guint32 driver_offset = 0;
         thread_info_t * info = (thread_info_t *)arg;
 
@@ -1826,6 +2050,7 @@ win32_thread(void * arg) {
 					short_buf[j] = 0;
 				}
 				rb_write(rb_out2disk, (char *)&driver_offset, sizeof(guint32));
+				wake_disk_thread_for_reply(1);
 				goto win32_wake;
 				break;
 			case CMD_FINISH:
@@ -1839,7 +2064,7 @@ win32_thread(void * arg) {
 		}
 
 		if ((n_avail = rb_read_space(rb) / (2*sample_size)) == 0) {
-			Sleep(100);
+			wait_for_output_data();
 			goto win32_wake;
 		}
 
@@ -1848,20 +2073,8 @@ win32_thread(void * arg) {
 		while (!(whdr[bufcnt].dwFlags & WHDR_DONE))
 			Sleep(1);
 
-		for (i = 0; i < bufsize; i++) {
-			if (l_buf[i] > 1.0)
-				l_buf[i] = 1.0;
-			else if (l_buf[i] < -1.0)
-				l_buf[i] = -1.0;
-
-			if (r_buf[i] > 1.0)
-				r_buf[i] = 1.0;
-			else if (r_buf[i] < -1.0)
-				r_buf[i] = -1.0;
-
-			short_buf[2*bufcnt*bufsize + 2*i] = floorf(32767.0 * l_buf[i]);
-			short_buf[2*bufcnt*bufsize + 2*i+1] = floorf(32767.0 * r_buf[i]);
-		}
+		sample_conv_to_s16(l_buf, r_buf, short_buf + 2*bufcnt*bufsize, bufsize,
+				   options.output_dither);
 
 		/* write data to audio device */
 		if ((error = waveOutWrite(hwave, &(whdr[bufcnt]), sizeof(WAVEHDR)))
@@ -2256,6 +2469,9 @@ print_usage(void) {
 		"\nGeneral options:\n"
 		"-D, --disk-realtime: Try to use realtime (SCHED_FIFO) scheduling for disk thread.\n"
 		"-Y, --disk-priority <int>: When running -D, set scheduler priority to <int> (defaults to 1).\n"
+		"-p, --rb-profile (low|normal|safe|<int>): Set the size of the audio ringbuffer between\n"
+		"disk and output thread (low latency, default, extra robustness, or size in frames).\n"
+		"-M, --lock-buffers: Lock the audio ringbuffer into memory, using huge pages if possible.\n"
 		
 		"\nOptions relevant to ALSA output:\n"
 		"-d, --device <name>: Set the output device (defaults to 'default').\n"
@@ -2437,7 +2653,10 @@ main(int argc, char ** argv) {
 	char * voladj_arg = NULL;
 	char * custom_arg = NULL;
 
-	char * optstring = "vho:d:c:r:b:a::RP:DY:s::l:m:N:BLUTFEC:V:Qt::";
+	int rb_audio_size = RB_AUDIO_SIZE;
+	int rb_flags = 0;
+
+	char * optstring = "vho:d:c:r:b:a::RP:DY:p:Ms::l:m:N:BLUTFEC:V:Qt::";
 	struct option long_options[] = {
 		{ "version", 0, 0, 'v' },
 		{ "help", 0, 0, 'h' },
@@ -2451,6 +2670,8 @@ main(int argc, char ** argv) {
 		{ "priority", 1, 0, 'P' },
 		{ "disk-realtime", 0, 0, 'D' },
 		{ "disk-priority", 1, 0, 'Y' },
+		{ "rb-profile", 1, 0, 'p' },
+		{ "lock-buffers", 0, 0, 'M' },
 		{ "srctype", 2, 0, 's' },
                 { "show-pl", 1, 0, 'l' },
 		{ "show-ms", 1, 0, 'm' },
@@ -2483,9 +2704,12 @@ main(int argc, char ** argv) {
 #ifndef HAVE_LIBPTHREAD
 	disk_thread_lock = g_mutex_new();
 	disk_thread_wake = g_cond_new();
+	output_thread_lock = g_mutex_new();
+	output_thread_wake = g_cond_new();
 #endif /* !HAVE_LIBPTHREAD */
 
 	file_decoder_init();
+	sample_conv_init();
 
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
@@ -2650,6 +2874,25 @@ main(int argc, char ** argv) {
 			case 'Y':
 				disk_priority = atoi(optarg);
 				break;
+			case 'p':
+				if (strcmp(optarg, "low") == 0) {
+					rb_audio_size = RB_AUDIO_SIZE_LOW;
+				} else if (strcmp(optarg, "normal") == 0) {
+					rb_audio_size = RB_AUDIO_SIZE;
+				} else if (strcmp(optarg, "safe") == 0) {
+					rb_audio_size = RB_AUDIO_SIZE_SAFE;
+				} else {
+					rb_audio_size = atoi(optarg);
+					if ((rb_audio_size < RB_AUDIO_SIZE_MIN) ||
+					    (rb_audio_size > RB_AUDIO_SIZE_MAX)) {
+						fprintf(stderr, "Invalid ringbuffer profile: %s\n", optarg);
+						exit(0);
+					}
+				}
+				break;
+			case 'M':
+				rb_flags = RB_MLOCK | RB_HUGETLB;
+				break;
 			case 's':
 #ifdef HAVE_SRC
 				if (optarg) {
@@ -2888,9 +3131,16 @@ main(int argc, char ** argv) {
 	/* Initialize thread_info and create ringbuffers */
 	memset(&thread_info, 0, sizeof(thread_info));
 
-	thread_info.rb_size = RB_AUDIO_SIZE;
+	thread_info.rb_size = rb_audio_size;
 
-        rb = rb_create(2*sample_size * thread_info.rb_size);
+        rb = rb_create_ex(2*sample_size * thread_info.rb_size, rb_flags);
+	if (rb == NULL) {
+		fprintf(stderr, "aqualung main(): failed to allocate audio ringbuffer\n");
+		exit(1);
+	}
+	if ((rb_flags & RB_MLOCK) && !rb->mlocked) {
+		fprintf(stderr, "Warning: cannot lock audio ringbuffer into memory\n");
+	}
 	memset(rb->buf, 0, rb->size);
 
 
@@ -2907,7 +3157,7 @@ main(int argc, char ** argv) {
 	memset(rb_out2disk->buf, 0, rb_out2disk->size);
 
 	thread_info.is_streaming = 0;
-	thread_info.is_mono = 0;
+	thread_info.channels = 2;
 	thread_info.in_SR = 0;
 
 
@@ -3175,7 +3425,7 @@ main(int argc, char ** argv) {
 	}
 #endif /* HAVE_WINMM */
 
-	create_gui(argc, argv, optind, enqueue, rate, RB_AUDIO_SIZE * rate / 44100.0);
+	create_gui(argc, argv, optind, enqueue, rate, thread_info.rb_size * rate / 44100.0);
 	setup_app_socket();
 	run_gui(); /* control stays here until user exits program */
 	close_app_socket();
@@ -3237,6 +3487,8 @@ main(int argc, char ** argv) {
 #ifndef HAVE_LIBPTHREAD
 	g_mutex_free(disk_thread_lock);
 	g_cond_free(disk_thread_wake);
+	g_mutex_free(output_thread_lock);
+	g_cond_free(output_thread_wake);
 #endif /* !HAVE_LIBPTHREAD */
 
 	if (device_name != NULL)
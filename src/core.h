@@ -61,8 +61,13 @@
 #define MAX_SAMPLERATE 96000
 
 
-/* audio ringbuffer size in stereo frames */
+/* audio ringbuffer size in stereo frames: the default, and the
+   sizes selectable with --rb-profile (low latency / extra robustness) */
 #define RB_AUDIO_SIZE 32768
+#define RB_AUDIO_SIZE_LOW 8192
+#define RB_AUDIO_SIZE_SAFE 131072
+#define RB_AUDIO_SIZE_MIN 1024
+#define RB_AUDIO_SIZE_MAX 1048576
 
 /* control ringbuffer size in bytes */
 #define RB_CONTROL_SIZE 32768
@@ -115,10 +120,9 @@ typedef struct _thread_info {
 
 	guint32 rb_size;
 	unsigned long in_SR;
-	unsigned long in_SR_prev;
 	unsigned long out_SR;
 	volatile int is_streaming;
-	volatile int is_mono;
+	int channels; /* decoder output, mixed down to stereo */
 
 } thread_info_t;
 
@@ -131,11 +135,13 @@ typedef struct _thread_info {
 #define CMD_FINISH      4
 #define CMD_SEEKTO      5
 #define CMD_STOPWOFL    6
+#define CMD_PRELOAD    12
 /* command numbers from disk to gui */
 #define CMD_FILEREQ     7
 #define CMD_FILEINFO    8
 #define CMD_STATUS      9
 #define CMD_METABLOCK  10
+#define CMD_PRELOADREQ 13
 /* command numbers from disk to output */
 #define CMD_FLUSH      11
 
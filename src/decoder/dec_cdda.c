@@ -199,10 +199,8 @@ cdda_reader_thread(void * arg) {
 			}
 		}
 
-		for (i = 0; i < CDIO_CD_FRAMESIZE_RAW / 2; i++) {
-			float f = readbuf[i] / 32768.0 * fdec->voladj_lin;
-			rb_write(pd->rb, (char *)&f, sample_size);
-		}
+		file_decoder_rb_write_s16(pd->rb, (const short *)readbuf, 2,
+					  CDIO_CD_FRAMESIZE_RAW / 4, fdec->voladj_lin / 32768.0f);
 		pd->is_eos = (pd->pos_lsn >= pd->last_lsn ? 1 : 0);
 	}
 
@@ -293,6 +291,23 @@ cdda_decoder_open(decoder_t * dec, char * filename) {
 	if (drive->disc.hash != hash) {
 		return DECODER_OPEN_FERROR;
 	}
+
+	if (fdec->info_only) {
+		/* the scanner already has the TOC, no need to grab the drive */
+		if (track < 1 || track > drive->disc.n_tracks) {
+			return DECODER_OPEN_FERROR;
+		}
+		fdec->fileinfo.channels = 2;
+		fdec->fileinfo.sample_rate = 44100;
+		fdec->fileinfo.total_samples =
+			(drive->disc.toc[track] - drive->disc.toc[track-1]) * 588;
+
+		fdec->file_lib = CDDA_LIB;
+		fdec->fileinfo.bps = 2 * 16 * 44100;
+		strcpy(dec->format_str, "Audio CD");
+		return DECODER_OPEN_SUCCESS;
+	}
+
 	if (drive->is_used) {
 		fprintf(stderr, "cdda_decoder_open: drive %s is already in use\n", pd->device_path);
 		return DECODER_OPEN_FERROR;
@@ -439,6 +454,10 @@ cdda_decoder_close(decoder_t * dec) {
 	cdda_pdata_t * pd = (cdda_pdata_t *)dec->pdata;
 	cdda_drive_t * drive;
 
+	if (dec->fdec->info_only) {
+		return;
+	}
+
 	AQUALUNG_MUTEX_LOCK(pd->cdda_reader_mutex)
 	if (pd->cdda_reader_status == CDDA_READER_BUSY) {
 		pd->cdda_reader_status = CDDA_READER_FREE;
@@ -48,26 +48,16 @@ write_callback(const FLAC__StreamDecoder * decoder,
 	decoder_t * dec = (decoder_t *) client_data;
 	flac_pdata_t * pd = (flac_pdata_t *)dec->pdata;
 	file_decoder_t * fdec = dec->fdec;
-	int i, j;
-	long int scale, blocksize;
-        FLAC__int32 buf[2];
-        float fbuf[2];
+	long int scale;
 
 
         if (pd->probing)
                 return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 
-        blocksize = frame->header.blocksize;
         scale = 1 << (pd->bits_per_sample - 1);
 
-        for (i = 0; i < blocksize; i++) {
-                for (j = 0; j < pd->channels; j++) {
-                        buf[j] = *(buffer[j] + i);
-                        fbuf[j] = (float)buf[j] * fdec->voladj_lin / scale;
-                }
-                rb_write(pd->rb, (char *)fbuf,
-                                      pd->channels * sample_size);
-        }
+	file_decoder_rb_write_planar_s32(pd->rb, (const int * const *)buffer, pd->channels,
+					 0, frame->header.blocksize, fdec->voladj_lin / scale);
 
         return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -460,7 +450,7 @@ flac_decoder_open(decoder_t * dec, char * filename) {
 	FLAC__stream_decoder_process_until_end_of_metadata(pd->flac_decoder);
 
 	if ((!pd->error) && (pd->channels > 0)) {
-		if ((pd->channels != 1) && (pd->channels != 2)) {
+		if (pd->channels > FILE_DECODER_MAX_CHANNELS) {
 			fprintf(stderr,
 				"flac_decoder_open: FLAC file with %d channels is "
 				"unsupported\n", pd->channels);
@@ -483,10 +473,15 @@ flac_decoder_open(decoder_t * dec, char * filename) {
 				tried_flac = 1;
 				FLAC__stream_decoder_finish(pd->flac_decoder);
 				FLAC__stream_decoder_delete(pd->flac_decoder);
-				goto try_flac;
+				pd->flac_decoder = NULL;
+				if (!fdec->info_only) {
+					goto try_flac;
+				}
 			}
 
-			pd->rb = rb_create(pd->channels * sample_size * RB_FLAC_SIZE);
+			if (!fdec->info_only) {
+				pd->rb = rb_create(pd->channels * sample_size * RB_FLAC_SIZE);
+			}
 
 			fdec->fileinfo.channels = pd->channels;
 			fdec->fileinfo.sample_rate = pd->SR;
@@ -525,9 +520,13 @@ flac_decoder_close(decoder_t * dec) {
 
 	flac_pdata_t * pd = (flac_pdata_t *)dec->pdata;
 
-	FLAC__stream_decoder_finish(pd->flac_decoder);
-	FLAC__stream_decoder_delete(pd->flac_decoder);
-	rb_free(pd->rb);
+	if (pd->flac_decoder != NULL) {
+		FLAC__stream_decoder_finish(pd->flac_decoder);
+		FLAC__stream_decoder_delete(pd->flac_decoder);
+	}
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
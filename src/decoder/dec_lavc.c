@@ -293,16 +293,20 @@ lavc_decoder_open(decoder_t * dec, char * filename) {
 	if (pd->avCodec == NULL)
 		return DECODER_OPEN_BADLIB;
 
+	/* stream info already has the parameters; only decoding needs the codec */
+	if (!fdec->info_only) {
 #if LIBAVCODEC_VERSION_MAJOR < 53
-	if (avcodec_open(pd->avCodecCtx, pd->avCodec) < 0)
+		if (avcodec_open(pd->avCodecCtx, pd->avCodec) < 0)
 #else /* LIBAVCODEC_VERSION_MAJOR >= 53 */
-	if (avcodec_open2(pd->avCodecCtx, pd->avCodec, NULL) < 0)
+		if (avcodec_open2(pd->avCodecCtx, pd->avCodec, NULL) < 0)
 #endif /* LIBAVCODEC_VERSION_MAJOR >= 53 */
-	{
-		return DECODER_OPEN_BADLIB;
+		{
+			return DECODER_OPEN_BADLIB;
+		}
 	}
 
-	if ((pd->avCodecCtx->channels != 1) && (pd->avCodecCtx->channels != 2)) {
+	if ((pd->avCodecCtx->channels < 1) ||
+	    (pd->avCodecCtx->channels > FILE_DECODER_MAX_CHANNELS)) {
 		fprintf(stderr,
 			"lavc_decoder_open: audio stream with %d channels is unsupported\n",
 			pd->avCodecCtx->channels);
@@ -310,7 +314,9 @@ lavc_decoder_open(decoder_t * dec, char * filename) {
 	}
 
         pd->is_eos = 0;
-        pd->rb = rb_create(pd->avCodecCtx->channels * sample_size * RB_LAVC_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->avCodecCtx->channels * sample_size * RB_LAVC_SIZE);
+	}
 
 	fdec->fileinfo.channels = pd->avCodecCtx->channels;
 	fdec->fileinfo.sample_rate = pd->avCodecCtx->sample_rate;
@@ -342,7 +348,9 @@ lavc_decoder_close(decoder_t * dec) {
 
 	lavc_pdata_t * pd = (lavc_pdata_t *)dec->pdata;
 
-	avcodec_close(pd->avCodecCtx);
+	if (!dec->fdec->info_only) {
+		avcodec_close(pd->avCodecCtx);
+	}
 
 #if LIBAVFORMAT_VERSION_MAJOR < 53
 	av_close_input_file(pd->avFormatCtx);
@@ -350,7 +358,9 @@ lavc_decoder_close(decoder_t * dec) {
 	avformat_close_input(&pd->avFormatCtx);
 #endif /* LIBAVFORMAT_VERSION_MAJOR >= 53 */
 
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
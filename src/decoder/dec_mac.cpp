@@ -204,7 +204,9 @@ mac_decoder_open(decoder_t * dec, char * filename) {
 	pd->swap_bytes = bigendianp();
 
 	pd->is_eos = 0;
-	pd->rb = rb_create(pd->channels * sample_size * RB_MAC_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->channels * sample_size * RB_MAC_SIZE);
+	}
 	fdec->fileinfo.channels = pd->channels;
 	fdec->fileinfo.sample_rate = pd->sample_rate;
 	fdec->fileinfo.total_samples = (unsigned long long)(pd->sample_rate / 1000.0f * pd->length_in_ms);
@@ -252,7 +254,9 @@ mac_decoder_close(decoder_t * dec) {
 	IAPEDecompress * pdecompress = (IAPEDecompress *)pd->decompress;
 
 	delete(pdecompress);
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
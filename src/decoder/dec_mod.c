@@ -500,7 +500,9 @@ char *filename = NULL;
 	ModPlug_SetSettings(&(pd->mp_settings));
 
 	pd->is_eos = 0;
-	pd->rb = rb_create(pd->mp_settings.mChannels * sample_size * RB_MOD_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->mp_settings.mChannels * sample_size * RB_MOD_SIZE);
+	}
 	fdec->fileinfo.channels = pd->mp_settings.mChannels;
 	fdec->fileinfo.sample_rate = pd->mp_settings.mFrequency;
 	fdec->file_lib = MOD_LIB;
@@ -540,7 +542,9 @@ mod_decoder_close(decoder_t * dec) {
         if (munmap(pd->fdm, pd->st.st_size) == -1)
 		fprintf(stderr, "Error while munmap()'ing MOD Audio file mapping\n");
 	close(pd->fd);
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
@@ -44,8 +44,6 @@ decode_mpc(decoder_t * dec) {
 	mpc_pdata_t * pd = (mpc_pdata_t *)dec->pdata;
 	file_decoder_t * fdec = dec->fdec;
 
-	int n;
-	float fval;
         MPC_SAMPLE_FORMAT buffer[MPC_DECODER_BUFFER_LENGTH];
 
 
@@ -72,21 +70,14 @@ decode_mpc(decoder_t * dec) {
 	pd->status = frame.samples;
 #endif /* MPC_OLD_API */
 	
-	for (n = 0; n < pd->status * pd->mpc_i.channels; n++) {
 #ifdef MPC_FIXED_POINT
-                fval = buffer[n] / (double)MPC_FIXED_POINT_SCALE * fdec->voladj_lin;
+	file_decoder_rb_write_s32(pd->rb, (const int *)buffer, pd->mpc_i.channels, pd->status,
+				  fdec->voladj_lin / (float)MPC_FIXED_POINT_SCALE);
 #else
-                fval = buffer[n] * fdec->voladj_lin;
+	file_decoder_rb_write_float(pd->rb, buffer, pd->mpc_i.channels, pd->status,
+				    fdec->voladj_lin);
 #endif /* MPC_FIXED_POINT */
-		
-                if (fval < -1.0f) {
-                        fval = -1.0f;
-                } else if (fval > 1.0f) {
-                        fval = 1.0f;
-                }
-		
-                rb_write(pd->rb, (char *)&fval, sample_size);
-	}
+
 	return 0;
 }
 
@@ -215,10 +206,12 @@ mpc_decoder_open(decoder_t * dec, char * filename) {
 		return DECODER_OPEN_BADLIB;
 	}
 	
-	mpc_decoder_setup(&pd->mpc_d, &pd->mpc_r_f.reader);
-	if (!mpc_decoder_initialize(&pd->mpc_d, &pd->mpc_i)) {
-		fclose(pd->mpc_file);
-		return DECODER_OPEN_BADLIB;
+	if (!fdec->info_only) {
+		mpc_decoder_setup(&pd->mpc_d, &pd->mpc_r_f.reader);
+		if (!mpc_decoder_initialize(&pd->mpc_d, &pd->mpc_i)) {
+			fclose(pd->mpc_file);
+			return DECODER_OPEN_BADLIB;
+		}
 	}
 #else
 	mpc_reader_init_stdio_stream(&pd->mpc_r_f, pd->mpc_file);
@@ -232,7 +225,9 @@ mpc_decoder_open(decoder_t * dec, char * filename) {
 #endif /* MPC_OLD_API */
 	
 	pd->is_eos = 0;
-	pd->rb = rb_create(pd->mpc_i.channels * sample_size * RB_MPC_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->mpc_i.channels * sample_size * RB_MPC_SIZE);
+	}
 	
 	fdec->fileinfo.channels = pd->mpc_i.channels;
 	fdec->fileinfo.sample_rate = pd->mpc_i.sample_freq;
@@ -287,7 +282,9 @@ mpc_decoder_close(decoder_t * dec) {
 
 	mpc_pdata_t * pd = (mpc_pdata_t *)dec->pdata;
 
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 	fclose(pd->mpc_file);
 }
 
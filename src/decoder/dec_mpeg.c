@@ -39,12 +39,14 @@
 #include "../metadata_ape.h"
 #include "../metadata_id3v1.h"
 #include "../metadata_id3v2.h"
+#include "../options.h"
 #include "../rb.h"
 #include "file_decoder.h"
 #include "dec_mpeg.h"
 
 
 extern size_t sample_size;
+extern options_t options;
 
 
 /* Uncomment this to get debug printouts */
@@ -685,42 +687,195 @@ get_mp3file_info(decoder_t * dec) {
 }
 
 
-void *
-build_seek_table_thread(void * args) {
+/* The frame indices of long files are cached on disk, one file per
+   MP3 file under <confdir>/mp3index, in host byte order. An index is
+   only reused if the path, size and modification time of the file
+   still match. The offsets are stored as frame-to-frame deltas of 16
+   bits; a larger delta is written as 0xffff followed by 32 bits. */
+
+#define MPEG_INDEX_MAGIC "AQMPIDX1"
+
+typedef struct {
+	char magic[8];
+	gint64 size;
+	gint64 mtime;
+	guint32 start_byteoffset;
+	guint32 frame_samples;
+	guint32 n_frames;
+	guint32 path_len;
+} mpeg_index_header_t;
+
+
+static char *
+mpeg_index_cache_file(char * path) {
+
+	return g_strdup_printf("%s/mp3index/%08x", options.confdir, g_str_hash(path));
+}
+
+static uint32_t *
+mpeg_index_load(mpeg_pdata_t * pd, char * path, unsigned long * n_frames) {
+
+	char * file = mpeg_index_cache_file(path);
+	gchar * data = NULL;
+	gsize len = 0;
+	mpeg_index_header_t hdr;
+	uint32_t * index = NULL;
+	uint32_t offset;
+	char * p;
+	char * end;
+	unsigned long k;
+
+	if (!g_file_get_contents(file, &data, &len, NULL)) {
+		g_free(file);
+		return NULL;
+	}
+	g_free(file);
+
+	if (len < sizeof(hdr)) {
+		goto out;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if (memcmp(hdr.magic, MPEG_INDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.size != (gint64)pd->mpeg_stat.st_size ||
+	    hdr.mtime != (gint64)pd->mpeg_stat.st_mtime ||
+	    hdr.start_byteoffset != pd->mp3info.start_byteoffset ||
+	    hdr.frame_samples != pd->mp3info.frame_samples ||
+	    hdr.n_frames == 0 ||
+	    hdr.path_len != strlen(path) ||
+	    sizeof(hdr) + hdr.path_len > len ||
+	    memcmp(data + sizeof(hdr), path, hdr.path_len) != 0) {
+		goto out;
+	}
+
+	if ((index = (uint32_t *)malloc(hdr.n_frames * sizeof(uint32_t))) == NULL) {
+		fprintf(stderr, "mpeg_index_load: malloc error\n");
+		goto out;
+	}
+
+	p = data + sizeof(hdr) + hdr.path_len;
+	end = data + len;
+	offset = hdr.start_byteoffset;
+	for (k = 0; k < hdr.n_frames; k++) {
+
+		guint16 d16;
+		guint32 d;
+
+		if (p + sizeof(d16) > end) {
+			break;
+		}
+		memcpy(&d16, p, sizeof(d16));
+		p += sizeof(d16);
+		d = d16;
+
+		if (d16 == 0xffff) {
+			if (p + sizeof(d) > end) {
+				break;
+			}
+			memcpy(&d, p, sizeof(d));
+			p += sizeof(d);
+		}
+
+		offset += d;
+		index[k] = offset;
+	}
+
+	if (k < hdr.n_frames) {
+		/* truncated file */
+		free(index);
+		index = NULL;
+		goto out;
+	}
+
+	*n_frames = hdr.n_frames;
+
+ out:
+	g_free(data);
+	return index;
+}
+
+static void
+mpeg_index_save(mpeg_pdata_t * pd, char * path, uint32_t * index, unsigned long n_frames) {
+
+	char * dir;
+	char * file;
+	GByteArray * buf;
+	mpeg_index_header_t hdr;
+	GError * error = NULL;
+	uint32_t offset;
+	unsigned long k;
+
+	dir = g_strdup_printf("%s/mp3index", options.confdir);
+	if (g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR) != 0) {
+		fprintf(stderr, "mpeg_index_save: unable to create %s\n", dir);
+		g_free(dir);
+		return;
+	}
+	g_free(dir);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MPEG_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.size = pd->mpeg_stat.st_size;
+	hdr.mtime = pd->mpeg_stat.st_mtime;
+	hdr.start_byteoffset = pd->mp3info.start_byteoffset;
+	hdr.frame_samples = pd->mp3info.frame_samples;
+	hdr.n_frames = n_frames;
+	hdr.path_len = strlen(path);
+
+	buf = g_byte_array_sized_new(sizeof(hdr) + hdr.path_len + 2 * n_frames);
+	g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+	g_byte_array_append(buf, (guint8 *)path, hdr.path_len);
+
+	offset = hdr.start_byteoffset;
+	for (k = 0; k < n_frames; k++) {
+
+		guint32 d = index[k] - offset;
+
+		if (d < 0xffff) {
+			guint16 d16 = d;
+			g_byte_array_append(buf, (guint8 *)&d16, sizeof(d16));
+		} else {
+			guint16 esc = 0xffff;
+			g_byte_array_append(buf, (guint8 *)&esc, sizeof(esc));
+			g_byte_array_append(buf, (guint8 *)&d, sizeof(d));
+		}
+		offset = index[k];
+	}
+
+	file = mpeg_index_cache_file(path);
+	if (!g_file_set_contents(file, (gchar *)buf->data, buf->len, &error)) {
+		fprintf(stderr, "mpeg_index_save: %s\n", error->message);
+		g_error_free(error);
+	}
+	g_free(file);
+	g_byte_array_free(buf, TRUE);
+}
+
+/* Walk the mmap'ed file from frame to frame; returns NULL if there are
+   no frames or the builder was cancelled. */
+static uint32_t *
+mpeg_index_scan(mpeg_pdata_t * pd, unsigned long * n_frames) {
 
-	mpeg_pdata_t * pd = (mpeg_pdata_t *) args;
-	int cnt = 0;
-	int table_index = 0;
-	long long sample_offset = 0;
 	char * bytes = (char *)pd->fdm;
-	long i;
-	int div;
-	long last = 0, last_but_1 = 0;
 	long limit = pd->filesize-4;
-
-	pd->builder_thread_running = 1;
+	uint32_t * index;
+	unsigned long size;
+	unsigned long cnt = 0;
+	long i;
 
 	if (pd->mp3info.is_vbr) {
-		div = pd->mp3info.frame_count / 100;
+		size = pd->mp3info.frame_count;
 	} else {
-		unsigned long frame_count = (pd->filesize - pd->mp3info.start_byteoffset)
-			/ pd->mp3info.frame_size;
-		div = frame_count / 100;
+		size = (pd->filesize - pd->mp3info.start_byteoffset)
+			/ (pd->mp3info.frame_size > 0 ? pd->mp3info.frame_size : 1024);
 	}
+	size += 64;
 
-	if (div < 1) {
-#ifdef MPEG_DEBUG
-		printf("track is too short, not building seek table\n");
-#endif /* MPEG_DEBUG */
-		AQUALUNG_THREAD_DETACH()
+	if ((index = (uint32_t *)malloc(size * sizeof(uint32_t))) == NULL) {
+		fprintf(stderr, "mpeg_index_scan: malloc error\n");
 		return NULL;
 	}
 
-#ifdef MPEG_DEBUG
-	printf("building seek table, div = %d\n", div);
-#endif /* MPEG_DEBUG */
-
-
 	/* look for id3v1 tag at the end of file */
 	if (pd->filesize >= 128 + 4) {
 		if ((bytes[pd->filesize-128] == 'T') &&
@@ -733,7 +888,6 @@ build_seek_table_thread(void * args) {
 		}
 	}
 
-
 	for (i = pd->mp3info.start_byteoffset; i < limit;) {
 		long header = BYTES2INT(bytes[i], bytes[i+1], bytes[i+2], bytes[i+3]);
 		mp3info_t mp3info;
@@ -745,27 +899,23 @@ build_seek_table_thread(void * args) {
 			    (mp3info.channel_mode == pd->mp3info.channel_mode) &&
 			    (mp3info.frequency == pd->mp3info.frequency)) {
 
-				last_but_1 = last;
-				last = i;
-
-				if ((cnt % div == 0) && (table_index < 100)) {
-#ifdef MPEG_DEBUG
-					printf("idx %2d | offset %8ld | sample %9lld\n",
-					       table_index, i, sample_offset);
-#endif /* MPEG_DEBUG */
-					pd->seek_table[table_index].frame = cnt;
-					pd->seek_table[table_index].sample = sample_offset;
-					pd->seek_table[table_index].offset = i;
-					++table_index;
+				if (cnt == size) {
+					uint32_t * p;
+					size *= 2;
+					if ((p = (uint32_t *)realloc(index, size * sizeof(uint32_t))) == NULL) {
+						fprintf(stderr, "mpeg_index_scan: realloc error\n");
+						free(index);
+						return NULL;
+					}
+					index = p;
 				}
+				index[cnt++] = i;
 
-				sample_offset += mp3info.frame_samples;
 				if (mp3info.frame_size == 0) {
 					i += pd->mp3info.frame_size;
 				} else {
 					i += mp3info.frame_size;
 				}
-				++cnt;
 			} else {
 				++i;
 			}
@@ -778,50 +928,71 @@ build_seek_table_thread(void * args) {
 #ifdef MPEG_DEBUG
 			printf("seek table builder thread cancelled, exiting.\n");
 #endif /* MPEG_DEBUG */
-			AQUALUNG_THREAD_DETACH()
+			free(index);
 			return NULL;
 		}
 	}
 
-	if (table_index > 0 && table_index < 100) {
-		int j;
-		for (j = table_index; j < 100; j++) {
-			pd->seek_table[j].frame = pd->seek_table[table_index-1].frame;
-			pd->seek_table[j].sample = pd->seek_table[table_index-1].sample;
-			pd->seek_table[j].offset = pd->seek_table[table_index-1].offset;
-		}
+	if (cnt == 0) {
+		free(index);
+		return NULL;
 	}
 
-#ifdef MPEG_DEBUG
-	{
-		i = last;
-		long header = BYTES2INT(bytes[i], bytes[i+1], bytes[i+2], bytes[i+3]);
-		mp3info_t mp3info;
-		mp3headerinfo(&mp3info, header);
-		printf("last frame position = %ld\n", limit + 4 - i);
-		printf("last frame length = %d samp = %d\n",
-		       mp3info.frame_size, mp3info.frame_samples);
+	*n_frames = cnt;
+	return index;
+}
+
+
+void *
+build_seek_table_thread(void * args) {
+
+	decoder_t * dec = (decoder_t *)args;
+	mpeg_pdata_t * pd = (mpeg_pdata_t *)dec->pdata;
+	char * filename = dec->fdec->filename;
+	uint32_t * index = NULL;
+	unsigned long n_frames = 0;
+
+	/* offsets are kept in 32 bits */
+	if (pd->filesize > UINT32_MAX) {
+		pd->builder_thread_running = 0;
+		return NULL;
 	}
-#endif /* MPEG_DEBUG */
 
-	pd->last_frames[1] = last_but_1;
-	pd->last_frames[0] = last;
+	if ((index = mpeg_index_load(pd, filename, &n_frames)) == NULL) {
+		if ((index = mpeg_index_scan(pd, &n_frames)) == NULL) {
+			pd->builder_thread_running = 0;
+			return NULL;
+		}
+		if (n_frames >= MPEG_INDEX_CACHE_MIN_FRAMES) {
+			mpeg_index_save(pd, filename, index, n_frames);
+		}
+	}
+
+	AQUALUNG_MUTEX_LOCK(pd->frame_index_mutex)
+	pd->frame_index = index;
+	pd->frame_index_len = n_frames;
+	AQUALUNG_MUTEX_UNLOCK(pd->frame_index_mutex)
+
+	pd->last_frames[1] = (n_frames > 1) ? (long)index[n_frames-2] : -1;
+	pd->last_frames[0] = index[n_frames-1];
 
 #ifdef MPEG_DEBUG
-	printf("seek table builder thread finished, cnt = %d\n", cnt);
+	printf("seek table builder thread finished, n_frames = %lu\n", n_frames);
 	printf("last_frames[1] = %ld\n", pd->last_frames[1]);
 	printf("last_frames[0] = %ld\n", pd->last_frames[0]);
 #endif /* MPEG_DEBUG */
 	pd->builder_thread_running = 0;
-	AQUALUNG_THREAD_DETACH()
 	return NULL;
 }
 
 
 void
-build_seek_table(mpeg_pdata_t * pd) {
+build_seek_table(decoder_t * dec) {
+
+	mpeg_pdata_t * pd = (mpeg_pdata_t *)dec->pdata;
 
-	AQUALUNG_THREAD_CREATE(pd->seek_builder_id, NULL, build_seek_table_thread, pd)
+	pd->builder_thread_running = 1;
+	AQUALUNG_THREAD_CREATE(pd->seek_builder_id, NULL, build_seek_table_thread, dec)
 }
 
 
@@ -930,8 +1101,7 @@ mpeg_output(void * data, struct mad_header const * header, struct mad_pcm * pcm)
 
 	int i = 0, j;
 	unsigned long scale = 322122547; /* (1 << 28) * 1.2 */
-        int buf[2];
-        float fbuf[2];
+	const int * planes[2];
 
 	int pad = pd->mp3info.enc_padding;
 
@@ -980,18 +1150,18 @@ mpeg_output(void * data, struct mad_header const * header, struct mad_pcm * pcm)
 		}
 	}
 
-        for (; i < end_count; i++) {
-                for (j = 0; j < pd->channels; j++) {
-                        buf[j] = pd->error ? 0 : *(pcm->samples[j] + i);
-                        fbuf[j] = (double)buf[j] * fdec->voladj_lin / scale;
-                }
-		if (fdec->is_stream && pcm->channels == 1) {
-			fbuf[1] = fbuf[0];
-		}
-                if (rb_write_space(pd->rb) >= pd->channels * sample_size) {
-                        rb_write(pd->rb, (char *)fbuf, pd->channels * sample_size);
-		}
-        }
+	for (j = 0; j < pd->channels; j++) {
+		planes[j] = (const int *)pcm->samples[j];
+	}
+	if (fdec->is_stream && pcm->channels == 1) {
+		planes[1] = planes[0];
+	}
+
+	if (i < end_count) {
+		/* a frame with errors is output as silence */
+		file_decoder_rb_write_planar_s32(pd->rb, planes, pd->channels, i, end_count - i,
+						 pd->error ? 0.0f : fdec->voladj_lin / scale);
+	}
 	pd->frame_counter++;
         pd->error = 0;
 
@@ -1097,6 +1267,10 @@ mpeg_decoder_init(file_decoder_t * fdec) {
                 return NULL;
         }
 
+#ifndef HAVE_LIBPTHREAD
+	((mpeg_pdata_t *)dec->pdata)->frame_index_mutex = g_mutex_new();
+#endif /* !HAVE_LIBPTHREAD */
+
 	dec->init = mpeg_decoder_init;
 	dec->destroy = mpeg_decoder_destroy;
 	dec->open = mpeg_decoder_open;
@@ -1120,6 +1294,10 @@ mpeg_decoder_destroy(decoder_t * dec) {
 		fdec->is_stream = 0;
 	}
 
+#ifndef HAVE_LIBPTHREAD
+	g_mutex_free(pd->frame_index_mutex);
+#endif /* !HAVE_LIBPTHREAD */
+
 	free(dec->pdata);
 	free(dec);
 }
@@ -1132,10 +1310,8 @@ mpeg_decoder_finish_open(decoder_t * dec) {
 	file_decoder_t * fdec = dec->fdec;
 	int i;
 
-	/* data init (so when seeking we know if an entry is not yet filled in) */
-	for (i = 0; i < 100; i++) {
-		pd->seek_table[i].frame = -1;
-	}
+	pd->frame_index = NULL;
+	pd->frame_index_len = 0;
 	pd->builder_thread_running = 0;
 
 	for (i = 0; i < 2; i++) {
@@ -1145,7 +1321,9 @@ mpeg_decoder_finish_open(decoder_t * dec) {
 	pd->error = 0;
 	pd->is_eos = 0;
 	pd->seek_table_built = 0;
-	pd->rb = rb_create(pd->channels * sample_size * RB_MAD_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->channels * sample_size * RB_MAD_SIZE);
+	}
 	fdec->fileinfo.channels = pd->channels;
 	fdec->fileinfo.sample_rate = pd->SR;
 	fdec->file_lib = MAD_LIB;
@@ -1207,6 +1385,10 @@ mpeg_decoder_finish_open(decoder_t * dec) {
 	fdec->fileinfo.total_samples = pd->total_samples_est;
 	fdec->fileinfo.bps = pd->bitrate;
 
+	if (fdec->info_only) {
+		return DECODER_OPEN_SUCCESS;
+	}
+
 	/* setup playback */
 	mad_stream_init(&(pd->mpeg_stream));
 	mad_frame_init(&(pd->mpeg_frame));
@@ -1356,12 +1538,15 @@ mpeg_decoder_open(decoder_t * dec, char * filename) {
 	}
 
 	if (pd->mp3info.enc_delay > 0) {
-		pd->delay_frames = pd->mp3info.enc_delay + 528 + pd->mp3info.frame_samples;
+		pd->start_delay = pd->mp3info.enc_delay + 528 + pd->mp3info.frame_samples;
 	} else {
-		pd->delay_frames = 0;
+		pd->start_delay = 0;
 	}
+	pd->delay_frames = pd->start_delay;
 
-	pd->fd = open(filename, O_RDONLY);
+	if (!fdec->info_only) {
+		pd->fd = open(filename, O_RDONLY);
+	}
 
 	return mpeg_decoder_finish_open(dec);
 }
@@ -1415,8 +1600,13 @@ mpeg_decoder_close(decoder_t * dec) {
 	mpeg_pdata_t * pd = (mpeg_pdata_t *)dec->pdata;
 	file_decoder_t * fdec = dec->fdec;
 
+	if (fdec->info_only) {
+		/* nothing but the header was read */
+		return;
+	}
+
 	/* take care of seek table builder thread, if there is any */
-	if (pd->builder_thread_running) {
+	if (pd->seek_table_built) {
 		pd->builder_thread_running = 0;
 #ifdef MPEG_DEBUG
 		printf("joining seek table builder thread\n");
@@ -1439,6 +1629,9 @@ mpeg_decoder_close(decoder_t * dec) {
 		close(pd->fd);
 	}
 	rb_free(pd->rb);
+	free(pd->frame_index);
+	pd->frame_index = NULL;
+	pd->frame_index_len = 0;
 #ifdef MPEG_DEBUG
 	printf("mpeg_decoder_close successful\n");
 #endif /* MPEG_DEBUG */
@@ -1461,7 +1654,7 @@ mpeg_decoder_read(decoder_t * dec, float * dest, int num) {
 		/* read mmap'ed file and build seek table in background thread.
 		   we do this upon the first read, so it doesn't start when we open
 		   a mass of files, but don't read any audio (metadata retrieval, etc) */
-		build_seek_table(pd);
+		build_seek_table(dec);
 		pd->seek_table_built = 1;
 	}
 
@@ -1488,94 +1681,79 @@ mpeg_decoder_seek(decoder_t * dec, unsigned long long seek_to_pos) {
 
 	mpeg_pdata_t * pd = (mpeg_pdata_t *)dec->pdata;
 	file_decoder_t * fdec = dec->fdec;
-	char * bytes = (char *)pd->fdm;
-	long header;
-	mp3info_t mp3info;
 	char flush_dest;
-	int i;
+	unsigned long long target;
+	unsigned long k, k0;
 	unsigned long offset;
-	unsigned long long sample;
-#ifdef MPEG_DEBUG
-	int cnt = 0;
-#endif /* MPEG_DEBUG */
 
 	if (seek_to_pos < pd->mp3info.frame_samples) {
 		pd->frame_counter = 0;
+		pd->delay_frames = pd->start_delay;
 		pd->mpeg_stream.next_frame = pd->mpeg_stream.buffer;
 		fdec->samples_left = fdec->fileinfo.total_samples;
 		goto flush_decoder_rb;
 	}
 
-	/* search for closest preceding entry in seek table */
-	for (i = 0; i < 99; i++) {
-		if (pd->seek_table[i].frame == -1) {
-			/* uninitialized seek table (to the desired position, at least)
-			   so we fall back on conventional bitstream seeking */
+	AQUALUNG_MUTEX_LOCK(pd->frame_index_mutex)
+	if (pd->frame_index == NULL) {
+		AQUALUNG_MUTEX_UNLOCK(pd->frame_index_mutex)
+		/* frame index not (yet) available,
+		   so we fall back on conventional bitstream seeking */
 #ifdef MPEG_DEBUG
-			printf("seek table not yet ready, seeking bitstream.\n");
+		printf("frame index not yet ready, seeking bitstream.\n");
 #endif /* MPEG_DEBUG */
-			pd->mpeg_stream.next_frame = pd->mpeg_stream.buffer;
-			mad_stream_sync(&(pd->mpeg_stream));
-			mad_stream_skip(&(pd->mpeg_stream),
-					(pd->filesize - pd->mp3info.start_byteoffset)
-					* (double)seek_to_pos / pd->total_samples_est);
-			mad_stream_sync(&(pd->mpeg_stream));
-
-			pd->is_eos = decode_mpeg(dec);
-			/* report the real position of the decoder */
-			fdec->samples_left = fdec->fileinfo.total_samples -
-				(pd->mpeg_stream.next_frame - pd->mpeg_stream.buffer)
-				/ pd->bitrate * 8 * pd->SR;
+		pd->mpeg_stream.next_frame = pd->mpeg_stream.buffer;
+		mad_stream_sync(&(pd->mpeg_stream));
+		mad_stream_skip(&(pd->mpeg_stream),
+				(pd->filesize - pd->mp3info.start_byteoffset)
+				* (double)seek_to_pos / pd->total_samples_est);
+		mad_stream_sync(&(pd->mpeg_stream));
+		pd->delay_frames = 0;
 
-			goto flush_decoder_rb;
-		}
+		pd->is_eos = decode_mpeg(dec);
+		/* report the real position of the decoder */
+		fdec->samples_left = fdec->fileinfo.total_samples -
+			(pd->mpeg_stream.next_frame - pd->mpeg_stream.buffer)
+			/ pd->bitrate * 8 * pd->SR;
 
-		if (pd->seek_table[i+1].sample > seek_to_pos)
-			break;
+		goto flush_decoder_rb;
 	}
 
-	offset = pd->seek_table[i].offset;
-	sample = pd->seek_table[i].sample;
-#ifdef MPEG_DEBUG
-	printf("seek table: byte_offset = %d  sample_pos = %d\n", offset, sample);
-#endif /* MPEG_DEBUG */
+	/* the index starts at the first frame of the file (the Xing/LAME
+	   frame, if any), so the encoder delay skipped on open has to be
+	   skipped here as well */
+	target = seek_to_pos + pd->start_delay;
+	k = target / pd->mp3info.frame_samples;
+	if (k >= pd->frame_index_len) {
+		k = pd->frame_index_len - 1;
+	}
 
-	do {
-		if (offset > pd->filesize - 4) {
-			offset = pd->filesize-4;
-			break;
-		}
-		header = BYTES2INT(bytes[offset], bytes[offset+1], bytes[offset+2], bytes[offset+3]);
-		if (is_mp3frameheader(header, 1)) {
-			mp3headerinfo(&mp3info, header);
-			if ((mp3info.layer == pd->mp3info.layer) &&
-			    (mp3info.version == pd->mp3info.version) &&
-			    (mp3info.frequency == pd->mp3info.frequency)) {
+	/* A Layer III frame may take its data from the frames before it
+	   (bit reservoir), and its synthesis overlaps with the previous
+	   frame: start decoding a little earlier and drop the output up
+	   to the requested sample. */
+	k0 = k;
+	while (k0 > 0 && pd->frame_index[k] - pd->frame_index[k0] < MPEG_SEEK_PREROLL_BYTES) {
+		--k0;
+	}
+	if (k0 > 0) {
+		--k0;
+	}
+	offset = pd->frame_index[k0];
+	AQUALUNG_MUTEX_UNLOCK(pd->frame_index_mutex)
 
-				sample += mp3info.frame_samples;
-				offset += mp3info.frame_size;
 #ifdef MPEG_DEBUG
-				cnt += mp3info.frame_size;
-#endif /* MPEG_DEBUG */
-			} else {
-				++offset;
-#ifdef MPEG_DEBUG
-				++cnt;
-#endif /* MPEG_DEBUG */
-			}
-		} else {
-			++offset;
-#ifdef MPEG_DEBUG
-			++cnt;
-#endif /* MPEG_DEBUG */
-		}
-	} while (sample + mp3info.frame_samples < seek_to_pos);
-#ifdef MPEG_DEBUG
-	printf("stream nudged by %d bytes\n", cnt);
+	printf("frame index: frame %lu at byte %lu, preroll from frame %lu\n", k, offset, k0);
 #endif /* MPEG_DEBUG */
 
 	pd->mpeg_stream.next_frame = pd->mpeg_stream.buffer - pd->mp3info.start_byteoffset + offset;
-	fdec->samples_left = fdec->fileinfo.total_samples - sample;
+	pd->delay_frames = target - (unsigned long long)k0 * pd->mp3info.frame_samples;
+	pd->frame_counter = k0;
+	if (seek_to_pos < fdec->fileinfo.total_samples) {
+		fdec->samples_left = fdec->fileinfo.total_samples - seek_to_pos;
+	} else {
+		fdec->samples_left = 0;
+	}
 
  flush_decoder_rb:
 	/* empty mpeg decoder ringbuffer */
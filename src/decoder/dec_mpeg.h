@@ -22,6 +22,7 @@
 #define AQUALUNG_DEC_MPEG_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <mad.h>
 
@@ -101,11 +102,13 @@ typedef struct {
 unsigned long find_next_frame(int fd, long *offset, long max_offset,
                               unsigned long last_header, int is_ubr_allowed);
 
-typedef struct {
-	int frame; /* number of mpeg frame */
-	unsigned long long sample; /* number of audio samples since beginning of file */
-	unsigned long offset; /* byte offset from beginning of file */
-} mpeg_seek_table_t;
+/* Frame indices of files with at least this many frames are kept in
+   the on-disk cache (about 13 minutes at 44.1 kHz) */
+#define MPEG_INDEX_CACHE_MIN_FRAMES 30000
+
+/* Decoding resumes this many bytes (and one frame) before the target
+   frame of a seek; Layer III frames may reach back 511 bytes. */
+#define MPEG_SEEK_PREROLL_BYTES 1024
 
 typedef struct _mpeg_pdata_t {
         struct mad_decoder mpeg_decoder;
@@ -120,6 +123,7 @@ typedef struct _mpeg_pdata_t {
         long long int filesize;
 	long skip_bytes;
        	long delay_frames;
+	long start_delay; /* delay_frames at the start of the file */
         int fd;
         void * fdm;
         unsigned long total_samples_est;
@@ -128,7 +132,12 @@ typedef struct _mpeg_pdata_t {
 	int seek_table_built;
 	AQUALUNG_THREAD_DECLARE(seek_builder_id)
         int builder_thread_running;
-	mpeg_seek_table_t seek_table[100];
+	/* Byte offset of every frame from the first valid one on; frame k
+	   starts at sample k * mp3info.frame_samples. Set up by the seek
+	   table builder thread, protected by frame_index_mutex. */
+	uint32_t * frame_index;
+	unsigned long frame_index_len;
+	AQUALUNG_MUTEX_DECLARE(frame_index_mutex)
 	unsigned long frame_counter;
 	long last_frames[2]; /* [0] is the last frame's byte offset, [1] the last-but-one */
 
@@ -98,7 +98,7 @@ sndfile_decoder_open(decoder_t * dec, char * filename) {
 	}
 #endif /* HAVE_SNDFILE_1_0_18 */
 
-	if ((pd->sf_info.channels != 1) && (pd->sf_info.channels != 2)) {
+	if ((pd->sf_info.channels < 1) || (pd->sf_info.channels > FILE_DECODER_MAX_CHANNELS)) {
 		fprintf(stderr,
 			"sndfile_decoder_open: sndfile with %d channels is unsupported\n",
 			pd->sf_info.channels);
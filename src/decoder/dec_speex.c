@@ -254,17 +254,20 @@ speex_dec_open(decoder_t * dec, char * filename) {
 		return DECODER_OPEN_FERROR;
 	}
 	
-	pd->packetno = 0;
-	pd->exploring = 0;
-	pd->error = 0;
-        pd->oggz = oggz_open(filename, OGGZ_READ | OGGZ_AUTO);
-	oggz_set_read_callback(pd->oggz, -1, read_ogg_packet, dec);
-	speex_bits_init(&(pd->bits));
-	pd->decoder = speex_decoder_init(pd->mode);
-	speex_decoder_ctl(pd->decoder, SPEEX_SET_ENH, &enh);
-
-	pd->is_eos = 0;
-	pd->rb = rb_create(pd->channels * sample_size * RB_SPEEX_SIZE);
+	if (!fdec->info_only) {
+		pd->packetno = 0;
+		pd->exploring = 0;
+		pd->error = 0;
+		pd->oggz = oggz_open(filename, OGGZ_READ | OGGZ_AUTO);
+		oggz_set_read_callback(pd->oggz, -1, read_ogg_packet, dec);
+		speex_bits_init(&(pd->bits));
+		pd->decoder = speex_decoder_init(pd->mode);
+		speex_decoder_ctl(pd->decoder, SPEEX_SET_ENH, &enh);
+
+		pd->is_eos = 0;
+		pd->rb = rb_create(pd->channels * sample_size * RB_SPEEX_SIZE);
+	}
+
 	fdec->fileinfo.channels = pd->channels;
 	fdec->fileinfo.sample_rate = pd->sample_rate;
 	length_in_samples = pd->granulepos + pd->nframes - 1;
@@ -288,6 +291,10 @@ speex_dec_close(decoder_t * dec) {
 
 	speex_pdata_t * pd = (speex_pdata_t *)dec->pdata;
 
+	if (dec->fdec->info_only) {
+		return;
+	}
+
 	oggz_close(pd->oggz);
 	speex_bits_destroy(&(pd->bits));
         speex_decoder_destroy(pd->decoder);
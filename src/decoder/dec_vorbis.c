@@ -112,16 +112,19 @@ decode_vorbis(decoder_t * dec) {
 	vorbis_pdata_t * pd = (vorbis_pdata_t *)dec->pdata;
 	file_decoder_t * fdec = dec->fdec;
 
-	int i;
-	long bytes_read;
-        float fbuffer[VORBIS_BUFSIZE/2];
-        char buffer[VORBIS_BUFSIZE];
+	int j;
+	long n_read;
+	float ** pcm;
+	const float * planes[2];
+	vorbis_info * vi;
 	int current_section;
 
 
-	bytes_read = ov_read(&(pd->vf), buffer, VORBIS_BUFSIZE, bigendianp(), 2, 1, &current_section);
+	/* as many frames as ov_read() used to return in VORBIS_BUFSIZE bytes */
+	n_read = ov_read_float(&(pd->vf), &pcm, VORBIS_BUFSIZE / (2 * pd->vi->channels),
+			       &current_section);
 
-	switch (bytes_read) {
+	switch (n_read) {
 	case 0:
 		/* end of file */
                 return 1;
@@ -132,21 +135,23 @@ decode_vorbis(decoder_t * dec) {
 			vorbis_decoder_send_metadata(dec);
 			break;
 		} else {
-			printf("dec_vorbis.c/decode_vorbis(): ov_read() returned OV_HOLE\n");
+			printf("dec_vorbis.c/decode_vorbis(): ov_read_float() returned OV_HOLE\n");
 			printf("This indicates an interruption in the Vorbis data (one of:\n");
 			printf("garbage between Ogg pages, loss of sync, or corrupt page).\n");
 		}
 		break;
 	case OV_EBADLINK:
-		printf("dec_vorbis.c/decode_vorbis(): ov_read() returned OV_EBADLINK\n");
+		printf("dec_vorbis.c/decode_vorbis(): ov_read_float() returned OV_EBADLINK\n");
 		printf("An invalid stream section was supplied to libvorbisfile.\n");
 		break;
 	default:
-                for (i = 0; i < bytes_read/2; i++) {
-                        fbuffer[i] = *((short *)(buffer + 2*i)) * fdec->voladj_lin / 32768.f;
+		/* a chained stream may switch to a link with fewer channels */
+		vi = ov_info(&(pd->vf), current_section);
+		for (j = 0; j < pd->vi->channels; j++) {
+			planes[j] = pcm[(vi != NULL && j < vi->channels) ? j : 0];
 		}
-                rb_write(pd->rb, (char *)fbuffer,
-                                      bytes_read/2 * sample_size);
+		file_decoder_rb_write_planar_float(pd->rb, planes, pd->vi->channels,
+						   0, n_read, fdec->voladj_lin);
 		break;
 	}
 	return 0;
@@ -274,7 +279,9 @@ vorbis_decoder_finish_open(decoder_t * dec) {
 	}
 
 	pd->is_eos = 0;
-	pd->rb = rb_create(pd->vi->channels * sample_size * RB_VORBIS_SIZE);
+	if (!fdec->info_only) {
+		pd->rb = rb_create(pd->vi->channels * sample_size * RB_VORBIS_SIZE);
+	}
 	fdec->fileinfo.channels = pd->vi->channels;
 	fdec->fileinfo.sample_rate = pd->vi->rate;
 	if (fdec->is_stream && pd->session->type != HTTPC_SESSION_NORMAL) {
@@ -359,7 +366,9 @@ vorbis_decoder_close(decoder_t * dec) {
 	vorbis_pdata_t * pd = (vorbis_pdata_t *)dec->pdata;
 
 	ov_clear(&(pd->vf));
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
@@ -44,9 +44,6 @@ decode_wavpack(decoder_t * dec) {
 	wavpack_pdata_t * pd = (wavpack_pdata_t *)dec->pdata;
 
 	int32_t buffer[WAVPACK_BUFSIZE];
-	uint i, j;
-
-	float fval[fdec->fileinfo.channels];
 
 	pd->last_decoded_samples = WavpackUnpackSamples(pd->wpc, buffer,
 							WAVPACK_BUFSIZE / fdec->fileinfo.channels);
@@ -73,19 +70,9 @@ decode_wavpack(decoder_t * dec) {
 	if (pd->last_decoded_samples == 0)
 		return 1;
 
-	for (i = 0; i < pd->last_decoded_samples * fdec->fileinfo.channels; i += fdec->fileinfo.channels) {
-		for (j = 0; j < fdec->fileinfo.channels; j++) {
-
-			fval[j] = buffer[i+j] * fdec->voladj_lin / pd->scale_factor_float;
-
-			if (fval[j] < -1.0f) {
-				fval[j] = -1.0f;
-			} else if (fval[j] > 1.0f) {
-				fval[j] = 1.0f;
-			}
-		}
-		rb_write(pd->rb, (char *)fval, fdec->fileinfo.channels * sample_size);
-	}
+	file_decoder_rb_write_s32(pd->rb, (const int *)buffer, fdec->fileinfo.channels,
+				  pd->last_decoded_samples,
+				  fdec->voladj_lin / pd->scale_factor_float);
 
 	return 0;
 }
@@ -140,7 +127,10 @@ wavpack_decoder_open(decoder_t * dec, char * filename) {
 	/* Normalize is for floating point data only, it gets scaled to -1.0 and 1.0,
 	   not replaygain related or anything */
 	/* Opening hybrid correction file if possible */
-	pd->flags = OPEN_2CH_MAX | OPEN_TAGS | OPEN_NORMALIZE | OPEN_WVC;
+	pd->flags = OPEN_2CH_MAX | OPEN_TAGS | OPEN_NORMALIZE;
+	if (!fdec->info_only) {
+		pd->flags |= OPEN_WVC;
+	}
 
 	strcpy(pd->error, "No Error");
 	pd->wpc = WavpackOpenFileInput(filename, pd->error, pd->flags, 0);
@@ -154,7 +144,9 @@ wavpack_decoder_open(decoder_t * dec, char * filename) {
 					* fdec->fileinfo.channels;
 		pd->bits_per_sample = WavpackGetBitsPerSample(pd->wpc);
 
-		pd->rb = rb_create(fdec->fileinfo.channels * sample_size * RB_WAVPACK_SIZE);
+		if (!fdec->info_only) {
+			pd->rb = rb_create(fdec->fileinfo.channels * sample_size * RB_WAVPACK_SIZE);
+		}
 
 		pd->end_of_file = 0;
 
@@ -193,7 +185,9 @@ wavpack_decoder_close(decoder_t * dec) {
 	wavpack_pdata_t * pd = (wavpack_pdata_t *)dec->pdata;
 
 	WavpackCloseFile(pd->wpc);
-	rb_free(pd->rb);
+	if (pd->rb != NULL) {
+		rb_free(pd->rb);
+	}
 }
 
 
@@ -24,10 +24,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
 
 #include "../httpc.h"
 #include "../metadata.h"
 #include "../options.h"
+#include "../sample_conv.h"
 #include "dec_null.h"
 #ifdef HAVE_CDDA
 #include "dec_cdda.h"
@@ -212,12 +216,9 @@ file_decoder_delete(file_decoder_t * fdec) {
 int
 file_decoder_finalize_open(file_decoder_t * fdec, decoder_t * dec, char * filename) {
 
-	if (fdec->fileinfo.channels == 1) {
-		fdec->fileinfo.is_mono = 1;
-		goto ok_open;
-
-	} else if (fdec->fileinfo.channels == 2) {
-		fdec->fileinfo.is_mono = 0;
+	if ((fdec->fileinfo.channels >= 1) &&
+	    (fdec->fileinfo.channels <= FILE_DECODER_MAX_CHANNELS)) {
+		fdec->fileinfo.is_mono = (fdec->fileinfo.channels == 1);
 		goto ok_open;
 
 	} else {
@@ -319,12 +320,214 @@ stream_decoder_open(file_decoder_t * fdec, char * URL) {
 }
 
 
+/* Guessing the decoder from the contents of the file. file_decoder_open()
+   tries the decoder picked here first, and all the others in the order
+   of decoder_init_v[] if it fails. */
+
+#define SNIFF_SIZE 4096
+
+#ifdef HAVE_MOD
+extern char * valid_extensions_mod[];
+#endif /* HAVE_MOD */
+
+typedef struct {
+	char * ext;
+	decoder_init_t * init;
+} ext_hint_t;
+
+/* used when the first bytes of the file give no clue */
+static ext_hint_t ext_hints[] = {
+#ifdef HAVE_SNDFILE
+	{ "wav", sndfile_decoder_init },
+	{ "aiff", sndfile_decoder_init },
+	{ "aif", sndfile_decoder_init },
+	{ "au", sndfile_decoder_init },
+#endif /* HAVE_SNDFILE */
+#ifdef HAVE_FLAC
+	{ "flac", flac_decoder_init },
+#endif /* HAVE_FLAC */
+#ifdef HAVE_VORBIS
+	{ "ogg", vorbis_decoder_init },
+	{ "oga", vorbis_decoder_init },
+#endif /* HAVE_VORBIS */
+#ifdef HAVE_SPEEX
+	{ "spx", speex_dec_init },
+#endif /* HAVE_SPEEX */
+#ifdef HAVE_MPC
+	{ "mpc", mpc_decoder_init_func },
+#endif /* HAVE_MPC */
+#ifdef HAVE_MAC
+	{ "ape", mac_decoder_init },
+#endif /* HAVE_MAC */
+#ifdef HAVE_MPEG
+	{ "mp3", mpeg_decoder_init },
+	{ "mp2", mpeg_decoder_init },
+	{ "mpa", mpeg_decoder_init },
+#endif /* HAVE_MPEG */
+#ifdef HAVE_WAVPACK
+	{ "wv", wavpack_decoder_init },
+#endif /* HAVE_WAVPACK */
+#ifdef HAVE_LAVC
+	{ "m4a", lavc_decoder_init },
+	{ "aac", lavc_decoder_init },
+	{ "wma", lavc_decoder_init },
+	{ "ac3", lavc_decoder_init },
+#endif /* HAVE_LAVC */
+	{ NULL, NULL }
+};
+
+
+static int
+sniff_memmem(unsigned char * buf, int len, const char * needle, int n) {
+
+	int i;
+
+	for (i = 0; i + n <= len; i++) {
+		if (memcmp(buf + i, needle, n) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* a plausible MPEG audio frame header (excludes AAC ADTS) */
+static int
+sniff_mpeg_header(unsigned char * b) {
+
+	return (b[0] == 0xff) && ((b[1] & 0xe0) == 0xe0) &&
+		((b[1] & 0x18) != 0x08) && /* version */
+		((b[1] & 0x06) != 0x00) && /* layer */
+		((b[2] & 0xf0) != 0xf0) && /* bitrate */
+		((b[2] & 0x0c) != 0x0c);   /* sample rate */
+}
+
+static decoder_init_t *
+sniff_magic(unsigned char * b, int len) {
+
+	if (len < 12) {
+		return NULL;
+	}
+
+#ifdef HAVE_SNDFILE
+	if ((memcmp(b, "RIFF", 4) == 0 || memcmp(b, "RIFX", 4) == 0) &&
+	    memcmp(b + 8, "WAVE", 4) == 0) {
+		return sndfile_decoder_init;
+	}
+	if (memcmp(b, "FORM", 4) == 0 &&
+	    (memcmp(b + 8, "AIFF", 4) == 0 || memcmp(b + 8, "AIFC", 4) == 0)) {
+		return sndfile_decoder_init;
+	}
+	if (memcmp(b, ".snd", 4) == 0) {
+		return sndfile_decoder_init;
+	}
+#endif /* HAVE_SNDFILE */
+#ifdef HAVE_FLAC
+	if (memcmp(b, "fLaC", 4) == 0) {
+		return flac_decoder_init;
+	}
+#endif /* HAVE_FLAC */
+	if (memcmp(b, "OggS", 4) == 0) {
+		/* the codec is named in the first packet */
+#ifdef HAVE_VORBIS
+		if (sniff_memmem(b, len, "\001vorbis", 7)) {
+			return vorbis_decoder_init;
+		}
+#endif /* HAVE_VORBIS */
+#ifdef HAVE_SPEEX
+		if (sniff_memmem(b, len, "Speex   ", 8)) {
+			return speex_dec_init;
+		}
+#endif /* HAVE_SPEEX */
+		return NULL;
+	}
+#ifdef HAVE_MPC
+	if (memcmp(b, "MPCK", 4) == 0 || memcmp(b, "MP+", 3) == 0) {
+		return mpc_decoder_init_func;
+	}
+#endif /* HAVE_MPC */
+#ifdef HAVE_MAC
+	if (memcmp(b, "MAC ", 4) == 0) {
+		return mac_decoder_init;
+	}
+#endif /* HAVE_MAC */
+#ifdef HAVE_WAVPACK
+	if (memcmp(b, "wvpk", 4) == 0) {
+		return wavpack_decoder_init;
+	}
+#endif /* HAVE_WAVPACK */
+#ifdef HAVE_MPEG
+	if (sniff_mpeg_header(b)) {
+		return mpeg_decoder_init;
+	}
+#endif /* HAVE_MPEG */
+
+	return NULL;
+}
+
+static decoder_init_t *
+file_decoder_sniff(char * filename) {
+
+	unsigned char buf[SNIFF_SIZE];
+	decoder_init_t * init = NULL;
+	int fd;
+	int len;
+	int i;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		return NULL;
+	}
+
+	len = read(fd, buf, SNIFF_SIZE);
+
+	/* skip an ID3v2 tag, as found in front of MP3 and sometimes FLAC files */
+	if (len >= 10 && memcmp(buf, "ID3", 3) == 0) {
+		off_t skip = 10 + ((buf[6] & 0x7f) << 21) + ((buf[7] & 0x7f) << 14) +
+			((buf[8] & 0x7f) << 7) + (buf[9] & 0x7f);
+		if (buf[5] & 0x10) {
+			skip += 10; /* footer */
+		}
+		len = pread(fd, buf, SNIFF_SIZE, skip);
+#ifdef HAVE_MPEG
+		init = mpeg_decoder_init;
+#endif /* HAVE_MPEG */
+	}
+	close(fd);
+
+	if (len > 0) {
+		decoder_init_t * magic = sniff_magic(buf, len);
+		if (magic != NULL) {
+			return magic;
+		}
+	}
+	if (init != NULL) {
+		/* a tagged file that doesn't start with a known header */
+		return init;
+	}
+
+	for (i = 0; ext_hints[i].ext != NULL; i++) {
+		char * ext[2] = { ext_hints[i].ext, NULL };
+		if (is_valid_extension(ext, filename, 0)) {
+			return ext_hints[i].init;
+		}
+	}
+#ifdef HAVE_MOD
+	if (is_valid_extension(valid_extensions_mod, filename, 1)) {
+		return mod_decoder_init;
+	}
+#endif /* HAVE_MOD */
+
+	return NULL;
+}
+
+
 /* return: 0 is OK, >0 is error */
 int
 file_decoder_open(file_decoder_t * fdec, char * filename) {
 
 	int i, ret;
 	decoder_t * dec;
+	decoder_init_t * preferred;
+	decoder_init_t * init;
 
 	if (filename == NULL) {
 		fprintf(stderr, "Warning: filename == NULL passed to file_decoder_open()\n");
@@ -336,8 +539,18 @@ file_decoder_open(file_decoder_t * fdec, char * filename) {
 	if (httpc_is_url(filename))
 		return stream_decoder_open(fdec, filename);
 
-	for (i = 0; decoder_init_v[i] != NULL; i++) {
-		dec = decoder_init_v[i](fdec);
+	preferred = file_decoder_sniff(filename);
+
+	/* i == -1 stands for the preferred decoder, if any */
+	for (i = (preferred != NULL) ? -1 : 0; i < 0 || decoder_init_v[i] != NULL; i++) {
+		if (i < 0) {
+			init = preferred;
+		} else if (decoder_init_v[i] == preferred) {
+			continue;
+		} else {
+			init = decoder_init_v[i];
+		}
+		dec = init(fdec);
 		if (!dec) {
 			continue;
 		}
@@ -358,16 +571,13 @@ file_decoder_open(file_decoder_t * fdec, char * filename) {
 		break;
 	}
 
-	if (decoder_init_v[i] == NULL) {
+	if (i >= 0 && decoder_init_v[i] == NULL) {
 	        goto no_open;
 	}
 
-	if (fdec->fileinfo.channels == 1) {
-		fdec->fileinfo.is_mono = 1;
-		goto ok_open;
-
-	} else if (fdec->fileinfo.channels == 2) {
-		fdec->fileinfo.is_mono = 0;
+	if ((fdec->fileinfo.channels >= 1) &&
+	    (fdec->fileinfo.channels <= FILE_DECODER_MAX_CHANNELS)) {
+		fdec->fileinfo.is_mono = (fdec->fileinfo.channels == 1);
 		goto ok_open;
 
 	} else {
@@ -390,6 +600,25 @@ file_decoder_open(file_decoder_t * fdec, char * filename) {
 }
 
 
+/* return: 0 is OK, >0 is error */
+int
+file_decoder_probe(file_decoder_t * fdec, char * filename) {
+
+	int ret;
+
+	/* streams are opened the normal way */
+	if (filename != NULL && httpc_is_url(filename)) {
+		return file_decoder_open(fdec, filename);
+	}
+
+	fdec->info_only = 1;
+	if ((ret = file_decoder_open(fdec, filename)) != 0) {
+		fdec->info_only = 0;
+	}
+	return ret;
+}
+
+
 void
 file_decoder_send_metadata(file_decoder_t * fdec) {
 
@@ -431,6 +660,7 @@ file_decoder_close(file_decoder_t * fdec) {
 	fdec->pdec = NULL;
 	fdec->file_open = 0;
 	fdec->file_lib = 0;
+	fdec->info_only = 0;
 	if (fdec->filename != NULL) {
 		free(fdec->filename);
 		fdec->filename = NULL;
@@ -447,6 +677,10 @@ file_decoder_read(file_decoder_t * fdec, float * dest, int num) {
 
 	decoder_t * dec = (decoder_t *)(fdec->pdec);
 
+	if (fdec->info_only) {
+		return 0;
+	}
+
 	return dec->read(dec, dest, num);
 }
 
@@ -456,6 +690,10 @@ file_decoder_seek(file_decoder_t * fdec, unsigned long long seek_to_pos) {
 
 	decoder_t * dec = (decoder_t *)(fdec->pdec);
 
+	if (fdec->info_only) {
+		return;
+	}
+
 	dec->seek(dec, seek_to_pos);
 }
  
@@ -489,8 +727,8 @@ get_file_duration(char * file) {
                 return -1.0f;
         }
 
-        if (file_decoder_open(fdec, file)) {
-                fprintf(stderr, "file_decoder_open() failed on %s\n", file);
+        if (file_decoder_probe(fdec, file)) {
+                fprintf(stderr, "file_decoder_probe() failed on %s\n", file);
 		file_decoder_delete(fdec);
                 return -1.0f;
         }
@@ -503,6 +741,138 @@ get_file_duration(char * file) {
 	return duration;
 }
 
+/* Clamp n to the whole frames that fit into the write space of rb and
+   return the number of samples that go into vec[0]; the rest, if any,
+   go to the start of vec[1]. Samples never straddle the two parts. */
+static int
+rb_write_prepare(rb_t * rb, rb_data_t * vec, int channels, int * n) {
+
+	size_t n_samples;
+	size_t n0;
+
+	rb_get_write_vector(rb, vec);
+
+	n_samples = (vec[0].len + vec[1].len) / sizeof(float);
+	if (*n > n_samples / channels) {
+		*n = n_samples / channels;
+	}
+
+	n0 = vec[0].len / sizeof(float);
+	if (n0 > (size_t)*n * channels) {
+		n0 = (size_t)*n * channels;
+	}
+
+	return n0;
+}
+
+int
+file_decoder_rb_write_planar_s32(rb_t * rb, const int * const * src, int channels,
+				 int offset, int n, float gain) {
+
+	rb_data_t vec[2];
+	int n0 = rb_write_prepare(rb, vec, channels, &n);
+	int f0 = n0 / channels;
+	int split = n0 % channels;
+
+	sample_conv_planar_s32_to_float(src, channels, offset, (float *)vec[0].buf, f0, gain);
+
+	if (f0 < n) {
+		float * dest = (float *)vec[1].buf;
+
+		if (split > 0) {
+			/* this frame wraps around the end of the buffer */
+			float frame[FILE_DECODER_MAX_CHANNELS];
+
+			sample_conv_planar_s32_to_float(src, channels, offset + f0, frame, 1, gain);
+			memcpy(vec[0].buf + f0 * channels * sizeof(float), frame, split * sizeof(float));
+			memcpy(dest, frame + split, (channels - split) * sizeof(float));
+			dest += channels - split;
+			++f0;
+		}
+		sample_conv_planar_s32_to_float(src, channels, offset + f0, dest, n - f0, gain);
+	}
+
+	rb_write_advance(rb, (size_t)n * channels * sizeof(float));
+	return n;
+}
+
+int
+file_decoder_rb_write_planar_float(rb_t * rb, const float * const * src, int channels,
+				   int offset, int n, float gain) {
+
+	rb_data_t vec[2];
+	int n0 = rb_write_prepare(rb, vec, channels, &n);
+	int f0 = n0 / channels;
+	int split = n0 % channels;
+
+	sample_conv_planar_float_gain(src, channels, offset, (float *)vec[0].buf, f0, gain);
+
+	if (f0 < n) {
+		float * dest = (float *)vec[1].buf;
+
+		if (split > 0) {
+			/* this frame wraps around the end of the buffer */
+			float frame[FILE_DECODER_MAX_CHANNELS];
+
+			sample_conv_planar_float_gain(src, channels, offset + f0, frame, 1, gain);
+			memcpy(vec[0].buf + f0 * channels * sizeof(float), frame, split * sizeof(float));
+			memcpy(dest, frame + split, (channels - split) * sizeof(float));
+			dest += channels - split;
+			++f0;
+		}
+		sample_conv_planar_float_gain(src, channels, offset + f0, dest, n - f0, gain);
+	}
+
+	rb_write_advance(rb, (size_t)n * channels * sizeof(float));
+	return n;
+}
+
+int
+file_decoder_rb_write_s16(rb_t * rb, const short * src, int channels, int n, float gain) {
+
+	rb_data_t vec[2];
+	int n0 = rb_write_prepare(rb, vec, channels, &n);
+
+	sample_conv_s16_to_float(src, (float *)vec[0].buf, n0, gain);
+	if (n0 < n * channels) {
+		sample_conv_s16_to_float(src + n0, (float *)vec[1].buf, n * channels - n0, gain);
+	}
+
+	rb_write_advance(rb, (size_t)n * channels * sizeof(float));
+	return n;
+}
+
+int
+file_decoder_rb_write_s32(rb_t * rb, const int * src, int channels, int n, float gain) {
+
+	rb_data_t vec[2];
+	int n0 = rb_write_prepare(rb, vec, channels, &n);
+
+	sample_conv_s32_to_float(src, (float *)vec[0].buf, n0, gain);
+	if (n0 < n * channels) {
+		sample_conv_s32_to_float(src + n0, (float *)vec[1].buf, n * channels - n0, gain);
+	}
+
+	rb_write_advance(rb, (size_t)n * channels * sizeof(float));
+	return n;
+}
+
+int
+file_decoder_rb_write_float(rb_t * rb, const float * src, int channels, int n, float gain) {
+
+	rb_data_t vec[2];
+	int n0 = rb_write_prepare(rb, vec, channels, &n);
+
+	sample_conv_float_gain(src, (float *)vec[0].buf, n0, gain);
+	if (n0 < n * channels) {
+		sample_conv_float_gain(src + n0, (float *)vec[1].buf, n * channels - n0, gain);
+	}
+
+	rb_write_advance(rb, (size_t)n * channels * sizeof(float));
+	return n;
+}
+
+
 /* taken from cdparanoia source */
 int
 bigendianp(void) {
@@ -25,12 +25,17 @@
 
 #include "../common.h"
 #include "../metadata.h"
+#include "../rb.h"
 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Decoders hand over up to this many channels, in WAVE channel order
+   (FL FR FC LFE BL BR SL SR); playback mixes them down to stereo. */
+#define FILE_DECODER_MAX_CHANNELS 8
+
 /* input libs */
 #define NULL_LIB    0
 #define CDDA_LIB    1
@@ -73,6 +78,7 @@ typedef struct _file_decoder_t {
 	float voladj_db;
 	float voladj_lin;
 	int is_stream;
+	int info_only; /* opened by file_decoder_probe(), no decoding state */
 
 	/* Note that the metadata block sent by meta_cb is still owned by
 	   the file_decoder instance and should not be freed externally.
@@ -128,6 +134,11 @@ file_decoder_t * file_decoder_new(void);
 void file_decoder_delete(file_decoder_t * fdec);
 
 int file_decoder_open(file_decoder_t * fdec, char * filename);
+/* Open for fileinfo and metadata only. Decoders parse the headers and
+   tags but set up no decoding state (ringbuffer, codec context, file
+   mapping), so the file cannot be read or seeked; file_decoder_close()
+   it as usual. Returns like file_decoder_open(). */
+int file_decoder_probe(file_decoder_t * fdec, char * filename);
 void file_decoder_send_metadata(file_decoder_t * fdec);
 void file_decoder_set_rva(file_decoder_t * fdec, float voladj);
 void file_decoder_set_meta_cb(file_decoder_t * fdec,
@@ -142,6 +153,21 @@ void file_decoder_resume(file_decoder_t * fdec);
     
 float get_file_duration(char * file);
 
+/* Block output for decoders: convert n frames of decoded samples to
+   float, multiplied by gain, straight into the write space of the
+   decoder's ringbuffer. Only whole frames are written, as many as fit;
+   the number of frames written is returned. The planar variants read
+   src[ch][offset ...] (libFLAC, libmad, libvorbisfile), the others take
+   interleaved samples. All but the s16 and planar s32 variants clip the
+   result to [-1.0, 1.0]. */
+int file_decoder_rb_write_planar_s32(rb_t * rb, const int * const * src, int channels,
+				     int offset, int n, float gain);
+int file_decoder_rb_write_planar_float(rb_t * rb, const float * const * src, int channels,
+				       int offset, int n, float gain);
+int file_decoder_rb_write_s16(rb_t * rb, const short * src, int channels, int n, float gain);
+int file_decoder_rb_write_s32(rb_t * rb, const int * src, int channels, int n, float gain);
+int file_decoder_rb_write_float(rb_t * rb, const float * src, int channels, int n, float gain);
+
 int bigendianp(void);
 
 #define db2lin(x) ((x) > -90.0f ? powf(10.0f, (x) * 0.05f) : 0.0f)
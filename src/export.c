@@ -44,6 +44,7 @@
 #include "encoder/enc_lame.h"
 #include "metadata.h"
 #include "options.h"
+#include "sample_conv.h"
 #include "export.h"
 
 
@@ -517,6 +518,7 @@ export_item(export_t * export, export_item_t * item, int index) {
 	int force_copy = 0;
 
 	float buf[2*BUFSIZE];
+	float * mixbuf = NULL;
 	int n_read;
 	long long samples_read = 0;
 
@@ -644,6 +646,10 @@ export_item(export_t * export, export_item_t * item, int index) {
 	mode.file_lib = export->format;
 	mode.sample_rate = fdec->fileinfo.sample_rate;
 	mode.channels = fdec->fileinfo.channels;
+	if (mode.channels > 2) {
+		/* export the same stereo downmix that playback uses */
+		mode.channels = 2;
+	}
 
 	if (mode.file_lib == ENC_FLAC_LIB) {
 		mode.clevel = export->bitrate;
@@ -670,9 +676,23 @@ export_item(export_t * export, export_item_t * item, int index) {
 		return;
 	}
 
+	if (fdec->fileinfo.channels > 2) {
+		if ((mixbuf = malloc(fdec->fileinfo.channels * BUFSIZE * sizeof(float))) == NULL) {
+			fprintf(stderr, "export_item: malloc error\n");
+			file_encoder_close(fenc);
+			file_encoder_delete(fenc);
+			return;
+		}
+	}
+
 	while (!export->cancelled) {
 
-		n_read = file_decoder_read(fdec, buf, BUFSIZE);
+		if (mixbuf != NULL) {
+			n_read = file_decoder_read(fdec, mixbuf, BUFSIZE);
+			sample_conv_to_stereo(mixbuf, buf, fdec->fileinfo.channels, n_read);
+		} else {
+			n_read = file_decoder_read(fdec, buf, BUFSIZE);
+		}
 		file_encoder_write(fenc, buf, n_read);
 		
 		samples_read += n_read;
@@ -686,6 +706,7 @@ export_item(export_t * export, export_item_t * item, int index) {
 		}
 	}
 
+	free(mixbuf);
 	file_decoder_close(fdec);
 	file_encoder_close(fenc);
 	file_decoder_delete(fdec);
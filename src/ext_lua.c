@@ -39,6 +39,7 @@
 #include "common.h"
 #include "metadata.h"
 #include "metadata_api.h"
+#include "metadata_cache.h"
 #include "options.h"
 #include "playlist.h"
 
@@ -414,6 +415,8 @@ static int l_add_playlist_menu_command(lua_State * L) {
 
 static void reload_lua_cb(gpointer data) {
         setup_extended_title_formatting();
+	/* the script may have been edited */
+	metadata_cache_options_changed();
 }
 
 void setup_extended_title_formatting(void) {
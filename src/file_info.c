@@ -1831,6 +1831,8 @@ fi_set_common_entries(fi_t * fi) {
 
 	if (fi->fileinfo.is_mono) {
 		strcpy(str, _("MONO"));
+	} else if (fi->fileinfo.channels > 2) {
+		sprintf(str, _("%d channels"), fi->fileinfo.channels);
 	} else {
 		strcpy(str, _("STEREO"));
 	}
@@ -1900,6 +1902,7 @@ fi_media_init(fi_t * fi) {
 		fi->fileinfo.format_str = _("Audio CD");
 		fi->fileinfo.sample_rate = 44100;
 		fi->fileinfo.is_mono = 0;
+		fi->fileinfo.channels = 2;
 		fi->fileinfo.format_flags = 0;
 		fi->fileinfo.bps = 2*16*44100;
 		fi->fileinfo.total_samples = (drive->disc.toc[track] - drive->disc.toc[track-1]) * 588;
@@ -1924,6 +1927,7 @@ fi_media_init(fi_t * fi) {
 		fi->fileinfo.format_str = fi->dec->format_str;
 		fi->fileinfo.sample_rate = fi->fdec->fileinfo.sample_rate;
 		fi->fileinfo.is_mono = fi->fdec->fileinfo.is_mono;
+		fi->fileinfo.channels = fi->fdec->fileinfo.channels;
 		fi->fileinfo.format_flags = fi->fdec->fileinfo.format_flags;
 		fi->fileinfo.bps = fi->fdec->fileinfo.bps;
 		fi->fileinfo.total_samples = fi->fdec->fileinfo.total_samples;
@@ -83,7 +83,9 @@
 #include "httpc.h"
 #include "metadata.h"
 #include "metadata_api.h"
+#include "metadata_cache.h"
 #include "music_browser.h"
+#include "store_file.h"
 #include "version.h"
 #include "gui_main.h"
 
@@ -337,13 +339,16 @@ extern gint playlist_state;
 extern gint browser_state;
 
 
+/* Call this after writing a command (and its payload) to rb_gui2disk.
+   The disk thread only holds disk_thread_lock while checking whether
+   it has work to do, so taking the lock here is cheap and guarantees
+   that the wakeup is not lost. */
 void
-try_waking_disk_thread(void) {
+wake_disk_thread(void) {
 
-	if (AQUALUNG_MUTEX_TRYLOCK(disk_thread_lock)) {
-		AQUALUNG_COND_SIGNAL(disk_thread_wake)
-		AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
-	}
+	AQUALUNG_MUTEX_LOCK(disk_thread_lock)
+	AQUALUNG_COND_SIGNAL(disk_thread_wake)
+	AQUALUNG_MUTEX_UNLOCK(disk_thread_lock)
 }
 
 
@@ -762,7 +767,7 @@ main_window_close(GtkWidget * widget, GdkEvent * event, gpointer data) {
 
 	send_cmd = CMD_FINISH;
 	rb_write(rb_gui2disk, &send_cmd, 1);
-	try_waking_disk_thread();
+	wake_disk_thread();
 
 #ifdef HAVE_CDDA
 	cdda_shutdown();
@@ -792,6 +797,9 @@ main_window_close(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		playlist_save_all(playlist_name);
 	}
 
+	metadata_cache_finalize();
+	store_file_save_flush();
+
         pango_font_description_free(fd_playlist);
         pango_font_description_free(fd_browser);
 
@@ -1026,7 +1034,7 @@ seek_song(void) {
 		seek.seek_to_pos = gtk_adjustment_get_value(GTK_ADJUSTMENT(adj_pos)) / 100.0f * total_samples;
 		rb_write(rb_gui2disk, &send_cmd, 1);
 		rb_write(rb_gui2disk, (char *)&seek, sizeof(seek_t));
-		try_waking_disk_thread();
+		wake_disk_thread();
 		refresh_scale_suppress = 2;
         }
 }
@@ -1168,7 +1176,7 @@ main_window_key_pressed(GtkWidget * widget, GdkEventKey * event) {
 			seek.seek_to_pos = 0.0f;
 			rb_write(rb_gui2disk, &send_cmd, 1);
 			rb_write(rb_gui2disk, (char *)&seek, sizeof(seek_t));
-			try_waking_disk_thread();
+			wake_disk_thread();
 			refresh_scale_suppress = 2;
 		}
 
@@ -1448,7 +1456,7 @@ scale_button_release_event(GtkWidget * widget, GdkEventButton * event) {
 				/ 100.0f * total_samples;
 			rb_write(rb_gui2disk, &send_cmd, 1);
 			rb_write(rb_gui2disk, (char *)&seek, sizeof(seek_t));
-			try_waking_disk_thread();
+			wake_disk_thread();
 			refresh_scale_suppress = 2;
 		}
 	}
@@ -1987,7 +1995,7 @@ prev_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		flush_rb_disk2gui();
 		rb_write(rb_gui2disk, &cmd, sizeof(char));
 		rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
-		try_waking_disk_thread();
+		wake_disk_thread();
 	}
 	return FALSE;
 }
@@ -2068,7 +2076,7 @@ next_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		flush_rb_disk2gui();
 		rb_write(rb_gui2disk, &cmd, sizeof(char));
 		rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
-		try_waking_disk_thread();
+		wake_disk_thread();
 	}
 	return FALSE;
 }
@@ -2090,7 +2098,7 @@ play_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		}
 		send_cmd = CMD_RESUME;
 		rb_write(rb_gui2disk, &send_cmd, 1);
-		try_waking_disk_thread();
+		wake_disk_thread();
 		return FALSE;
 	}
 	if (options.combine_play_pause && is_file_loaded) {
@@ -2137,7 +2145,7 @@ play_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		flush_rb_disk2gui();
 		rb_write(rb_gui2disk, &cmd, sizeof(char));
 		rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
-		try_waking_disk_thread();
+		wake_disk_thread();
 	}
 	return FALSE;
 }
@@ -2166,7 +2174,7 @@ pause_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 		rb_write(rb_gui2disk, &send_cmd, 1);
 	}
 
-	try_waking_disk_thread();
+	wake_disk_thread();
 	return FALSE;
 }
 
@@ -2195,7 +2203,7 @@ stop_event(GtkWidget * widget, GdkEvent * event, gpointer data) {
 	flush_rb_disk2gui();
         rb_write(rb_gui2disk, &cmd, sizeof(char));
         rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
-	try_waking_disk_thread();
+	wake_disk_thread();
 
  	show_scale_pos(TRUE);
 
@@ -2294,6 +2302,52 @@ decide_next_track(cue_t * pcue) {
 }
 
 
+/* Predict the track decide_next_track() will choose when the current
+   one ends, without changing any state, so that the disk thread can
+   open it ahead of time. Returns 0 if there is no predictable next
+   track (e.g. in shuffle mode). */
+int
+peek_next_track(cue_t * pcue) {
+
+	GtkTreePath * p;
+	GtkTreeIter iter;
+	playlist_t * pl;
+	playlist_data_t * data;
+
+	if ((pl = playlist_get_playing()) == NULL) {
+		return 0;
+	}
+
+	if (stop_after_current_song ||
+	    gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(shuffle_button))) {
+		return 0;
+	}
+
+	if ((p = playlist_get_playing_path(pl)) == NULL) {
+		return 0;
+	}
+
+	gtk_tree_model_get_iter(GTK_TREE_MODEL(pl->store), &iter, p);
+	gtk_tree_path_free(p);
+
+	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(repeat_button))) {
+		/* normal or list repeat mode; in track repeat mode, the
+		   next track is the current one */
+		if (!choose_adjacent_track(pl->store, &iter)) {
+			if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(repeat_all_button)) ||
+			    !choose_first_track(pl->store, &iter)) {
+				return 0;
+			}
+		}
+	}
+
+	gtk_tree_model_get(GTK_TREE_MODEL(pl->store), &iter, PL_COL_DATA, &data, -1);
+	pcue->filename = strdup(data->file);
+	pcue->voladj = options.rva_is_enabled ? data->voladj : 0.0f;
+	return 1;
+}
+
+
 /********************************************/
 
 void
@@ -3735,6 +3789,13 @@ create_gui(int argc, char ** argv, int optind, int enqueue,
 	        changed_pos(GTK_ADJUSTMENT(adj_pos), NULL);
         }
 
+	{
+		char cache_file[MAXLEN];
+
+		snprintf(cache_file, MAXLEN-1, "%s/%s", options.confdir, "metadata_cache");
+		metadata_cache_init(cache_file);
+	}
+
 	zero_displays();
 	if (options.auto_save_playlist) {
 		/* start playback only if no files to be loaded on command line */
@@ -3912,6 +3973,7 @@ process_metablock(metadata_t * meta) {
 			gtk_tree_model_get(GTK_TREE_MODEL(pl->store), &iter, PL_COL_DATA, &data, -1);
 
 			free_strdup(&data->title, buf);
+			playlist_data_invalidate_search_key(data);
 			gtk_tree_store_set(pl->store, &iter, PL_COL_NAME, buf, -1);
 
 			gtk_tree_path_free(p);
@@ -3968,12 +4030,19 @@ timeout_callback(gpointer data) {
 				rb_write(rb_gui2disk, &send_cmd, sizeof(char));
 			}
 
-			try_waking_disk_thread();
+			wake_disk_thread();
+			break;
+
+		case CMD_PRELOADREQ:
+			if (is_file_loaded && peek_next_track(&cue)) {
+				cmd = CMD_PRELOAD;
+				rb_write(rb_gui2disk, &cmd, sizeof(char));
+				rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
+				wake_disk_thread();
+			}
 			break;
 
 		case CMD_FILEINFO:
-			while (rb_read_space(rb_disk2gui) < sizeof(fileinfo_t))
-				;
 			if (fileinfo.format_str != NULL) { /* free previous format_str, if there is one */
 				free(fileinfo.format_str);
 				fileinfo.format_str = NULL;
@@ -3990,8 +4059,6 @@ timeout_callback(gpointer data) {
 			break;
 
 		case CMD_STATUS:
-			while (rb_read_space(rb_disk2gui) < sizeof(status_t))
-				;
 			rb_read(rb_disk2gui, (char *)&status, sizeof(status_t));
 
 			sample_pos = total_samples - status.samples_left;
@@ -4006,7 +4073,7 @@ timeout_callback(gpointer data) {
 				seek.seek_to_pos = options.loop_range_start * total_samples;
 				rb_write(rb_gui2disk, &send_cmd, 1);
 				rb_write(rb_gui2disk, (char *)&seek, sizeof(seek_t));
-				try_waking_disk_thread();
+				wake_disk_thread();
 				refresh_scale_suppress = 2;
 			}
 #endif /* HAVE_LOOP */
@@ -4073,8 +4140,6 @@ timeout_callback(gpointer data) {
 			break;
 
 		case CMD_METABLOCK:
-			while (rb_read_space(rb_disk2gui) < sizeof(metadata_t *))
-				;
 			rb_read(rb_disk2gui, (char *)&meta, sizeof(metadata_t *));
 
 			process_metablock(meta);
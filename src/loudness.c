@@ -0,0 +1,349 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "loudness.h"
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif /* M_PI */
+
+#define LOUDNESS_OFFSET -0.691
+
+
+static float
+energy_to_loudness(double energy) {
+
+	if (energy <= 0.0) {
+		return -HUGE_VAL;
+	}
+	return LOUDNESS_OFFSET + 10.0 * log10(energy);
+}
+
+
+/* K-weighting coefficients for arbitrary sample rates, derived from the
+   analog prototypes of the 48 kHz filters given in ITU-R BS.1770. */
+static void
+loudness_init_filters(loudness_t * l) {
+
+	double rate = (double)l->sample_rate;
+	double f0, G, Q, K, Vh, Vb, a0;
+
+	f0 = 1681.974450955533;
+	G = 3.999843853973347;
+	Q = 0.7071752369554196;
+	K = tan(M_PI * f0 / rate);
+	Vh = pow(10.0, G / 20.0);
+	Vb = pow(Vh, 0.4996667741545416);
+	a0 = 1.0 + K / Q + K * K;
+
+	l->shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+	l->shelf.b1 = 2.0 * (K * K - Vh) / a0;
+	l->shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+	l->shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+	l->shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(M_PI * f0 / rate);
+	a0 = 1.0 + K / Q + K * K;
+
+	l->hipass.b0 = 1.0;
+	l->hipass.b1 = -2.0;
+	l->hipass.b2 = 1.0;
+	l->hipass.a1 = 2.0 * (K * K - 1.0) / a0;
+	l->hipass.a2 = (1.0 - K / Q + K * K) / a0;
+}
+
+
+/* Hann-windowed sinc interpolator split into `oversample' phases. The
+   coefficients of each phase are stored time-reversed so that they can
+   be applied directly to the chronologically ordered history. */
+static void
+loudness_init_true_peak(loudness_t * l) {
+
+	int n_taps, p, j;
+
+	if (l->sample_rate < 96000) {
+		l->oversample = 4;
+	} else if (l->sample_rate < 192000) {
+		l->oversample = 2;
+	} else {
+		l->oversample = 1;
+		return;
+	}
+
+	n_taps = l->oversample * LOUDNESS_TP_TAPS;
+
+	for (p = 0; p < l->oversample; p++) {
+		double sum = 0.0;
+		for (j = 0; j < LOUDNESS_TP_TAPS; j++) {
+			int i = p + l->oversample * j;
+			double t = (i - (n_taps - 1) / 2.0) / l->oversample;
+			double w = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / n_taps);
+			double h = (fabs(t) < 1e-9) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+			l->tp_coeffs[p][LOUDNESS_TP_TAPS - 1 - j] = h * w;
+			sum += h * w;
+		}
+		for (j = 0; j < LOUDNESS_TP_TAPS; j++) {
+			l->tp_coeffs[p][j] /= sum;
+		}
+	}
+}
+
+
+loudness_t *
+loudness_new(unsigned long sample_rate, int channels) {
+
+	loudness_t * l;
+	int i;
+
+	if (sample_rate == 0 || channels < 1 || channels > LOUDNESS_MAX_CHANNELS) {
+		return NULL;
+	}
+
+	if ((l = (loudness_t *)calloc(1, sizeof(loudness_t))) == NULL) {
+		fprintf(stderr, "loudness_new(): calloc error\n");
+		return NULL;
+	}
+
+	l->sample_rate = sample_rate;
+	l->channels = channels;
+	l->sub_len = (sample_rate + 5) / 10;
+
+	/* mono files are treated as dual mono, so a mono and a stereo
+	   copy of the same material measure identically (ReplayGain 2) */
+	for (i = 0; i < channels; i++) {
+		if (channels == 1) {
+			l->weight[i] = 2.0f;
+		} else if (i < 3) {
+			l->weight[i] = 1.0f;
+		} else if (i == 3 && channels >= 6) {
+			l->weight[i] = 0.0f; /* LFE */
+		} else {
+			l->weight[i] = 1.41f;
+		}
+	}
+
+	loudness_init_filters(l);
+	loudness_init_true_peak(l);
+
+	return l;
+}
+
+
+void
+loudness_free(loudness_t * l) {
+
+	free(l);
+}
+
+
+static void
+loudness_end_sub_block(loudness_t * l) {
+
+	double z = 0.0;
+	double block;
+	float lufs;
+	int i;
+
+	for (i = 0; i < l->channels; i++) {
+		z += l->weight[i] * l->sub_sum[i];
+		l->sub_sum[i] = 0.0;
+	}
+	l->sub_energy[l->n_sub & 3] = z / l->sub_len;
+	l->sub_pos = 0;
+
+	if (++l->n_sub < 4) {
+		return;
+	}
+
+	block = (l->sub_energy[0] + l->sub_energy[1] +
+		 l->sub_energy[2] + l->sub_energy[3]) / 4.0;
+	lufs = energy_to_loudness(block);
+
+	if (lufs > LOUDNESS_HIST_MIN) {
+		int bin = (int)((lufs - LOUDNESS_HIST_MIN) * 10.0);
+		if (bin >= LOUDNESS_HIST_BINS) {
+			bin = LOUDNESS_HIST_BINS - 1;
+		}
+		l->hist_count[bin]++;
+		l->hist_energy[bin] += block;
+	}
+}
+
+
+static void
+loudness_process_channel(loudness_t * l, int ch, float * samples, unsigned long n_frames) {
+
+	biquad_coeffs_t s = l->shelf;
+	biquad_coeffs_t h = l->hipass;
+	double s0 = l->shelf_z[ch][0], s1 = l->shelf_z[ch][1];
+	double h0 = l->hipass_z[ch][0], h1 = l->hipass_z[ch][1];
+	double sum = 0.0;
+	float peak = l->true_peak;
+	float * hist = l->tp_hist[ch];
+	int pos = l->tp_pos;
+	int stride = l->channels;
+	unsigned long i;
+	int p, k;
+
+	for (i = 0; i < n_frames; i++) {
+
+		double x = samples[i * stride];
+		double y;
+
+		/* K-weighting */
+		y = s.b0 * x + s0;
+		s0 = s.b1 * x - s.a1 * y + s1;
+		s1 = s.b2 * x - s.a2 * y;
+		x = y;
+		y = h.b0 * x + h0;
+		h0 = h.b1 * x - h.a1 * y + h1;
+		h1 = h.b2 * x - h.a2 * y;
+		sum += y * y;
+
+		/* true peak */
+		if (l->oversample == 1) {
+			float a = fabsf(samples[i * stride]);
+			if (a > peak) {
+				peak = a;
+			}
+			continue;
+		}
+
+		hist[pos] = hist[pos + LOUDNESS_TP_TAPS] = samples[i * stride];
+		if (++pos == LOUDNESS_TP_TAPS) {
+			pos = 0;
+		}
+		for (p = 0; p < l->oversample; p++) {
+			float * w = hist + pos;
+			float * c = l->tp_coeffs[p];
+			float acc = 0.0f;
+			for (k = 0; k < LOUDNESS_TP_TAPS; k++) {
+				acc += c[k] * w[k];
+			}
+			acc = fabsf(acc);
+			if (acc > peak) {
+				peak = acc;
+			}
+		}
+	}
+
+	l->shelf_z[ch][0] = s0;
+	l->shelf_z[ch][1] = s1;
+	l->hipass_z[ch][0] = h0;
+	l->hipass_z[ch][1] = h1;
+	l->sub_sum[ch] += sum;
+	l->true_peak = peak;
+}
+
+
+/* Feed n_frames interleaved frames. The input is split at 100 ms
+   sub-block boundaries; within a run every channel is filtered in one
+   tight loop. */
+void
+loudness_process(loudness_t * l, float * samples, unsigned long n_frames) {
+
+	while (n_frames > 0) {
+
+		unsigned long n = l->sub_len - l->sub_pos;
+		int ch;
+
+		if (n > n_frames) {
+			n = n_frames;
+		}
+
+		for (ch = 0; ch < l->channels; ch++) {
+			loudness_process_channel(l, ch, samples + ch, n);
+		}
+
+		if (l->oversample > 1) {
+			l->tp_pos = (l->tp_pos + n) % LOUDNESS_TP_TAPS;
+		}
+
+		l->sub_pos += n;
+		if (l->sub_pos == l->sub_len) {
+			loudness_end_sub_block(l);
+		}
+
+		samples += n * l->channels;
+		n_frames -= n;
+	}
+}
+
+
+/* Gated integrated loudness in LUFS: blocks below -70 LUFS never enter
+   the histogram (absolute gate), then blocks more than 10 LU below the
+   ungated mean are dropped (relative gate). */
+float
+loudness_integrated(loudness_t * l) {
+
+	unsigned long count = 0;
+	double energy = 0.0;
+	float gate;
+	int start, i;
+
+	for (i = 0; i < LOUDNESS_HIST_BINS; i++) {
+		count += l->hist_count[i];
+		energy += l->hist_energy[i];
+	}
+
+	if (count == 0) {
+		return LOUDNESS_SILENCE;
+	}
+
+	gate = energy_to_loudness(energy / count) - 10.0f;
+	start = (int)((gate - LOUDNESS_HIST_MIN) * 10.0);
+	if (start < 0) {
+		start = 0;
+	}
+
+	count = 0;
+	energy = 0.0;
+	for (i = start; i < LOUDNESS_HIST_BINS; i++) {
+		count += l->hist_count[i];
+		energy += l->hist_energy[i];
+	}
+
+	if (count == 0) {
+		return LOUDNESS_SILENCE;
+	}
+
+	return energy_to_loudness(energy / count);
+}
+
+
+/* Linear true peak (sample peak if the rate is too high to oversample) */
+float
+loudness_true_peak(loudness_t * l) {
+
+	return l->true_peak;
+}
+
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -0,0 +1,88 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#ifndef AQUALUNG_LOUDNESS_H
+#define AQUALUNG_LOUDNESS_H
+
+
+/* EBU R128 / ITU-R BS.1770 loudness meter: K-weighted, gated
+   integrated loudness plus 4x oversampled true peak. Samples are fed
+   block-wise as interleaved float frames; all state is allocated once
+   in loudness_new(). */
+
+#define LOUDNESS_MAX_CHANNELS  8
+#define LOUDNESS_TP_TAPS      12  /* interpolator taps per phase */
+#define LOUDNESS_TP_MAX_OVER   4
+
+/* histogram of gated block loudness, 0.1 LU resolution */
+#define LOUDNESS_HIST_MIN    -70.0
+#define LOUDNESS_HIST_MAX      5.0
+#define LOUDNESS_HIST_BINS   750
+
+/* integrated loudness returned for (near) silent input */
+#define LOUDNESS_SILENCE     -70.0f
+
+typedef struct {
+	double b0, b1, b2, a1, a2;
+} biquad_coeffs_t;
+
+typedef struct {
+	unsigned long sample_rate;
+	int channels;
+	float weight[LOUDNESS_MAX_CHANNELS];
+
+	/* K-weighting: pre-filter (high shelf) and RLB high-pass,
+	   direct form II transposed, two state words per channel */
+	biquad_coeffs_t shelf;
+	biquad_coeffs_t hipass;
+	double shelf_z[LOUDNESS_MAX_CHANNELS][2];
+	double hipass_z[LOUDNESS_MAX_CHANNELS][2];
+
+	/* gating: 400 ms blocks built from four 100 ms sub-blocks */
+	unsigned long sub_len;
+	unsigned long sub_pos;
+	double sub_sum[LOUDNESS_MAX_CHANNELS];
+	double sub_energy[4];
+	unsigned long n_sub;
+
+	unsigned long hist_count[LOUDNESS_HIST_BINS];
+	double hist_energy[LOUDNESS_HIST_BINS];
+
+	/* true peak: polyphase windowed-sinc interpolator */
+	int oversample;
+	float tp_coeffs[LOUDNESS_TP_MAX_OVER][LOUDNESS_TP_TAPS];
+	float tp_hist[LOUDNESS_MAX_CHANNELS][2 * LOUDNESS_TP_TAPS];
+	int tp_pos;
+	float true_peak;
+} loudness_t;
+
+
+loudness_t * loudness_new(unsigned long sample_rate, int channels);
+void loudness_free(loudness_t * l);
+
+void loudness_process(loudness_t * l, float * samples, unsigned long n_frames);
+
+float loudness_integrated(loudness_t * l);
+float loudness_true_peak(loudness_t * l);
+
+
+#endif /* AQUALUNG_LOUDNESS_H */
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
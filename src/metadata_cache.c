@@ -0,0 +1,555 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "athread.h"
+#include "common.h"
+#include "options.h"
+#include "metadata_cache.h"
+
+
+extern options_t options;
+
+#define METADATA_CACHE_MAGIC "aqualung-metadata-cache 2"
+
+/* entries not used for this long are dropped on save [s] */
+#define METADATA_CACHE_MAX_AGE (90 * 24 * 60 * 60)
+
+/* last_used is only refreshed (and the cache rewritten) this often [s] */
+#define METADATA_CACHE_TOUCH_INTERVAL (24 * 60 * 60)
+
+enum {
+	MC_PATH = 0,
+	MC_MTIME,
+	MC_SIZE,
+	MC_LAST_USED,
+	MC_DURATION,
+	MC_HAS_RVA,
+	MC_RVA,
+	MC_ARTIST,
+	MC_ALBUM,
+	MC_TITLE,
+	MC_DISPLAY,
+	MC_N_FIELDS
+};
+
+AQUALUNG_MUTEX_DECLARE_INIT(cache_mutex)
+
+static GHashTable * cache = NULL;
+static char * cache_file = NULL;
+static char * cache_format_sig = NULL;
+static int cache_dirty = 0;
+
+/* bytes >= 0x80 are left alone by g_strescape() so UTF-8 stays readable */
+static char escape_exceptions[129];
+
+
+void
+metadata_cache_entry_free(metadata_cache_entry_t * entry) {
+
+	if (entry == NULL) {
+		return;
+	}
+
+	g_free(entry->artist);
+	g_free(entry->album);
+	g_free(entry->title);
+	g_free(entry->display);
+	g_free(entry);
+}
+
+
+static metadata_cache_entry_t *
+metadata_cache_entry_copy(metadata_cache_entry_t * entry) {
+
+	metadata_cache_entry_t * copy = g_new(metadata_cache_entry_t, 1);
+
+	*copy = *entry;
+	copy->artist = g_strdup(entry->artist);
+	copy->album = g_strdup(entry->album);
+	copy->title = g_strdup(entry->title);
+	copy->display = g_strdup(entry->display);
+
+	return copy;
+}
+
+
+/* The display string depends on the Lua title format script, and the
+ * cached RVA is already converted with the current ReplayGain and RVA
+ * settings, so cached entries are only good for the script (and script
+ * version) and settings that produced them.
+ */
+static char *
+metadata_cache_format_sig(void) {
+
+	struct stat st;
+	char refvol[G_ASCII_DTOSTR_BUF_SIZE];
+	char steepness[G_ASCII_DTOSTR_BUF_SIZE];
+	char * script;
+	char * sig;
+
+	if (!options.use_ext_title_format) {
+		script = g_strdup("");
+	} else if (g_stat(options.ext_title_format_file, &st) != 0) {
+		script = g_strdup(options.ext_title_format_file);
+	} else {
+		script = g_strdup_printf("%s:%lld", options.ext_title_format_file, (long long)st.st_mtime);
+	}
+
+	sig = g_strdup_printf("%d:%s:%s:%s", options.replaygain_tag_to_use,
+			      g_ascii_dtostr(refvol, sizeof(refvol), options.rva_refvol),
+			      g_ascii_dtostr(steepness, sizeof(steepness), options.rva_steepness),
+			      script);
+	g_free(script);
+
+	return sig;
+}
+
+
+void
+metadata_cache_options_changed(void) {
+
+	char * sig;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	/* stat()s the title format script, so keep it out of the lock */
+	sig = metadata_cache_format_sig();
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	if (cache == NULL ||
+	    (cache_format_sig != NULL && strcmp(sig, cache_format_sig) == 0)) {
+		AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+		g_free(sig);
+		return;
+	}
+
+	if (g_hash_table_size(cache) > 0) {
+		g_hash_table_remove_all(cache);
+		cache_dirty = 1;
+	}
+
+	g_free(cache_format_sig);
+	cache_format_sig = sig;
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+}
+
+
+static char *
+field_compress(char * str) {
+
+	if (str[0] == '\0') {
+		return NULL;
+	}
+
+	return g_strcompress(str);
+}
+
+
+static void
+metadata_cache_parse_line(char * line) {
+
+	char * fields[MC_N_FIELDS];
+	metadata_cache_entry_t * entry;
+	char * path;
+	int i;
+
+	fields[0] = line;
+	for (i = 1; i < MC_N_FIELDS; i++) {
+		char * tab = strchr(fields[i-1], '\t');
+		if (tab == NULL) {
+			return;
+		}
+		*tab = '\0';
+		fields[i] = tab + 1;
+	}
+
+	if (fields[MC_PATH][0] == '\0') {
+		return;
+	}
+
+	entry = g_new0(metadata_cache_entry_t, 1);
+	entry->mtime = g_ascii_strtoll(fields[MC_MTIME], NULL, 10);
+	entry->size = g_ascii_strtoll(fields[MC_SIZE], NULL, 10);
+	entry->last_used = g_ascii_strtoll(fields[MC_LAST_USED], NULL, 10);
+	entry->duration = g_ascii_strtod(fields[MC_DURATION], NULL);
+	entry->has_rva = atoi(fields[MC_HAS_RVA]);
+	entry->rva = g_ascii_strtod(fields[MC_RVA], NULL);
+	entry->artist = field_compress(fields[MC_ARTIST]);
+	entry->album = field_compress(fields[MC_ALBUM]);
+	entry->title = field_compress(fields[MC_TITLE]);
+	entry->display = field_compress(fields[MC_DISPLAY]);
+
+	path = g_strcompress(fields[MC_PATH]);
+	g_hash_table_replace(cache, path, entry);
+}
+
+
+static void
+metadata_cache_load(void) {
+
+	gchar * contents;
+	gsize length;
+	char * line;
+	char * next;
+	char * sig;
+
+	if (!g_file_get_contents(cache_file, &contents, &length, NULL)) {
+		return;
+	}
+
+	line = contents;
+	if ((next = strchr(line, '\n')) == NULL) {
+		g_free(contents);
+		return;
+	}
+	*next++ = '\0';
+
+	if (strncmp(line, METADATA_CACHE_MAGIC "\t", strlen(METADATA_CACHE_MAGIC) + 1) != 0) {
+		fprintf(stderr, "metadata_cache_load: ignoring %s: unknown format\n", cache_file);
+		g_free(contents);
+		return;
+	}
+
+	sig = g_strcompress(line + strlen(METADATA_CACHE_MAGIC) + 1);
+
+	for (line = next; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL) {
+			*next++ = '\0';
+		} else {
+			next = line + strlen(line);
+		}
+		metadata_cache_parse_line(line);
+	}
+
+	g_free(contents);
+
+	g_free(cache_format_sig);
+	cache_format_sig = sig;
+}
+
+
+void
+metadata_cache_init(char * filename) {
+
+	int i;
+
+	if (cache != NULL) {
+		return;
+	}
+
+	for (i = 0; i < 128; i++) {
+		escape_exceptions[i] = (char)(0x80 + i);
+	}
+	escape_exceptions[128] = '\0';
+
+#ifndef HAVE_LIBPTHREAD
+	if (cache_mutex == NULL) {
+		cache_mutex = g_mutex_new();
+	}
+#endif /* !HAVE_LIBPTHREAD */
+
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				      (GDestroyNotify)metadata_cache_entry_free);
+	cache_file = g_strdup(filename);
+	cache_dirty = 0;
+
+	metadata_cache_load();
+	metadata_cache_options_changed();
+}
+
+
+static void
+write_field(FILE * f, char * str, char sep) {
+
+	if (str != NULL) {
+		char * esc = g_strescape(str, escape_exceptions);
+		fputs(esc, f);
+		g_free(esc);
+	}
+	fputc(sep, f);
+}
+
+
+void
+metadata_cache_save(void) {
+
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	char * tmpname;
+	FILE * f;
+	gint64 now;
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (cache == NULL) {
+		return;
+	}
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+
+	if (!cache_dirty) {
+		AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+		return;
+	}
+
+	tmpname = g_strdup_printf("%s.tmp", cache_file);
+	if ((f = g_fopen(tmpname, "wb")) == NULL) {
+		fprintf(stderr, "metadata_cache_save: unable to open %s for writing\n", tmpname);
+		AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+		g_free(tmpname);
+		return;
+	}
+
+	fputs(METADATA_CACHE_MAGIC "\t", f);
+	write_field(f, cache_format_sig, '\n');
+
+	now = time(NULL);
+	g_hash_table_iter_init(&iter, cache);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+
+		metadata_cache_entry_t * entry = (metadata_cache_entry_t *)value;
+
+		if (now - entry->last_used > METADATA_CACHE_MAX_AGE) {
+			continue;
+		}
+
+		write_field(f, (char *)key, '\t');
+		fprintf(f, "%lld\t%lld\t%lld\t",
+			(long long)entry->mtime,
+			(long long)entry->size,
+			(long long)entry->last_used);
+		fprintf(f, "%s\t", g_ascii_dtostr(buf, sizeof(buf), entry->duration));
+		fprintf(f, "%d\t", entry->has_rva);
+		fprintf(f, "%s\t", g_ascii_dtostr(buf, sizeof(buf), entry->rva));
+		write_field(f, entry->artist, '\t');
+		write_field(f, entry->album, '\t');
+		write_field(f, entry->title, '\t');
+		write_field(f, entry->display, '\n');
+	}
+
+	if (fclose(f) != 0 || g_rename(tmpname, cache_file) != 0) {
+		fprintf(stderr, "metadata_cache_save: unable to write %s\n", cache_file);
+		g_unlink(tmpname);
+	} else {
+		cache_dirty = 0;
+	}
+
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+
+	g_free(tmpname);
+}
+
+
+void
+metadata_cache_finalize(void) {
+
+	if (cache == NULL) {
+		return;
+	}
+
+	metadata_cache_save();
+
+	/* import threads may still be running; they find cache == NULL
+	   once they get the lock. The mutex itself is kept for them. */
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	g_hash_table_destroy(cache);
+	cache = NULL;
+	g_free(cache_file);
+	cache_file = NULL;
+	g_free(cache_format_sig);
+	cache_format_sig = NULL;
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+}
+
+
+/* Returns 0 and fills in mtime and size if path can be stat()ed.
+ * Done before taking cache_mutex so slow filesystems don't hold up
+ * the other import threads.
+ */
+static int
+metadata_cache_stat(char * path, gint64 * mtime, gint64 * size) {
+
+	struct stat st;
+
+	if (g_stat(path, &st) != 0) {
+		return -1;
+	}
+
+	*mtime = st.st_mtime;
+	*size = st.st_size;
+	return 0;
+}
+
+
+/* call with cache_mutex held; mtime and size are as returned by
+ * metadata_cache_stat(), stat_ok is its return value
+ */
+static metadata_cache_entry_t *
+metadata_cache_lookup_locked(char * path, int stat_ok, gint64 mtime, gint64 size, gint64 now) {
+
+	metadata_cache_entry_t * entry;
+
+	if ((entry = g_hash_table_lookup(cache, path)) == NULL) {
+		return NULL;
+	}
+
+	if (stat_ok != 0 || mtime != entry->mtime || size != entry->size) {
+		g_hash_table_remove(cache, path);
+		cache_dirty = 1;
+		return NULL;
+	}
+
+	if (now - entry->last_used > METADATA_CACHE_TOUCH_INTERVAL) {
+		entry->last_used = now;
+		cache_dirty = 1;
+	}
+
+	return metadata_cache_entry_copy(entry);
+}
+
+
+metadata_cache_entry_t *
+metadata_cache_lookup(char * path) {
+
+	metadata_cache_entry_t * entry;
+	gint64 mtime = 0;
+	gint64 size = 0;
+	int stat_ok;
+
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	stat_ok = metadata_cache_stat(path, &mtime, &size);
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	if (cache == NULL) {
+		entry = NULL;
+	} else {
+		entry = metadata_cache_lookup_locked(path, stat_ok, mtime, size, time(NULL));
+	}
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+
+	return entry;
+}
+
+
+int
+metadata_cache_prefetch(char ** paths, int n, metadata_cache_entry_t ** entries) {
+
+	gint64 now = time(NULL);
+	gint64 * mtimes;
+	gint64 * sizes;
+	int * stat_ok;
+	int hits = 0;
+	int i;
+
+	if (cache == NULL) {
+		for (i = 0; i < n; i++) {
+			entries[i] = NULL;
+		}
+		return 0;
+	}
+
+	mtimes = g_new0(gint64, n);
+	sizes = g_new0(gint64, n);
+	stat_ok = g_new(int, n);
+	for (i = 0; i < n; i++) {
+		stat_ok[i] = metadata_cache_stat(paths[i], mtimes + i, sizes + i);
+	}
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	for (i = 0; i < n; i++) {
+		if (cache == NULL) {
+			entries[i] = NULL;
+		} else if ((entries[i] = metadata_cache_lookup_locked(paths[i], stat_ok[i],
+								      mtimes[i], sizes[i], now)) != NULL) {
+			++hits;
+		}
+	}
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+
+	g_free(mtimes);
+	g_free(sizes);
+	g_free(stat_ok);
+
+	return hits;
+}
+
+
+void
+metadata_cache_store(char * path, metadata_cache_entry_t * entry) {
+
+	metadata_cache_entry_t * copy;
+	struct stat st;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	if (g_stat(path, &st) != 0) {
+		return;
+	}
+
+	copy = metadata_cache_entry_copy(entry);
+	copy->mtime = st.st_mtime;
+	copy->size = st.st_size;
+	copy->last_used = time(NULL);
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	if (cache == NULL) {
+		metadata_cache_entry_free(copy);
+	} else {
+		g_hash_table_replace(cache, g_strdup(path), copy);
+		cache_dirty = 1;
+	}
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+}
+
+
+void
+metadata_cache_forget(char * path) {
+
+	if (cache == NULL) {
+		return;
+	}
+
+	AQUALUNG_MUTEX_LOCK(cache_mutex)
+	if (cache != NULL && g_hash_table_remove(cache, path)) {
+		cache_dirty = 1;
+	}
+	AQUALUNG_MUTEX_UNLOCK(cache_mutex)
+}
+
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
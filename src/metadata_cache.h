@@ -0,0 +1,83 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#ifndef AQUALUNG_METADATA_CACHE_H
+#define AQUALUNG_METADATA_CACHE_H
+
+#include <glib.h>
+
+
+/* On-disk cache of the metadata playlist_filemeta_get() would otherwise
+ * have to open a decoder for. Entries are keyed by file path and only
+ * considered valid while the file's mtime and size are unchanged.
+ * All functions are safe to call from the playlist import threads.
+ */
+
+typedef struct {
+
+	gint64 mtime;
+	gint64 size;
+	gint64 last_used;
+
+	float duration; /* length in seconds */
+	int has_rva;    /* rva holds a stored volume adjustment */
+	float rva;      /* [dB] */
+
+	char * artist;
+	char * album;
+	char * title;
+	char * display; /* result of the extended title format, if any */
+
+} metadata_cache_entry_t;
+
+
+void metadata_cache_init(char * filename);
+void metadata_cache_save(void);
+void metadata_cache_finalize(void);
+
+/* Drops all entries if the settings they depend on (title format
+ * script, ReplayGain and RVA options) differ from those they were
+ * made with. Call after changing any of these.
+ */
+void metadata_cache_options_changed(void);
+
+/* Returns a newly allocated copy of the entry for path if it is still
+ * up to date, NULL otherwise. Free with metadata_cache_entry_free().
+ */
+metadata_cache_entry_t * metadata_cache_lookup(char * path);
+
+/* Looks up n paths at once, taking the cache lock only once.
+ * entries[i] is set as metadata_cache_lookup(paths[i]) would return.
+ * Returns the number of hits.
+ */
+int metadata_cache_prefetch(char ** paths, int n, metadata_cache_entry_t ** entries);
+
+/* Stores a copy of entry for path; mtime, size and last_used are
+ * filled in here from the file itself.
+ */
+void metadata_cache_store(char * path, metadata_cache_entry_t * entry);
+void metadata_cache_forget(char * path);
+
+void metadata_cache_entry_free(metadata_cache_entry_t * entry);
+
+
+#endif /* AQUALUNG_METADATA_CACHE_H */
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -801,6 +801,7 @@ music_store_mark_changed(GtkTreeIter * iter) {
 	store_t * data;
 
 	music_store_selection_changed(STORE_TYPE_FILE);
+	search_index_invalidate();
 
 	path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store), iter);
 
@@ -817,6 +818,8 @@ music_store_mark_changed(GtkTreeIter * iter) {
 	case STORE_TYPE_FILE:
 		{
 			store_data_t * store_data = (store_data_t *)data;
+			store_file_invalidate_xml(iter);
+			store_data->dirty_gen++;
 			if (store_data->dirty) {
 				return;
 			}
@@ -927,13 +930,14 @@ music_store_load_all(void) {
 		switch (music_store_get_type(store_file)) {
 		case STORE_TYPE_FILE:
 			snprintf(sort, 15, "%03d", i+1);
-			store_file_load(store_file, sort);
+			store_file_load_queue(store_file, sort);
 			break;
 		}
 
 		g_free(store_file);
         }
 
+	store_file_load_start();
 	music_tree_expand_stores();
 }
 
@@ -64,6 +64,7 @@
 #include "store_file.h"
 #include "search.h"
 #include "playlist.h"
+#include "metadata_cache.h"
 #include "i18n.h"
 #include "skin.h"
 #include "options.h"
@@ -182,6 +183,7 @@ GtkWidget * combo_ladspa;
 GtkWidget * combo_src;
 #endif /* HAVE_SRC */
 GtkWidget * label_src;
+GtkWidget * check_output_dither;
 
 GtkWidget * check_rva_is_enabled;
 GtkWidget * rva_drawing_area;
@@ -421,9 +423,9 @@ music_store_remove_unset_stores(void) {
 
 				if (ret == GTK_RESPONSE_YES) {
 					store_file_save(&iter);
-				} else {
-					music_store_mark_saved(&iter);
 				}
+				/* the store goes away, the save (if any) is queued */
+				music_store_mark_saved(&iter);
 
 				g_free(name);
 			}
@@ -463,11 +465,18 @@ music_store_remove_non_existent_stores(void) {
 }
 
 void
-music_store_add_new_stores() {
+music_store_add_new_stores(void) {
 	int i;
 	GtkTreeIter iter;
 	GtkTreeIter iter2;
 
+	/* stores still being read in would be loaded twice, so try
+	   again once they are in music_store */
+	if (store_file_load_in_progress()) {
+		store_file_load_add_new_stores_when_done();
+		return;
+	}
+
 	i = 0;
 	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(ms_pathlist_store),
 					     &iter, NULL, i++)) {
@@ -700,6 +709,8 @@ options_window_accept(void) {
 	set_option_from_toggle(check_meta_rm_extension, &options.meta_rm_extension);
 	set_option_from_toggle(check_meta_us_to_space, &options.meta_us_to_space);
 
+	metadata_cache_options_changed();
+
 	if (metadata_encoding_changed) {
 		playlist_update_metadata();
 	}
@@ -802,6 +813,14 @@ options_window_accept(void) {
 }
 
 
+void
+check_output_dither_toggled(GtkWidget * widget, gpointer * data) {
+
+	options.output_dither =
+		gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check_output_dither));
+}
+
+
 #ifdef HAVE_LADSPA
 void
 changed_ladspa_prepost(GtkWidget * widget, gpointer * data) {
@@ -1951,10 +1970,12 @@ create_options_window(void) {
 	GtkWidget * vbox_dsp;
 	GtkWidget * frame_ladspa;
 	GtkWidget * frame_src;
+	GtkWidget * frame_output;
 	GtkWidget * frame_fonts;
 	GtkWidget * frame_colors;
 	GtkWidget * vbox_ladspa;
 	GtkWidget * vbox_src;
+	GtkWidget * vbox_output;
         GtkWidget * table_fonts;
 	GtkWidget * vbox_colors;
 
@@ -2835,6 +2856,23 @@ create_options_window(void) {
 	gtk_box_pack_start(GTK_BOX(vbox_src), label_src, TRUE, TRUE, 0);
 
 
+	frame_output = gtk_frame_new(_("Output conversion"));
+	gtk_box_pack_start(GTK_BOX(vbox_dsp), frame_output, FALSE, TRUE, 5);
+
+	vbox_output = gtk_vbox_new(FALSE, 3);
+	gtk_container_set_border_width(GTK_CONTAINER(vbox_output), 10);
+	gtk_container_add(GTK_CONTAINER(frame_output), vbox_output);
+
+	check_output_dither = gtk_check_button_new_with_label(_("Apply TPDF dither to 16-bit output"));
+	gtk_widget_set_name(check_output_dither, "check_on_notebook");
+	if (options.output_dither) {
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check_output_dither), TRUE);
+	}
+	g_signal_connect(G_OBJECT(check_output_dither), "toggled",
+			 G_CALLBACK(check_output_dither_toggled), NULL);
+	gtk_box_pack_start(GTK_BOX(vbox_output), check_output_dither, FALSE, FALSE, 0);
+
+
 	/* "Playback RVA" notebook page */
 
 	vbox_rva = gtk_vbox_new(FALSE, 3);
@@ -3849,6 +3887,7 @@ save_config(void) {
 	SAVE_STR(skin);
 	SAVE_INT(src_type);
 	SAVE_INT(ladspa_is_postfader);
+	SAVE_INT(output_dither);
 	SAVE_INT(auto_save_playlist);
 	SAVE_INT(playlist_auto_save);
 	SAVE_INT(playlist_auto_save_int);
@@ -3859,9 +3898,12 @@ save_config(void) {
 	SAVE_INT(show_active_track_name_in_bold);
 	SAVE_INT(auto_roll_to_active_track);
 	SAVE_INT(enable_pl_rules_hint);
+	SAVE_INT(pl_import_worker_threads);
 	SAVE_INT(enable_ms_rules_hint);
 	SAVE_INT_SH(enable_ms_tree_icons);
 	SAVE_INT(ms_confirm_removal);
+	SAVE_INT(ms_build_worker_threads);
+	SAVE_INT(ms_store_snapshot);
 	SAVE_INT(batch_mpeg_add_id3v1);
 	SAVE_INT(batch_mpeg_add_id3v2);
 	SAVE_INT(batch_mpeg_add_ape);
@@ -3904,6 +3946,7 @@ save_config(void) {
 	SAVE_FLOAT(rva_avg_linear_thresh);
 	SAVE_FLOAT(rva_avg_stddev_thresh);
 	SAVE_FLOAT(rva_no_rva_voladj);
+	SAVE_INT(rva_worker_threads);
 	SAVE_INT(main_pos_x);
 	SAVE_INT(main_pos_y);
 	SAVE_INT(main_size_x);
@@ -4185,6 +4228,8 @@ load_config(void) {
         options.enable_ms_tree_icons = options.enable_ms_tree_icons_shadow = 1;
 	options.ms_statusbar_show_size = 1;
 	options.ms_confirm_removal = 1;
+	options.ms_build_worker_threads = 0;
+	options.ms_store_snapshot = 1;
 
         options.cover_width = 2;
 
@@ -4196,6 +4241,7 @@ load_config(void) {
 	options.show_length_in_playlist = 1;
 	options.enable_playlist_statusbar = options.enable_playlist_statusbar_shadow = 1;
 	options.pl_statusbar_show_size = 1;
+	options.pl_import_worker_threads = 0;
 
 	options.rva_refvol = -12.0f;
 	options.rva_steepness = 1.0f;
@@ -4203,6 +4249,7 @@ load_config(void) {
 	options.rva_use_linear_thresh = 0;
 	options.rva_avg_linear_thresh = 3.0f;
 	options.rva_avg_stddev_thresh = 2.0f;
+	options.rva_worker_threads = 0;
 
 	options.batch_mpeg_add_id3v1 = 1;
 	options.batch_mpeg_add_id3v2 = 1;
@@ -4283,6 +4330,7 @@ load_config(void) {
 		}
 
 		LOAD_INT(ladspa_is_postfader);
+		LOAD_INT(output_dither);
 		LOAD_INT(auto_save_playlist);
 		LOAD_INT(playlist_auto_save);
 		LOAD_INT(playlist_auto_save_int);
@@ -4301,9 +4349,12 @@ load_config(void) {
 		LOAD_INT(show_active_track_name_in_bold);
 		LOAD_INT(auto_roll_to_active_track);
 		LOAD_INT(enable_pl_rules_hint);
+		LOAD_INT(pl_import_worker_threads);
 		LOAD_INT(enable_ms_rules_hint);
 		LOAD_INT_SH(enable_ms_tree_icons);
 		LOAD_INT(ms_confirm_removal);
+		LOAD_INT(ms_build_worker_threads);
+		LOAD_INT(ms_store_snapshot);
 		LOAD_INT(enable_tooltips);
 		LOAD_INT(disable_buttons_relief);
 		LOAD_INT_SH(combine_play_pause);
@@ -4338,6 +4389,7 @@ load_config(void) {
 		LOAD_FLOAT(rva_avg_linear_thresh);
 		LOAD_FLOAT(rva_avg_stddev_thresh);
 		LOAD_FLOAT(rva_no_rva_voladj);
+		LOAD_INT(rva_worker_threads);
 		LOAD_INT(main_pos_x);
 		LOAD_INT(main_pos_y);
 		LOAD_INT(main_size_x);
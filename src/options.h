@@ -148,6 +148,7 @@ typedef struct {
 	int auto_roll_to_active_track;
 	int enable_pl_rules_hint;
 	int plcol_idx[3];
+	int pl_import_worker_threads; /* 0: one per CPU */
 
 	/* Music Store */
 	int hide_comment_pane;
@@ -162,12 +163,15 @@ typedef struct {
 	int enable_ms_tree_icons;
 	int enable_ms_tree_icons_shadow;
 	int ms_confirm_removal;
+	int ms_build_worker_threads; /* 0: one per CPU */
+	int ms_store_snapshot;       /* keep binary snapshots of store files */
 	int cover_width;
 	int magnify_smaller_images;
 
 	/* DSP */
 	int ladspa_is_postfader;
 	int src_type;
+	int output_dither;
 
 	/* RVA */
 	int rva_is_enabled;
@@ -179,6 +183,7 @@ typedef struct {
 	float rva_avg_linear_thresh;
 	float rva_avg_stddev_thresh;
 	float rva_no_rva_voladj;
+	int rva_worker_threads; /* 0: one per CPU */
 
 	/* Metadata */
 	int replaygain_tag_to_use;
@@ -265,6 +270,7 @@ void create_options_window(void);
 void append_ms_pathlist(char * path, char * name);
 
 void options_store_watcher_start(void);
+void music_store_add_new_stores(void);
 
 void save_config(void);
 void load_config(void);
@@ -58,6 +58,7 @@
 #include "file_info.h"
 #include "decoder/file_decoder.h"
 #include "metadata_api.h"
+#include "metadata_cache.h"
 #include "volume.h"
 #include "options.h"
 #include "i18n.h"
@@ -168,6 +169,7 @@ playlist_transfer_t * playlist_transfer_get(int mode, char * tab_name, int start
 
 
 playlist_data_t * playlist_filemeta_get(char * filename);
+static playlist_data_t * playlist_filemeta_from_cache(char * filename, metadata_cache_entry_t * entry);
 
 void playlist_unlink_files(playlist_t * pl);
 void set_cursor_in_playlist(playlist_t * pl, GtkTreeIter *iter, gboolean scroll);
@@ -209,6 +211,10 @@ GtkWidget * playlist_notebook;
 GList * playlists;
 GList * playlists_closed;
 
+/* Bumped when the display name formatting changes, which makes every
+   cached search key stale at once. */
+static unsigned playlist_search_gen = 1;
+
 
 playlist_data_t *
 playlist_data_new() {
@@ -229,6 +235,9 @@ playlist_data_new() {
 	data->title = NULL;
 	data->display = NULL;
 	data->file = NULL;
+	data->search_text = NULL;
+	data->search_key = NULL;
+	data->search_gen = 0;
 
 	return data;
 }
@@ -259,6 +268,7 @@ playlist_data_copy_noalloc(playlist_data_t * dest, playlist_data_t * src) {
 	dest->ntracks = src->ntracks;
 	dest->actrack = src->actrack;
 	dest->flags = src->flags;
+	playlist_data_invalidate_search_key(dest);
 }
 
 playlist_data_t *
@@ -298,9 +308,39 @@ playlist_data_free(playlist_data_t * data) {
 		free(data->file);
 		data->file = NULL;
 	}
+	g_free(data->search_text);
+	g_free(data->search_key);
 	free(data);
 }
 
+void
+playlist_data_invalidate_search_key(playlist_data_t * data) {
+
+	data->search_gen = 0;
+}
+
+void
+playlist_data_update_search_key(playlist_data_t * data) {
+
+	char text[MAXLEN];
+
+	if (data->search_gen == playlist_search_gen) {
+		return;
+	}
+
+	if (IS_PL_ALBUM_NODE(data)) {
+		snprintf(text, MAXLEN-1, "%s: %s", data->artist, data->album);
+	} else {
+		playlist_data_get_display_name(text, data);
+	}
+
+	g_free(data->search_text);
+	g_free(data->search_key);
+	data->search_text = g_strdup(text);
+	data->search_key = g_utf8_strup(text, -1);
+	data->search_gen = playlist_search_gen;
+}
+
 gboolean
 playlist_remove_track(GtkTreeStore * store, GtkTreeIter * iter) {
 
@@ -318,15 +358,16 @@ playlist_clear(GtkTreeStore * store) {
 	GtkTreeIter iter;
 	GtkTreeIter iter_child;
 	playlist_data_t * data;
-	int i, j;
+	gboolean valid;
+	gboolean valid_child;
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, i++)) {
+	for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter); valid;
+	     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter)) {
 		gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, PL_COL_DATA, &data, -1);
 		playlist_data_free(data);
 
-		j = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter_child, &iter, j++)) {
+		for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &iter_child, &iter);
+		     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter_child)) {
 			gtk_tree_model_get(GTK_TREE_MODEL(store), &iter_child, PL_COL_DATA, &data, -1);
 			playlist_data_free(data);
 		}
@@ -342,11 +383,30 @@ playlist_store_new() {
 				  G_TYPE_STRING,    /* title string */
 				  G_TYPE_STRING,    /* volume adj. displayed */
 				  G_TYPE_STRING,    /* duration displayed */
-				  G_TYPE_STRING,    /* color */
-				  G_TYPE_INT,       /* font weight */
 				  G_TYPE_POINTER);  /* pointer to struct playlist_data_t */
 }
 
+static void
+playlist_search_rows_changed(GtkTreeModel * model, GtkTreePath * path,
+			     GtkTreeIter * iter, gpointer data) {
+
+	((playlist_t *)data)->search_rows_valid = 0;
+}
+
+static void
+playlist_rows_deleted(GtkTreeModel * model, GtkTreePath * path, gpointer data) {
+
+	((playlist_t *)data)->search_rows_valid = 0;
+	((playlist_t *)data)->rows_deleted++;
+}
+
+static void
+playlist_search_rows_reordered(GtkTreeModel * model, GtkTreePath * path,
+			       GtkTreeIter * iter, gpointer new_order, gpointer data) {
+
+	((playlist_t *)data)->search_rows_valid = 0;
+}
+
 playlist_t *
 playlist_new(char * name) {
 
@@ -365,6 +425,7 @@ playlist_new(char * name) {
 	pl->thread_mutex = g_mutex_new();
 	pl->wait_mutex = g_mutex_new();
 	pl->thread_wait = g_cond_new();
+	pl->import_mutex = g_mutex_new();
 #endif /* !HAVE_LIBPTHREAD */
 
 	if (name != NULL) {
@@ -378,6 +439,15 @@ playlist_new(char * name) {
 
 	pl->store = playlist_store_new();
 
+	g_signal_connect(G_OBJECT(pl->store), "row-inserted",
+			 G_CALLBACK(playlist_search_rows_changed), pl);
+	g_signal_connect(G_OBJECT(pl->store), "row-changed",
+			 G_CALLBACK(playlist_search_rows_changed), pl);
+	g_signal_connect(G_OBJECT(pl->store), "row-deleted",
+			 G_CALLBACK(playlist_rows_deleted), pl);
+	g_signal_connect(G_OBJECT(pl->store), "rows-reordered",
+			 G_CALLBACK(playlist_search_rows_reordered), pl);
+
 	return pl;
 }
 
@@ -390,8 +460,13 @@ playlist_free(playlist_t * pl) {
 	g_mutex_free(pl->thread_mutex);
 	g_mutex_free(pl->wait_mutex);
 	g_cond_free(pl->thread_wait);
+	g_mutex_free(pl->import_mutex);
 #endif /* !HAVE_LIBPTHREAD */
 
+	if (pl->search_rows != NULL) {
+		g_array_free(pl->search_rows, TRUE);
+	}
+
 	free(pl);
 }
 
@@ -514,6 +589,17 @@ playlist_is_empty(playlist_t * pl) {
 	return 0;
 }
 
+/* Colour and weight of a row are derived from its playlist_data_t when
+   it is drawn, so a row only needs to be redrawn when its flags change. */
+static void
+playlist_row_changed(GtkTreeStore * store, GtkTreeIter * iter) {
+
+	GtkTreePath * path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), iter);
+
+	gtk_tree_model_row_changed(GTK_TREE_MODEL(store), path, iter);
+	gtk_tree_path_free(path);
+}
+
 void
 playlist_set_active(GtkTreeStore * store, GtkTreeIter * piter) {
 
@@ -521,11 +607,7 @@ playlist_set_active(GtkTreeStore * store, GtkTreeIter * piter) {
 
 	gtk_tree_model_get(GTK_TREE_MODEL(store), piter, PL_COL_DATA, &data, -1);
 	PL_SET_FLAG(data, PL_FLAG_ACTIVE);
-
-	gtk_tree_store_set(store, piter, PL_COL_COLO, pl_color_active, -1);
-	if (options.show_active_track_name_in_bold) {
-		gtk_tree_store_set(store, piter, PL_COL_FONT, PANGO_WEIGHT_BOLD, -1);
-	}
+	playlist_row_changed(store, piter);
 }
 
 void
@@ -535,10 +617,7 @@ playlist_set_inactive(GtkTreeStore * store, GtkTreeIter * piter) {
 
 	gtk_tree_model_get(GTK_TREE_MODEL(store), piter, PL_COL_DATA, &data, -1);
 	PL_UNSET_FLAG(data, PL_FLAG_ACTIVE);
-
-	gtk_tree_store_set(store, piter,
-			   PL_COL_COLO, pl_color_inactive,
-			   PL_COL_FONT, PANGO_WEIGHT_NORMAL, -1);
+	playlist_row_changed(store, piter);
 }
 
 void
@@ -595,10 +674,6 @@ playlist_node_copy(GtkTreeStore * sstore, GtkTreeIter * siter,
 	gtk_tree_store_set(tstore, iter,
 			   PL_COL_VADJ, vadj,
 			   PL_COL_DURA, dura,
-			   PL_COL_COLO, IS_PL_ACTIVE(tdata) ? pl_color_active : pl_color_inactive,
-			   PL_COL_FONT, (IS_PL_ACTIVE(tdata) && options.show_active_track_name_in_bold) ?
-			                 PANGO_WEIGHT_BOLD :
-			                 PANGO_WEIGHT_NORMAL,
 			   PL_COL_DATA, tdata, -1);
 
 	if (sstore != tstore && IS_PL_ACTIVE(sdata)) {
@@ -654,7 +729,7 @@ void
 playlist_copy(playlist_t * pl) {
 
 	GtkTreeIter iter;
-	gint i = 0;
+	gboolean valid;
 
 	if (clipboard == NULL) {
 		if ((clipboard = (clipboard_t *)calloc(1, sizeof(clipboard_t))) == NULL) {
@@ -668,7 +743,8 @@ playlist_copy(playlist_t * pl) {
 
 	clipboard->has_album_node = 0;
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+	for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+	     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 
 		if (gtk_tree_selection_iter_is_selected(pl->select, &iter)) {
 			playlist_node_deep_copy(pl->store, &iter, clipboard->store, NULL, 2);
@@ -684,11 +760,12 @@ playlist_copy(playlist_t * pl) {
 			playlist_node_deep_copy(pl->store, &iter, clipboard->store, NULL, 2);
 			clipboard->has_album_node = 1;
 		} else {
-			int j = 0;
 			GtkTreeIter iter_child;
+			gboolean valid_child;
 			GtkTreeIter dummy;
 
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter_child, &iter, j++)) {
+			for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, &iter);
+			     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 				if (gtk_tree_selection_iter_is_selected(pl->select, &iter_child)) {
 					playlist_node_copy(pl->store, &iter_child,
 							   clipboard->store, NULL, &dummy, 2);
@@ -793,6 +870,11 @@ playlist_transfer_free(playlist_transfer_t * pt) {
 		free(pt->filename);
 	}
 
+	if (pt->import != NULL) {
+		/* the reader threads flush their entries before they finish */
+		g_ptr_array_free(pt->import, TRUE);
+	}
+
 	free(pt);
 }
 
@@ -803,11 +885,15 @@ playlist_reset_display_names(void) {
 	playlist_data_t * data = NULL;
 	char list_str[MAXLEN];
 
+	++playlist_search_gen;
+
 	for (node = playlists; node; node = node->next) {
 		playlist_t * pl = (playlist_t *)node->data;
 		GtkTreeIter iter;
-		int i = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+		gboolean valid;
+
+		for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+		     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 			if (!gtk_tree_model_iter_has_child(GTK_TREE_MODEL(pl->store), &iter)) {
 				gtk_tree_model_get(GTK_TREE_MODEL(pl->store), &iter, PL_COL_DATA, &data, -1);
 				if (!httpc_is_url(data->file)) {
@@ -820,30 +906,15 @@ playlist_reset_display_names(void) {
 }
 
 void
-playlist_disable_bold_font_foreach(gpointer data, gpointer user_data) {
-
-        GtkTreeIter iter;
-	gint i = 0;
-
-	GtkTreeStore * store = ((playlist_t *)data)->store;
+playlist_disable_bold_font(void) {
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, i++)) {
-		gint j = 0;
-		GtkTreeIter iter_child;
+	GList * node;
 
-		gtk_tree_store_set(store, &iter, PL_COL_FONT, PANGO_WEIGHT_NORMAL, -1);
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter_child, &iter, j++)) {
-			gtk_tree_store_set(store, &iter_child, PL_COL_FONT, PANGO_WEIGHT_NORMAL, -1);
-		}
+	for (node = playlists; node; node = node->next) {
+		gtk_widget_queue_draw(((playlist_t *)node->data)->view);
 	}
 }
 
-void
-playlist_disable_bold_font(void) {
-
-	g_list_foreach(playlists, playlist_disable_bold_font_foreach, NULL);
-}
-
 void
 playlist_set_font_foreach(gpointer data, gpointer user_data) {
 
@@ -890,43 +961,25 @@ playlist_set_playing(playlist_t * pl, int playing) {
 	playlist_set_markup(pl);
 }
 
-void
-adjust_playlist_item_color(GtkTreeStore * store, GtkTreeIter * iter,
-			   char * active, char * inactive) {
+static void
+playlist_cell_data_func(GtkTreeViewColumn * column, GtkCellRenderer * renderer,
+			GtkTreeModel * model, GtkTreeIter * iter, gpointer user_data) {
 
 	playlist_data_t * data;
 
-	gtk_tree_model_get(GTK_TREE_MODEL(store), iter, PL_COL_DATA, &data, -1);
+	gtk_tree_model_get(model, iter, PL_COL_DATA, &data, -1);
 
 	if (IS_PL_ACTIVE(data)) {
-		gtk_tree_store_set(store, iter, PL_COL_COLO, active, -1);
-		if (options.show_active_track_name_in_bold) {
-			gtk_tree_store_set(store, iter, PL_COL_FONT, PANGO_WEIGHT_BOLD, -1);
-		}
+		g_object_set(G_OBJECT(renderer),
+			     "foreground", pl_color_active,
+			     "weight", options.show_active_track_name_in_bold ?
+			               PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL,
+			     NULL);
 	} else {
-		gtk_tree_store_set(store, iter,
-				   PL_COL_COLO, inactive,
-				   PL_COL_FONT, PANGO_WEIGHT_NORMAL, -1);
-	}
-}
-
-
-void
-adjust_playlist_color(playlist_t * pl, char * active, char * inactive) {
-
-	int i = 0;
-	GtkTreeIter iter;
-
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
-		int j = 0;
-		GtkTreeIter iter_child;
-
-		adjust_playlist_item_color(pl->store, &iter, active, inactive);
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-						     &iter_child, &iter, j++)) {
-			adjust_playlist_item_color(pl->store, &iter_child,
-						   active, inactive);
-		}
+		g_object_set(G_OBJECT(renderer),
+			     "foreground", pl_color_inactive,
+			     "weight", PANGO_WEIGHT_NORMAL,
+			     NULL);
 	}
 }
 
@@ -976,19 +1029,14 @@ playlist_set_color(void) {
         sprintf(active, "#%04X%04X%04X", rs, gs, bs);
 	sprintf(inactive, "#%04X%04X%04X", ri, gi, bi);
 
+        strcpy(pl_color_active, active);
+	strcpy(pl_color_inactive, inactive);
+
 	for (node = playlists; node; node = node->next) {
 		playlist_t * pl = (playlist_t *)node->data;
-		adjust_playlist_color(pl, active, inactive);
 		playlist_set_playing(pl, pl->playing);
+		gtk_widget_queue_draw(pl->view);
 	}
-
-	for (node = playlists_closed; node; node = node->next) {
-		playlist_t * pl = (playlist_t *)node->data;
-		adjust_playlist_color(pl, active, inactive);
-	}
-
-        strcpy(pl_color_active, active);
-	strcpy(pl_color_inactive, inactive);
 }
 
 void
@@ -997,18 +1045,18 @@ playlist_foreach_selected(playlist_t * pl, int (* foreach)(playlist_t *, GtkTree
 
 	GtkTreeIter iter_top;
 	GtkTreeIter iter;
-	gint i;
-	gint j;
+	gboolean valid;
+	gboolean valid_child;
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter_top, NULL, i++)) {
+	for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter_top); valid;
+	     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_top)) {
 
 		gboolean topsel = gtk_tree_selection_iter_is_selected(pl->select, &iter_top);
 
 		if (gtk_tree_model_iter_has_child(GTK_TREE_MODEL(pl->store), &iter_top)) {
 
-			j = 0;
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, &iter_top, j++)) {
+			for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter, &iter_top);
+			     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 				if (topsel || gtk_tree_selection_iter_is_selected(pl->select, &iter)) {
 					if (foreach(pl, &iter, data)) {
 						return;
@@ -1057,9 +1105,10 @@ playlist_get_playing_path(playlist_t * pl) {
 
 	playlist_data_t * data;
 	GtkTreeIter iter;
-	int i = 0;
+	gboolean valid;
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+	for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+	     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 
 		gtk_tree_model_get(GTK_TREE_MODEL(pl->store), &iter, PL_COL_DATA, &data, -1);
 
@@ -1068,10 +1117,10 @@ playlist_get_playing_path(playlist_t * pl) {
 
 				playlist_data_t * data_child;
 				GtkTreeIter iter_child;
-				int j = 0;
+				gboolean valid_child;
 
-				while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-								     &iter_child, &iter, j++)) {
+				for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, &iter);
+				     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 
 					gtk_tree_model_get(GTK_TREE_MODEL(pl->store), &iter_child,
 							   PL_COL_DATA, &data_child, -1);
@@ -1243,7 +1292,7 @@ playlist_start_playback_at_path(playlist_t * pl, GtkTreePath * path) {
 	flush_rb_disk2gui();
 	rb_write(rb_gui2disk, &cmd, sizeof(char));
 	rb_write(rb_gui2disk, (void *)&cue, sizeof(cue_t));
-	try_waking_disk_thread();
+	wake_disk_thread();
 }
 
 
@@ -1668,19 +1717,29 @@ add_file_to_playlist(gpointer data) {
 
 		if (IS_PL_TOPLEVEL(pldata)) {
 			gtk_tree_store_append(pt->pl->store, &iter, NULL);
+			if (IS_PL_ALBUM_NODE(pldata)) {
+				pt->album_iter = iter;
+				pt->album_iter_set = 1;
+				pt->album_stamp = pt->pl->rows_deleted;
+			}
 		} else {
-			GtkTreeIter parent;
-			int n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(pt->pl->store), NULL);
+			/* the remembered album node is valid as long as no rows
+			   have been deleted; finding the last one is linear */
+			if (!pt->album_iter_set || pt->album_stamp != pt->pl->rows_deleted) {
+				int n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(pt->pl->store), NULL);
+
+				if (n == 0) {
+					/* someone viciously cleared the list while adding tracks to album node;
+					   ignore further tracks added to this node */
+					playlist_data_free(pldata);
+					continue;
+				}
 
-			if (n == 0) {
-				/* someone viciously cleared the list while adding tracks to album node;
-				   ignore further tracks added to this node */
-				playlist_data_free(pldata);
-				continue;
+				gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pt->pl->store), &pt->album_iter, NULL, n-1);
+				pt->album_iter_set = 1;
+				pt->album_stamp = pt->pl->rows_deleted;
 			}
-
-			gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pt->pl->store), &parent, NULL, n-1);
-			gtk_tree_store_append(pt->pl->store, &iter, &parent);
+			gtk_tree_store_append(pt->pl->store, &iter, &pt->album_iter);
 		}
 
 		if (IS_PL_ALBUM_NODE(pldata)) {
@@ -1712,10 +1771,6 @@ add_file_to_playlist(gpointer data) {
 				   PL_COL_NAME, list_str,
 				   PL_COL_VADJ, IS_PL_ALBUM_NODE(pldata) ? "" : voladj_str,
 				   PL_COL_DURA, duration_str,
-				   PL_COL_COLO, IS_PL_ACTIVE(pldata) ? pl_color_active : pl_color_inactive,
-				   PL_COL_FONT, (IS_PL_ACTIVE(pldata) && options.show_active_track_name_in_bold) ?
-				                 PANGO_WEIGHT_BOLD :
-				                 PANGO_WEIGHT_NORMAL,
 				   PL_COL_DATA, pldata,
 				   -1);
 
@@ -1773,6 +1828,8 @@ add_file_to_playlist(gpointer data) {
 	return FALSE;
 }
 
+#define PLAYLIST_IMPORT_MAX_WORKERS 16
+#define PLAYLIST_IMPORT_BATCH       256
 
 void
 playlist_thread_add_to_list(playlist_transfer_t * pt, playlist_data_t * pldata) {
@@ -1784,7 +1841,7 @@ playlist_thread_add_to_list(playlist_transfer_t * pt, playlist_data_t * pldata)
 
 	if (pt->data_written >= pt->threshold || pldata == NULL) {
 
-		if (pt->threshold < 64) {
+		if (pt->threshold < PLAYLIST_IMPORT_BATCH) {
 			pt->threshold *= 2;
 		}
 
@@ -1798,6 +1855,180 @@ playlist_thread_add_to_list(playlist_transfer_t * pt, playlist_data_t * pldata)
 	AQUALUNG_MUTEX_UNLOCK(pt->pl->wait_mutex);
 }
 
+/* Files are probed for metadata by a pool of worker threads, a batch at
+   a time. The results are handed to the GUI in the order the entries
+   were added, so the playlist looks the same as with a single thread. */
+
+typedef struct {
+	char * file;    /* NULL if pldata has been resolved by the caller */
+	char * title;   /* title given by the playlist file, or NULL */
+	int flags;
+	playlist_data_t * pldata;
+} playlist_import_item_t;
+
+
+static void
+playlist_import_item_free(playlist_import_item_t * item) {
+
+	if (item->pldata != NULL) {
+		playlist_data_free(item->pldata);
+	}
+	g_free(item->file);
+	g_free(item->title);
+	free(item);
+}
+
+static int
+playlist_import_n_workers(int n_items) {
+
+	int n = options.pl_import_worker_threads;
+
+	if (n <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+	}
+	if (n > n_items) {
+		n = n_items;
+	}
+	if (n > PLAYLIST_IMPORT_MAX_WORKERS) {
+		n = PLAYLIST_IMPORT_MAX_WORKERS;
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	return n;
+}
+
+static void *
+playlist_import_worker(void * arg) {
+
+	playlist_transfer_t * pt = (playlist_transfer_t *)arg;
+
+	while (1) {
+		playlist_import_item_t * item;
+
+		AQUALUNG_MUTEX_LOCK(pt->pl->import_mutex);
+		if (pt->pl->thread_stop || pt->import_next >= pt->import->len) {
+			AQUALUNG_MUTEX_UNLOCK(pt->pl->import_mutex);
+			break;
+		}
+		item = (playlist_import_item_t *)g_ptr_array_index(pt->import, pt->import_next++);
+		AQUALUNG_MUTEX_UNLOCK(pt->pl->import_mutex);
+
+		if (item->pldata == NULL) {
+			item->pldata = playlist_filemeta_get(item->file);
+		}
+	}
+
+	return NULL;
+}
+
+/* Probe the pending entries and pass them on to the playlist. */
+static void
+playlist_import_flush(playlist_transfer_t * pt) {
+
+	AQUALUNG_THREAD_DECLARE(worker_ids[PLAYLIST_IMPORT_MAX_WORKERS])
+	int n_workers;
+	int i;
+	guint k;
+
+	if (pt->import == NULL || pt->import->len == 0) {
+		return;
+	}
+
+	pt->import_next = 0;
+	n_workers = playlist_import_n_workers(pt->import->len);
+
+	if (n_workers == 1) {
+		playlist_import_worker(pt);
+	} else {
+		for (i = 0; i < n_workers; i++) {
+			AQUALUNG_THREAD_CREATE(worker_ids[i], NULL, playlist_import_worker, pt);
+		}
+		for (i = 0; i < n_workers; i++) {
+			AQUALUNG_THREAD_JOIN(worker_ids[i]);
+		}
+	}
+
+	for (k = 0; k < pt->import->len; k++) {
+
+		playlist_import_item_t * item = (playlist_import_item_t *)g_ptr_array_index(pt->import, k);
+
+		if (!pt->pl->thread_stop) {
+			if (item->pldata == NULL) {
+				if (pt->filename != NULL) {
+					fprintf(stderr, "%s: unable to load playlist entry %s\n",
+						pt->filename, item->file);
+				}
+			} else {
+				if (item->title != NULL) {
+					free_strdup(&item->pldata->title, item->title);
+				}
+				item->pldata->flags |= item->flags;
+				playlist_thread_add_to_list(pt, item->pldata);
+				item->pldata = NULL;
+			}
+		}
+
+		playlist_import_item_free(item);
+	}
+
+	g_ptr_array_set_size(pt->import, 0);
+}
+
+static void
+playlist_import_queue(playlist_transfer_t * pt, playlist_import_item_t * item) {
+
+	if (pt->import == NULL) {
+		pt->import = g_ptr_array_new();
+	}
+
+	g_ptr_array_add(pt->import, item);
+
+	if (pt->import->len >= PLAYLIST_IMPORT_BATCH) {
+		playlist_import_flush(pt);
+	}
+}
+
+/* Queue a file to be added to the playlist. flags are set on its
+   playlist_data_t, title overrides the title from its metadata. */
+static void
+playlist_import_add(playlist_transfer_t * pt, char * file, char * title, int flags) {
+
+	playlist_import_item_t * item;
+
+	if ((item = (playlist_import_item_t *)calloc(1, sizeof(playlist_import_item_t))) == NULL) {
+		fprintf(stderr, "playlist_import_add(): calloc error\n");
+		return;
+	}
+
+	item->file = g_strdup(file);
+	item->title = g_strdup(title);
+	item->flags = flags;
+
+	playlist_import_queue(pt, item);
+}
+
+/* Queue an entry that is already resolved, keeping its place in line. */
+static void
+playlist_import_add_data(playlist_transfer_t * pt, playlist_data_t * pldata) {
+
+	playlist_import_item_t * item;
+
+	if ((item = (playlist_import_item_t *)calloc(1, sizeof(playlist_import_item_t))) == NULL) {
+		fprintf(stderr, "playlist_import_add_data(): calloc error\n");
+		playlist_data_free(pldata);
+		return;
+	}
+
+	item->pldata = pldata;
+
+	playlist_import_queue(pt, item);
+}
+
+
 void *
 add_files_to_playlist_thread(void * arg) {
 
@@ -1811,19 +2042,14 @@ add_files_to_playlist_thread(void * arg) {
 	for (node = pt->list; node; node = node->next) {
 
 		if (!pt->pl->thread_stop) {
-			playlist_data_t * pldata = NULL;
-
-			if ((pldata = playlist_filemeta_get((char *)node->data)) != NULL) {
-				if (pt->start_playback) {
-					PL_SET_FLAG(pldata, PL_FLAG_ACTIVE);
-				}
-				playlist_thread_add_to_list(pt, pldata);
-			}
+			playlist_import_add(pt, (char *)node->data, NULL,
+					    pt->start_playback ? PL_FLAG_ACTIVE : 0);
 		}
 
 		g_free(node->data);
 	}
 
+	playlist_import_flush(pt);
 	playlist_thread_add_to_list(pt, NULL);
 
 	g_slist_free(pt->list);
@@ -1867,13 +2093,26 @@ add_dir_to_playlist(playlist_transfer_t * pt, char * dirname) {
 	gint i, n;
 	struct dirent ** ent;
 	gchar path[MAXLEN];
-
+	char ** paths = NULL;
+	metadata_cache_entry_t ** cached = NULL;
 
 	if (pt->pl->thread_stop) {
 		return;
 	}
 
 	n = scandir(dirname, &ent, filter, alphasort);
+
+	/* resolve everything the metadata cache already knows about
+	   in one go, so only new or changed files get decoded */
+	if (n > 0) {
+		paths = g_new(char *, n);
+		cached = g_new(metadata_cache_entry_t *, n);
+		for (i = 0; i < n; i++) {
+			paths[i] = g_strdup_printf("%s/%s", dirname, ent[i]->d_name);
+		}
+		metadata_cache_prefetch(paths, n, cached);
+	}
+
 	for (i = 0; i < n; i++) {
 
 		if (pt->pl->thread_stop) {
@@ -1890,13 +2129,18 @@ add_dir_to_playlist(playlist_transfer_t * pt, char * dirname) {
 		if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
 			add_dir_to_playlist(pt, path);
 		} else {
-			playlist_data_t * pldata = NULL;
+			if (cached[i] != NULL) {
+				playlist_data_t * pldata = playlist_filemeta_from_cache(path, cached[i]);
 
-			if ((pldata = playlist_filemeta_get(path)) != NULL) {
-				if (pt->start_playback) {
-					PL_SET_FLAG(pldata, PL_FLAG_ACTIVE);
+				if (pldata != NULL) {
+					if (pt->start_playback) {
+						PL_SET_FLAG(pldata, PL_FLAG_ACTIVE);
+					}
+					playlist_import_add_data(pt, pldata);
 				}
-				playlist_thread_add_to_list(pt, pldata);
+			} else {
+				playlist_import_add(pt, path, NULL,
+						    pt->start_playback ? PL_FLAG_ACTIVE : 0);
 			}
 		}
 
@@ -1909,6 +2153,12 @@ add_dir_to_playlist(playlist_transfer_t * pt, char * dirname) {
 	}
 
 	if (n > 0) {
+		for (i = 0; i < n; i++) {
+			g_free(paths[i]);
+			metadata_cache_entry_free(cached[i]);
+		}
+		g_free(paths);
+		g_free(cached);
 		free(ent);
 	}
 }
@@ -1931,6 +2181,7 @@ add_dir_to_playlist_thread(void * arg) {
 		g_free(node->data);
 	}
 
+	playlist_import_flush(pt);
 	playlist_thread_add_to_list(pt, NULL);
 
 	g_slist_free(pt->list);
@@ -2056,8 +2307,6 @@ add_url(GtkWidget * widget, gpointer data) {
 				   PL_COL_NAME, url,
 				   PL_COL_VADJ, voladj_str,
 				   PL_COL_DURA, duration_str,
-				   PL_COL_COLO, pl_color_inactive,
-				   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 				   PL_COL_DATA, data, -1);
 
 		playlist_content_changed(pl);
@@ -2351,6 +2600,8 @@ plist__reread_file_meta_foreach(playlist_t * pl, GtkTreeIter * iter, void * user
 		return 0;
 	}
 
+	metadata_cache_forget(data->file);
+
 	if ((tmp = playlist_filemeta_get(data->file)) == NULL) {
 		fprintf(stderr, "plist__reread_file_meta_foreach(): "
 			"playlist_filemeta_get() returned NULL\n");
@@ -2361,6 +2612,7 @@ plist__reread_file_meta_foreach(playlist_t * pl, GtkTreeIter * iter, void * user
 	free_strdup(&data->album, tmp->album);
 	free_strdup(&data->title, tmp->title);
 	free_strdup(&data->display, tmp->display);
+	playlist_data_invalidate_search_key(data);
 
 	data->voladj = tmp->voladj;
 	data->duration = tmp->duration;
@@ -2450,8 +2702,10 @@ playlist_update_metadata(void) {
 	for (node = playlists; node; node = node->next) {
 		playlist_t * pl = (playlist_t *)node->data;
 		GtkTreeIter iter;
-		gint i = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+		gboolean valid;
+
+		for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+		     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 			plist__reread_file_meta_foreach(pl, &iter, NULL);
 		}
 		playlist_content_changed(pl);
@@ -2488,7 +2742,7 @@ plist__export_foreach(playlist_t * pl, GtkTreeIter * iter, void * data) {
 		return 0;
 	}
 
-	if (file_decoder_open(fdec, pldata->file) == 0) {
+	if (file_decoder_probe(fdec, pldata->file) == 0) {
 
 		char * tmp;
 
@@ -2655,14 +2909,50 @@ rem_cb(GtkWidget * widget, GdkEvent * event) {
 }
 
 
+static playlist_data_t *
+playlist_filemeta_from_cache(char * filename, metadata_cache_entry_t * entry) {
+
+	playlist_data_t * data;
+
+	if ((data = playlist_data_new()) == NULL) {
+		return NULL;
+	}
+
+	data->size = entry->size;
+	data->duration = entry->duration;
+
+	if (options.rva_is_enabled) {
+		data->voladj = entry->has_rva ? entry->rva : options.rva_no_rva_voladj;
+	} else {
+		data->voladj = 0.0f;
+	}
+
+	data->artist = g_strdup(entry->artist);
+	data->album = g_strdup(entry->album);
+	data->title = g_strdup(entry->title);
+	data->display = g_strdup(entry->display);
+	data->file = strdup(filename);
+
+	return data;
+}
+
+
 playlist_data_t *
 playlist_filemeta_get(char * filename) {
 
 	playlist_data_t * data;
 	file_decoder_t * fdec;
+	metadata_cache_entry_t entry;
+	metadata_cache_entry_t * cached;
 	struct stat statbuf;
 	char * tmp;
 
+	if ((cached = metadata_cache_lookup(filename)) != NULL) {
+		data = playlist_filemeta_from_cache(filename, cached);
+		metadata_cache_entry_free(cached);
+		return data;
+	}
+
 	if ((data = playlist_data_new()) == NULL) {
 		return NULL;
 	}
@@ -2673,22 +2963,24 @@ playlist_filemeta_get(char * filename) {
 		playlist_data_free(data);
 		return NULL;
 	}
-	if (file_decoder_open(fdec, filename) != 0) {
+	if (file_decoder_probe(fdec, filename) != 0) {
 		file_decoder_delete(fdec);
 		playlist_data_free(data);
 		return NULL;
 	}
 
-	if (g_stat(data->file, &statbuf) != -1) {
+	memset(&entry, 0, sizeof(entry));
+
+	if (g_stat(filename, &statbuf) != -1) {
 		data->size = statbuf.st_size;
 	}
 
 	data->duration = (float)fdec->fileinfo.total_samples / fdec->fileinfo.sample_rate;
+	entry.duration = data->duration;
 
+	entry.has_rva = metadata_get_rva(fdec->meta, &entry.rva);
 	if (options.rva_is_enabled) {
-		if (!metadata_get_rva(fdec->meta, &data->voladj)) {
-			data->voladj = options.rva_no_rva_voladj;
-		}
+		data->voladj = entry.has_rva ? entry.rva : options.rva_no_rva_voladj;
 	} else {
 		data->voladj = 0.0f;
 	}
@@ -2705,6 +2997,12 @@ playlist_filemeta_get(char * filename) {
 
 	data->display = extended_title_format(fdec);
 
+	entry.artist = data->artist;
+	entry.album = data->album;
+	entry.title = data->title;
+	entry.display = data->display;
+	metadata_cache_store(filename, &entry);
+
 	file_decoder_close(fdec);
 	file_decoder_delete(fdec);
 
@@ -3006,10 +3304,11 @@ cut_track_item(playlist_t * pl, GtkTreeIter * piter) {
 int
 any_tracks_selected(playlist_t * pl, GtkTreeIter * piter) {
 
-	gint j = 0;
 	GtkTreeIter iter_child;
+	gboolean valid_child;
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter_child, piter, j++)) {
+	for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, piter);
+	     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 		if (gtk_tree_selection_iter_is_selected(pl->select, &iter_child)) {
 			return 1;
 		}
@@ -3102,11 +3401,12 @@ void
 playlist_child_stats(playlist_t * pl, GtkTreeIter * iter,
 		     int * ntrack, float * length, double * size, int selected) {
 
-	int j = 0;
 	GtkTreeIter iter_child;
+	gboolean valid_child;
 	playlist_data_t * data;
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter_child, iter, j++)) {
+	for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, iter);
+	     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 
 		if (!selected || gtk_tree_selection_iter_is_selected(pl->select, &iter_child)) {
 
@@ -3132,7 +3432,7 @@ void
 playlist_stats(playlist_t * pl, int selected) {
 
 	GtkTreeIter iter;
-	int i = 0;
+	gboolean valid;
 
 	int ntrack = 0;
 	float length = 0;
@@ -3149,7 +3449,8 @@ playlist_stats(playlist_t * pl, int selected) {
 		return;
 	}
 
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+	for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+	     valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 
 		gint n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(pl->store), &iter);
 		if (n > 0) {
@@ -3972,9 +4273,9 @@ create_playlist_gui(playlist_t * pl) {
 			pl->track_column = gtk_tree_view_column_new_with_attributes("Tracks",
 										track_renderer,
 										"text", PL_COL_NAME,
-										"foreground", PL_COL_COLO,
-                                                                                "weight", PL_COL_FONT,
 										NULL);
+			gtk_tree_view_column_set_cell_data_func(pl->track_column, track_renderer,
+								playlist_cell_data_func, NULL, NULL);
 			gtk_tree_view_column_set_sizing(GTK_TREE_VIEW_COLUMN(pl->track_column),
 							GTK_TREE_VIEW_COLUMN_AUTOSIZE);
 			gtk_tree_view_column_set_spacing(GTK_TREE_VIEW_COLUMN(pl->track_column), 3);
@@ -3990,9 +4291,9 @@ create_playlist_gui(playlist_t * pl) {
 			pl->rva_column = gtk_tree_view_column_new_with_attributes("RVA",
 									      rva_renderer,
 									      "text", PL_COL_VADJ,
-									      "foreground", PL_COL_COLO,
-                                                                              "weight", PL_COL_FONT,
 									      NULL);
+			gtk_tree_view_column_set_cell_data_func(pl->rva_column, rva_renderer,
+								playlist_cell_data_func, NULL, NULL);
 			gtk_tree_view_column_set_sizing(GTK_TREE_VIEW_COLUMN(pl->rva_column),
 							GTK_TREE_VIEW_COLUMN_AUTOSIZE);
 			gtk_tree_view_column_set_spacing(GTK_TREE_VIEW_COLUMN(pl->rva_column), 3);
@@ -4011,9 +4312,9 @@ create_playlist_gui(playlist_t * pl) {
 			pl->length_column = gtk_tree_view_column_new_with_attributes("Length",
 										 length_renderer,
 										 "text", PL_COL_DURA,
-										 "foreground", PL_COL_COLO,
-                                                                                 "weight", PL_COL_FONT,
 										 NULL);
+			gtk_tree_view_column_set_cell_data_func(pl->length_column, length_renderer,
+								playlist_cell_data_func, NULL, NULL);
 			gtk_tree_view_column_set_sizing(GTK_TREE_VIEW_COLUMN(pl->length_column),
 							GTK_TREE_VIEW_COLUMN_AUTOSIZE);
 			gtk_tree_view_column_set_spacing(GTK_TREE_VIEW_COLUMN(pl->length_column), 3);
@@ -4512,8 +4813,8 @@ save_track_node(playlist_t * pl, GtkTreeIter * piter, xmlNodePtr root, char * no
 void
 playlist_save_data(playlist_t * pl, xmlNodePtr dest, int current) {
 
-        gint i = 0;
         GtkTreeIter iter;
+	gboolean valid;
 	GtkTreePath * p = NULL;
 
 	if (pl->name_set) {
@@ -4530,18 +4831,19 @@ playlist_save_data(playlist_t * pl, xmlNodePtr dest, int current) {
 		gtk_tree_path_free(p);
 	}
 
-        while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+        for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+             valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 
 		gint n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(pl->store), &iter);
 
 		if (n) { /* album node */
-			gint j = 0;
 			GtkTreeIter iter_child;
+			gboolean valid_child;
 			xmlNodePtr node;
 
 			node = save_track_node(pl, &iter, dest, "record");
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-							     &iter_child, &iter, j++)) {
+			for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, &iter);
+			     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 				save_track_node(pl, &iter_child, node, "track");
 			}
 		} else { /* track node */
@@ -4590,24 +4892,25 @@ void
 playlist_save_m3u(playlist_t * pl, char * filename) {
 
 	FILE * f;
-        gint i = 0;
         GtkTreeIter iter;
+	gboolean valid;
 
 	if ((f = g_fopen(filename, "wb")) == NULL) {
 		g_warning("Unable to open playlist file %s for writing", filename);
 		return;
 	}
 
-        while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store), &iter, NULL, i++)) {
+        for (valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(pl->store), &iter); valid;
+             valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter)) {
 
 		gint n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(pl->store), &iter);
 
 		if (n) { /* album node */
-			gint j = 0;
 			GtkTreeIter iter_child;
+			gboolean valid_child;
 
-			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-							     &iter_child, &iter, j++)) {
+			for (valid_child = gtk_tree_model_iter_children(GTK_TREE_MODEL(pl->store), &iter_child, &iter);
+			     valid_child; valid_child = gtk_tree_model_iter_next(GTK_TREE_MODEL(pl->store), &iter_child)) {
 				if (playlist_save_m3u_node(pl, &iter_child, f) != 0) {
 					goto playlist_save_m3u_cleanup;
 				 }
@@ -5028,7 +5331,6 @@ playlist_load_m3u_thread(void * arg) {
 	gint end_of_file_reached = 0;
 
 	playlist_transfer_t * pt = (playlist_transfer_t *)arg;
-	playlist_data_t * data = NULL;
 
 
 	AQUALUNG_THREAD_DETACH();
@@ -5107,27 +5409,18 @@ playlist_load_m3u_thread(void * arg) {
                                                 }
                                         }
 
-                                        data = playlist_filemeta_get(path);
+                                        playlist_import_add(pt, path, have_name ? name : NULL, 0);
                                 } else {
 
-                                        data = playlist_filemeta_get(line);
+                                        playlist_import_add(pt, line, have_name ? name : NULL, 0);
                                 }
 
-				if (have_name && data != NULL) {
-					free_strdup(&data->title, name);
-				}
-
 				have_name = 0;
-
-				if (data == NULL) {
-					fprintf(stderr, "load_m3u(): playlist_filemeta_get() returned NULL\n");
-				} else {
-					playlist_thread_add_to_list(pt, data);
-				}
 			}
 		}
 	}
 
+	playlist_import_flush(pt);
 	playlist_thread_add_to_list(pt, NULL);
 
  finish:
@@ -5143,23 +5436,11 @@ playlist_load_m3u_thread(void * arg) {
 void
 load_pls_load(playlist_transfer_t * pt, char * file, char * title, gint * have_file, gint * have_title) {
 
-	playlist_data_t * data = NULL;
-
 	if (*have_file == 0) {
 		return;
 	}
 
-	data = playlist_filemeta_get(file);
-
-	if (data && *have_title) {
-		free_strdup(&data->title, title);
-	}
-
-	if (data == NULL) {
-		fprintf(stderr, "load_pls_load(): playlist_filemeta_get() returned NULL\n");
-	} else {
-		playlist_thread_add_to_list(pt, data);
-	}
+	playlist_import_add(pt, file, *have_title ? title : NULL, 0);
 
 	*have_file = *have_title = 0;
 }
@@ -5344,10 +5625,14 @@ playlist_load_pls_thread(void * arg) {
 
 	load_pls_load(pt, file, title, &have_file, &have_title);
 
+	playlist_import_flush(pt);
 	playlist_thread_add_to_list(pt, NULL);
 
  finish:
 
+	/* entries read before a syntax error */
+	playlist_import_flush(pt);
+
 	AQUALUNG_MUTEX_UNLOCK(pt->pl->thread_mutex);
 
 	playlist_transfer_free(pt);
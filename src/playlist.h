@@ -43,6 +43,7 @@ typedef struct {
 	AQUALUNG_MUTEX_DECLARE(thread_mutex)
 	AQUALUNG_MUTEX_DECLARE(wait_mutex)
 	AQUALUNG_COND_DECLARE(thread_wait)
+	AQUALUNG_MUTEX_DECLARE(import_mutex)
 
 	volatile int thread_stop;
 
@@ -75,6 +76,11 @@ typedef struct {
 
 	GtkWidget * widget;
 
+	GArray * search_rows; /* flattened rows for search_playlist */
+	int search_rows_valid;
+
+	unsigned rows_deleted; /* bumped on every row-deleted */
+
 } playlist_t;
 
 typedef struct {
@@ -96,6 +102,13 @@ typedef struct {
 	int clear;
 	int start_playback;
 
+	GPtrArray * import; /* entries waiting for playlist_import_flush() */
+	guint import_next;
+
+	GtkTreeIter album_iter; /* last album node added */
+	int album_iter_set;
+	unsigned album_stamp;
+
 } playlist_transfer_t;
 
 playlist_t * playlist_tab_new(char * name);
@@ -180,10 +193,16 @@ typedef struct {
 	unsigned short actrack; /* active children node (for album nodes only) */
 	int flags;
 
+	char * search_text; /* display name as matched by search_playlist */
+	char * search_key;  /* uppercased search_text */
+	unsigned search_gen;
+
 } playlist_data_t;
 
 playlist_data_t * playlist_data_new(void);
 void playlist_data_get_display_name(char * list_str, playlist_data_t * pldata);
+void playlist_data_update_search_key(playlist_data_t * pldata);
+void playlist_data_invalidate_search_key(playlist_data_t * pldata);
 
 #define PL_IS_SET_FLAG(plist, flag) (plist->flags & flag)
 #define PL_SET_FLAG(plist, flag) (plist->flags |= flag)
@@ -200,8 +219,6 @@ enum {
 	PL_COL_NAME = 0,
 	PL_COL_VADJ,
 	PL_COL_DURA,
-	PL_COL_COLO,
-	PL_COL_FONT,
 	PL_COL_DATA,
 
 	PL_COL_COUNT
@@ -24,32 +24,121 @@
 
 #include <stdlib.h>
 #include <string.h>
-#ifdef USE_MLOCK
+#ifdef _WIN32
+#include <malloc.h>
+#else
 #include <sys/mman.h>
-#endif /* USE_MLOCK */
+#endif /* _WIN32 */
 
 #include "rb.h"
 
+/* Memory ordering of the read and write indices. The index owned by
+   the calling thread may be loaded relaxed; the other one must be
+   loaded with acquire semantics, and stores (which publish data or
+   free space to the other side) use release semantics.  */
+
+#if defined(RB_C11_ATOMICS)
+#define rb_load_relaxed(p) atomic_load_explicit(&(p), memory_order_relaxed)
+#define rb_load_acquire(p) atomic_load_explicit(&(p), memory_order_acquire)
+#define rb_store_release(p, v) atomic_store_explicit(&(p), (v), memory_order_release)
+#elif defined(__GNUC__)
+#define rb_load_relaxed(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rb_load_acquire(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rb_store_release(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define rb_load_relaxed(p) (p)
+#define rb_load_acquire(p) (p)
+#define rb_store_release(p, v) ((p) = (v))
+#endif
+
+/* Size of a huge page; buffers backed by huge pages are rounded up
+   to a multiple of this.  */
+#define RB_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+
+static rb_t *
+rb_struct_alloc (void)
+{
+  rb_t *rb;
+
+#ifdef _WIN32
+  rb = _aligned_malloc (sizeof (rb_t), RB_CACHELINE_SIZE);
+#else
+  if (posix_memalign ((void **)&rb, RB_CACHELINE_SIZE, sizeof (rb_t)) != 0) {
+    rb = NULL;
+  }
+#endif /* _WIN32 */
+  if (rb != NULL) {
+    memset (rb, 0, sizeof (rb_t));
+  }
+  return rb;
+}
+
+static void
+rb_struct_free (rb_t * rb)
+{
+#ifdef _WIN32
+  _aligned_free (rb);
+#else
+  free (rb);
+#endif /* _WIN32 */
+}
+
 /* Create a new ringbuffer to hold at least `sz' bytes of data. The
    actual buffer size is rounded up to the next power of two.  */
 
 rb_t *
 rb_create (size_t sz)
+{
+  return rb_create_ex (sz, 0);
+}
+
+rb_t *
+rb_create_ex (size_t sz, int flags)
 {
   int power_of_two;
   rb_t *rb;
 
-  rb = calloc (1, sizeof (rb_t));
+  if ((rb = rb_struct_alloc ()) == NULL) {
+    return NULL;
+  }
 
   for (power_of_two = 1; 1 << power_of_two < sz; power_of_two++);
 
   rb->size = 1 << power_of_two;
   rb->size_mask = rb->size;
   rb->size_mask -= 1;
-  rb->write_ptr = 0;
-  rb->read_ptr = 0;
-  rb->buf = calloc (1, rb->size);
+  rb_store_release (rb->write_ptr, 0);
+  rb_store_release (rb->read_ptr, 0);
+  rb->buf = NULL;
   rb->mlocked = 0;
+  rb->hugetlb = 0;
+
+#ifdef MAP_HUGETLB
+  if (flags & RB_HUGETLB) {
+    void *map;
+
+    rb->alloc_size = (rb->size + RB_HUGEPAGE_SIZE - 1) & ~((size_t)RB_HUGEPAGE_SIZE - 1);
+    map = mmap (NULL, rb->alloc_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED) {
+      rb->buf = map;
+      rb->hugetlb = 1;
+    }
+  }
+#endif /* MAP_HUGETLB */
+
+  if (rb->buf == NULL) {
+    rb->alloc_size = rb->size;
+    if ((rb->buf = calloc (1, rb->size)) == NULL) {
+      rb_struct_free (rb);
+      return NULL;
+    }
+  }
+
+  if (flags & RB_MLOCK) {
+    rb_mlock (rb);
+  }
 
   return rb;
 }
@@ -59,13 +148,21 @@ rb_create (size_t sz)
 void
 rb_free (rb_t * rb)
 {
-#ifdef USE_MLOCK
+#ifdef HAVE_MLOCK
   if (rb->mlocked) {
     munlock (rb->buf, rb->size);
   }
-#endif /* USE_MLOCK */
+#endif /* HAVE_MLOCK */
+#ifdef MAP_HUGETLB
+  if (rb->hugetlb) {
+    munmap (rb->buf, rb->alloc_size);
+  } else {
+    free (rb->buf);
+  }
+#else
   free (rb->buf);
-  free (rb);
+#endif /* MAP_HUGETLB */
+  rb_struct_free (rb);
 }
 
 /* Lock the data block of `rb' using the system call 'mlock'.  */
@@ -73,13 +170,15 @@ rb_free (rb_t * rb)
 int
 rb_mlock (rb_t * rb)
 {
-#ifdef USE_MLOCK
+#ifdef HAVE_MLOCK
   if (mlock (rb->buf, rb->size)) {
     return -1;
   }
-#endif /* USE_MLOCK */
   rb->mlocked = 1;
   return 0;
+#else
+  return -1;
+#endif /* HAVE_MLOCK */
 }
 
 /* Reset the read and write pointers to zero. This is not thread
@@ -88,8 +187,8 @@ rb_mlock (rb_t * rb)
 void
 rb_reset (rb_t * rb)
 {
-  rb->read_ptr = 0;
-  rb->write_ptr = 0;
+  rb_store_release (rb->read_ptr, 0);
+  rb_store_release (rb->write_ptr, 0);
 }
 
 /* Return the number of bytes available for reading.  This is the
@@ -101,8 +200,8 @@ rb_read_space (const rb_t * rb)
 {
   size_t w, r;
 
-  w = rb->write_ptr;
-  r = rb->read_ptr;
+  w = rb_load_acquire (rb->write_ptr);
+  r = rb_load_acquire (rb->read_ptr);
 
   if (w > r) {
     return w - r;
@@ -120,8 +219,8 @@ rb_write_space (const rb_t * rb)
 {
   size_t w, r;
 
-  w = rb->write_ptr;
-  r = rb->read_ptr;
+  w = rb_load_acquire (rb->write_ptr);
+  r = rb_load_acquire (rb->read_ptr);
 
   if (w > r) {
     return ((r - w + rb->size) & rb->size_mask) - 1;
@@ -133,7 +232,8 @@ rb_write_space (const rb_t * rb)
 }
 
 /* The copying data reader.  Copy at most `cnt' bytes from `rb' to
-   `dest'.  Returns the actual number of bytes copied. */
+   `dest'.  Returns the actual number of bytes copied. The read
+   pointer is published once, after all data has been copied.  */
 
 size_t
 rb_read (rb_t * rb, char *dest, size_t cnt)
@@ -142,6 +242,7 @@ rb_read (rb_t * rb, char *dest, size_t cnt)
   size_t cnt2;
   size_t to_read;
   size_t n1, n2;
+  size_t r;
 
   if ((free_cnt = rb_read_space (rb)) == 0) {
     return 0;
@@ -149,26 +250,24 @@ rb_read (rb_t * rb, char *dest, size_t cnt)
 
   to_read = cnt > free_cnt ? free_cnt : cnt;
 
-  cnt2 = rb->read_ptr + to_read;
+  r = rb_load_relaxed (rb->read_ptr);
+  cnt2 = r + to_read;
 
   if (cnt2 > rb->size) {
-    n1 = rb->size - rb->read_ptr;
+    n1 = rb->size - r;
     n2 = cnt2 & rb->size_mask;
   } else {
     n1 = to_read;
     n2 = 0;
   }
 
-  memcpy (dest, &(rb->buf[rb->read_ptr]), n1);
-  rb->read_ptr += n1;
-  rb->read_ptr &= rb->size_mask;
-
+  memcpy (dest, &(rb->buf[r]), n1);
   if (n2) {
-    memcpy (dest + n1, &(rb->buf[rb->read_ptr]), n2);
-    rb->read_ptr += n2;
-    rb->read_ptr &= rb->size_mask;
+    memcpy (dest + n1, rb->buf, n2);
   }
 
+  rb_store_release (rb->read_ptr, (r + to_read) & rb->size_mask);
+
   return to_read;
 }
 
@@ -185,7 +284,7 @@ rb_peek (rb_t * rb, char *dest, size_t cnt)
   size_t n1, n2;
   size_t tmp_read_ptr;
 
-  tmp_read_ptr = rb->read_ptr;
+  tmp_read_ptr = rb_load_relaxed (rb->read_ptr);
 
   if ((free_cnt = rb_read_space (rb)) == 0) {
     return 0;
@@ -204,13 +303,8 @@ rb_peek (rb_t * rb, char *dest, size_t cnt)
   }
 
   memcpy (dest, &(rb->buf[tmp_read_ptr]), n1);
-  tmp_read_ptr += n1;
-  tmp_read_ptr &= rb->size_mask;
-
   if (n2) {
-    memcpy (dest + n1, &(rb->buf[tmp_read_ptr]), n2);
-    tmp_read_ptr += n2;
-    tmp_read_ptr &= rb->size_mask;
+    memcpy (dest + n1, rb->buf, n2);
   }
 
   return to_read;
@@ -218,7 +312,9 @@ rb_peek (rb_t * rb, char *dest, size_t cnt)
 
 
 /* The copying data writer.  Copy at most `cnt' bytes to `rb' from
-   `src'.  Returns the actual number of bytes copied. */
+   `src'.  Returns the actual number of bytes copied. The write
+   pointer is published once, so the reader never sees a partially
+   written block (e.g. a command without its payload).  */
 
 size_t
 rb_write (rb_t * rb, const char *src, size_t cnt)
@@ -227,6 +323,7 @@ rb_write (rb_t * rb, const char *src, size_t cnt)
   size_t cnt2;
   size_t to_write;
   size_t n1, n2;
+  size_t w;
 
   if ((free_cnt = rb_write_space (rb)) == 0) {
     return 0;
@@ -234,26 +331,24 @@ rb_write (rb_t * rb, const char *src, size_t cnt)
 
   to_write = cnt > free_cnt ? free_cnt : cnt;
 
-  cnt2 = rb->write_ptr + to_write;
+  w = rb_load_relaxed (rb->write_ptr);
+  cnt2 = w + to_write;
 
   if (cnt2 > rb->size) {
-    n1 = rb->size - rb->write_ptr;
+    n1 = rb->size - w;
     n2 = cnt2 & rb->size_mask;
   } else {
     n1 = to_write;
     n2 = 0;
   }
 
-  memcpy (&(rb->buf[rb->write_ptr]), src, n1);
-  rb->write_ptr += n1;
-  rb->write_ptr &= rb->size_mask;
-
+  memcpy (&(rb->buf[w]), src, n1);
   if (n2) {
-    memcpy (&(rb->buf[rb->write_ptr]), src + n1, n2);
-    rb->write_ptr += n2;
-    rb->write_ptr &= rb->size_mask;
+    memcpy (rb->buf, src + n1, n2);
   }
 
+  rb_store_release (rb->write_ptr, (w + to_write) & rb->size_mask);
+
   return to_write;
 }
 
@@ -262,8 +357,9 @@ rb_write (rb_t * rb, const char *src, size_t cnt)
 void
 rb_read_advance (rb_t * rb, size_t cnt)
 {
-  rb->read_ptr += cnt;
-  rb->read_ptr &= rb->size_mask;
+  size_t r = rb_load_relaxed (rb->read_ptr);
+
+  rb_store_release (rb->read_ptr, (r + cnt) & rb->size_mask);
 }
 
 /* Advance the write pointer `cnt' places. */
@@ -271,8 +367,9 @@ rb_read_advance (rb_t * rb, size_t cnt)
 void
 rb_write_advance (rb_t * rb, size_t cnt)
 {
-  rb->write_ptr += cnt;
-  rb->write_ptr &= rb->size_mask;
+  size_t w = rb_load_relaxed (rb->write_ptr);
+
+  rb_store_release (rb->write_ptr, (w + cnt) & rb->size_mask);
 }
 
 /* The non-copying data reader.  `vec' is an array of two places.  Set
@@ -288,8 +385,8 @@ rb_get_read_vector (const rb_t * rb,
   size_t cnt2;
   size_t w, r;
 
-  w = rb->write_ptr;
-  r = rb->read_ptr;
+  w = rb_load_acquire (rb->write_ptr);
+  r = rb_load_acquire (rb->read_ptr);
 
   if (w > r) {
     free_cnt = w - r;
@@ -332,8 +429,8 @@ rb_get_write_vector (const rb_t * rb,
   size_t cnt2;
   size_t w, r;
 
-  w = rb->write_ptr;
-  r = rb->read_ptr;
+  w = rb_load_acquire (rb->write_ptr);
+  r = rb_load_acquire (rb->read_ptr);
 
   if (w > r) {
     free_cnt = ((r - w + rb->size) & rb->size_mask) - 1;
@@ -50,14 +50,42 @@ typedef struct
 } 
 rb_data_t ;
 
+/* The read and write indices are published with acquire/release
+ * semantics: C11 atomics when available, the equivalent GCC builtins
+ * otherwise, plain volatile as a last resort.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define RB_C11_ATOMICS
+typedef atomic_size_t rb_index_t;
+#else
+typedef volatile size_t rb_index_t;
+#endif
+
+/* Each index lives on its own cache line, so that the reader and the
+ * writer do not false-share the line the other one keeps modifying.
+ */
+#define RB_CACHELINE_SIZE 64
+#ifdef __GNUC__
+#define RB_CACHELINE_ALIGNED __attribute__((aligned(RB_CACHELINE_SIZE)))
+#else
+#define RB_CACHELINE_ALIGNED
+#endif
+
+/* Flags for rb_create_ex() */
+#define RB_MLOCK   0x01 /* lock the buffer into memory */
+#define RB_HUGETLB 0x02 /* back the buffer with huge pages, if possible */
+
 typedef struct
 {
   char		 *buf;
-  volatile size_t write_ptr;
-  volatile size_t read_ptr;
   size_t	  size;
   size_t	  size_mask;
+  size_t	  alloc_size;
   int		  mlocked;
+  int		  hugetlb;
+  rb_index_t	  write_ptr RB_CACHELINE_ALIGNED;
+  rb_index_t	  read_ptr RB_CACHELINE_ALIGNED;
 } 
 rb_t ;
 
@@ -73,6 +101,24 @@ rb_t ;
  */
 rb_t *rb_create(size_t sz);
 
+/**
+ * Same as rb_create(), with additional control over how the buffer
+ * memory is obtained.
+ *
+ * If RB_HUGETLB is set in @a flags, the buffer is mapped with huge
+ * pages (MAP_HUGETLB) when the system supports it; otherwise, or if no
+ * huge pages are available, it silently falls back to normal memory.
+ * If RB_MLOCK is set, the buffer is locked with rb_mlock(); a failure
+ * to do so is not fatal and can be checked via the @a mlocked field.
+ *
+ * @param sz the ringbuffer size in bytes.
+ * @param flags a combination of RB_MLOCK and RB_HUGETLB, or 0.
+ *
+ * @return a pointer to a new rb_t, if successful; NULL
+ * otherwise.
+ */
+rb_t *rb_create_ex(size_t sz, int flags);
+
 /**
  * Frees the ringbuffer data structure allocated by an earlier call to
  * rb_create().
@@ -183,6 +229,9 @@ size_t rb_read_space(const rb_t *rb);
  * Uses the mlock() system call.  This is not a realtime operation.
  *
  * @param rb a pointer to the ringbuffer structure.
+ *
+ * @return 0 if the buffer was locked, -1 if mlock() failed or is not
+ * available on this system.
  */
 int rb_mlock(rb_t *rb);
 
@@ -0,0 +1,156 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#include <config.h>
+
+#ifdef HAVE_SRC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <samplerate.h>
+
+#include "resampler.h"
+
+
+resampler_t *
+resampler_new(int channels) {
+
+	resampler_t * r;
+
+	if ((r = (resampler_t *)calloc(1, sizeof(resampler_t))) == NULL) {
+		fprintf(stderr, "resampler_new(): calloc error\n");
+		return NULL;
+	}
+
+	r->channels = channels;
+	r->ratio = 1.0;
+	return r;
+}
+
+
+void
+resampler_delete(resampler_t * r) {
+
+	int i;
+
+	for (i = 0; i < RESAMPLER_N_STATES; i++) {
+		if (r->slots[i].state != NULL) {
+			src_delete(r->slots[i].state);
+		}
+	}
+	free(r);
+}
+
+
+int
+resampler_select(resampler_t * r, int src_type, unsigned long in_SR, unsigned long out_SR) {
+
+	resampler_slot_t * slot = NULL;
+	int error;
+	int i;
+
+	r->ratio = (double)out_SR / (double)in_SR;
+
+	if ((r->current != NULL) &&
+	    (r->current->src_type == src_type) && (r->current->in_SR == in_SR)) {
+		r->current->last_used = ++r->clock;
+		return 0;
+	}
+
+	for (i = 0; i < RESAMPLER_N_STATES; i++) {
+		if ((r->slots[i].state != NULL) &&
+		    (r->slots[i].src_type == src_type) && (r->slots[i].in_SR == in_SR)) {
+			slot = &r->slots[i];
+			/* the stream is discontinuous, start from clean history */
+			src_reset(slot->state);
+			break;
+		}
+	}
+
+	if (slot == NULL) {
+		/* take a free slot, or evict the least recently used one */
+		slot = &r->slots[0];
+		for (i = 0; i < RESAMPLER_N_STATES; i++) {
+			if (r->slots[i].state == NULL) {
+				slot = &r->slots[i];
+				break;
+			}
+			if (r->slots[i].last_used < slot->last_used) {
+				slot = &r->slots[i];
+			}
+		}
+
+		if (slot->state != NULL) {
+			src_delete(slot->state);
+		}
+		if ((slot->state = src_new(src_type, r->channels, &error)) == NULL) {
+			fprintf(stderr, "resampler_select(): src_new() failed: %s.\n",
+				src_strerror(error));
+			r->current = NULL;
+			return -1;
+		}
+		slot->src_type = src_type;
+		slot->in_SR = in_SR;
+	}
+
+	slot->last_used = ++r->clock;
+	r->current = slot;
+	return 0;
+}
+
+
+void
+resampler_reset(resampler_t * r) {
+
+	if (r->current != NULL) {
+		src_reset(r->current->state);
+	}
+}
+
+
+long
+resampler_process(resampler_t * r, float * in, long in_frames, float * out, long out_frames) {
+
+	SRC_DATA src_data;
+	int error;
+
+	if (r->current == NULL) {
+		return -1;
+	}
+
+	src_data.data_in = in;
+	src_data.input_frames = in_frames;
+	src_data.data_out = out;
+	src_data.output_frames = out_frames;
+	src_data.src_ratio = r->ratio;
+	src_data.end_of_input = 0;
+
+	if ((error = src_process(r->current->state, &src_data))) {
+		fprintf(stderr, "resampler_process(): SRC error: %s\n", src_strerror(error));
+		return -1;
+	}
+
+	return src_data.output_frames_gen;
+}
+
+
+#endif /* HAVE_SRC */
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -0,0 +1,75 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#ifndef AQUALUNG_RESAMPLER_H
+#define AQUALUNG_RESAMPLER_H
+
+#include <config.h>
+
+#ifdef HAVE_SRC
+
+#include <samplerate.h>
+
+
+/* Sample rate converter stage of the disk thread. It keeps one SRC
+   state per (converter type, input rate) pair, up to RESAMPLER_N_STATES
+   of them, and evicts the least recently used one when a new pair is
+   needed. Consecutive tracks at the same rate keep using the same state
+   without interruption; going back to a cached rate only resets the
+   state instead of allocating a new one. */
+
+#define RESAMPLER_N_STATES 4
+
+typedef struct {
+	SRC_STATE * state;
+	int src_type;
+	unsigned long in_SR;
+	unsigned long last_used;
+} resampler_slot_t;
+
+typedef struct {
+	int channels;
+	unsigned long clock;
+	resampler_slot_t * current;
+	resampler_slot_t slots[RESAMPLER_N_STATES];
+	double ratio; /* output rate / input rate of the current state */
+} resampler_t;
+
+
+resampler_t * resampler_new(int channels);
+void resampler_delete(resampler_t * r);
+
+/* make the converter for this type and rate pair current;
+   returns 0 on success, -1 on error */
+int resampler_select(resampler_t * r, int src_type, unsigned long in_SR, unsigned long out_SR);
+
+/* drop the history of the current converter (e.g. after a seek) */
+void resampler_reset(resampler_t * r);
+
+/* convert in_frames frames from in to at most out_frames frames in out;
+   returns the number of frames generated, or -1 on error */
+long resampler_process(resampler_t * r, float * in, long in_frames, float * out, long out_frames);
+
+
+#endif /* HAVE_SRC */
+
+#endif /* AQUALUNG_RESAMPLER_H */
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -0,0 +1,826 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#include <config.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "sample_conv.h"
+
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SAMPLE_CONV_X86
+#include <immintrin.h>
+#endif /* x86 && gcc >= 4.9 */
+
+
+#define S16_SCALE 32767.0f
+#define S32_SCALE 2147483647.0f
+#define S32_MAX_F 2147483520.0f /* largest float below 2^31 */
+#define U32_NORM  (1.0f / 4294967296.0f)
+#define M3DB      0.70710678f /* -3 dB */
+
+
+/* xorshift32 state for the dither generator, one word per SIMD lane */
+static unsigned int dither_state[8] = {
+	0x9e3779b9, 0x7f4a7c15, 0xf39cc060, 0x5ced1bd3,
+	0x2545f491, 0x4f6cdd1d, 0x94d049bb, 0xbf58476d
+};
+
+/* Left and right weights of each input channel for the stereo downmix,
+   by channel count. The channels are in WAVE order; 3: FL FR FC,
+   4: FL FR BL BR, 5: FL FR FC BL BR, 6: 5.1, 7: 6.1 (FL FR FC LFE BC
+   SL SR), 8: 7.1. */
+static const float downmix_weights[SAMPLE_CONV_MAX_CHANNELS + 1][SAMPLE_CONV_MAX_CHANNELS][2] = {
+	[3] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, M3DB} },
+	[4] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, 0.0f}, {0.0f, M3DB} },
+	[5] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, M3DB}, {M3DB, 0.0f}, {0.0f, M3DB} },
+	[6] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, M3DB}, {0.0f, 0.0f},
+		{M3DB, 0.0f}, {0.0f, M3DB} },
+	[7] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, M3DB}, {0.0f, 0.0f},
+		{0.5f, 0.5f}, {M3DB, 0.0f}, {0.0f, M3DB} },
+	[8] = { {1.0f, 0.0f}, {0.0f, 1.0f}, {M3DB, M3DB}, {0.0f, 0.0f},
+		{M3DB, 0.0f}, {0.0f, M3DB}, {M3DB, 0.0f}, {0.0f, M3DB} },
+};
+
+static void (* conv_mono_to_stereo)(float * src, float * dest, int n);
+static void (* conv_51_to_stereo)(float * src, float * dest, int n);
+static void (* conv_deinterleave)(float * src, float * l, float * r, int n);
+static void (* conv_to_s16)(float * l, float * r, short * dest, int n, int dither);
+static void (* conv_to_s32)(float * l, float * r, int * dest, int n);
+static void (* conv_planar_s32_to_float)(const int * const * src, int channels, int offset,
+					 float * dest, int n, float gain);
+static void (* conv_planar_float_gain)(const float * const * src, int channels, int offset,
+				      float * dest, int n, float gain);
+static void (* conv_s16_to_float)(const short * src, float * dest, int n, float gain);
+static void (* conv_s32_to_float)(const int * src, float * dest, int n, float gain);
+static void (* conv_float_gain)(const float * src, float * dest, int n, float gain);
+
+
+static inline float
+clip(float x) {
+
+	if (x > 1.0f) {
+		return 1.0f;
+	} else if (x < -1.0f) {
+		return -1.0f;
+	}
+	return x;
+}
+
+/* uniform in [-0.5, 0.5) */
+static inline float
+dither_uniform(void) {
+
+	unsigned int x = dither_state[0];
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	dither_state[0] = x;
+
+	return (float)(int)x * U32_NORM;
+}
+
+static inline short
+float_to_s16(float x, float d) {
+
+	float y = floorf(S16_SCALE * clip(x) + d);
+
+	if (y > 32767.0f) {
+		return 32767;
+	} else if (y < -32768.0f) {
+		return -32768;
+	}
+	return (short)y;
+}
+
+static inline int
+float_to_s32(float x) {
+
+	float y = S32_SCALE * clip(x);
+
+	if (y > S32_MAX_F) {
+		y = S32_MAX_F;
+	}
+	return (int)floorf(y);
+}
+
+
+static void
+conv_mono_to_stereo_c(float * src, float * dest, int n) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dest[2*i] = dest[2*i+1] = src[i];
+	}
+}
+
+static void
+conv_51_to_stereo_c(float * src, float * dest, int n) {
+
+	const float norm = 1.0f / (1.0f + 2.0f * M3DB);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float * f = src + 6*i;
+		float c = M3DB * f[2];
+		dest[2*i] = norm * (f[0] + c + M3DB * f[4]);
+		dest[2*i+1] = norm * (f[1] + c + M3DB * f[5]);
+	}
+}
+
+/* any other layout in downmix_weights */
+static void
+conv_matrix_to_stereo_c(float * src, float * dest, int channels, int n) {
+
+	const float (* w)[2] = downmix_weights[channels];
+	float norm_l = 0.0f;
+	float norm_r = 0.0f;
+	int i, ch;
+
+	for (ch = 0; ch < channels; ch++) {
+		norm_l += w[ch][0];
+		norm_r += w[ch][1];
+	}
+	norm_l = 1.0f / norm_l;
+	norm_r = 1.0f / norm_r;
+
+	for (i = 0; i < n; i++) {
+		float l = 0.0f;
+		float r = 0.0f;
+		for (ch = 0; ch < channels; ch++) {
+			l += w[ch][0] * src[ch];
+			r += w[ch][1] * src[ch];
+		}
+		dest[2*i] = norm_l * l;
+		dest[2*i+1] = norm_r * r;
+		src += channels;
+	}
+}
+
+static void
+conv_deinterleave_c(float * src, float * l, float * r, int n) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		l[i] = src[2*i];
+		r[i] = src[2*i+1];
+	}
+}
+
+static void
+conv_to_s16_c(float * l, float * r, short * dest, int n, int dither) {
+
+	int i;
+
+	if (dither) {
+		for (i = 0; i < n; i++) {
+			float dl = dither_uniform() - dither_uniform();
+			float dr = dither_uniform() - dither_uniform();
+			dest[2*i] = float_to_s16(l[i], dl);
+			dest[2*i+1] = float_to_s16(r[i], dr);
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			dest[2*i] = float_to_s16(l[i], 0.0f);
+			dest[2*i+1] = float_to_s16(r[i], 0.0f);
+		}
+	}
+}
+
+static void
+conv_to_s32_c(float * l, float * r, int * dest, int n) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dest[2*i] = float_to_s32(l[i]);
+		dest[2*i+1] = float_to_s32(r[i]);
+	}
+}
+
+static void
+conv_planar_s32_to_float_c(const int * const * src, int channels, int offset,
+			   float * dest, int n, float gain) {
+
+	int i, ch;
+
+	for (i = offset; i < offset + n; i++) {
+		for (ch = 0; ch < channels; ch++) {
+			*dest++ = (float)src[ch][i] * gain;
+		}
+	}
+}
+
+static void
+conv_planar_float_gain_c(const float * const * src, int channels, int offset,
+			 float * dest, int n, float gain) {
+
+	int i, ch;
+
+	for (i = offset; i < offset + n; i++) {
+		for (ch = 0; ch < channels; ch++) {
+			*dest++ = clip(src[ch][i] * gain);
+		}
+	}
+}
+
+static void
+conv_s16_to_float_c(const short * src, float * dest, int n, float gain) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dest[i] = (float)src[i] * gain;
+	}
+}
+
+static void
+conv_s32_to_float_c(const int * src, float * dest, int n, float gain) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dest[i] = clip((float)src[i] * gain);
+	}
+}
+
+static void
+conv_float_gain_c(const float * src, float * dest, int n, float gain) {
+
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dest[i] = clip(src[i] * gain);
+	}
+}
+
+
+#ifdef SAMPLE_CONV_X86
+
+/* SSE2 has no floor instruction: truncate, then correct the negative
+   non-integers that were rounded up. */
+__attribute__((target("sse2")))
+static inline __m128i
+floor_epi32_sse2(__m128 x) {
+
+	__m128i t = _mm_cvttps_epi32(x);
+	__m128 mask = _mm_cmpgt_ps(_mm_cvtepi32_ps(t), x);
+
+	return _mm_add_epi32(t, _mm_castps_si128(mask));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+xorshift_sse2(__m128i x) {
+
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+__attribute__((target("sse2")))
+static inline __m128
+tpdf_sse2(__m128i * st) {
+
+	__m128 norm = _mm_set1_ps(U32_NORM);
+	__m128 a, b;
+
+	*st = xorshift_sse2(*st);
+	a = _mm_cvtepi32_ps(*st);
+	*st = xorshift_sse2(*st);
+	b = _mm_cvtepi32_ps(*st);
+
+	return _mm_mul_ps(_mm_sub_ps(a, b), norm);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_mono_to_stereo_sse2(float * src, float * dest, int n) {
+
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 m = _mm_loadu_ps(src + i);
+		_mm_storeu_ps(dest + 2*i, _mm_unpacklo_ps(m, m));
+		_mm_storeu_ps(dest + 2*i + 4, _mm_unpackhi_ps(m, m));
+	}
+
+	conv_mono_to_stereo_c(src + i, dest + 2*i, n - i);
+}
+
+/* Two 5.1 frames (a, b) fill three vectors: a0 a1 a2 a3 | a4 a5 b0 b1 |
+   b2 b3 b4 b5; gather the fronts, centres and backs of both frames so
+   that one multiply-add yields L R L R. */
+__attribute__((target("sse2")))
+static void
+conv_51_to_stereo_sse2(float * src, float * dest, int n) {
+
+	__m128 k = _mm_set1_ps(M3DB);
+	__m128 norm = _mm_set1_ps(1.0f / (1.0f + 2.0f * M3DB));
+	int i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128 v0 = _mm_loadu_ps(src + 6*i);
+		__m128 v1 = _mm_loadu_ps(src + 6*i + 4);
+		__m128 v2 = _mm_loadu_ps(src + 6*i + 8);
+		__m128 front = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 2, 1, 0));
+		__m128 centre = _mm_shuffle_ps(v0, v2, _MM_SHUFFLE(0, 0, 2, 2));
+		__m128 back = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(3, 2, 1, 0));
+		__m128 out = _mm_add_ps(front, _mm_mul_ps(k, _mm_add_ps(centre, back)));
+		_mm_storeu_ps(dest + 2*i, _mm_mul_ps(norm, out));
+	}
+
+	conv_51_to_stereo_c(src + 6*i, dest + 2*i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_deinterleave_sse2(float * src, float * l, float * r, int n) {
+
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 a = _mm_loadu_ps(src + 2*i);
+		__m128 b = _mm_loadu_ps(src + 2*i + 4);
+		_mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+
+	conv_deinterleave_c(src + 2*i, l + i, r + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_to_s16_sse2(float * l, float * r, short * dest, int n, int dither) {
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 mone = _mm_set1_ps(-1.0f);
+	__m128 scale = _mm_set1_ps(S16_SCALE);
+	__m128i st = _mm_loadu_si128((__m128i *)dither_state);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+
+		__m128 vl = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(l + i), one), mone);
+		__m128 vr = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(r + i), one), mone);
+		__m128i il, ir;
+
+		vl = _mm_mul_ps(vl, scale);
+		vr = _mm_mul_ps(vr, scale);
+		if (dither) {
+			vl = _mm_add_ps(vl, tpdf_sse2(&st));
+			vr = _mm_add_ps(vr, tpdf_sse2(&st));
+		}
+		il = floor_epi32_sse2(vl);
+		ir = floor_epi32_sse2(vr);
+
+		/* interleave and saturate to 16 bits */
+		_mm_storeu_si128((__m128i *)(dest + 2*i),
+				 _mm_packs_epi32(_mm_unpacklo_epi32(il, ir),
+						 _mm_unpackhi_epi32(il, ir)));
+	}
+
+	_mm_storeu_si128((__m128i *)dither_state, st);
+	conv_to_s16_c(l + i, r + i, dest + 2*i, n - i, dither);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_to_s32_sse2(float * l, float * r, int * dest, int n) {
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 mone = _mm_set1_ps(-1.0f);
+	__m128 scale = _mm_set1_ps(S32_SCALE);
+	__m128 top = _mm_set1_ps(S32_MAX_F);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+
+		__m128 vl = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(l + i), one), mone);
+		__m128 vr = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(r + i), one), mone);
+		__m128i il, ir;
+
+		il = floor_epi32_sse2(_mm_min_ps(_mm_mul_ps(vl, scale), top));
+		ir = floor_epi32_sse2(_mm_min_ps(_mm_mul_ps(vr, scale), top));
+
+		_mm_storeu_si128((__m128i *)(dest + 2*i), _mm_unpacklo_epi32(il, ir));
+		_mm_storeu_si128((__m128i *)(dest + 2*i + 4), _mm_unpackhi_epi32(il, ir));
+	}
+
+	conv_to_s32_c(l + i, r + i, dest + 2*i, n - i);
+}
+
+/* mono and stereo are vectorized, other layouts fall back to C */
+__attribute__((target("sse2")))
+static void
+conv_planar_s32_to_float_sse2(const int * const * src, int channels, int offset,
+			      float * dest, int n, float gain) {
+
+	__m128 g = _mm_set1_ps(gain);
+	int i = 0;
+
+	if (channels == 1) {
+		const int * m = src[0] + offset;
+		for (; i + 4 <= n; i += 4) {
+			__m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(m + i)));
+			_mm_storeu_ps(dest + i, _mm_mul_ps(v, g));
+		}
+	} else if (channels == 2) {
+		const int * l = src[0] + offset;
+		const int * r = src[1] + offset;
+		for (; i + 4 <= n; i += 4) {
+			__m128 vl = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(l + i)));
+			__m128 vr = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(r + i)));
+			vl = _mm_mul_ps(vl, g);
+			vr = _mm_mul_ps(vr, g);
+			_mm_storeu_ps(dest + 2*i, _mm_unpacklo_ps(vl, vr));
+			_mm_storeu_ps(dest + 2*i + 4, _mm_unpackhi_ps(vl, vr));
+		}
+	}
+
+	conv_planar_s32_to_float_c(src, channels, offset + i, dest + channels * i, n - i, gain);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_planar_float_gain_sse2(const float * const * src, int channels, int offset,
+			    float * dest, int n, float gain) {
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 mone = _mm_set1_ps(-1.0f);
+	__m128 g = _mm_set1_ps(gain);
+	int i = 0;
+
+	if (channels == 1) {
+		const float * m = src[0] + offset;
+		for (; i + 4 <= n; i += 4) {
+			__m128 v = _mm_mul_ps(_mm_loadu_ps(m + i), g);
+			_mm_storeu_ps(dest + i, _mm_max_ps(_mm_min_ps(v, one), mone));
+		}
+	} else if (channels == 2) {
+		const float * l = src[0] + offset;
+		const float * r = src[1] + offset;
+		for (; i + 4 <= n; i += 4) {
+			__m128 vl = _mm_mul_ps(_mm_loadu_ps(l + i), g);
+			__m128 vr = _mm_mul_ps(_mm_loadu_ps(r + i), g);
+			vl = _mm_max_ps(_mm_min_ps(vl, one), mone);
+			vr = _mm_max_ps(_mm_min_ps(vr, one), mone);
+			_mm_storeu_ps(dest + 2*i, _mm_unpacklo_ps(vl, vr));
+			_mm_storeu_ps(dest + 2*i + 4, _mm_unpackhi_ps(vl, vr));
+		}
+	}
+
+	conv_planar_float_gain_c(src, channels, offset + i, dest + channels * i, n - i, gain);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_s16_to_float_sse2(const short * src, float * dest, int n, float gain) {
+
+	__m128 g = _mm_set1_ps(gain);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		/* each sample lands in the upper half of a 32-bit word;
+		   the arithmetic shift sign-extends it */
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+		_mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+	}
+
+	conv_s16_to_float_c(src + i, dest + i, n - i, gain);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_s32_to_float_sse2(const int * src, float * dest, int n, float gain) {
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 mone = _mm_set1_ps(-1.0f);
+	__m128 g = _mm_set1_ps(gain);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i)));
+		v = _mm_mul_ps(v, g);
+		_mm_storeu_ps(dest + i, _mm_max_ps(_mm_min_ps(v, one), mone));
+	}
+
+	conv_s32_to_float_c(src + i, dest + i, n - i, gain);
+}
+
+__attribute__((target("sse2")))
+static void
+conv_float_gain_sse2(const float * src, float * dest, int n, float gain) {
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 mone = _mm_set1_ps(-1.0f);
+	__m128 g = _mm_set1_ps(gain);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+		_mm_storeu_ps(dest + i, _mm_max_ps(_mm_min_ps(v, one), mone));
+	}
+
+	conv_float_gain_c(src + i, dest + i, n - i, gain);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i
+xorshift_avx2(__m256i x) {
+
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+__attribute__((target("avx2")))
+static inline __m256
+tpdf_avx2(__m256i * st) {
+
+	__m256 norm = _mm256_set1_ps(U32_NORM);
+	__m256 a, b;
+
+	*st = xorshift_avx2(*st);
+	a = _mm256_cvtepi32_ps(*st);
+	*st = xorshift_avx2(*st);
+	b = _mm256_cvtepi32_ps(*st);
+
+	return _mm256_mul_ps(_mm256_sub_ps(a, b), norm);
+}
+
+__attribute__((target("avx2")))
+static void
+conv_mono_to_stereo_avx2(float * src, float * dest, int n) {
+
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 m = _mm256_loadu_ps(src + i);
+		/* in-lane unpack yields m0 m0 m1 m1 | m4 m4 m5 m5 and
+		   m2 m2 m3 m3 | m6 m6 m7 m7; recombine the lanes */
+		__m256 lo = _mm256_unpacklo_ps(m, m);
+		__m256 hi = _mm256_unpackhi_ps(m, m);
+		_mm256_storeu_ps(dest + 2*i, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(dest + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+
+	conv_mono_to_stereo_c(src + i, dest + 2*i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+conv_deinterleave_avx2(float * src, float * l, float * r, int n) {
+
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_loadu_ps(src + 2*i);
+		__m256 b = _mm256_loadu_ps(src + 2*i + 8);
+		/* in-lane shuffle yields l0 l1 l4 l5 | l2 l3 l6 l7,
+		   swapping the middle 64-bit pairs restores the order */
+		__m256 vl = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 vr = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		vl = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(vl), _MM_SHUFFLE(3, 1, 2, 0)));
+		vr = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(vr), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_ps(l + i, vl);
+		_mm256_storeu_ps(r + i, vr);
+	}
+
+	conv_deinterleave_c(src + 2*i, l + i, r + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+conv_to_s16_avx2(float * l, float * r, short * dest, int n, int dither) {
+
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 mone = _mm256_set1_ps(-1.0f);
+	__m256 scale = _mm256_set1_ps(S16_SCALE);
+	__m256i st = _mm256_loadu_si256((__m256i *)dither_state);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+
+		__m256 vl = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(l + i), one), mone);
+		__m256 vr = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(r + i), one), mone);
+		__m256i il, ir;
+
+		vl = _mm256_mul_ps(vl, scale);
+		vr = _mm256_mul_ps(vr, scale);
+		if (dither) {
+			vl = _mm256_add_ps(vl, tpdf_avx2(&st));
+			vr = _mm256_add_ps(vr, tpdf_avx2(&st));
+		}
+		il = _mm256_cvttps_epi32(_mm256_floor_ps(vl));
+		ir = _mm256_cvttps_epi32(_mm256_floor_ps(vr));
+
+		/* unpack and pack both work within 128-bit lanes, which
+		   happens to leave the frames in order */
+		_mm256_storeu_si256((__m256i *)(dest + 2*i),
+				    _mm256_packs_epi32(_mm256_unpacklo_epi32(il, ir),
+						       _mm256_unpackhi_epi32(il, ir)));
+	}
+
+	_mm256_storeu_si256((__m256i *)dither_state, st);
+	conv_to_s16_c(l + i, r + i, dest + 2*i, n - i, dither);
+}
+
+__attribute__((target("avx2")))
+static void
+conv_to_s32_avx2(float * l, float * r, int * dest, int n) {
+
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 mone = _mm256_set1_ps(-1.0f);
+	__m256 scale = _mm256_set1_ps(S32_SCALE);
+	__m256 top = _mm256_set1_ps(S32_MAX_F);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+
+		__m256 vl = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(l + i), one), mone);
+		__m256 vr = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(r + i), one), mone);
+		__m256i il, ir, lo, hi;
+
+		il = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_min_ps(_mm256_mul_ps(vl, scale), top)));
+		ir = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_min_ps(_mm256_mul_ps(vr, scale), top)));
+
+		lo = _mm256_unpacklo_epi32(il, ir);
+		hi = _mm256_unpackhi_epi32(il, ir);
+		_mm256_storeu_si256((__m256i *)(dest + 2*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dest + 2*i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	conv_to_s32_c(l + i, r + i, dest + 2*i, n - i);
+}
+
+#endif /* SAMPLE_CONV_X86 */
+
+
+void
+sample_conv_init(void) {
+
+	conv_mono_to_stereo = conv_mono_to_stereo_c;
+	conv_51_to_stereo = conv_51_to_stereo_c;
+	conv_deinterleave = conv_deinterleave_c;
+	conv_to_s16 = conv_to_s16_c;
+	conv_to_s32 = conv_to_s32_c;
+	conv_planar_s32_to_float = conv_planar_s32_to_float_c;
+	conv_planar_float_gain = conv_planar_float_gain_c;
+	conv_s16_to_float = conv_s16_to_float_c;
+	conv_s32_to_float = conv_s32_to_float_c;
+	conv_float_gain = conv_float_gain_c;
+
+#ifdef SAMPLE_CONV_X86
+	__builtin_cpu_init();
+	/* the decoder side conversions are memory bound, SSE2 will do */
+	if (__builtin_cpu_supports("sse2")) {
+		conv_planar_s32_to_float = conv_planar_s32_to_float_sse2;
+		conv_planar_float_gain = conv_planar_float_gain_sse2;
+		conv_s16_to_float = conv_s16_to_float_sse2;
+		conv_s32_to_float = conv_s32_to_float_sse2;
+		conv_float_gain = conv_float_gain_sse2;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		conv_mono_to_stereo = conv_mono_to_stereo_avx2;
+		conv_51_to_stereo = conv_51_to_stereo_sse2;
+		conv_deinterleave = conv_deinterleave_avx2;
+		conv_to_s16 = conv_to_s16_avx2;
+		conv_to_s32 = conv_to_s32_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		conv_mono_to_stereo = conv_mono_to_stereo_sse2;
+		conv_51_to_stereo = conv_51_to_stereo_sse2;
+		conv_deinterleave = conv_deinterleave_sse2;
+		conv_to_s16 = conv_to_s16_sse2;
+		conv_to_s32 = conv_to_s32_sse2;
+	}
+#endif /* SAMPLE_CONV_X86 */
+}
+
+
+void
+sample_conv_to_stereo(float * src, float * dest, int channels, int n) {
+
+	if (conv_mono_to_stereo == NULL) {
+		sample_conv_init();
+	}
+
+	switch (channels) {
+	case 1:
+		conv_mono_to_stereo(src, dest, n);
+		break;
+	case 2:
+		memcpy(dest, src, 2 * n * sizeof(float));
+		break;
+	case 6:
+		conv_51_to_stereo(src, dest, n);
+		break;
+	default:
+		conv_matrix_to_stereo_c(src, dest, channels, n);
+		break;
+	}
+}
+
+void
+sample_conv_deinterleave(float * src, float * l, float * r, int n) {
+
+	if (conv_deinterleave == NULL) {
+		sample_conv_init();
+	}
+	conv_deinterleave(src, l, r, n);
+}
+
+void
+sample_conv_to_s16(float * l, float * r, short * dest, int n, int dither) {
+
+	if (conv_to_s16 == NULL) {
+		sample_conv_init();
+	}
+	conv_to_s16(l, r, dest, n, dither);
+}
+
+void
+sample_conv_to_s32(float * l, float * r, int * dest, int n) {
+
+	if (conv_to_s32 == NULL) {
+		sample_conv_init();
+	}
+	conv_to_s32(l, r, dest, n);
+}
+
+void
+sample_conv_planar_s32_to_float(const int * const * src, int channels, int offset,
+				float * dest, int n, float gain) {
+
+	if (conv_planar_s32_to_float == NULL) {
+		sample_conv_init();
+	}
+	conv_planar_s32_to_float(src, channels, offset, dest, n, gain);
+}
+
+void
+sample_conv_planar_float_gain(const float * const * src, int channels, int offset,
+			      float * dest, int n, float gain) {
+
+	if (conv_planar_float_gain == NULL) {
+		sample_conv_init();
+	}
+	conv_planar_float_gain(src, channels, offset, dest, n, gain);
+}
+
+void
+sample_conv_s16_to_float(const short * src, float * dest, int n, float gain) {
+
+	if (conv_s16_to_float == NULL) {
+		sample_conv_init();
+	}
+	conv_s16_to_float(src, dest, n, gain);
+}
+
+void
+sample_conv_s32_to_float(const int * src, float * dest, int n, float gain) {
+
+	if (conv_s32_to_float == NULL) {
+		sample_conv_init();
+	}
+	conv_s32_to_float(src, dest, n, gain);
+}
+
+void
+sample_conv_float_gain(const float * src, float * dest, int n, float gain) {
+
+	if (conv_float_gain == NULL) {
+		sample_conv_init();
+	}
+	conv_float_gain(src, dest, n, gain);
+}
+
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -0,0 +1,67 @@
+/*                                                     -*- linux-c -*-
+    Copyright (C) 2007 Tom Szilagyi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+    $Id$
+*/
+
+#ifndef AQUALUNG_SAMPLE_CONV_H
+#define AQUALUNG_SAMPLE_CONV_H
+
+
+/* Conversion between the interleaved float stream carried by the
+   ringbuffer, the planar float output buffers (l_buf, r_buf) and the
+   interleaved integer samples for the output drivers. Integer output is
+   clipped to [-1.0, 1.0]. The implementation is picked at runtime according to
+   the capabilities of the CPU (AVX2, SSE2 or plain C). */
+
+void sample_conv_init(void);
+
+/* Mix n interleaved frames of 1 to SAMPLE_CONV_MAX_CHANNELS channels
+   in WAVE channel order (FL FR FC LFE BL BR SL SR) down to interleaved
+   stereo. Mono is copied to both sides; for more than two channels the
+   centre and surrounds are folded in at -3 dB, the LFE is dropped and
+   the result is scaled so that it cannot clip. src and dest must not
+   overlap. */
+#define SAMPLE_CONV_MAX_CHANNELS 8
+
+void sample_conv_to_stereo(float * src, float * dest, int channels, int n);
+
+/* split n interleaved stereo frames into two planar buffers */
+void sample_conv_deinterleave(float * src, float * l, float * r, int n);
+
+/* dither != 0 adds TPDF dither of +/- 1 LSB before quantization */
+void sample_conv_to_s16(float * l, float * r, short * dest, int n, int dither);
+void sample_conv_to_s32(float * l, float * r, int * dest, int n);
+
+/* Decoder side: convert n frames of channels planar samples, starting
+   at index offset of each plane, to interleaved float, multiplied by
+   gain. The float variant clips the result to [-1.0, 1.0]. */
+void sample_conv_planar_s32_to_float(const int * const * src, int channels, int offset,
+				     float * dest, int n, float gain);
+void sample_conv_planar_float_gain(const float * const * src, int channels, int offset,
+				   float * dest, int n, float gain);
+
+/* Convert n interleaved samples to float, multiplied by gain. The s32
+   and float variants clip the result to [-1.0, 1.0]. */
+void sample_conv_s16_to_float(const short * src, float * dest, int n, float gain);
+void sample_conv_s32_to_float(const int * src, float * dest, int n, float gain);
+void sample_conv_float_gain(const float * src, float * dest, int n, float gain);
+
+
+#endif /* AQUALUNG_SAMPLE_CONV_H */
+
+// vim: shiftwidth=8:tabstop=8:softtabstop=8 :  
@@ -68,6 +68,10 @@ int record_yes;
 int track_yes;
 int comment_yes;
 
+static guint search_typing_tag = 0;
+
+static void search_index_free(void);
+
 static void
 get_toggle_buttons_state(void) {
 
@@ -114,7 +118,13 @@ close_button_clicked(GtkWidget * widget, gpointer data) {
                           (artist_yes * SEARCH_F_AN) | (record_yes * SEARCH_F_RT) | (track_yes * SEARCH_F_TT) |
                           (comment_yes * SEARCH_F_CO);
 
+	if (search_typing_tag != 0) {
+		g_source_remove(search_typing_tag);
+		search_typing_tag = 0;
+	}
+
 	clear_search_store();
+	search_index_free();
         gtk_widget_destroy(search_window);
         search_window = NULL;
         return TRUE;
@@ -129,7 +139,13 @@ search_window_close(GtkWidget * widget, gpointer * data) {
                           (artist_yes * SEARCH_F_AN) | (record_yes * SEARCH_F_RT) | (track_yes * SEARCH_F_TT) |
                           (comment_yes * SEARCH_F_CO);
 
+	if (search_typing_tag != 0) {
+		g_source_remove(search_typing_tag);
+		search_typing_tag = 0;
+	}
+
 	clear_search_store();
+	search_index_free();
         search_window = NULL;
         return 0;
 }
@@ -154,48 +170,152 @@ sfac_clicked(GtkWidget * widget, gpointer data) {
         return TRUE;
 }
 
-static gint
-search_button_clicked(GtkWidget * widget, gpointer data) {
+/* Casefolded trigram index over the file type stores. It is rebuilt
+ * lazily by the first search after the store has changed, so typing
+ * into the key entry only costs a few posting list intersections.
+ * Postings are entry indices shifted left by one, the low bit set
+ * for hits in the comment field.
+ */
 
-	int valid;
-	const char * key_string = gtk_entry_get_text(GTK_ENTRY(searchkey_entry));
-	char key[MAXLEN];
-	GPatternSpec * pattern;
+typedef struct {
+	GtkTreeIter iter;
+	int level;		/* 1: artist, 2: record, 3: track */
+	int parent;		/* index of the parent entry or -1 */
+	char * name;
+	char * name_fold;
+	char * comment;
+	char * comment_fold;
+} search_entry_t;
 
-	int h, i, j, k;
-	GtkTreeIter store_iter;
-	GtkTreeIter artist_iter;
-	GtkTreeIter record_iter;
-	GtkTreeIter track_iter;
-	GtkTreeIter sfac_iter;
+#define SEARCH_TRIGRAM(s) ((((guint)(guchar)(s)[0]) << 16) | \
+			   (((guint)(guchar)(s)[1]) << 8) |  \
+			   ((guint)(guchar)(s)[2]))
 
-        get_toggle_buttons_state();
+#define SEARCH_TYPING_DELAY 200
 
-	clear_search_store();
+static GArray * search_entries = NULL;
+static GHashTable * search_trigrams = NULL;
+static int search_index_valid = 0;
+static int search_index_connected = 0;
 
-	valid = 0;
-	for (i = 0; key_string[i] != '\0'; i++) {
-		if ((key_string[i] != '?') && (key_string[i] != '*')) {
-			valid = 1;
-			break;
+
+static void
+search_posting_free(gpointer data) {
+
+	g_array_free((GArray *)data, TRUE);
+}
+
+static void
+search_index_free(void) {
+
+	guint i;
+
+	if (search_entries != NULL) {
+		for (i = 0; i < search_entries->len; i++) {
+			search_entry_t * entry = &g_array_index(search_entries, search_entry_t, i);
+			g_free(entry->name);
+			g_free(entry->name_fold);
+			g_free(entry->comment);
+			g_free(entry->comment_fold);
 		}
+		g_array_free(search_entries, TRUE);
+		search_entries = NULL;
 	}
-	if (!valid) {
-		return TRUE;
+
+	if (search_trigrams != NULL) {
+		g_hash_table_destroy(search_trigrams);
+		search_trigrams = NULL;
 	}
 
-	if (!casesens) {
-		key_string = g_utf8_strup(key_string, -1);
+	search_index_valid = 0;
+}
+
+void
+search_index_invalidate(void) {
+
+	search_index_valid = 0;
+}
+
+static void
+search_index_row_inserted(GtkTreeModel * model, GtkTreePath * path,
+			  GtkTreeIter * iter, gpointer data) {
+
+	search_index_invalidate();
+}
+
+static void
+search_index_row_deleted(GtkTreeModel * model, GtkTreePath * path, gpointer data) {
+
+	search_index_invalidate();
+}
+
+static void
+search_index_add_trigrams(const char * str, guint posting) {
+
+	size_t len = strlen(str);
+	size_t i;
+
+	for (i = 0; i + 3 <= len; i++) {
+
+		gpointer key = GUINT_TO_POINTER(SEARCH_TRIGRAM(str + i));
+		GArray * list = (GArray *)g_hash_table_lookup(search_trigrams, key);
+
+		if (list == NULL) {
+			list = g_array_new(FALSE, FALSE, sizeof(guint));
+			g_hash_table_insert(search_trigrams, key, list);
+		} else if (g_array_index(list, guint, list->len - 1) == posting) {
+			continue;
+		}
+
+		g_array_append_val(list, posting);
 	}
+}
 
-	if (exactonly) {
-		strcpy(key, key_string);
-	} else {
-		snprintf(key, MAXLEN-1, "*%s*", key_string);
+static int
+search_index_add_entry(GtkTreeIter * iter, int level, int parent, char * name, char * comment) {
+
+	search_entry_t entry;
+	guint idx = search_entries->len;
+
+	entry.iter = *iter;
+	entry.level = level;
+	entry.parent = parent;
+	entry.name = name;
+	entry.name_fold = g_utf8_strup(name, -1);
+	entry.comment = (comment != NULL) ? g_strdup(comment) : NULL;
+	entry.comment_fold = (comment != NULL) ? g_utf8_strup(comment, -1) : NULL;
+
+	g_array_append_val(search_entries, entry);
+
+	search_index_add_trigrams(entry.name_fold, idx << 1);
+	if (entry.comment_fold != NULL) {
+		search_index_add_trigrams(entry.comment_fold, (idx << 1) | 1);
 	}
 
-	pattern = g_pattern_spec_new(key);
+	return idx;
+}
+
+static void
+search_index_build(void) {
 
+	int h, i, j, k;
+	GtkTreeIter store_iter;
+	GtkTreeIter artist_iter;
+	GtkTreeIter record_iter;
+	GtkTreeIter track_iter;
+
+	if (!search_index_connected) {
+		g_signal_connect(G_OBJECT(music_store), "row-inserted",
+				 G_CALLBACK(search_index_row_inserted), NULL);
+		g_signal_connect(G_OBJECT(music_store), "row-deleted",
+				 G_CALLBACK(search_index_row_deleted), NULL);
+		search_index_connected = 1;
+	}
+
+	search_index_free();
+	search_entries = g_array_new(FALSE, FALSE, sizeof(search_entry_t));
+	search_trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, search_posting_free);
 
 	h = 0;
 	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store), &store_iter, NULL, h++)) {
@@ -210,61 +330,14 @@ search_button_clicked(GtkWidget * widget, gpointer data) {
 
 			char * artist_name;
 			artist_data_t * artist_data;
-
+			int artist_idx;
 
 			gtk_tree_model_get(GTK_TREE_MODEL(music_store), &artist_iter,
 					   MS_COL_NAME, &artist_name,
 					   MS_COL_DATA, &artist_data, -1);
 
-			if (artist_yes) {
-				char * tmp = NULL;
-				if (casesens) {
-					tmp = strdup(artist_name);
-				} else {
-					tmp = g_utf8_strup(artist_name, -1);
-				}
-				if (g_pattern_match_string(pattern, tmp)) {
-
-					GtkTreeIter iter;
-					GtkTreePath * path;
-
-					path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-								       &artist_iter);
-					gtk_list_store_append(search_store, &iter);
-					gtk_list_store_set(search_store, &iter,
-							   0, artist_name,
-							   1, "",
-							   2, "",
-							   3, (gpointer)path,
-							   -1);
-				}
-				g_free(tmp);
-			}
-
-			if (comment_yes && artist_data->comment != NULL) {
-				char * tmp = NULL;
-				if (casesens) {
-					tmp = strdup(artist_data->comment);
-				} else {
-					tmp = g_utf8_strup(artist_data->comment, -1);
-				}
-				if (g_pattern_match_string(pattern, tmp)) {
-
-					GtkTreeIter iter;
-					GtkTreePath * path;
-
-					path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-								       &artist_iter);
-					gtk_list_store_append(search_store, &iter);
-					gtk_list_store_set(search_store, &iter,
-							   0, artist_name,
-							   1, "",
-							   2, "",
-							   3, (gpointer)path,
-							   -1);
-				}
-				g_free(tmp);
-			}
+			artist_idx = search_index_add_entry(&artist_iter, 1, -1,
+							    artist_name, artist_data->comment);
 
 			j = 0;
 			while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store), &record_iter,
@@ -272,130 +345,229 @@ search_button_clicked(GtkWidget * widget, gpointer data) {
 
 				char * record_name;
 				record_data_t * record_data;
+				int record_idx;
 
 				gtk_tree_model_get(GTK_TREE_MODEL(music_store), &record_iter,
 						   MS_COL_NAME, &record_name,
 						   MS_COL_DATA, &record_data, -1);
-				
-				if (record_yes) {
-					char * tmp = NULL;
-					if (casesens) {
-						tmp = strdup(record_name);
-					} else {
-						tmp = g_utf8_strup(record_name, -1);
-					}
-					if (g_pattern_match_string(pattern, tmp)) {
-						
-						GtkTreeIter iter;
-						GtkTreePath * path;
-						
-						path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-									       &record_iter);
-						gtk_list_store_append(search_store, &iter);
-						gtk_list_store_set(search_store, &iter,
-								   0, artist_name,
-								   1, record_name,
-								   2, "",
-								   3, (gpointer)path,
-								   -1);
-					}
-					g_free(tmp);
-				}
-				
-				if (comment_yes && record_data->comment != NULL) {
-					char * tmp = NULL;
-					if (casesens) {
-						tmp = strdup(record_data->comment);
-					} else {
-						tmp = g_utf8_strup(record_data->comment, -1);
-					}
-					if (g_pattern_match_string(pattern, tmp)) {
-						
-						GtkTreeIter iter;
-						GtkTreePath * path;
-						
-						path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-									       &record_iter);
-						gtk_list_store_append(search_store, &iter);
-						gtk_list_store_set(search_store, &iter,
-								   0, artist_name,
-								   1, record_name,
-								   2, "",
-								   3, (gpointer)path,
-								   -1);
-					}
-					g_free(tmp);
-				}
-				
+
+				record_idx = search_index_add_entry(&record_iter, 2, artist_idx,
+								    record_name, record_data->comment);
+
 				k = 0;
 				while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store),
 								     &track_iter, &record_iter, k++)) {
-					
+
 					char * track_name;
 					track_data_t * track_data;
-					
+
 					gtk_tree_model_get(GTK_TREE_MODEL(music_store), &track_iter,
 							   MS_COL_NAME, &track_name,
 							   MS_COL_DATA, &track_data, -1);
-					
-					if (track_yes) {
-						char * tmp = NULL;
-						if (casesens) {
-							tmp = strdup(track_name);
-						} else {
-							tmp = g_utf8_strup(track_name, -1);
-						}
-						if (g_pattern_match_string(pattern, tmp)) {
-							
-							GtkTreeIter iter;
-							GtkTreePath * path;
-							
-							path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-										       &track_iter);
-							gtk_list_store_append(search_store, &iter);
-							gtk_list_store_set(search_store, &iter,
-									   0, artist_name,
-									   1, record_name,
-									   2, track_name,
-									   3, (gpointer)path,
-									   -1);
-						}
-						g_free(tmp);
-					}
-					
-					if (comment_yes && track_data->comment != NULL) {
-						char * tmp = NULL;
-						if (casesens) {
-							tmp = strdup(track_data->comment);
-						} else {
-							tmp = g_utf8_strup(track_data->comment, -1);
-						}
-						if (g_pattern_match_string(pattern, tmp)) {
-							
-							GtkTreeIter iter;
-							GtkTreePath * path;
-							
-							path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store),
-										       &track_iter);
-							gtk_list_store_append(search_store, &iter);
-							gtk_list_store_set(search_store, &iter,
-									   0, artist_name,
-									   1, record_name,
-									   2, track_name,
-									   3, (gpointer)path,
-									   -1);
-						}
-						g_free(tmp);
-					}
-
-					g_free(track_name);
+
+					search_index_add_entry(&track_iter, 3, record_idx,
+							       track_name, track_data->comment);
 				}
-				g_free(record_name);
 			}
-			g_free(artist_name);
 		}
 	}
-		
+
+	search_index_valid = 1;
+}
+
+static gint
+search_posting_cmp_len(gconstpointer a, gconstpointer b) {
+
+	GArray * la = *(GArray **)a;
+	GArray * lb = *(GArray **)b;
+
+	return (int)la->len - (int)lb->len;
+}
+
+/* Returns the sorted postings whose field contains every trigram of
+ * the literal runs in key_fold, or NULL if the key has no run long
+ * enough to narrow the search (every field has to be matched then).
+ */
+static GArray *
+search_index_candidates(const char * key_fold) {
+
+	GPtrArray * lists = g_ptr_array_new();
+	GArray * result = NULL;
+	const char * seg = key_fold;
+	const char * p;
+	guint i;
+
+	for (p = key_fold; ; p++) {
+
+		if (*p != '\0' && *p != '?' && *p != '*') {
+			continue;
+		}
+
+		for (; seg + 3 <= p; seg++) {
+
+			GArray * list = (GArray *)g_hash_table_lookup(search_trigrams,
+					     GUINT_TO_POINTER(SEARCH_TRIGRAM(seg)));
+			if (list == NULL) {
+				g_ptr_array_free(lists, TRUE);
+				return g_array_new(FALSE, FALSE, sizeof(guint));
+			}
+			g_ptr_array_add(lists, list);
+		}
+
+		if (*p == '\0') {
+			break;
+		}
+		seg = p + 1;
+	}
+
+	if (lists->len == 0) {
+		g_ptr_array_free(lists, TRUE);
+		return NULL;
+	}
+
+	/* intersect starting from the rarest trigram */
+	g_ptr_array_sort(lists, search_posting_cmp_len);
+
+	result = g_array_new(FALSE, FALSE, sizeof(guint));
+	g_array_append_vals(result, ((GArray *)g_ptr_array_index(lists, 0))->data,
+			    ((GArray *)g_ptr_array_index(lists, 0))->len);
+
+	for (i = 1; i < lists->len && result->len > 0; i++) {
+
+		GArray * list = (GArray *)g_ptr_array_index(lists, i);
+		guint a = 0, b = 0, n = 0;
+
+		while (a < result->len && b < list->len) {
+			guint x = g_array_index(result, guint, a);
+			guint y = g_array_index(list, guint, b);
+			if (x < y) {
+				++a;
+			} else if (x > y) {
+				++b;
+			} else {
+				g_array_index(result, guint, n++) = x;
+				++a;
+				++b;
+			}
+		}
+		g_array_set_size(result, n);
+	}
+
+	g_ptr_array_free(lists, TRUE);
+	return result;
+}
+
+static void
+search_append_result(search_entry_t * entry) {
+
+	GtkTreeIter iter;
+	GtkTreePath * path;
+	char * names[3] = { "", "", "" };
+	search_entry_t * e = entry;
+
+	for (;;) {
+		names[e->level - 1] = e->name;
+		if (e->parent < 0) {
+			break;
+		}
+		e = &g_array_index(search_entries, search_entry_t, e->parent);
+	}
+
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store), &entry->iter);
+	gtk_list_store_append(search_store, &iter);
+	gtk_list_store_set(search_store, &iter,
+			   0, names[0],
+			   1, names[1],
+			   2, names[2],
+			   3, (gpointer)path,
+			   -1);
+}
+
+static gint
+search_button_clicked(GtkWidget * widget, gpointer data) {
+
+	int valid;
+	const char * key_string = gtk_entry_get_text(GTK_ENTRY(searchkey_entry));
+	char * key_fold;
+	char * key;
+	GPatternSpec * pattern;
+	GArray * candidates;
+	guint last = G_MAXUINT;
+	guint i, n;
+
+	GtkTreeIter sfac_iter;
+
+        get_toggle_buttons_state();
+
+	clear_search_store();
+
+	valid = 0;
+	for (i = 0; key_string[i] != '\0'; i++) {
+		if ((key_string[i] != '?') && (key_string[i] != '*')) {
+			valid = 1;
+			break;
+		}
+	}
+	if (!valid) {
+		return TRUE;
+	}
+
+	key_fold = g_utf8_strup(key_string, -1);
+
+	if (exactonly) {
+		key = g_strdup(casesens ? key_string : key_fold);
+	} else {
+		key = g_strdup_printf("*%s*", casesens ? key_string : key_fold);
+	}
+
+	pattern = g_pattern_spec_new(key);
+	g_free(key);
+
+	if (!search_index_valid) {
+		search_index_build();
+	}
+
+	/* Case sensitive hits are a subset of the casefolded ones,
+	   so the folded index narrows down both kinds of search. */
+	candidates = search_index_candidates(key_fold);
+	g_free(key_fold);
+
+	n = (candidates != NULL) ? candidates->len : search_entries->len * 2;
+
+	for (i = 0; i < n; i++) {
+
+		guint posting = (candidates != NULL) ? g_array_index(candidates, guint, i) : i;
+		guint idx = posting >> 1;
+		search_entry_t * entry = &g_array_index(search_entries, search_entry_t, idx);
+		char * str;
+
+		if (idx == last) {
+			continue;
+		}
+
+		if (posting & 1) {
+			if (!comment_yes || entry->comment == NULL) {
+				continue;
+			}
+			str = casesens ? entry->comment : entry->comment_fold;
+		} else {
+			if ((entry->level == 1 && !artist_yes) ||
+			    (entry->level == 2 && !record_yes) ||
+			    (entry->level == 3 && !track_yes)) {
+				continue;
+			}
+			str = casesens ? entry->name : entry->name_fold;
+		}
+
+		if (g_pattern_match_string(pattern, str)) {
+			search_append_result(entry);
+			last = idx;
+		}
+	}
+
+	if (candidates != NULL) {
+		g_array_free(candidates, TRUE);
+	}
 	g_pattern_spec_free(pattern);
 	
 	if (selectfc) {
@@ -409,6 +581,32 @@ search_button_clicked(GtkWidget * widget, gpointer data) {
 	return TRUE;
 }
 
+static gboolean
+search_typing_timeout(gpointer data) {
+
+	search_typing_tag = 0;
+
+	if (search_window != NULL) {
+		search_button_clicked(NULL, NULL);
+	}
+
+	return FALSE;
+}
+
+static void
+searchkey_entry_changed(GtkEditable * editable, gpointer data) {
+
+	/* "select first and close" would close the window on the first keystroke */
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check_sfac))) {
+		return;
+	}
+
+	if (search_typing_tag != 0) {
+		g_source_remove(search_typing_tag);
+	}
+	search_typing_tag = aqualung_timeout_add(SEARCH_TYPING_DELAY, search_typing_timeout, NULL);
+}
+
 
 void
 search_selection_changed(GtkTreeSelection * treeselection, gpointer user_data) {
@@ -501,6 +699,8 @@ search_dialog(void) {
         searchkey_entry = gtk_entry_new();
         gtk_widget_show(searchkey_entry);
         gtk_box_pack_start(GTK_BOX(hbox), searchkey_entry, TRUE, TRUE, 5);
+        g_signal_connect(G_OBJECT(searchkey_entry), "changed",
+			 G_CALLBACK(searchkey_entry_changed), NULL);
 
 
 	table = gtk_table_new(5, 2, FALSE);
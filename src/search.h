@@ -31,6 +31,7 @@
 #define SEARCH_F_CO (1 << 6)    /* comments */
 
 void search_dialog(void);
+void search_index_invalidate(void);
 
 
 #endif /* AQUALUNG_SEARCH_H */
@@ -139,38 +139,95 @@ sfac_clicked(GtkWidget * widget, gpointer data) {
 }
 
 
-void
-search_foreach(playlist_t * pl, GPatternSpec * pattern, GtkTreeIter * list_iter, int album_node) {
+/* One entry per playlist row in display order, so that searching scans
+   an array instead of walking the tree store. Rebuilt on the next search
+   after the playlist store emitted any row signal. */
+typedef struct {
+	playlist_data_t * pldata;
+	int index;       /* top level position */
+	int child_index; /* position under the album node, -1 if top level */
+} search_row_t;
+
+
+static void
+search_rows_append(GArray * rows, playlist_data_t * pldata, int index, int child_index) {
 
-	char text[MAXLEN];
-	char * tmp = NULL;
+	search_row_t row;
+
+	row.pldata = pldata;
+	row.index = index;
+	row.child_index = child_index;
+	g_array_append_val(rows, row);
+}
+
+static GArray *
+search_rows_get(playlist_t * pl) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(pl->store);
+	GtkTreeIter list_iter;
+	GtkTreeIter iter;
 	playlist_data_t * pldata;
+	int i, j;
 
-	gtk_tree_model_get(GTK_TREE_MODEL(pl->store), list_iter, PL_COL_DATA, &pldata, -1);
-	if (album_node) {
-		snprintf(text, MAXLEN-1, "%s: %s", pldata->artist, pldata->album);
-	} else {
-		playlist_data_get_display_name(text, pldata);
+	if (pl->search_rows != NULL && pl->search_rows_valid) {
+		return pl->search_rows;
 	}
 
-	if (casesens) {
-		tmp = strdup(text);
+	if (pl->search_rows == NULL) {
+		pl->search_rows = g_array_new(FALSE, FALSE, sizeof(search_row_t));
 	} else {
-		tmp = g_utf8_strup(text, -1);
+		g_array_set_size(pl->search_rows, 0);
+	}
+
+	i = 0;
+	if (gtk_tree_model_get_iter_first(model, &list_iter)) {
+		do {
+			gtk_tree_model_get(model, &list_iter, PL_COL_DATA, &pldata, -1);
+			search_rows_append(pl->search_rows, pldata, i, -1);
+
+			j = 0;
+			if (gtk_tree_model_iter_children(model, &iter, &list_iter)) {
+				do {
+					gtk_tree_model_get(model, &iter, PL_COL_DATA, &pldata, -1);
+					search_rows_append(pl->search_rows, pldata, i, j++);
+				} while (gtk_tree_model_iter_next(model, &iter));
+			}
+			++i;
+		} while (gtk_tree_model_iter_next(model, &list_iter));
 	}
 
-	if (g_pattern_match_string(pattern, tmp)) {
+	pl->search_rows_valid = 1;
+	return pl->search_rows;
+}
 
-		GtkTreeIter iter;
-		GtkTreePath * path;
+static void
+search_playlist(playlist_t * pl, GPatternSpec * pattern) {
 
-		path = gtk_tree_model_get_path(GTK_TREE_MODEL(pl->store), list_iter);
-		gtk_list_store_append(search_store, &iter);
-		gtk_list_store_set(search_store, &iter, 0, text,
-				   1, (gpointer)path, 2, pl->name, 3, (gpointer)pl, -1);
-	}
+	GArray * rows = search_rows_get(pl);
+	guint i;
 
-	g_free(tmp);
+	for (i = 0; i < rows->len; i++) {
+
+		search_row_t * row = &g_array_index(rows, search_row_t, i);
+		playlist_data_t * pldata = row->pldata;
+
+		playlist_data_update_search_key(pldata);
+
+		if (g_pattern_match_string(pattern, casesens ? pldata->search_text : pldata->search_key)) {
+
+			GtkTreeIter iter;
+			GtkTreePath * path;
+
+			if (row->child_index < 0) {
+				path = gtk_tree_path_new_from_indices(row->index, -1);
+			} else {
+				path = gtk_tree_path_new_from_indices(row->index, row->child_index, -1);
+			}
+			gtk_list_store_append(search_store, &iter);
+			gtk_list_store_set(search_store, &iter, 0, pldata->search_text,
+					   1, (gpointer)path, 2, pl->name, 3, (gpointer)pl, -1);
+		}
+	}
 }
 
 static gint
@@ -178,11 +235,11 @@ search_button_clicked(GtkWidget * widget, gpointer data) {
 
 	int valid;
 	const char * key_string = gtk_entry_get_text(GTK_ENTRY(searchkey_entry));
-	char key[MAXLEN];
+	char * key_upper = NULL;
+	char * key;
 	GPatternSpec * pattern;
 
 	int i;
-	GtkTreeIter list_iter;
 	GtkTreeIter sfac_iter;
 
 	GList * node = NULL;
@@ -204,40 +261,21 @@ search_button_clicked(GtkWidget * widget, gpointer data) {
 	}
 
 	if (!casesens) {
-		key_string = g_utf8_strup(key_string, -1);
+		key_string = key_upper = g_utf8_strup(key_string, -1);
 	}
 
 	if (exactonly) {
-		strcpy(key, key_string);
+		key = g_strdup(key_string);
 	} else {
-		snprintf(key, MAXLEN-1, "*%s*", key_string);
+		key = g_strdup_printf("*%s*", key_string);
 	}
 
 	pattern = g_pattern_spec_new(key);
+	g_free(key);
+	g_free(key_upper);
 
 	for (node = playlists; node; node = node->next) {
-
-		playlist_t * pl = (playlist_t *)node->data;
-
-		i = 0;
-		while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-						     &list_iter, NULL, i++)) {
-
-			if (gtk_tree_model_iter_has_child(GTK_TREE_MODEL(pl->store), &list_iter)) {
-
-				int j = 0;
-				GtkTreeIter iter;
-
-				search_foreach(pl, pattern, &list_iter, 1/*album node*/);
-
-				while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(pl->store),
-								     &iter, &list_iter, j++)) {
-					search_foreach(pl, pattern, &iter, 0/*track node*/);
-				}
-			} else {
-				search_foreach(pl, pattern, &list_iter, 0/*track node*/);
-			}
-		}
+		search_playlist((playlist_t *)node->data, pattern);
 	}
 
 	g_pattern_spec_free(pattern);
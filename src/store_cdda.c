@@ -681,8 +681,6 @@ cdda_track_addlist_iter(GtkTreeIter iter_track, playlist_t * pl, GtkTreeIter * p
 			   PL_COL_NAME, list_str,
 			   PL_COL_VADJ, "",
 			   PL_COL_DURA, duration_str,
-			   PL_COL_COLO, pl_color_inactive,
-			   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 			   PL_COL_DATA, pldata, -1);
 
 	g_free(track_name);
@@ -727,8 +725,6 @@ cdda_record_addlist_iter(GtkTreeIter iter_record, playlist_t * pl, GtkTreeIter *
 				   PL_COL_NAME, list_str,
 				   PL_COL_VADJ, "",
 				   PL_COL_DURA, "00:00",
-				   PL_COL_COLO, pl_color_inactive,
-				   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 				   PL_COL_DATA, pldata, -1);
 
 		plist_iter = &list_iter;
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <gdk/gdkkeysyms.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -33,6 +34,7 @@
 #include <libxml/globals.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 
 #ifdef HAVE_CDDB
 #include "cddb_lookup.h"
@@ -298,6 +300,7 @@ artist_data_free(artist_data_t * data) {
 	if (data->comment != NULL) {
 		free(data->comment);
 	}
+	g_free(data->xml);
 	free(data);
 }
 
@@ -1420,8 +1423,6 @@ track_addlist_iter(GtkTreeIter iter_track, playlist_t * pl,
 			   PL_COL_NAME, list_str,
 			   PL_COL_VADJ, voladj_str,
 			   PL_COL_DURA, duration_str,
-			   PL_COL_COLO, pl_color_inactive,
-			   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 			   PL_COL_DATA, pldata, -1);
 
 	if (fdec != NULL) {
@@ -1514,8 +1515,6 @@ record_addlist_iter(GtkTreeIter iter_record, playlist_t * pl,
 				   PL_COL_NAME, list_str,
 				   PL_COL_VADJ, "",
 				   PL_COL_DURA, "00:00",
-				   PL_COL_COLO, pl_color_inactive,
-				   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 				   PL_COL_DATA, pldata, -1);
 
 		g_free(record_name);
@@ -2042,9 +2041,9 @@ store__remove_cb(gpointer user_data) {
 				if (confirm_dialog(_("Remove Store"),
 						   _("Do you want to save the store before removing?"))) {
 					store_file_save(&iter);
-				} else {
-					music_store_mark_saved(&iter);
 				}
+				/* the store goes away, the save (if any) is queued */
+				music_store_mark_saved(&iter);
 			}
 
 			if (store_file_remove_store(&iter)) {
@@ -3708,541 +3707,1833 @@ track_get_absolute_path(char * store_dirname, char * filename, const GtkTreeIter
 	return path;
 }
 
-void
-parse_track(xmlDocPtr doc, xmlNodePtr cur, GtkTreeIter * iter_record, char * store_dirname, int * save) {
+/* Store files are read with the streaming xmlTextReader into a light
+ * tree of the parsed rows first, so no DOM of the whole file is ever
+ * built. The rows are then put into music_store in one pass with
+ * sorting turned off, which lets the model sort each level just once.
+ * At startup the parsing runs in a background thread.
+ */
 
-	GtkTreeIter iter_track;
-	xmlChar * key;
+typedef struct {
+	char * name;
+	char * sort;
+	gpointer data;		/* artist_data_t, record_data_t or track_data_t */
+	GPtrArray * children;	/* NULL for tracks */
+} store_load_node_t;
 
-	char name[MAXLEN];
-	char sort[MAXLEN];
-	track_data_t * data;
+typedef struct {
+	char * file;
+	char sort[16];
+	long size;
+	char * name;		/* NULL if the store has no <name> */
+	store_data_t * data;	/* NULL if the file could not be parsed */
+	GPtrArray * artists;
+	GtkTreeIter iter_store;
+	int save;
+	int owns_data;		/* copy made by store_load_from_tree() */
+	int quiet;		/* don't report parse progress */
+} store_load_t;
 
-	name[0] = '\0';
-	sort[0] = '\0';
+static GSList * store_load_queue = NULL;
+static volatile int store_load_running = 0;
+static int store_load_add_new_stores = 0;
+static volatile long store_load_bytes_total;
+static volatile long store_load_bytes_done;
+static volatile long store_load_bytes_current;
+static GtkWidget * store_load_progress_bar = NULL;
+static guint store_load_progress_tag;
 
-	if ((data = (track_data_t *)calloc(1, sizeof(track_data_t))) == NULL) {
-		fprintf(stderr, "parse_track: calloc error\n");
-		return;
-	}
 
-	gtk_tree_store_append(music_store, &iter_track, iter_record);
-	gtk_tree_store_set(music_store, &iter_track,
-			   MS_COL_NAME, "",
-			   MS_COL_SORT, "",
-			   MS_COL_DATA, data, -1);
+static store_load_node_t *
+store_load_node_new(GPtrArray * siblings, gpointer data, int has_children) {
+
+	store_load_node_t * node;
 
-	if (options.enable_ms_tree_icons) {
-		gtk_tree_store_set(music_store, &iter_track, MS_COL_ICON, icon_track, -1);
+	if ((node = (store_load_node_t *)calloc(1, sizeof(store_load_node_t))) == NULL) {
+		fprintf(stderr, "store_load_node_new: calloc error\n");
+		return NULL;
 	}
 
-	data->duration = 0.0f;
-	data->volume = 1.0f;
-	data->rva = 0.0f;
-	data->use_rva = 0;
+	node->name = g_strdup("");
+	node->sort = g_strdup("");
+	node->data = data;
+	if (has_children) {
+		node->children = g_ptr_array_new();
+	}
 
- 	for (cur = cur->xmlChildrenNode; cur != NULL; cur = cur->next) {
+	g_ptr_array_add(siblings, node);
+	return node;
+}
 
-		if ((!xmlStrcmp(cur->name, (const xmlChar *)"name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(name, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			if (name[0] == '\0') {
-				fprintf(stderr, "Error in XML music_store: track <name> is required, but NULL\n");
-			}
-			gtk_tree_store_set(music_store, &iter_track, MS_COL_NAME, name, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"sort_name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(sort, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			gtk_tree_store_set(music_store, &iter_track, MS_COL_SORT, sort, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"file"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				if (httpc_is_url((char *)key)) {
-					data->file = strndup((char *)key, MAXLEN-1);
-				} else {
-					data->file = track_get_absolute_path(store_dirname, (char *)key, &iter_track);
-				}
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"size"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				sscanf((char *)key, "%u", &data->size);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"comment"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				data->comment = strndup((char *)key, MAXLEN-1);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"duration"))) {
-                        key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-                        if (key != NULL) {
-                                data->duration = convf((char *) key);
-				xmlFree(key);
-                        }
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"volume"))) {
-                        key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-                        if (key != NULL) {
-                                data->volume = convf((char *) key);
-				xmlFree(key);
-                        }
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"rva"))) {
-                        key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-                        if (key != NULL) {
-                                data->rva = convf((char *) key);
-				xmlFree(key);
-                        }
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"use_rva"))) {
-                        key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-                        if (key != NULL) {
-                                data->use_rva = convf((char *) key);
-				xmlFree(key);
-                        }
-                }
-	}
+/* level: 1 artist, 2 record, 3 track */
+static void
+store_load_node_free(store_load_node_t * node, int level, int free_data) {
 
-	if (data->size == 0) {
-		struct stat statbuf;
-		if (stat(data->file, &statbuf) != -1) {
-			data->size = statbuf.st_size;
-			*save = 1;
+	guint i;
+
+	if (node->children != NULL) {
+		for (i = 0; i < node->children->len; i++) {
+			store_load_node_free((store_load_node_t *)g_ptr_array_index(node->children, i),
+					     level + 1, free_data);
 		}
+		g_ptr_array_free(node->children, TRUE);
 	}
 
-	if (data->file == NULL) {
-		fprintf(stderr, "Error in XML music_store: track <file> is required, but NULL\n");
-		store_file_remove_track(&iter_track);
+	if (free_data) {
+		switch (level) {
+		case 1:
+			artist_data_free((artist_data_t *)node->data);
+			break;
+		case 2:
+			record_data_free((record_data_t *)node->data);
+			break;
+		case 3:
+			track_data_free((track_data_t *)node->data);
+			break;
+		}
 	}
+
+	g_free(node->name);
+	g_free(node->sort);
+	free(node);
 }
 
+static void
+store_load_free_rows(store_load_t * load, int free_data) {
 
-void
-parse_record(xmlDocPtr doc, xmlNodePtr cur, GtkTreeIter * iter_artist, char * store_dirname, int * save) {
+	guint i;
 
-	GtkTreeIter iter_record;
-	xmlChar * key;
+	for (i = 0; i < load->artists->len; i++) {
+		store_load_node_free((store_load_node_t *)g_ptr_array_index(load->artists, i),
+				     1, free_data);
+	}
+	g_ptr_array_set_size(load->artists, 0);
 
-	char name[MAXLEN];
-	char sort[MAXLEN];
+	if (free_data && load->data != NULL) {
+		store_data_free(load->data);
+		load->data = NULL;
+	}
+}
 
-	record_data_t * data;
+static store_load_t *
+store_load_new(char * store_file, char * sort) {
 
-	name[0] = '\0';
-	sort[0] = '\0';
+	store_load_t * load;
+	struct stat statbuf;
 
-	if ((data = (record_data_t *)calloc(1, sizeof(record_data_t))) == NULL) {
-		fprintf(stderr, "parse_record: calloc error\n");
-		return;
+	if ((load = (store_load_t *)calloc(1, sizeof(store_load_t))) == NULL) {
+		fprintf(stderr, "store_load_new: calloc error\n");
+		return NULL;
 	}
 
-	gtk_tree_store_append(music_store, &iter_record, iter_artist);
-	gtk_tree_store_set(music_store, &iter_record,
-			   MS_COL_NAME, "",
-			   MS_COL_SORT, "",
-			   MS_COL_DATA, data, -1);
+	load->file = strdup(store_file);
+	strncpy(load->sort, sort, sizeof(load->sort)-1);
+	load->artists = g_ptr_array_new();
 
-	if (options.enable_ms_tree_icons) {
-		gtk_tree_store_set(music_store, &iter_record, MS_COL_ICON, icon_record, -1);
+	if (stat(store_file, &statbuf) != -1) {
+		load->size = statbuf.st_size;
 	}
 
-	for (cur = cur->xmlChildrenNode; cur != NULL; cur = cur->next) {
-
-		if ((!xmlStrcmp(cur->name, (const xmlChar *)"name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(name, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			if (name[0] == '\0') {
-				fprintf(stderr, "Error in XML music_store: "
-				       "Record <name> is required, but NULL\n");
-			}
-			gtk_tree_store_set(music_store, &iter_record, MS_COL_NAME, name, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"sort_name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(sort, (char *) key, MAXLEN-1);
-				/* parse year from sort key if otherwise not set */
-				if (is_valid_year(atoi(sort)) && !is_valid_year(data->year)) {
-					data->year = atoi(sort);
-				}
-				xmlFree(key);
-			}
-			gtk_tree_store_set(music_store, &iter_record, MS_COL_SORT, sort, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"comment"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				data->comment = strndup((char *)key, MAXLEN-1);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"year"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				data->year = atoi((char *)key);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"track"))) {
-			parse_track(doc, cur, &iter_record, store_dirname, save);
-		}
-	}
+	return load;
 }
 
+/* Frees everything but the row data, which belongs to music_store once
+   inserted (and has already been freed if parsing failed). */
+static void
+store_load_free(store_load_t * load) {
 
-void
-parse_artist(xmlDocPtr doc, xmlNodePtr cur, GtkTreeIter * iter_store, char * store_dirname, int * save) {
+	store_load_free_rows(load, load->owns_data);
+	g_ptr_array_free(load->artists, TRUE);
+	g_free(load->name);
+	free(load->file);
+	free(load);
+}
 
-	GtkTreeIter iter_artist;
-	xmlChar * key;
+/* Binary snapshots of store files, kept next to them as <store file>.snap
+ * when options.ms_store_snapshot is set. The XML stays the real store;
+ * a snapshot is only used while it matches the mtime, size and path of
+ * the XML file it was made from. It is a header followed by the track,
+ * artist and record tables and a pool of interned strings referenced by
+ * offset, so loading it is a single mapping of the file.
+ */
 
-	char name[MAXLEN];
-	char sort[MAXLEN];
+#define STORE_SNAPSHOT_MAGIC      "AQMSSNP2"
+#define STORE_SNAPSHOT_BYTE_ORDER 0x01020304
+#define STORE_SNAPSHOT_NONE       0xffffffff
 
-	artist_data_t * data;
+typedef struct {
+	char magic[8];
+	guint32 byte_order;
+	guint32 use_relative_paths;
+	gint64 xml_mtime;
+	gint64 xml_size;
+	guint32 xml_file;
+	guint32 name;
+	guint32 comment;
+	guint32 n_tracks;
+	guint32 n_artists;
+	guint32 n_records;
+	guint32 strings_size;
+	guint32 reserved;
+} store_snapshot_header_t;
 
-	name[0] = '\0';
-	sort[0] = '\0';
+typedef struct {
+	gint64 mtime;
+	guint64 inode;
+	guint32 name;
+	guint32 sort;
+	guint32 comment;
+	guint32 file;
+	float duration;
+	float volume;
+	float rva;
+	gint32 use_rva;
+	guint64 size;
+} store_snapshot_track_t;
 
-	if ((data = (artist_data_t *)calloc(1, sizeof(artist_data_t))) == NULL) {
-		fprintf(stderr, "parse_artist: calloc error\n");
-		return;
-	}
+typedef struct {
+	guint32 name;
+	guint32 sort;
+	guint32 comment;
+	guint32 first_record;
+	guint32 n_records;
+} store_snapshot_artist_t;
 
-	gtk_tree_store_append(music_store, &iter_artist, iter_store);
-	gtk_tree_store_set(music_store, &iter_artist,
-			   MS_COL_NAME, "",
-			   MS_COL_SORT, "",
-			   MS_COL_DATA, data, -1);
+typedef struct {
+	guint32 name;
+	guint32 sort;
+	guint32 comment;
+	gint32 year;
+	guint32 first_track;
+	guint32 n_tracks;
+} store_snapshot_record_t;
 
-	if (options.enable_ms_tree_icons) {
-		gtk_tree_store_set(music_store, &iter_artist, MS_COL_ICON, icon_artist, -1);
-	}
+typedef struct {
+	GHashTable * offsets;
+	GString * pool;
+	const char * strings;
+	guint32 strings_size;
+	int bad;
+} store_snapshot_strings_t;
 
-	for (cur = cur->xmlChildrenNode; cur != NULL; cur = cur->next) {
 
-		if ((!xmlStrcmp(cur->name, (const xmlChar *)"name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(name, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			if (name[0] == '\0') {
-				fprintf(stderr, "Error in XML music_store: "
-				       "Artist <name> is required, but NULL\n");
-			}
-			gtk_tree_store_set(music_store, &iter_artist, MS_COL_NAME, name, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"sort_name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(sort, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			gtk_tree_store_set(music_store, &iter_artist, MS_COL_SORT, sort, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"comment"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				data->comment = strndup((char *)key, MAXLEN-1);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"record"))) {
-			parse_record(doc, cur, &iter_artist, store_dirname, save);
-		}
-	}
-}
+static char *
+store_snapshot_filename(char * store_file) {
 
+	return g_strdup_printf("%s.snap", store_file);
+}
 
-void
-store_file_load(char * store_file, char * sort) {
+static guint32
+store_snapshot_intern(store_snapshot_strings_t * s, const char * str) {
 
-	GtkTreeIter iter_store;
+	gpointer offset;
+	guint32 off;
 
-	char name[MAXLEN];
+	if (str == NULL) {
+		return STORE_SNAPSHOT_NONE;
+	}
 
-	name[0] = '\0';
+	if (g_hash_table_lookup_extended(s->offsets, str, NULL, &offset)) {
+		return GPOINTER_TO_UINT(offset);
+	}
 
-	xmlDocPtr doc;
-	xmlNodePtr cur;
-	xmlChar * key;
-	char * store_dirname;
-	int save = 0;
+	off = s->pool->len;
+	g_string_append_len(s->pool, str, strlen(str) + 1);
+	g_hash_table_insert(s->offsets, (gpointer)str, GUINT_TO_POINTER(off));
+	return off;
+}
 
-	store_data_t * data;
+static char *
+store_snapshot_strdup(store_snapshot_strings_t * s, guint32 offset) {
 
-	if (access(store_file, R_OK) != 0) {
-		return;
+	if (offset == STORE_SNAPSHOT_NONE) {
+		return NULL;
 	}
-
-	doc = xmlParseFile(store_file);
-	if (doc == NULL) {
-		fprintf(stderr, "An XML error occured while parsing %s\n", store_file);
-		return;
+	if (offset >= s->strings_size) {
+		s->bad = 1;
+		return NULL;
 	}
+	return strdup(s->strings + offset);
+}
 
-	cur = xmlDocGetRootElement(doc);
-	if (cur == NULL) {
-		fprintf(stderr, "store_file_load: empty XML document\n");
-		xmlFreeDoc(doc);
-		return;
+static void
+store_snapshot_node_strings(store_snapshot_strings_t * s, store_load_node_t * node,
+			    guint32 name, guint32 sort) {
+
+	if (name != STORE_SNAPSHOT_NONE && name < s->strings_size) {
+		g_free(node->name);
+		node->name = g_strdup(s->strings + name);
 	}
+	if (sort != STORE_SNAPSHOT_NONE && sort < s->strings_size) {
+		g_free(node->sort);
+		node->sort = g_strdup(s->strings + sort);
+	}
+}
 
-	if (xmlStrcmp(cur->name, (const xmlChar *)"music_store")) {
-		fprintf(stderr, "store_file_load: XML document of the wrong type, "
-			"root node != music_store\n");
-		xmlFreeDoc(doc);
+static void
+store_snapshot_write(store_load_t * load) {
+
+	store_snapshot_header_t header;
+	store_snapshot_strings_t s;
+	GArray * tracks;
+	GArray * artists;
+	GArray * records;
+	struct stat statbuf;
+	char * snap;
+	char * tmp;
+	FILE * f;
+	guint i, j, k;
+	int ok;
+
+	if (!options.ms_store_snapshot || stat(load->file, &statbuf) == -1) {
 		return;
 	}
 
-	if ((data = (store_data_t *)calloc(1, sizeof(store_data_t))) == NULL) {
-		fprintf(stderr, "store_file_load: calloc error\n");
-		return;
+	s.offsets = g_hash_table_new(g_str_hash, g_str_equal);
+	s.pool = g_string_new(NULL);
+	tracks = g_array_new(FALSE, FALSE, sizeof(store_snapshot_track_t));
+	artists = g_array_new(FALSE, FALSE, sizeof(store_snapshot_artist_t));
+	records = g_array_new(FALSE, FALSE, sizeof(store_snapshot_record_t));
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, STORE_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.byte_order = STORE_SNAPSHOT_BYTE_ORDER;
+	header.use_relative_paths = load->data->use_relative_paths;
+	header.xml_mtime = statbuf.st_mtime;
+	header.xml_size = statbuf.st_size;
+	header.xml_file = store_snapshot_intern(&s, load->file);
+	header.name = store_snapshot_intern(&s, load->name);
+	header.comment = store_snapshot_intern(&s, load->data->comment);
+
+	for (i = 0; i < load->artists->len; i++) {
+
+		store_load_node_t * artist = (store_load_node_t *)g_ptr_array_index(load->artists, i);
+		store_snapshot_artist_t a;
+
+		a.name = store_snapshot_intern(&s, artist->name);
+		a.sort = store_snapshot_intern(&s, artist->sort);
+		a.comment = store_snapshot_intern(&s, ((artist_data_t *)artist->data)->comment);
+		a.first_record = records->len;
+		a.n_records = artist->children->len;
+		g_array_append_val(artists, a);
+
+		for (j = 0; j < artist->children->len; j++) {
+
+			store_load_node_t * record = (store_load_node_t *)g_ptr_array_index(artist->children, j);
+			record_data_t * record_data = (record_data_t *)record->data;
+			store_snapshot_record_t r;
+
+			r.name = store_snapshot_intern(&s, record->name);
+			r.sort = store_snapshot_intern(&s, record->sort);
+			r.comment = store_snapshot_intern(&s, record_data->comment);
+			r.year = record_data->year;
+			r.first_track = tracks->len;
+			r.n_tracks = record->children->len;
+			g_array_append_val(records, r);
+
+			for (k = 0; k < record->children->len; k++) {
+
+				store_load_node_t * track = (store_load_node_t *)g_ptr_array_index(record->children, k);
+				track_data_t * track_data = (track_data_t *)track->data;
+				store_snapshot_track_t t;
+
+				memset(&t, 0, sizeof(t));
+				t.name = store_snapshot_intern(&s, track->name);
+				t.sort = store_snapshot_intern(&s, track->sort);
+				t.comment = store_snapshot_intern(&s, track_data->comment);
+				t.file = store_snapshot_intern(&s, track_data->file);
+				t.duration = track_data->duration;
+				t.volume = track_data->volume;
+				t.rva = track_data->rva;
+				t.use_rva = track_data->use_rva;
+				t.size = track_data->size;
+				t.mtime = track_data->mtime;
+				t.inode = track_data->inode;
+				g_array_append_val(tracks, t);
+			}
+		}
 	}
 
+	header.n_tracks = tracks->len;
+	header.n_artists = artists->len;
+	header.n_records = records->len;
+	header.strings_size = s.pool->len;
 
-	data->type = STORE_TYPE_FILE;
-	data->file = strdup(store_file);
-	data->use_relative_paths = 0;
-	store_dirname = g_path_get_dirname(data->file);
+	snap = store_snapshot_filename(load->file);
+	tmp = g_strdup_printf("%s.tmp", snap);
 
-	if (access(store_file, W_OK) == 0) {
-		data->readonly = 0;
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		fprintf(stderr, "store_snapshot_write: unable to create %s\n", tmp);
 	} else {
-		data->readonly = 1;
+		ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		ok = ok && fwrite(tracks->data, sizeof(store_snapshot_track_t), tracks->len, f) == tracks->len;
+		ok = ok && fwrite(artists->data, sizeof(store_snapshot_artist_t), artists->len, f) == artists->len;
+		ok = ok && fwrite(records->data, sizeof(store_snapshot_record_t), records->len, f) == records->len;
+		ok = ok && fwrite(s.pool->str, 1, s.pool->len, f) == s.pool->len;
+		ok = (fclose(f) == 0) && ok;
+
+		if (!ok || g_rename(tmp, snap) != 0) {
+			fprintf(stderr, "store_snapshot_write: unable to write %s\n", snap);
+			g_unlink(tmp);
+		}
 	}
 
-	gtk_tree_store_append(music_store, &iter_store, NULL);
+	g_free(tmp);
+	g_free(snap);
+	g_array_free(tracks, TRUE);
+	g_array_free(artists, TRUE);
+	g_array_free(records, TRUE);
+	g_string_free(s.pool, TRUE);
+	g_hash_table_destroy(s.offsets);
+}
 
-	gtk_tree_store_set(music_store, &iter_store,
-			   MS_COL_NAME, _("Music Store"),
-			   MS_COL_SORT, sort,
-			   MS_COL_FONT, PANGO_WEIGHT_BOLD,
-			   MS_COL_DATA, data, -1);
+/* Fill load from the snapshot of load->file if there is an up to date one.
+ * Returns -1 if the XML has to be parsed instead.
+ */
+static int
+store_snapshot_load(store_load_t * load) {
 
-	if (options.enable_ms_tree_icons) {
-		gtk_tree_store_set(music_store, &iter_store, MS_COL_ICON, icon_store, -1);
-	}
+	GMappedFile * mapped;
+	const char * map;
+	guint64 len;
+	const store_snapshot_header_t * header;
+	const store_snapshot_track_t * tracks;
+	const store_snapshot_artist_t * artists;
+	const store_snapshot_record_t * records;
+	store_snapshot_strings_t s;
+	struct stat statbuf;
+	char * snap;
+	char * xml_file;
+	guint32 i, j, k;
+	int ret = -1;
 
-	for (cur = cur->xmlChildrenNode; cur != NULL; cur = cur->next) {
+	if (!options.ms_store_snapshot || stat(load->file, &statbuf) == -1) {
+		return -1;
+	}
 
-		if ((!xmlStrcmp(cur->name, (const xmlChar *)"name"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				strncpy(name, (char *) key, MAXLEN-1);
-				xmlFree(key);
-			}
-			if (name[0] == '\0') {
-				fprintf(stderr, "Error in XML music_store: "
-					"Music Store <name> is required, but NULL\n");
-			}
-			gtk_tree_store_set(music_store, &iter_store, MS_COL_NAME, name, -1);
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"comment"))) {
-			key = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-			if (key != NULL) {
-				data->comment = strndup((char *)key, MAXLEN-1);
-				xmlFree(key);
-			}
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"use_relative_paths"))) {
-			data->use_relative_paths = 1;
-		} else if ((!xmlStrcmp(cur->name, (const xmlChar *)"artist"))) {
-			parse_artist(doc, cur, &iter_store, store_dirname, &save);
-		}
+	snap = store_snapshot_filename(load->file);
+	mapped = g_mapped_file_new(snap, FALSE, NULL);
+	g_free(snap);
+	if (mapped == NULL) {
+		return -1;
 	}
 
-	xmlFreeDoc(doc);
-	g_free(store_dirname);
+	map = g_mapped_file_get_contents(mapped);
+	len = g_mapped_file_get_length(mapped);
 
-	if (save && !data->readonly) {
-		music_store_mark_changed(&iter_store);
-		store_file_save(&iter_store);
+	if (len < sizeof(store_snapshot_header_t)) {
+		goto out;
 	}
 
-	if (options.autoexpand_stores) {
-		GtkTreePath * path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store), &iter_store);
-		gtk_tree_view_expand_row(GTK_TREE_VIEW(music_tree), path, FALSE);
-		gtk_tree_path_free(path);
+	header = (const store_snapshot_header_t *)map;
+	if (memcmp(header->magic, STORE_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+	    header->byte_order != STORE_SNAPSHOT_BYTE_ORDER ||
+	    header->xml_mtime != (gint64)statbuf.st_mtime ||
+	    header->xml_size != (gint64)statbuf.st_size) {
+		goto out;
 	}
-}
-
 
-/**********************************************************************************/
-
-
-void
-save_track(xmlDocPtr doc, xmlNodePtr node_track, GtkTreeIter * iter_track,
-	   char * store_dirname, int dirname_strlen, int use_relative_paths) {
+	if (len != sizeof(store_snapshot_header_t) +
+	    (guint64)header->n_tracks * sizeof(store_snapshot_track_t) +
+	    (guint64)header->n_artists * sizeof(store_snapshot_artist_t) +
+	    (guint64)header->n_records * sizeof(store_snapshot_record_t) +
+	    header->strings_size) {
+		goto out;
+	}
 
-	xmlNodePtr node;
-	char * name;
-	char * sort;
-	track_data_t * data;
-	char str[32];
+	tracks = (const store_snapshot_track_t *)(map + sizeof(store_snapshot_header_t));
+	artists = (const store_snapshot_artist_t *)(tracks + header->n_tracks);
+	records = (const store_snapshot_record_t *)(artists + header->n_artists);
 
-	gtk_tree_model_get(GTK_TREE_MODEL(music_store), iter_track,
-			   MS_COL_NAME, &name,
-			   MS_COL_SORT, &sort,
-			   MS_COL_DATA, &data,
-			   -1);
+	memset(&s, 0, sizeof(s));
+	s.strings = (const char *)(records + header->n_records);
+	s.strings_size = header->strings_size;
 
-	node = xmlNewTextChild(node_track, NULL, (const xmlChar *) "track", NULL);
-	if (name[0] == '\0') {
-		fprintf(stderr, "saving music_store XML: warning: track node with empty <name>\n");
-	}
-	xmlNewTextChild(node, NULL, (const xmlChar *) "name", (const xmlChar *) name);
-	if (sort[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "sort_name", (const xmlChar *) sort);
+	if (s.strings_size == 0 || s.strings[s.strings_size - 1] != '\0') {
+		goto out;
 	}
 
-	if (data->file == NULL && data->file[0] != '\0') {
-		fprintf(stderr, "saving music_store XML: warning: track node with empty <file>\n");
-		xmlNewTextChild(node, NULL, (const xmlChar *) "file", (const xmlChar *) "");
-	} else {
-		if (httpc_is_url(data->file)) {
-			gchar * tmp = g_filename_to_utf8(data->file, -1, NULL, NULL, NULL);
-			xmlNewTextChild(node, NULL, (const xmlChar *) "file", (const xmlChar *) tmp);
-			g_free(tmp);
-		} else if (use_relative_paths && g_str_has_prefix(data->file, store_dirname)) {
-			gchar * tmp = data->file + dirname_strlen + 1;
-			xmlNewTextChild(node, NULL, (const xmlChar *) "file", (const xmlChar *) tmp);
-		} else {
-			gchar * tmp = g_filename_to_uri(data->file, NULL, NULL);
-			xmlNewTextChild(node, NULL, (const xmlChar *) "file", (const xmlChar *) tmp);
-			g_free(tmp);
-		}
+	xml_file = store_snapshot_strdup(&s, header->xml_file);
+	if (xml_file == NULL || strcmp(xml_file, load->file)) {
+		free(xml_file);
+		goto out;
 	}
+	free(xml_file);
 
-	if (data->size != 0) {
-		snprintf(str, 31, "%u", data->size);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "size", (const xmlChar *) str);
+	if ((load->data = (store_data_t *)calloc(1, sizeof(store_data_t))) == NULL) {
+		fprintf(stderr, "store_snapshot_load: calloc error\n");
+		goto out;
 	}
-
-	if (data->comment != NULL && data->comment[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "comment", (const xmlChar *) data->comment);
+	load->data->type = STORE_TYPE_FILE;
+	load->data->file = strdup(load->file);
+	load->data->readonly = (access(load->file, W_OK) == 0) ? 0 : 1;
+	load->data->use_relative_paths = header->use_relative_paths;
+	load->data->comment = store_snapshot_strdup(&s, header->comment);
+	if (header->name != STORE_SNAPSHOT_NONE && header->name < s.strings_size) {
+		load->name = g_strdup(s.strings + header->name);
 	}
 
-	if (data->duration != 0.0f) {
-		snprintf(str, 31, "%.1f", data->duration);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "duration", (const xmlChar *) str);
-	}
+	for (i = 0; i < header->n_artists && !s.bad; i++) {
 
-	if (data->volume <= 0.1f) {
-		snprintf(str, 31, "%.1f", data->volume);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "volume", (const xmlChar *) str);
-	}
+		const store_snapshot_artist_t * a = artists + i;
+		store_load_node_t * artist;
+		artist_data_t * artist_data;
 
-	if (data->rva != 0.0f) {
-		snprintf(str, 31, "%.1f", data->rva);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "rva", (const xmlChar *) str);
-	}
+		if (a->first_record > header->n_records ||
+		    a->n_records > header->n_records - a->first_record) {
+			s.bad = 1;
+			break;
+		}
 
-	if (data->use_rva) {
-		snprintf(str, 31, "%d", data->use_rva);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "use_rva", (const xmlChar *) str);
-	}
+		if ((artist_data = (artist_data_t *)calloc(1, sizeof(artist_data_t))) == NULL) {
+			fprintf(stderr, "store_snapshot_load: calloc error\n");
+			s.bad = 1;
+			break;
+		}
+		artist_data->comment = store_snapshot_strdup(&s, a->comment);
+		if ((artist = store_load_node_new(load->artists, artist_data, 1)) == NULL) {
+			artist_data_free(artist_data);
+			s.bad = 1;
+			break;
+		}
+		store_snapshot_node_strings(&s, artist, a->name, a->sort);
 
-	g_free(name);
-	g_free(sort);
-}
+		for (j = a->first_record; j < a->first_record + a->n_records && !s.bad; j++) {
 
+			const store_snapshot_record_t * r = records + j;
+			store_load_node_t * record;
+			record_data_t * record_data;
 
-void
-save_record(xmlDocPtr doc, xmlNodePtr node_record, GtkTreeIter * iter_record,
-	    char * store_dirname, int dirname_strlen, int use_relative_paths) {
+			if (r->first_track > header->n_tracks ||
+			    r->n_tracks > header->n_tracks - r->first_track) {
+				s.bad = 1;
+				break;
+			}
 
-	xmlNodePtr node;
-	char * name;
-	char * sort;
-	record_data_t * data;
-	GtkTreeIter iter_track;
-	int i = 0;
+			if ((record_data = (record_data_t *)calloc(1, sizeof(record_data_t))) == NULL) {
+				fprintf(stderr, "store_snapshot_load: calloc error\n");
+				s.bad = 1;
+				break;
+			}
+			record_data->year = r->year;
+			record_data->comment = store_snapshot_strdup(&s, r->comment);
+			if ((record = store_load_node_new(artist->children, record_data, 1)) == NULL) {
+				record_data_free(record_data);
+				s.bad = 1;
+				break;
+			}
+			store_snapshot_node_strings(&s, record, r->name, r->sort);
 
-	gtk_tree_model_get(GTK_TREE_MODEL(music_store), iter_record,
-			   MS_COL_NAME, &name,
-			   MS_COL_SORT, &sort,
-			   MS_COL_DATA, &data, -1);
+			for (k = r->first_track; k < r->first_track + r->n_tracks; k++) {
 
-	node = xmlNewTextChild(node_record, NULL, (const xmlChar *) "record", NULL);
-	if (name[0] == '\0') {
-		fprintf(stderr, "saving music_store XML: warning: record node with empty <name>\n");
-	}
-	xmlNewTextChild(node, NULL, (const xmlChar *) "name", (const xmlChar *) name);
-	if (sort[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "sort_name", (const xmlChar *) sort);
-	}
-	if (data->comment != NULL && data->comment[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "comment", (const xmlChar *) data->comment);
-	}
-	if (data->year != 0) {
-		char str[32];
-		snprintf(str, 31, "%d", data->year);
-		xmlNewTextChild(node, NULL, (const xmlChar *) "year", (const xmlChar *) str);
+				const store_snapshot_track_t * t = tracks + k;
+				store_load_node_t * track;
+				track_data_t * track_data;
+
+				if ((track_data = (track_data_t *)calloc(1, sizeof(track_data_t))) == NULL) {
+					fprintf(stderr, "store_snapshot_load: calloc error\n");
+					s.bad = 1;
+					break;
+				}
+				track_data->file = store_snapshot_strdup(&s, t->file);
+				track_data->comment = store_snapshot_strdup(&s, t->comment);
+				track_data->duration = t->duration;
+				track_data->volume = t->volume;
+				track_data->rva = t->rva;
+				track_data->use_rva = t->use_rva;
+				track_data->size = t->size;
+				track_data->mtime = t->mtime;
+				track_data->inode = t->inode;
+				if ((track = store_load_node_new(record->children, track_data, 0)) == NULL) {
+					track_data_free(track_data);
+					s.bad = 1;
+					break;
+				}
+				store_snapshot_node_strings(&s, track, t->name, t->sort);
+
+				if (track_data->file == NULL) {
+					s.bad = 1;
+					break;
+				}
+			}
+		}
 	}
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store), &iter_track, iter_record, i++)) {
-		save_track(doc, node, &iter_track, store_dirname, dirname_strlen, use_relative_paths);
+	if (s.bad) {
+		fprintf(stderr, "store_snapshot_load: ignoring damaged snapshot of %s\n", load->file);
+		store_load_free_rows(load, 1);
+		g_free(load->name);
+		load->name = NULL;
+		goto out;
 	}
 
-	g_free(name);
-	g_free(sort);
+	ret = 0;
+
+ out:
+	g_mapped_file_unref(mapped);
+	return ret;
 }
 
+static track_data_t *
+track_data_copy(track_data_t * src) {
 
-void
-save_artist(xmlDocPtr doc, xmlNodePtr root, GtkTreeIter * iter_artist,
-	    char * store_dirname, int dirname_strlen, int use_relative_paths) {
+	track_data_t * data;
 
-	xmlNodePtr node;
-	char * name;
-	char * sort;
-	artist_data_t * data;
-	GtkTreeIter iter_record;
-	int i = 0;
+	if ((data = (track_data_t *)malloc(sizeof(track_data_t))) == NULL) {
+		fprintf(stderr, "track_data_copy: malloc error\n");
+		return NULL;
+	}
 
-	gtk_tree_model_get(GTK_TREE_MODEL(music_store), iter_artist,
-			   MS_COL_NAME, &name,
-			   MS_COL_SORT, &sort,
-			   MS_COL_DATA, &data, -1);
+	*data = *src;
+	data->file = (src->file != NULL) ? strdup(src->file) : NULL;
+	data->comment = (src->comment != NULL) ? strdup(src->comment) : NULL;
+	return data;
+}
 
-	node = xmlNewTextChild(root, NULL, (const xmlChar *) "artist", NULL);
-	if (name[0] == '\0') {
-		fprintf(stderr, "saving music_store XML: warning: artist node with empty <name>\n");
-	}
-	xmlNewTextChild(node, NULL, (const xmlChar *) "name", (const xmlChar *) name);
-	if (sort[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "sort_name", (const xmlChar *) sort);
-	}
-	if (data->comment != NULL && data->comment[0] != '\0') {
-		xmlNewTextChild(node, NULL, (const xmlChar *) "comment", (const xmlChar *) data->comment);
+/* Copy of a store in music_store, detached from the model so that it
+ * can be saved by another thread. If sources is not NULL, the artist
+ * data of each copied artist is appended to it. Artists with their
+ * XML cached are copied without their records, as only the cached
+ * XML is written for them.
+ */
+static store_load_t *
+store_load_from_tree(GtkTreeIter * iter_store, GPtrArray * sources) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(music_store);
+	GtkTreeIter iter_artist;
+	GtkTreeIter iter_record;
+	GtkTreeIter iter_track;
+	store_load_t * load;
+	store_data_t * store_data;
+
+	if ((load = (store_load_t *)calloc(1, sizeof(store_load_t))) == NULL) {
+		fprintf(stderr, "store_load_from_tree: calloc error\n");
+		return NULL;
 	}
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store), &iter_record, iter_artist, i++)) {
-		save_record(doc, node, &iter_record, store_dirname, dirname_strlen, use_relative_paths);
+	if ((load->data = (store_data_t *)calloc(1, sizeof(store_data_t))) == NULL) {
+		fprintf(stderr, "store_load_from_tree: calloc error\n");
+		free(load);
+		return NULL;
 	}
 
-	g_free(name);
-	g_free(sort);
-}
+	gtk_tree_model_get(model, iter_store, MS_COL_NAME, &load->name, MS_COL_DATA, &store_data, -1);
+	*load->data = *store_data;
+	load->data->file = strdup(store_data->file);
+	load->data->comment = (store_data->comment != NULL) ? strdup(store_data->comment) : NULL;
+	load->owns_data = 1;
 
+	load->artists = g_ptr_array_new();
+	load->file = strdup(store_data->file);
+	load->iter_store = *iter_store;
 
-void
-store_file_save(GtkTreeIter * iter_store) {
+	if (!gtk_tree_model_iter_children(model, &iter_artist, iter_store)) {
+		return load;
+	}
+	do {
+		store_load_node_t * artist;
+		artist_data_t * artist_data;
+		artist_data_t * copy;
 
-	xmlDocPtr doc;
-	xmlNodePtr root;
-	xmlNodePtr build_node;
+		gtk_tree_model_get(model, &iter_artist, MS_COL_DATA, &artist_data, -1);
+		if ((copy = (artist_data_t *)calloc(1, sizeof(artist_data_t))) == NULL) {
+			fprintf(stderr, "store_load_from_tree: calloc error\n");
+			continue;
+		}
+		copy->comment = (artist_data->comment != NULL) ? strdup(artist_data->comment) : NULL;
+		if ((artist = store_load_node_new(load->artists, copy, 1)) == NULL) {
+			artist_data_free(copy);
+			continue;
+		}
+		if (sources != NULL) {
+			g_ptr_array_add(sources, artist_data);
+		}
+		g_free(artist->name);
+		g_free(artist->sort);
+		gtk_tree_model_get(model, &iter_artist, MS_COL_NAME, &artist->name,
+				   MS_COL_SORT, &artist->sort, -1);
+
+		if (artist_data->xml != NULL) {
+			continue;
+		}
+
+		if (!gtk_tree_model_iter_children(model, &iter_record, &iter_artist)) {
+			continue;
+		}
+		do {
+			store_load_node_t * record;
+			record_data_t * record_data;
+			record_data_t * rcopy;
+
+			gtk_tree_model_get(model, &iter_record, MS_COL_DATA, &record_data, -1);
+			if ((rcopy = (record_data_t *)calloc(1, sizeof(record_data_t))) == NULL) {
+				fprintf(stderr, "store_load_from_tree: calloc error\n");
+				continue;
+			}
+			rcopy->year = record_data->year;
+			rcopy->comment = (record_data->comment != NULL) ? strdup(record_data->comment) : NULL;
+			if ((record = store_load_node_new(artist->children, rcopy, 1)) == NULL) {
+				record_data_free(rcopy);
+				continue;
+			}
+			g_free(record->name);
+			g_free(record->sort);
+			gtk_tree_model_get(model, &iter_record, MS_COL_NAME, &record->name,
+					   MS_COL_SORT, &record->sort, -1);
+
+			if (!gtk_tree_model_iter_children(model, &iter_track, &iter_record)) {
+				continue;
+			}
+			do {
+				store_load_node_t * track;
+				track_data_t * track_data;
+				track_data_t * tcopy;
+
+				gtk_tree_model_get(model, &iter_track, MS_COL_DATA, &track_data, -1);
+				if ((tcopy = track_data_copy(track_data)) == NULL) {
+					continue;
+				}
+				if ((track = store_load_node_new(record->children, tcopy, 0)) == NULL) {
+					track_data_free(tcopy);
+					continue;
+				}
+				g_free(track->name);
+				g_free(track->sort);
+				gtk_tree_model_get(model, &iter_track, MS_COL_NAME, &track->name,
+						   MS_COL_SORT, &track->sort, -1);
+			} while (gtk_tree_model_iter_next(model, &iter_track));
+		} while (gtk_tree_model_iter_next(model, &iter_record));
+	} while (gtk_tree_model_iter_next(model, &iter_artist));
+
+	return load;
+}
+
+static char *
+store_load_name(xmlTextReaderPtr reader, const char * what) {
+
+	xmlChar * key = xmlTextReaderReadString(reader);
+	char * name = g_strndup((key != NULL) ? (char *)key : "", MAXLEN-1);
+
+	if (key != NULL) {
+		xmlFree(key);
+	}
+	if (name[0] == '\0') {
+		fprintf(stderr, "Error in XML music_store: %s <name> is required, but NULL\n", what);
+	}
+
+	return name;
+}
+
+static char *
+store_load_sort(xmlTextReaderPtr reader) {
+
+	xmlChar * key = xmlTextReaderReadString(reader);
+	char * sort = g_strndup((key != NULL) ? (char *)key : "", MAXLEN-1);
+
+	if (key != NULL) {
+		xmlFree(key);
+	}
+
+	return sort;
+}
+
+static void
+store_load_track_field(store_load_t * load, store_load_node_t * node, xmlTextReaderPtr reader,
+		       const char * field, char * store_dirname) {
+
+	track_data_t * data = (track_data_t *)node->data;
+	xmlChar * key;
+
+	if (!strcmp(field, "name")) {
+		g_free(node->name);
+		node->name = store_load_name(reader, "track");
+		return;
+	} else if (!strcmp(field, "sort_name")) {
+		g_free(node->sort);
+		node->sort = store_load_sort(reader);
+		return;
+	}
+
+	if ((key = xmlTextReaderReadString(reader)) == NULL) {
+		return;
+	}
+
+	if (!strcmp(field, "file")) {
+		if (data->file == NULL) {
+			if (httpc_is_url((char *)key)) {
+				data->file = strndup((char *)key, MAXLEN-1);
+			} else {
+				data->file = track_get_absolute_path(store_dirname, (char *)key, NULL);
+			}
+		}
+	} else if (!strcmp(field, "size")) {
+		sscanf((char *)key, "%llu", &data->size);
+	} else if (!strcmp(field, "mtime")) {
+		sscanf((char *)key, "%lld", &data->mtime);
+	} else if (!strcmp(field, "inode")) {
+		sscanf((char *)key, "%llu", &data->inode);
+	} else if (!strcmp(field, "comment")) {
+		if (data->comment == NULL) {
+			data->comment = strndup((char *)key, MAXLEN-1);
+		}
+	} else if (!strcmp(field, "duration")) {
+		data->duration = convf((char *)key);
+	} else if (!strcmp(field, "volume")) {
+		data->volume = convf((char *)key);
+	} else if (!strcmp(field, "rva")) {
+		data->rva = convf((char *)key);
+	} else if (!strcmp(field, "use_rva")) {
+		data->use_rva = convf((char *)key);
+	}
+
+	xmlFree(key);
+}
+
+/* returns 0 if the track has to be dropped */
+static int
+store_load_track_finish(store_load_t * load, store_load_node_t * node) {
+
+	track_data_t * data = (track_data_t *)node->data;
+
+	if (data->file == NULL) {
+		fprintf(stderr, "Error in XML music_store: track <file> is required, but NULL\n");
+		return 0;
+	}
+
+	/* stores written before mtime was recorded: take the files
+	   as they are now, just like their size */
+	if (data->size == 0 || data->mtime == 0) {
+		struct stat statbuf;
+		if (stat(data->file, &statbuf) != -1) {
+			data->size = statbuf.st_size;
+			data->mtime = statbuf.st_mtime;
+			data->inode = statbuf.st_ino;
+			load->save = 1;
+		}
+	}
+
+	return 1;
+}
+
+static void
+store_load_record_field(store_load_node_t * node, xmlTextReaderPtr reader, const char * field) {
+
+	record_data_t * data = (record_data_t *)node->data;
+	xmlChar * key;
+
+	if (!strcmp(field, "name")) {
+		g_free(node->name);
+		node->name = store_load_name(reader, "Record");
+	} else if (!strcmp(field, "sort_name")) {
+		g_free(node->sort);
+		node->sort = store_load_sort(reader);
+		/* parse year from sort key if otherwise not set */
+		if (is_valid_year(atoi(node->sort)) && !is_valid_year(data->year)) {
+			data->year = atoi(node->sort);
+		}
+	} else if (!strcmp(field, "comment")) {
+		if ((key = xmlTextReaderReadString(reader)) != NULL) {
+			if (data->comment == NULL) {
+				data->comment = strndup((char *)key, MAXLEN-1);
+			}
+			xmlFree(key);
+		}
+	} else if (!strcmp(field, "year")) {
+		if ((key = xmlTextReaderReadString(reader)) != NULL) {
+			data->year = atoi((char *)key);
+			xmlFree(key);
+		}
+	}
+}
+
+static void
+store_load_artist_field(store_load_node_t * node, xmlTextReaderPtr reader, const char * field) {
+
+	artist_data_t * data = (artist_data_t *)node->data;
+	xmlChar * key;
+
+	if (!strcmp(field, "name")) {
+		g_free(node->name);
+		node->name = store_load_name(reader, "Artist");
+	} else if (!strcmp(field, "sort_name")) {
+		g_free(node->sort);
+		node->sort = store_load_sort(reader);
+	} else if (!strcmp(field, "comment")) {
+		if ((key = xmlTextReaderReadString(reader)) != NULL) {
+			if (data->comment == NULL) {
+				data->comment = strndup((char *)key, MAXLEN-1);
+			}
+			xmlFree(key);
+		}
+	}
+}
+
+static void
+store_load_store_field(store_load_t * load, xmlTextReaderPtr reader, const char * field) {
+
+	xmlChar * key;
+
+	if (!strcmp(field, "name")) {
+		g_free(load->name);
+		load->name = store_load_name(reader, "Music Store");
+	} else if (!strcmp(field, "comment")) {
+		if ((key = xmlTextReaderReadString(reader)) != NULL) {
+			if (load->data->comment == NULL) {
+				load->data->comment = strndup((char *)key, MAXLEN-1);
+			}
+			xmlFree(key);
+		}
+	} else if (!strcmp(field, "use_relative_paths")) {
+		load->data->use_relative_paths = 1;
+	}
+}
+
+static gpointer
+store_load_calloc(size_t size) {
+
+	gpointer data;
+
+	if ((data = calloc(1, size)) == NULL) {
+		fprintf(stderr, "store_load_parse: calloc error\n");
+	}
+	return data;
+}
+
+/* Parse load->file into load->artists. May run outside the GTK thread.
+ * Returns -1 on error, leaving load->data NULL.
+ */
+static int
+store_load_parse(store_load_t * load) {
+
+	xmlTextReaderPtr reader;
+	char * store_dirname;
+	store_load_node_t * artist = NULL;
+	store_load_node_t * record = NULL;
+	store_load_node_t * track = NULL;
+	int ret;
+
+	if (store_snapshot_load(load) == 0) {
+		return 0;
+	}
+
+	if ((reader = xmlReaderForFile(load->file, NULL, 0)) == NULL) {
+		fprintf(stderr, "An XML error occured while parsing %s\n", load->file);
+		return -1;
+	}
+
+	store_dirname = g_path_get_dirname(load->file);
+
+	while ((ret = xmlTextReaderRead(reader)) == 1) {
+
+		const char * name;
+		int type = xmlTextReaderNodeType(reader);
+		int depth;
+
+		if (type == XML_READER_TYPE_END_ELEMENT) {
+			if (track != NULL && xmlTextReaderDepth(reader) == 3) {
+				if (!store_load_track_finish(load, track)) {
+					g_ptr_array_remove_index(record->children, record->children->len - 1);
+					store_load_node_free(track, 3, 1);
+				}
+				track = NULL;
+				if (!load->quiet) {
+					store_load_bytes_current = xmlTextReaderByteConsumed(reader);
+				}
+			}
+			continue;
+		}
+
+		if (type != XML_READER_TYPE_ELEMENT) {
+			continue;
+		}
+
+		name = (const char *)xmlTextReaderConstName(reader);
+		depth = xmlTextReaderDepth(reader);
+
+		if (depth == 0) {
+			if (strcmp(name, "music_store")) {
+				fprintf(stderr, "store_file_load: XML document of the wrong type, "
+					"root node != music_store\n");
+				ret = -1;
+				break;
+			}
+			if ((load->data = (store_data_t *)store_load_calloc(sizeof(store_data_t))) == NULL) {
+				ret = -1;
+				break;
+			}
+			load->data->type = STORE_TYPE_FILE;
+			load->data->file = strdup(load->file);
+			load->data->readonly = (access(load->file, W_OK) == 0) ? 0 : 1;
+			continue;
+		}
+
+		if (load->data == NULL) {
+			continue;
+		}
+
+		switch (depth) {
+		case 1:
+			if (!strcmp(name, "artist")) {
+				artist_data_t * data = (artist_data_t *)store_load_calloc(sizeof(artist_data_t));
+				artist = (data != NULL) ? store_load_node_new(load->artists, data, 1) : NULL;
+				if (data != NULL && artist == NULL) {
+					artist_data_free(data);
+				}
+				record = NULL;
+			} else {
+				/* children of e.g. <builder> are no artist fields */
+				artist = NULL;
+				record = NULL;
+				store_load_store_field(load, reader, name);
+			}
+			break;
+		case 2:
+			if (artist == NULL) {
+				break;
+			}
+			if (!strcmp(name, "record")) {
+				record_data_t * data = (record_data_t *)store_load_calloc(sizeof(record_data_t));
+				record = (data != NULL) ? store_load_node_new(artist->children, data, 1) : NULL;
+				if (data != NULL && record == NULL) {
+					record_data_free(data);
+				}
+			} else {
+				store_load_artist_field(artist, reader, name);
+			}
+			break;
+		case 3:
+			if (record == NULL) {
+				break;
+			}
+			if (!strcmp(name, "track")) {
+				track_data_t * data = (track_data_t *)store_load_calloc(sizeof(track_data_t));
+				if (data == NULL) {
+					break;
+				}
+				data->duration = 0.0f;
+				data->volume = 1.0f;
+				data->rva = 0.0f;
+				data->use_rva = 0;
+				if ((track = store_load_node_new(record->children, data, 0)) == NULL) {
+					free(data);
+					break;
+				}
+				if (xmlTextReaderIsEmptyElement(reader)) {
+					store_load_track_finish(load, track);
+					g_ptr_array_remove_index(record->children, record->children->len - 1);
+					store_load_node_free(track, 3, 1);
+					track = NULL;
+				}
+			} else {
+				store_load_record_field(record, reader, name);
+			}
+			break;
+		case 4:
+			if (track != NULL) {
+				store_load_track_field(load, track, reader, name, store_dirname);
+			}
+			break;
+		}
+	}
+
+	xmlFreeTextReader(reader);
+	g_free(store_dirname);
+
+	if (ret == 0 && load->data == NULL) {
+		fprintf(stderr, "store_file_load: empty XML document\n");
+		ret = -1;
+	} else if (ret < 0 && load->data != NULL) {
+		fprintf(stderr, "An XML error occured while parsing %s\n", load->file);
+	}
+
+	if (ret < 0) {
+		store_load_free_rows(load, 1);
+		return -1;
+	}
+
+	/* stores with backfilled stat data get saved, which also
+	   writes their snapshot */
+	if (!load->save && !load->data->readonly) {
+		store_snapshot_write(load);
+	}
+
+	return 0;
+}
+
+/* Call with sorting of music_store turned off. */
+static void
+store_load_insert(store_load_t * load) {
+
+	guint i, j, k;
+
+	gtk_tree_store_insert_with_values(music_store, &load->iter_store, NULL, -1,
+					  MS_COL_NAME, (load->name != NULL) ? load->name : _("Music Store"),
+					  MS_COL_SORT, load->sort,
+					  MS_COL_FONT, PANGO_WEIGHT_BOLD,
+					  MS_COL_ICON, options.enable_ms_tree_icons ? icon_store : NULL,
+					  MS_COL_DATA, load->data, -1);
+
+	for (i = 0; i < load->artists->len; i++) {
+
+		store_load_node_t * artist = (store_load_node_t *)g_ptr_array_index(load->artists, i);
+		GtkTreeIter iter_artist;
+
+		gtk_tree_store_insert_with_values(music_store, &iter_artist, &load->iter_store, -1,
+						  MS_COL_NAME, artist->name,
+						  MS_COL_SORT, artist->sort,
+						  MS_COL_ICON, options.enable_ms_tree_icons ? icon_artist : NULL,
+						  MS_COL_DATA, artist->data, -1);
+
+		for (j = 0; j < artist->children->len; j++) {
+
+			store_load_node_t * record = (store_load_node_t *)g_ptr_array_index(artist->children, j);
+			GtkTreeIter iter_record;
+
+			gtk_tree_store_insert_with_values(music_store, &iter_record, &iter_artist, -1,
+							  MS_COL_NAME, record->name,
+							  MS_COL_SORT, record->sort,
+							  MS_COL_ICON, options.enable_ms_tree_icons ? icon_record : NULL,
+							  MS_COL_DATA, record->data, -1);
+
+			for (k = 0; k < record->children->len; k++) {
+
+				store_load_node_t * track = (store_load_node_t *)g_ptr_array_index(record->children, k);
+				GtkTreeIter iter_track;
+
+				gtk_tree_store_insert_with_values(music_store, &iter_track, &iter_record, -1,
+								  MS_COL_NAME, track->name,
+								  MS_COL_SORT, track->sort,
+								  MS_COL_ICON, options.enable_ms_tree_icons ? icon_track : NULL,
+								  MS_COL_DATA, track->data, -1);
+			}
+		}
+	}
+}
+
+static void
+store_load_save_if_needed(store_load_t * load) {
+
+	if (load->save && !load->data->readonly) {
+		music_store_mark_changed(&load->iter_store);
+		store_file_save(&load->iter_store);
+	}
+}
+
+void
+store_file_load(char * store_file, char * sort) {
+
+	store_load_t * load;
+	gint sort_column;
+	GtkSortType order;
+
+	if (access(store_file, R_OK) != 0) {
+		return;
+	}
+
+	if ((load = store_load_new(store_file, sort)) == NULL) {
+		return;
+	}
+
+	if (store_load_parse(load) < 0) {
+		store_load_free(load);
+		return;
+	}
+
+	gtk_tree_sortable_get_sort_column_id(GTK_TREE_SORTABLE(music_store), &sort_column, &order);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(music_store),
+					     GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, order);
+	store_load_insert(load);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(music_store), sort_column, order);
+
+	store_load_save_if_needed(load);
+
+	if (options.autoexpand_stores) {
+		GtkTreePath * path = gtk_tree_model_get_path(GTK_TREE_MODEL(music_store), &load->iter_store);
+		gtk_tree_view_expand_row(GTK_TREE_VIEW(music_tree), path, FALSE);
+		gtk_tree_path_free(path);
+	}
+
+	store_load_free(load);
+}
+
+void
+store_file_load_queue(char * store_file, char * sort) {
+
+	store_load_t * load;
+
+	if (store_load_running) {
+		fprintf(stderr, "store_file_load_queue: a background load is in progress\n");
+		return;
+	}
+
+	if (access(store_file, R_OK) != 0) {
+		return;
+	}
+
+	if ((load = store_load_new(store_file, sort)) == NULL) {
+		return;
+	}
+
+	store_load_queue = g_slist_append(store_load_queue, load);
+}
+
+static gboolean
+store_load_progress_cb(gpointer data) {
+
+	double fraction;
+
+	if (store_load_progress_bar == NULL || store_load_bytes_total == 0) {
+		return TRUE;
+	}
+
+	fraction = (double)(store_load_bytes_done + store_load_bytes_current) / store_load_bytes_total;
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(store_load_progress_bar),
+				      (fraction > 1.0) ? 1.0 : fraction);
+	return TRUE;
+}
+
+static gboolean
+store_load_finish_cb(gpointer data) {
+
+	GSList * list = (GSList *)data;
+	GSList * node;
+	gint sort_column;
+	GtkSortType order;
+
+	/* detach the model so the view does not track the bulk insert */
+	gtk_tree_view_set_model(GTK_TREE_VIEW(music_tree), NULL);
+
+	gtk_tree_sortable_get_sort_column_id(GTK_TREE_SORTABLE(music_store), &sort_column, &order);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(music_store),
+					     GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, order);
+	for (node = list; node; node = node->next) {
+		store_load_t * load = (store_load_t *)node->data;
+		if (load->data != NULL) {
+			store_load_insert(load);
+		}
+	}
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(music_store), sort_column, order);
+
+	gtk_tree_view_set_model(GTK_TREE_VIEW(music_tree), GTK_TREE_MODEL(music_store));
+
+	for (node = list; node; node = node->next) {
+		store_load_t * load = (store_load_t *)node->data;
+		if (load->data != NULL) {
+			store_load_save_if_needed(load);
+		}
+		store_load_free(load);
+	}
+	g_slist_free(list);
+
+	music_tree_expand_stores();
+
+	g_source_remove(store_load_progress_tag);
+	if (store_load_progress_bar != NULL) {
+		gtk_widget_destroy(store_load_progress_bar);
+		store_load_progress_bar = NULL;
+	}
+
+	store_load_running = 0;
+
+	if (store_load_add_new_stores) {
+		store_load_add_new_stores = 0;
+		music_store_add_new_stores();
+	}
+
+	return FALSE;
+}
+
+static void *
+store_load_thread(void * arg) {
+
+	GSList * list = (GSList *)arg;
+	GSList * node;
+
+	AQUALUNG_THREAD_DETACH()
+
+	for (node = list; node; node = node->next) {
+		store_load_t * load = (store_load_t *)node->data;
+		store_load_bytes_current = 0;
+		store_load_parse(load);
+		store_load_bytes_done += load->size;
+	}
+	store_load_bytes_current = 0;
+
+	aqualung_idle_add(store_load_finish_cb, list);
+
+	return NULL;
+}
+
+/* Parse the stores queued by store_file_load_queue() in a background
+ * thread and insert them into music_store when all of them are read.
+ */
+void
+store_file_load_start(void) {
+
+	AQUALUNG_THREAD_DECLARE(thread_id)
+	GSList * node;
+
+	if (store_load_queue == NULL || store_load_running) {
+		return;
+	}
+
+	store_load_bytes_total = 0;
+	store_load_bytes_done = 0;
+	store_load_bytes_current = 0;
+	for (node = store_load_queue; node; node = node->next) {
+		store_load_bytes_total += ((store_load_t *)node->data)->size;
+	}
+
+	if (ms_progress_bar_container != NULL) {
+		store_load_progress_bar = gtk_progress_bar_new();
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(store_load_progress_bar), _("Loading Music Store..."));
+		gtk_box_pack_start(GTK_BOX(ms_progress_bar_container), store_load_progress_bar, TRUE, TRUE, 0);
+		gtk_widget_show(store_load_progress_bar);
+		gtk_widget_show(ms_progress_bar_container);
+	}
+	store_load_progress_tag = aqualung_timeout_add(100, store_load_progress_cb, NULL);
+
+	/* libxml2 has to be initialized before its first use in a thread */
+	xmlInitParser();
+
+	store_load_running = 1;
+	AQUALUNG_THREAD_CREATE(thread_id, NULL, store_load_thread, store_load_queue)
+	store_load_queue = NULL;
+}
+
+int
+store_file_load_in_progress(void) {
+
+	return store_load_running;
+}
+
+/* Have music_store_add_new_stores() run again when the background
+   load is finished. */
+void
+store_file_load_add_new_stores_when_done(void) {
+
+	store_load_add_new_stores = 1;
+}
+
+
+/**********************************************************************************/
+
+
+/* Stores are saved by a background thread from a copy taken on the GUI
+ * thread. The XML of each artist subtree is cached in its artist_data_t
+ * after a save and dropped by store_file_invalidate_xml() when anything
+ * below the artist changes, so a save only copies and serializes edited
+ * artists. The cached XML of the others is lent to the save thread and
+ * handed back when it is done.
+ */
+
+typedef struct {
+	store_load_t * load;
+	GPtrArray * sources;	/* live artist_data_t of each copied artist */
+	GPtrArray * fragments;	/* XML of each artist, NULL if to be written */
+	unsigned * gens;
+	unsigned dirty_gen;	/* store_data_t dirty_gen of the copied store */
+} store_save_t;
+
+static GSList * store_save_queue = NULL;
+static int store_save_running = 0;
+static unsigned store_save_xml_gen = 0;
+AQUALUNG_MUTEX_DECLARE_INIT(store_save_mutex)
+AQUALUNG_COND_DECLARE_INIT(store_save_idle)
+
+
+static void
+store_save_free(store_save_t * save) {
+
+	guint i;
+
+	for (i = 0; i < save->fragments->len; i++) {
+		g_free(g_ptr_array_index(save->fragments, i));
+	}
+	g_ptr_array_free(save->fragments, TRUE);
+	g_ptr_array_free(save->sources, TRUE);
+	g_free(save->gens);
+	store_load_free(save->load);
+	free(save);
+}
+
+static void
+store_save_element(GString * str, int indent, const char * name, const char * value) {
+
+	xmlChar * enc = xmlEncodeSpecialChars(NULL, (const xmlChar *)value);
+
+	g_string_append_printf(str, "%*s<%s>%s</%s>\n", indent, "", name, (char *)enc, name);
+	xmlFree(enc);
+}
+
+static void
+store_save_track(GString * str, store_load_node_t * node,
+		 char * store_dirname, int dirname_strlen, int use_relative_paths) {
+
+	track_data_t * data = (track_data_t *)node->data;
+	char buf[32];
+
+	g_string_append(str, "      <track>\n");
+	if (node->name[0] == '\0') {
+		fprintf(stderr, "saving music_store XML: warning: track node with empty <name>\n");
+	}
+	store_save_element(str, 8, "name", node->name);
+	if (node->sort[0] != '\0') {
+		store_save_element(str, 8, "sort_name", node->sort);
+	}
+
+	if (data->file == NULL || data->file[0] == '\0') {
+		fprintf(stderr, "saving music_store XML: warning: track node with empty <file>\n");
+		store_save_element(str, 8, "file", "");
+	} else {
+		if (httpc_is_url(data->file)) {
+			gchar * tmp = g_filename_to_utf8(data->file, -1, NULL, NULL, NULL);
+			store_save_element(str, 8, "file", (tmp != NULL) ? tmp : "");
+			g_free(tmp);
+		} else if (use_relative_paths && g_str_has_prefix(data->file, store_dirname)) {
+			store_save_element(str, 8, "file", data->file + dirname_strlen + 1);
+		} else {
+			gchar * tmp = g_filename_to_uri(data->file, NULL, NULL);
+			store_save_element(str, 8, "file", (tmp != NULL) ? tmp : "");
+			g_free(tmp);
+		}
+	}
+
+	if (data->size != 0) {
+		snprintf(buf, 31, "%llu", data->size);
+		store_save_element(str, 8, "size", buf);
+	}
+
+	if (data->mtime != 0) {
+		snprintf(buf, 31, "%lld", data->mtime);
+		store_save_element(str, 8, "mtime", buf);
+	}
+
+	if (data->inode != 0) {
+		snprintf(buf, 31, "%llu", data->inode);
+		store_save_element(str, 8, "inode", buf);
+	}
+
+	if (data->comment != NULL && data->comment[0] != '\0') {
+		store_save_element(str, 8, "comment", data->comment);
+	}
+
+	if (data->duration != 0.0f) {
+		snprintf(buf, 31, "%.1f", data->duration);
+		store_save_element(str, 8, "duration", buf);
+	}
+
+	if (data->volume <= 0.1f) {
+		snprintf(buf, 31, "%.1f", data->volume);
+		store_save_element(str, 8, "volume", buf);
+	}
+
+	if (data->rva != 0.0f) {
+		snprintf(buf, 31, "%.1f", data->rva);
+		store_save_element(str, 8, "rva", buf);
+	}
+
+	if (data->use_rva) {
+		snprintf(buf, 31, "%d", data->use_rva);
+		store_save_element(str, 8, "use_rva", buf);
+	}
+
+	g_string_append(str, "      </track>\n");
+}
+
+static void
+store_save_record(GString * str, store_load_node_t * node,
+		  char * store_dirname, int dirname_strlen, int use_relative_paths) {
+
+	record_data_t * data = (record_data_t *)node->data;
+	guint i;
+
+	g_string_append(str, "    <record>\n");
+	if (node->name[0] == '\0') {
+		fprintf(stderr, "saving music_store XML: warning: record node with empty <name>\n");
+	}
+	store_save_element(str, 6, "name", node->name);
+	if (node->sort[0] != '\0') {
+		store_save_element(str, 6, "sort_name", node->sort);
+	}
+	if (data->comment != NULL && data->comment[0] != '\0') {
+		store_save_element(str, 6, "comment", data->comment);
+	}
+	if (data->year != 0) {
+		char buf[32];
+		snprintf(buf, 31, "%d", data->year);
+		store_save_element(str, 6, "year", buf);
+	}
+
+	for (i = 0; i < node->children->len; i++) {
+		store_save_track(str, (store_load_node_t *)g_ptr_array_index(node->children, i),
+				 store_dirname, dirname_strlen, use_relative_paths);
+	}
+
+	g_string_append(str, "    </record>\n");
+}
+
+static char *
+store_save_artist(store_load_node_t * node,
+		  char * store_dirname, int dirname_strlen, int use_relative_paths) {
+
+	artist_data_t * data = (artist_data_t *)node->data;
+	GString * str = g_string_new("  <artist>\n");
+	guint i;
+
+	if (node->name[0] == '\0') {
+		fprintf(stderr, "saving music_store XML: warning: artist node with empty <name>\n");
+	}
+	store_save_element(str, 4, "name", node->name);
+	if (node->sort[0] != '\0') {
+		store_save_element(str, 4, "sort_name", node->sort);
+	}
+	if (data->comment != NULL && data->comment[0] != '\0') {
+		store_save_element(str, 4, "comment", data->comment);
+	}
+
+	for (i = 0; i < node->children->len; i++) {
+		store_save_record(str, (store_load_node_t *)g_ptr_array_index(node->children, i),
+				  store_dirname, dirname_strlen, use_relative_paths);
+	}
+
+	g_string_append(str, "  </artist>\n");
+	return g_string_free(str, FALSE);
+}
+
+/* Returns the <builder> element of the store file as it is on disk, or NULL. */
+static char *
+store_save_get_builder(char * file) {
+
+	xmlTextReaderPtr reader;
+	char * builder = NULL;
+	int ret;
+
+	if ((reader = xmlReaderForFile(file, NULL, 0)) == NULL) {
+		return NULL;
+	}
+
+	ret = xmlTextReaderRead(reader);
+	while (ret == 1) {
+		if (xmlTextReaderDepth(reader) == 1 &&
+		    xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+
+			if (!xmlStrcmp(xmlTextReaderConstName(reader), (const xmlChar *)"builder")) {
+				xmlChar * outer = xmlTextReaderReadOuterXml(reader);
+				builder = g_strdup((char *)outer);
+				xmlFree(outer);
+				break;
+			}
+			ret = xmlTextReaderNext(reader);
+		} else {
+			ret = xmlTextReaderRead(reader);
+		}
+	}
+
+	xmlFreeTextReader(reader);
+	return builder;
+}
+
+static int
+store_save_write(store_save_t * save) {
+
+	store_load_t * load = save->load;
 	char * store_dirname;
 	int dirname_strlen;
-	char * name;
-	int i;
-	store_data_t * data;
+	char * builder;
+	char * tmp;
+	FILE * f;
+	struct stat statbuf;
+	int ok;
+	guint i;
+
+	store_dirname = g_path_get_dirname(load->file);
+	dirname_strlen = strlen(store_dirname);
+
+	for (i = 0; i < load->artists->len; i++) {
+		if (g_ptr_array_index(save->fragments, i) == NULL) {
+			g_ptr_array_index(save->fragments, i) =
+				store_save_artist((store_load_node_t *)g_ptr_array_index(load->artists, i),
+						  store_dirname, dirname_strlen,
+						  load->data->use_relative_paths);
+		}
+	}
+	g_free(store_dirname);
+
+	builder = store_save_get_builder(load->file);
+
+	/* write to a temporary file and rename it over the store, so that
+	   the store is never left half written */
+	tmp = g_strdup_printf("%s.tmp", load->file);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		fprintf(stderr, "store_file_save: unable to create %s\n", tmp);
+		g_free(builder);
+		g_free(tmp);
+		return -1;
+	}
+
+	ok = fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<music_store>\n", f) >= 0;
+
+	if (load->name[0] == '\0') {
+		fprintf(stderr, "saving music_store XML: warning: empty <name>\n");
+	}
+	{
+		GString * str = g_string_new(NULL);
+
+		store_save_element(str, 2, "name", load->name);
+		if (load->data->comment != NULL && load->data->comment[0] != '\0') {
+			store_save_element(str, 2, "comment", load->data->comment);
+		}
+		if (load->data->use_relative_paths) {
+			g_string_append(str, "  <use_relative_paths/>\n");
+		}
+		ok = ok && fputs(str->str, f) >= 0;
+		g_string_free(str, TRUE);
+	}
+
+	for (i = 0; i < save->fragments->len; i++) {
+		ok = ok && fputs((char *)g_ptr_array_index(save->fragments, i), f) >= 0;
+	}
+
+	if (builder != NULL) {
+		ok = ok && fprintf(f, "  %s\n", builder) >= 0;
+		g_free(builder);
+	}
+
+	ok = ok && fputs("</music_store>\n", f) >= 0;
+	ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	ok = (fclose(f) == 0) && ok;
+
+	if (ok && stat(load->file, &statbuf) == 0) {
+		chmod(tmp, statbuf.st_mode & 07777);
+	}
+	if (!ok || g_rename(tmp, load->file) != 0) {
+		g_unlink(tmp);
+		ok = 0;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "store_file_save: unable to write %s\n", load->file);
+	}
+
+	g_free(tmp);
+	return ok ? 0 : -1;
+}
+
+static int
+store_save_find_store(store_save_t * save, GtkTreeIter * iter_store) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(music_store);
+	int i = 0;
+
+	while (gtk_tree_model_iter_nth_child(model, iter_store, NULL, i++)) {
+
+		store_data_t * store_data;
+
+		gtk_tree_model_get(model, iter_store, MS_COL_DATA, &store_data, -1);
+		if (store_data->type == STORE_TYPE_FILE && !strcmp(store_data->file, save->load->file)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Hands the XML written for or lent by each artist back to the artists
+   in music_store, unless they have been changed in the meantime. */
+static void
+store_save_return_fragments(store_save_t * save, GtkTreeIter * iter_store) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(music_store);
+	GHashTable * index;
+	GtkTreeIter iter_artist;
+	guint i;
+
+	if (!gtk_tree_model_iter_children(model, &iter_artist, iter_store)) {
+		return;
+	}
+
+	index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = 0; i < save->sources->len; i++) {
+		g_hash_table_insert(index, g_ptr_array_index(save->sources, i), GUINT_TO_POINTER(i + 1));
+	}
+
+	do {
+		artist_data_t * artist_data;
+		guint k;
+
+		gtk_tree_model_get(model, &iter_artist, MS_COL_DATA, &artist_data, -1);
+		if ((k = GPOINTER_TO_UINT(g_hash_table_lookup(index, artist_data))) == 0) {
+			continue;
+		}
+		--k;
+		if (artist_data->xml == NULL && artist_data->xml_gen == save->gens[k]) {
+			artist_data->xml = g_ptr_array_index(save->fragments, k);
+			g_ptr_array_index(save->fragments, k) = NULL;
+		}
+	} while (gtk_tree_model_iter_next(model, &iter_artist));
+
+	g_hash_table_destroy(index);
+}
+
+/* Marks the store saved unless it has been changed since it was copied. */
+static gboolean
+store_save_done_cb(gpointer data) {
+
+	store_save_t * save = (store_save_t *)data;
+	GtkTreeIter iter_store;
+
+	if (store_save_find_store(save, &iter_store)) {
+
+		store_data_t * store_data;
+
+		gtk_tree_model_get(GTK_TREE_MODEL(music_store), &iter_store, MS_COL_DATA, &store_data, -1);
+		if (store_data->dirty_gen == save->dirty_gen) {
+			music_store_mark_saved(&iter_store);
+		}
+		store_save_return_fragments(save, &iter_store);
+	}
+
+	store_save_free(save);
+	return FALSE;
+}
+
+/* The store stays marked as changed; tell the user. */
+static gboolean
+store_save_failed_cb(gpointer data) {
+
+	store_save_t * save = (store_save_t *)data;
+	GtkTreeIter iter_store;
+
+	message_dialog(_("Error"),
+		       browser_window,
+		       GTK_MESSAGE_ERROR,
+		       GTK_BUTTONS_CLOSE,
+		       NULL,
+		       _("Unable to save store file \"%s\". "
+			 "The file on disk has been left unchanged."),
+		       save->load->file);
+
+	if (store_save_find_store(save, &iter_store)) {
+		store_save_return_fragments(save, &iter_store);
+	}
+
+	store_save_free(save);
+	return FALSE;
+}
+
+/* The copy saved from lacks the records of unchanged artists, so the
+   snapshot is made from the file just written. */
+static void
+store_save_snapshot(char * file) {
+
+	store_load_t * load;
+
+	if (!options.ms_store_snapshot) {
+		return;
+	}
+
+	if ((load = store_load_new(file, "")) == NULL) {
+		return;
+	}
+
+	load->quiet = 1;
+	if (store_load_parse(load) == 0) {
+		/* the parser skips the snapshot if it backfilled stat data */
+		if (load->save && !load->data->readonly) {
+			store_snapshot_write(load);
+		}
+		load->owns_data = 1;
+	}
+
+	store_load_free(load);
+}
+
+static void *
+store_save_thread(void * arg) {
+
+	AQUALUNG_THREAD_DETACH()
+
+	AQUALUNG_MUTEX_LOCK(store_save_mutex)
+	while (store_save_queue != NULL) {
+
+		store_save_t * save = (store_save_t *)store_save_queue->data;
+
+		store_save_queue = g_slist_delete_link(store_save_queue, store_save_queue);
+		AQUALUNG_MUTEX_UNLOCK(store_save_mutex)
+
+		if (store_save_write(save) == 0) {
+			store_save_snapshot(save->load->file);
+			aqualung_idle_add(store_save_done_cb, save);
+		} else {
+			aqualung_idle_add(store_save_failed_cb, save);
+		}
+
+		AQUALUNG_MUTEX_LOCK(store_save_mutex)
+	}
+	store_save_running = 0;
+	AQUALUNG_COND_BROADCAST(store_save_idle)
+	AQUALUNG_MUTEX_UNLOCK(store_save_mutex)
+
+	return NULL;
+}
+
+/* Blocks until all queued store saves are on disk. */
+void
+store_file_save_flush(void) {
+
+#ifndef HAVE_LIBPTHREAD
+	if (store_save_mutex == NULL) {
+		return;
+	}
+#endif /* !HAVE_LIBPTHREAD */
+
+	AQUALUNG_MUTEX_LOCK(store_save_mutex)
+	while (store_save_running) {
+		AQUALUNG_COND_WAIT(store_save_idle, store_save_mutex)
+	}
+	AQUALUNG_MUTEX_UNLOCK(store_save_mutex)
+}
+
+/* Drop the cached XML of the artists at or above iter. */
+void
+store_file_invalidate_xml(GtkTreeIter * iter) {
+
+	GtkTreeModel * model = GTK_TREE_MODEL(music_store);
+	GtkTreePath * path = gtk_tree_model_get_path(model, iter);
 	GtkTreeIter iter_artist;
+	artist_data_t * data;
+
+	if (gtk_tree_path_get_depth(path) == 1) {
+		if (gtk_tree_model_iter_children(model, &iter_artist, iter)) {
+			do {
+				gtk_tree_model_get(model, &iter_artist, MS_COL_DATA, &data, -1);
+				g_free(data->xml);
+				data->xml = NULL;
+				data->xml_gen = 0;
+			} while (gtk_tree_model_iter_next(model, &iter_artist));
+		}
+	} else {
+		while (gtk_tree_path_get_depth(path) > 2) {
+			gtk_tree_path_up(path);
+		}
+		gtk_tree_model_get_iter(model, &iter_artist, path);
+		gtk_tree_model_get(model, &iter_artist, MS_COL_DATA, &data, -1);
+		g_free(data->xml);
+		data->xml = NULL;
+		data->xml_gen = 0;
+	}
+
+	gtk_tree_path_free(path);
+}
+
+void
+store_file_save(GtkTreeIter * iter_store) {
+
+	AQUALUNG_THREAD_DECLARE(thread_id)
+	store_data_t * data;
+	store_save_t * save;
+	guint i;
 
 
 	gtk_tree_model_get(GTK_TREE_MODEL(music_store), iter_store, MS_COL_DATA, &data, -1);
@@ -4263,42 +5554,51 @@ store_file_save(GtkTreeIter * iter_store) {
 		return;
 	}
 
-	music_store_mark_saved(iter_store);
-
-	store_dirname = g_path_get_dirname(data->file);
-	dirname_strlen = strlen(store_dirname);
-
-	doc = xmlNewDoc((const xmlChar *) "1.0");
-	root = xmlNewNode(NULL, (const xmlChar *) "music_store");
-	xmlDocSetRootElement(doc, root);
-
-	gtk_tree_model_get(GTK_TREE_MODEL(music_store), iter_store, MS_COL_NAME, &name, -1);
-	if (name[0] == '\0') {
-		fprintf(stderr, "saving music_store XML: warning: empty <name>\n");
+	/* the store is marked saved by store_save_done_cb() once the file
+	   has been replaced */
+	if ((save = (store_save_t *)calloc(1, sizeof(store_save_t))) == NULL) {
+		fprintf(stderr, "store_file_save: calloc error\n");
+		return;
 	}
-	xmlNewTextChild(root, NULL, (const xmlChar *) "name", (const xmlChar *) name);
-	g_free(name);
 
-	if (data->comment != NULL && data->comment[0] != '\0') {
-		xmlNewTextChild(root, NULL, (const xmlChar *) "comment", (const xmlChar *) data->comment);
+	save->sources = g_ptr_array_new();
+	if ((save->load = store_load_from_tree(iter_store, save->sources)) == NULL) {
+		g_ptr_array_free(save->sources, TRUE);
+		free(save);
+		return;
 	}
 
-	if (data->use_relative_paths) {
-		xmlNewChild(root, NULL, (const xmlChar *) "use_relative_paths", NULL);
-	}
+	save->dirty_gen = data->dirty_gen;
+	save->fragments = g_ptr_array_sized_new(save->sources->len);
+	save->gens = g_new(unsigned, save->sources->len);
+	for (i = 0; i < save->sources->len; i++) {
 
-	i = 0;
-	while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(music_store), &iter_artist, iter_store, i++)) {
-		save_artist(doc, root, &iter_artist, store_dirname, dirname_strlen, data->use_relative_paths);
+		artist_data_t * artist_data = (artist_data_t *)g_ptr_array_index(save->sources, i);
+
+		if (artist_data->xml != NULL) {
+			g_ptr_array_add(save->fragments, artist_data->xml);
+			artist_data->xml = NULL;
+		} else {
+			g_ptr_array_add(save->fragments, NULL);
+			artist_data->xml_gen = ++store_save_xml_gen;
+		}
+		save->gens[i] = artist_data->xml_gen;
 	}
 
-	if ((build_node = build_store_get_xml_node(data->file)) != NULL) {
-		xmlAddChild(root, build_node);
+#ifndef HAVE_LIBPTHREAD
+	if (store_save_mutex == NULL) {
+		store_save_mutex = g_mutex_new();
+		store_save_idle = g_cond_new();
 	}
+#endif /* !HAVE_LIBPTHREAD */
 
-	xmlSaveFormatFile(data->file, doc, 1);
-	xmlFreeDoc(doc);
-	g_free(store_dirname);
+	AQUALUNG_MUTEX_LOCK(store_save_mutex)
+	store_save_queue = g_slist_append(store_save_queue, save);
+	if (!store_save_running) {
+		store_save_running = 1;
+		AQUALUNG_THREAD_CREATE(thread_id, NULL, store_save_thread, NULL)
+	}
+	AQUALUNG_MUTEX_UNLOCK(store_save_mutex)
 }
 
 
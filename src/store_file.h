@@ -58,7 +58,13 @@ void store_file_progress_bar_hide(void);
 void store__add_cb(gpointer data);
 
 void store_file_load(char * file, char * sort);
+void store_file_load_queue(char * file, char * sort);
+void store_file_load_start(void);
+int store_file_load_in_progress(void);
+void store_file_load_add_new_stores_when_done(void);
 void store_file_save(GtkTreeIter * iter_store);
+void store_file_save_flush(void);
+void store_file_invalidate_xml(GtkTreeIter * iter);
 
 void store__addlist_defmode(gpointer data);
 void artist__addlist_defmode(gpointer data);
@@ -68,6 +74,7 @@ void track__addlist_cb(gpointer data);
 typedef struct {
 	int type;
 	int dirty;
+	unsigned dirty_gen; /* bumped on every change, see store_file_save() */
 	int readonly;
 	int use_relative_paths;
 	char * file;
@@ -76,6 +83,8 @@ typedef struct {
 
 typedef struct {
 	char * comment;
+	char * xml;         /* artist subtree as last saved, NULL if changed */
+	unsigned xml_gen;
 } artist_data_t;
 
 typedef struct {
@@ -90,7 +99,9 @@ typedef struct {
 	float rva;      /* manual RVA in dB */
 	int use_rva;    /* use manual RVA */
 	char * comment;
-	unsigned size;  /* file size in bytes */
+	unsigned long long size;  /* file size in bytes */
+	long long mtime;          /* file mtime and inode when last read in, */
+	unsigned long long inode; /* so store builds can skip unchanged files */
 } track_data_t;
 
 
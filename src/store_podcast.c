@@ -475,8 +475,6 @@ podcast_track_addlist_iter(GtkTreeIter iter_track, playlist_t * pl,
 			   PL_COL_NAME, list_str,
 			   PL_COL_VADJ, "",
 			   PL_COL_DURA, duration_str,
-			   PL_COL_COLO, pl_color_inactive,
-			   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 			   PL_COL_DATA, pldata, -1);
 
 	podcast_track_mark_read(&iter_track, item);
@@ -540,8 +538,6 @@ podcast_feed_addlist_iter(GtkTreeIter iter_record, playlist_t * pl, GtkTreeIter
 				   PL_COL_NAME, list_str,
 				   PL_COL_VADJ, "",
 				   PL_COL_DURA, "00:00",
-				   PL_COL_COLO, pl_color_inactive,
-				   PL_COL_FONT, PANGO_WEIGHT_NORMAL,
 				   PL_COL_DATA, pldata, -1);
 
 		plist_iter = &list_iter;
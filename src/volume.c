@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <gdk/gdk.h>
@@ -37,11 +38,26 @@
 #include "store_file.h"
 #include "playlist.h"
 #include "i18n.h"
+#include "loudness.h"
 #include "volume.h"
 
 
 #define EPSILON 0.00000000001
 
+/* Replaygain is almost always the "89 dB SPL" type.
+ * This means a -14 dBFS pink noise reference signal is used.
+ * A positive replaygain value means it's quiter than the reference signal.
+ * The magic values are due to different ways of calculating the levels.
+ * They're only approximations though.
+ */
+#define RG_REFERENCE_LEVEL -14.0
+#define RG_MAGIC_VAL1 -2.1 /* emperical */
+#define RG_MAGIC_VAL2 1.05 /* emperical */
+#define RG_TO_VOLUME(replaygain) ((-replaygain + RG_REFERENCE_LEVEL + RG_MAGIC_VAL1) * RG_MAGIC_VAL2)
+
+/* ReplayGain 2.0 reference loudness in LUFS */
+#define RG2_REFERENCE_LOUDNESS -18.0
+
 extern options_t options;
 
 extern GtkTreeStore * music_store;
@@ -76,11 +92,13 @@ volume_new(GtkTreeStore * store, int type) {
 	vol->type = type;
 
 	AQUALUNG_COND_INIT(vol->thread_wait);
+	AQUALUNG_COND_INIT(vol->item_done);
 
 #ifndef HAVE_LIBPTHREAD
 	vol->thread_mutex = g_mutex_new();
 	vol->wait_mutex = g_mutex_new();
 	vol->thread_wait = g_cond_new();
+	vol->item_done = g_cond_new();
 #endif /* !HAVE_LIBPTHREAD */
 
 	return vol;
@@ -98,8 +116,10 @@ volume_push(volume_t * vol, char * file, GtkTreeIter iter) {
 
 	item->file = strdup(file);
 	item->iter = iter;
+	item->state = VOL_ITEM_QUEUED;
 
 	vol->queue = g_list_append(vol->queue, item);
+	vol->n_items++;
 }
 
 void
@@ -112,34 +132,52 @@ vol_item_free(vol_item_t * item) {
 void
 volume_free(volume_t * vol) {
 
+	GList * node;
+
 #ifndef HAVE_LIBPTHREAD
 	g_mutex_free(vol->thread_mutex);
 	g_mutex_free(vol->wait_mutex);
 	g_cond_free(vol->thread_wait);
+	g_cond_free(vol->item_done);
 #endif /* !HAVE_LIBPTHREAD */
 
 	if (vol->volumes != NULL) {
 		free(vol->volumes);
 	}
 
+	for (node = vol->queue; node; node = node->next) {
+		vol_item_free((vol_item_t *)node->data);
+	}
 	g_list_free(vol->queue);
 	free(vol);
 }
 
 
-inline static float
-rms_env_process(rms_env_t * r, const float x) {
+/* Map integrated loudness (LUFS) to the volume level scale used by
+ * rva_from_volume(), going through the ReplayGain 2 gain so that
+ * measured files and files carrying ReplayGain tags end up with the
+ * same adjustment. The result is kept in the range store_file.c
+ * treats as measured (<= 0.1 dBFS).
+ */
+float
+volume_from_loudness(float lufs) {
 
-        r->sum -= r->buffer[r->pos];
-        r->sum += x;
-        r->buffer[r->pos] = x;
+	float volume = RG_TO_VOLUME(RG2_REFERENCE_LOUDNESS - lufs);
 
-	r->pos++;
-        if (r->pos == RMSSIZE) {
-		r->pos = 0;
+	if (volume > 0.0f) {
+		volume = 0.0f;
 	}
+	return volume;
+}
+
+/* Largest gain in dB that can be applied without clipping the true peak */
+float
+vol_peak_headroom(float peak) {
 
-        return sqrt(r->sum / (float)RMSSIZE);
+	if (peak <= 0.0f) {
+		return 1000.0f;
+	}
+	return -20.0f * log10f(peak);
 }
 
 gboolean
@@ -237,10 +275,21 @@ vol_update_progress(gpointer data) {
 
 		float fraction = 0.0f;
 		char str_progress[10];
+		GList * node;
 
+		/* progress of the whole batch: finished items count as
+		   one, items being analyzed by a worker count fractionally */
 		AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
-		if (vol->n_chunks != 0) {
-			fraction = (float)vol->chunks_read / vol->n_chunks;
+		for (node = vol->queue; node; node = node->next) {
+			vol_item_t * item = (vol_item_t *)node->data;
+			if (item->state == VOL_ITEM_DONE || item->state == VOL_ITEM_FAILED) {
+				fraction += 1.0f;
+			} else if (item->state == VOL_ITEM_RUNNING && item->n_chunks != 0) {
+				fraction += (float)item->chunks_read / item->n_chunks;
+			}
+		}
+		if (vol->n_items != 0) {
+			fraction /= vol->n_items;
 		}
 		AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
 
@@ -283,11 +332,20 @@ gboolean
 vol_store_result_sep(gpointer data) {
 
 	volume_t * vol = (volume_t *)data;
+	float voladj;
 
 	AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
 
-	vol_store_voladj(vol->store, &vol->item->iter,
-			 (vol->store == music_store) ? vol->result : rva_from_volume(vol->result));
+	if (vol->store == music_store) {
+		voladj = vol->item->result;
+	} else {
+		voladj = rva_from_volume(vol->item->result);
+		if (voladj > vol_peak_headroom(vol->item->peak)) {
+			voladj = vol_peak_headroom(vol->item->peak);
+		}
+	}
+
+	vol_store_voladj(vol->store, &vol->item->iter, voladj);
 
 	AQUALUNG_COND_SIGNAL(vol->thread_wait);
 	AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
@@ -306,6 +364,14 @@ vol_store_result_avg(gpointer data) {
 
 	voladj = rva_from_multiple_volumes(vol->n_volumes, vol->volumes);
 
+	/* the common adjustment must not clip any of the tracks */
+	for (node = vol->queue; node; node = node->next) {
+		vol_item_t * item = (vol_item_t *)node->data;
+		if (item->state == VOL_ITEM_DONE && voladj > vol_peak_headroom(item->peak)) {
+			voladj = vol_peak_headroom(item->peak);
+		}
+	}
+
 	for (node = vol->queue; node; node = node->next) {
 		vol_item_t * item = (vol_item_t *)node->data;
 		vol_store_voladj(vol->store, &item->iter, voladj);
@@ -400,149 +466,230 @@ vol_create_gui(volume_t * vol) {
 }
 
 
-/* if returns 1, file will be skipped */
+/* Analyze a single file with a private decoder. Called from the
+   worker threads; stores the result in item->result and item->peak and
+   returns 0 on success, 1 if the file was skipped or the batch was
+   cancelled. The whole file is measured in a single decode pass. */
 int
-process_volume_setup(volume_t * vol) {
+volume_process_item(volume_t * vol, vol_item_t * item) {
+
+	file_decoder_t * fdec;
+	loudness_t * meter;
+	float * samples;
+	unsigned long chunk_size;
+	unsigned long numread;
+	float lufs, peak;
 
-        if ((vol->fdec = file_decoder_new()) == NULL) {
-                fprintf(stderr, "calculate_volume: error: file_decoder_new() returned NULL\n");
+        if ((fdec = file_decoder_new()) == NULL) {
+                fprintf(stderr, "volume_process_item(): error: file_decoder_new() returned NULL\n");
                 return 1;
         }
 
-        if (file_decoder_open(vol->fdec, vol->item->file)) {
-                fprintf(stderr, "file_decoder_open() failed on %s\n",
-                        vol->item->file);
+        if (file_decoder_open(fdec, item->file)) {
+                fprintf(stderr, "file_decoder_open() failed on %s\n", item->file);
+		file_decoder_delete(fdec);
                 return 1;
         }
 
-	if ((vol->rms = (rms_env_t *)calloc(1, sizeof(rms_env_t))) == NULL) {
-		fprintf(stderr, "calculate_volume(): calloc error\n");
+	if ((meter = loudness_new(fdec->fileinfo.sample_rate, fdec->fileinfo.channels)) == NULL) {
+		fprintf(stderr, "volume_process_item(): cannot measure %s\n", item->file);
+		file_decoder_close(fdec);
+		file_decoder_delete(fdec);
 		return 1;
 	}
 
-	vol->chunks_read = 0;
-	vol->chunk_size = vol->fdec->fileinfo.sample_rate / 100;
-	vol->n_chunks = vol->fdec->fileinfo.total_samples / vol->chunk_size + 1;
+	/* 100 ms chunks: one loudness sub-block per read */
+	chunk_size = meter->sub_len;
 
-	AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
-	aqualung_idle_add(vol_set_filename_text, vol);
-	AQUALUNG_COND_WAIT(vol->thread_wait, vol->wait_mutex);
-	AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
+	if ((samples = (float *)malloc(chunk_size * fdec->fileinfo.channels * sizeof(float))) == NULL) {
+		fprintf(stderr, "volume_process_item(): malloc error\n");
+		loudness_free(meter);
+		file_decoder_close(fdec);
+		file_decoder_delete(fdec);
+		return 1;
+	}
+
+	AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
+	item->chunks_read = 0;
+	item->n_chunks = fdec->fileinfo.total_samples / chunk_size + 1;
+	AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
+
+	do {
+		numread = file_decoder_read(fdec, samples, chunk_size);
+		item->chunks_read++;
+
+		if (numread > 0) {
+			loudness_process(meter, samples, numread);
+		}
+
+		while (vol->paused && !vol->cancelled) {
+			g_usleep(500000);
+		}
+
+	} while (numread == chunk_size && !vol->cancelled);
+
+	lufs = loudness_integrated(meter);
+	peak = loudness_true_peak(meter);
+
+#ifdef HAVE_MPEG
+	/* compensate for anti-clip vol.reduction in dec_mpeg.c/mpeg_output() */
+	if (fdec->file_lib == MAD_LIB) {
+		lufs += 1.8f;
+		peak *= db2lin(1.8f);
+	}
+#endif /* HAVE_MPEG */
+
+	item->result = volume_from_loudness(lufs);
+	item->peak = peak;
+
+	free(samples);
+	loudness_free(meter);
+	file_decoder_close(fdec);
+	file_decoder_delete(fdec);
+
+	return vol->cancelled ? 1 : 0;
+}
+
+
+void *
+volume_worker(void * arg) {
+
+	volume_t * vol = (volume_t *)arg;
+
+	AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
+
+	while (vol->next_node != NULL && !vol->cancelled) {
+
+		vol_item_t * item = (vol_item_t *)vol->next_node->data;
+		int ret;
 
-	vol->result = 0.0f;
+		vol->next_node = vol->next_node->next;
+		item->state = VOL_ITEM_RUNNING;
+		AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
+
+		ret = volume_process_item(vol, item);
+
+		AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
+		item->state = ret ? VOL_ITEM_FAILED : VOL_ITEM_DONE;
+		AQUALUNG_COND_SIGNAL(vol->item_done);
+	}
 
-	return 0;
+	vol->n_workers_running--;
+	AQUALUNG_COND_SIGNAL(vol->item_done);
+	AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
+
+	return NULL;
 }
 
 
+int
+volume_n_workers(volume_t * vol) {
+
+	int n = options.rva_worker_threads;
+
+	if (n <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+	}
+	if (n > vol->n_items) {
+		n = vol->n_items;
+	}
+	if (n > VOLUME_MAX_WORKERS) {
+		n = VOLUME_MAX_WORKERS;
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	return n;
+}
+
+
+/* Coordinator thread: starts the worker pool and collects the results
+   in queue order, so the GUI sees them in the same sequence as with a
+   single worker. */
 void *
 volume_thread(void * arg) {
 
 	volume_t * vol = (volume_t *)arg;
 
 	GList * node;
-
-	float * samples = NULL;
-	unsigned long numread;
-	float chunk_power = 0.0f;
-	float rms;
-	unsigned long i;
+	int i;
 
 
 	AQUALUNG_THREAD_DETACH();
 
+	vol->next_node = vol->queue;
+	vol->n_workers = volume_n_workers(vol);
+	vol->n_workers_running = vol->n_workers;
+
+	for (i = 0; i < vol->n_workers; i++) {
+		AQUALUNG_THREAD_CREATE(vol->worker_ids[i], NULL, volume_worker, vol);
+	}
+
 	for (node = vol->queue; node; node = node->next) {
 
-		vol->item = (vol_item_t *)node->data;
+		vol_item_t * item = (vol_item_t *)node->data;
+		int state;
 
-		if (process_volume_setup(vol)) {
-			continue;
-		}
+		AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
+		vol->item = item;
+		AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
 
-		if ((samples = (float *)malloc(vol->chunk_size * vol->fdec->fileinfo.channels * sizeof(float))) == NULL) {
+		AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
+		aqualung_idle_add(vol_set_filename_text, vol);
+		AQUALUNG_COND_WAIT(vol->thread_wait, vol->wait_mutex);
+		AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
 
-			fprintf(stderr, "volume_thread(): malloc() error\n");
-			file_decoder_close(vol->fdec);
-			file_decoder_delete(vol->fdec);
-			free(vol->rms);
-			break;
+		AQUALUNG_MUTEX_LOCK(vol->thread_mutex);
+		while (item->state != VOL_ITEM_DONE && item->state != VOL_ITEM_FAILED &&
+		       vol->n_workers_running > 0) {
+			AQUALUNG_COND_WAIT(vol->item_done, vol->thread_mutex);
 		}
+		state = item->state;
+		AQUALUNG_MUTEX_UNLOCK(vol->thread_mutex);
 
-		do {
-			numread = file_decoder_read(vol->fdec, samples, vol->chunk_size);
-			vol->chunks_read++;
-			
-			/* calculate signal power of chunk and feed it in the rms envelope */
-			if (numread > 0) {
-				for (i = 0; i < numread * vol->fdec->fileinfo.channels; i++) {
-					chunk_power += samples[i] * samples[i];
-				}
-				chunk_power /= numread * vol->fdec->fileinfo.channels;
-				
-				rms = rms_env_process(vol->rms, chunk_power);
-				
-				if (rms > vol->result) {
-					vol->result = rms;
-				}
-			}
-			
-			while (vol->paused && !vol->cancelled) {
-				g_usleep(500000);
-			}
+		if (vol->cancelled) {
+			break;
+		}
 
-		} while (numread == vol->chunk_size && !vol->cancelled);
+		if (state != VOL_ITEM_DONE) {
+			continue;
+		}
 
-		if (!vol->cancelled) {
-					
-			vol->result = 20.0f * log10f(vol->result);
-					
-#ifdef HAVE_MPEG
-			/* compensate for anti-clip vol.reduction in dec_mpeg.c/mpeg_output() */
-			if (vol->fdec->file_lib == MAD_LIB) {
-				vol->result += 1.8f;
-			}
-#endif /* HAVE_MPEG */
+		if (vol->type == VOLUME_SEPARATE) {
 
-			if (vol->type == VOLUME_SEPARATE) {
+			AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
+			aqualung_idle_add(vol_store_result_sep, vol);
+			AQUALUNG_COND_WAIT(vol->thread_wait, vol->wait_mutex);
+			AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
 
-				AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
-				aqualung_idle_add(vol_store_result_sep, vol);
-				AQUALUNG_COND_WAIT(vol->thread_wait, vol->wait_mutex);
-				AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
+		} else if (vol->type == VOLUME_AVERAGE) {
 
-			} else if (vol->type == VOLUME_AVERAGE) {
+			float * volumes;
 
-				vol->n_volumes++;
-				if ((vol->volumes = realloc(vol->volumes, vol->n_volumes * sizeof(float))) == NULL) {
-					fprintf(stderr, "volume_thread(): realloc error\n");
-					return NULL;
-				}
-				vol->volumes[vol->n_volumes - 1] = vol->result;
+			if ((volumes = realloc(vol->volumes, (vol->n_volumes + 1) * sizeof(float))) == NULL) {
+				fprintf(stderr, "volume_thread(): realloc error\n");
+				vol->cancelled = 1;
+				break;
 			}
+			vol->volumes = volumes;
+			vol->volumes[vol->n_volumes++] = item->result;
 		}
+	}
 
-		file_decoder_close(vol->fdec);
-		file_decoder_delete(vol->fdec);
-		free(vol->rms);
-
-		free(samples);
-
-		if (vol->cancelled) {
-			break;
-		}
+	for (i = 0; i < vol->n_workers; i++) {
+		AQUALUNG_THREAD_JOIN(vol->worker_ids[i]);
 	}
 
-	if (!vol->cancelled && vol->type == VOLUME_AVERAGE) {
+	if (!vol->cancelled && vol->type == VOLUME_AVERAGE && vol->n_volumes > 0) {
 		AQUALUNG_MUTEX_LOCK(vol->wait_mutex);
 		aqualung_idle_add(vol_store_result_avg, vol);
 		AQUALUNG_COND_WAIT(vol->thread_wait, vol->wait_mutex);
 		AQUALUNG_MUTEX_UNLOCK(vol->wait_mutex);
 	}
 
-	for (node = vol->queue; node; node = node->next) {
-		vol_item_free((vol_item_t *)node->data);
-	}
-
 	aqualung_idle_add(volume_finalize, vol);
 
 
@@ -570,17 +717,6 @@ rva_from_volume(float volume) {
 	return ((volume - options.rva_refvol) * (options.rva_steepness - 1.0f));
 }
 
-/* Replaygain is almost always the "89 dB SPL" type.
- * This means a -14 dBFS pink noise reference signal is used.
- * A positive replaygain value means it's quiter than the reference signal.
- * The magic values are due to different ways of calculating the levels.
- * They're only approximations though.
- */
-#define RG_REFERENCE_LEVEL -14.0
-#define RG_MAGIC_VAL1 -2.1 /* emperical */
-#define RG_MAGIC_VAL2 1.05 /* emperical */
-#define RG_TO_VOLUME(replaygain) ((-replaygain + RG_REFERENCE_LEVEL + RG_MAGIC_VAL1) * RG_MAGIC_VAL2)
-
 float
 rva_from_replaygain(float rg) {
 
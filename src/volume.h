@@ -28,21 +28,27 @@
 #include "decoder/file_decoder.h"
 
 
-#define RMSSIZE 100
-
 #define VOLUME_SEPARATE 0
 #define VOLUME_AVERAGE  1
 
-typedef struct {
-        float buffer[RMSSIZE];
-        unsigned int pos;
-        float sum;
-} rms_env_t;
+/* upper limit on the number of files analyzed in parallel */
+#define VOLUME_MAX_WORKERS 16
 
+/* vol_item_t.state */
+#define VOL_ITEM_QUEUED  0
+#define VOL_ITEM_RUNNING 1
+#define VOL_ITEM_DONE    2
+#define VOL_ITEM_FAILED  3
 
 typedef struct {
 	GtkTreeIter iter;
 	char * file;
+
+	int state;
+	float result; /* volume level, see volume_from_loudness() */
+	float peak;   /* linear true peak */
+	unsigned long chunks_read;
+	unsigned long n_chunks;
 } vol_item_t;
 
 typedef struct {
@@ -60,19 +66,22 @@ typedef struct {
 	AQUALUNG_MUTEX_DECLARE(wait_mutex);
 	AQUALUNG_COND_DECLARE(thread_wait);
 
+	/* worker pool: each worker pulls the next queued item and
+	   analyzes it with its own file decoder */
+	AQUALUNG_THREAD_DECLARE(worker_ids[VOLUME_MAX_WORKERS]);
+	AQUALUNG_COND_DECLARE(item_done);
+	GList * next_node;
+	int n_items;
+	int n_workers;
+	int n_workers_running;
+
 	GtkWidget * slot;
 	GtkWidget * progress;
 	GtkWidget * pause_button;
 	GtkWidget * cancel_button;
 	GtkWidget * file_entry;
 
-	vol_item_t * item;
-	file_decoder_t * fdec;
-	unsigned long chunk_size;
-	unsigned long n_chunks;
-	unsigned long chunks_read;
-	float result;
-	rms_env_t * rms;
+	vol_item_t * item; /* item whose result is delivered next */
 
 	float * volumes;
 	unsigned int n_volumes;
@@ -85,6 +94,7 @@ void volume_start(volume_t * vol);
 
 void voladj2str(float voladj, char * str);
 
+float volume_from_loudness(float lufs);
 float rva_from_volume(float volume);
 float rva_from_replaygain(float rg);
 float rva_from_multiple_volumes(int nlevels, float * volumes);